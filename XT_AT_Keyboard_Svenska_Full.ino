@@ -14,16 +14,25 @@
 #include "realtime_ws.h"
 #include "detect_protocol.h"
 #include "rollback.h"
+#include "timing_profile.h"
+#include "la_capture.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "boot_phases.h"
+#include "logger.h"
+#include "flightrec.h"
+#include "web_assets.h"
+#include "storage.h"
+#include "snapshot.h"
+#include "auto_ota.h"
+#include "delta_ota.h"
+#include "ps2_mouse.h"
+#include "mem_stats.h"
+#include "web_state.h"
+#include "keymap_ws.h"
 
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
-#include <LittleFS.h>
-#include <SPIFFS.h>
-#include "ota.h"
-
-void setup() {
-  startOTA("DittSSID", "DittLösenord");
-}
 
 #ifndef XT_CLK_PIN_DEFAULT
   #define XT_CLK_PIN_DEFAULT 10
@@ -34,83 +43,150 @@ void setup() {
 #ifndef XT_BIT_DELAY_US_DEFAULT
   #define XT_BIT_DELAY_US_DEFAULT 40
 #endif
+// Further hosts on the same keyboard (KVM use): build with
+// -DXT_PORT1_CLK_PIN=.. -DXT_PORT1_DATA_PIN=.. (PORT2, PORT3 likewise).
+#ifndef PS2_MOUSE_CLK_PIN_DEFAULT
+  #define PS2_MOUSE_CLK_PIN_DEFAULT 12
+#endif
+#ifndef PS2_MOUSE_DATA_PIN_DEFAULT
+  #define PS2_MOUSE_DATA_PIN_DEFAULT 13
+#endif
 
 AsyncWebServer server(80);
 
+// Boot is split in two: setup() brings up only what the host needs to see a
+// keyboard (config, filesystem and translation tables, wire engine, USB).
+// Wi-Fi and the web stack follow from loop(), one step per pass, so
+// keystrokes are served while the network comes up.
+static uint8_t netBootStep = 0;
+static bool netReady = false;
+
 void setup() {
+  bootPhaseMark("start");
   Serial.begin(115200);
-  delay(100);
+  logBegin();
   Serial.println();
   Serial.println("=== ESP32-S3 XT/AT Keyboard Adapter - starting ===");
 
-  if (!SPIFFS.begin(true)) {
-    Serial.println("[FS] SPIFFS mount failed (continuing if LittleFS available)");
-  } else {
-    Serial.println("[FS] SPIFFS mounted");
-  }
-  if (!LittleFS.begin(true)) {
-    Serial.println("[FS] LittleFS mount failed (continuing)");
-  } else {
-    Serial.println("[FS] LittleFS mounted");
-  }
-
+  memBegin();
   configLoad();
-  Serial.println("[CONFIG] Loaded configuration");
+  bootPhaseMark("config");
 
   rollbackInitialize();
+  bootPhaseMark("rollback");
 
-  wifiStart(&server);
-  Serial.println("[WIFI] Started AP + STA (if configured)");
-
-  realtimeInit(server);
-  Serial.println("[WS] Realtime websocket initialized");
+  storageBegin();
+  bootPhaseMark("fs");
 
-  apiInit(server);
-  Serial.println("[API] REST endpoints initialized");
+  // config.keymap (NVS) with default_usb_to_xt fallback is the live translation table,
+  // keymapEx (/keymap_ex.bin) the one USB keys go through; both before the first key
+  keymapExBegin();
+  bootPhaseMark("keymap_ex");
 
-  setupOTA(server);
-  Serial.println("[OTA] OTA endpoints initialized");
+  xtatBegin(XT_CLK_PIN_DEFAULT, XT_DATA_PIN_DEFAULT, XT_BIT_DELAY_US_DEFAULT);
+#ifdef XT_PORT1_CLK_PIN
+  xtatAddPort(XT_PORT1_CLK_PIN, XT_PORT1_DATA_PIN);
+#endif
+#ifdef XT_PORT2_CLK_PIN
+  xtatAddPort(XT_PORT2_CLK_PIN, XT_PORT2_DATA_PIN);
+#endif
+#ifdef XT_PORT3_CLK_PIN
+  xtatAddPort(XT_PORT3_CLK_PIN, XT_PORT3_DATA_PIN);
+#endif
+  bootPhaseMark("xtat");
 
-  keymapInit(&server);
-  keymapExInit(&server);
-  Serial.println("[KEYMAP] Keymap systems initialized");
+  ps2MouseBegin(PS2_MOUSE_CLK_PIN_DEFAULT, PS2_MOUSE_DATA_PIN_DEFAULT);
+  bootPhaseMark("mouse");
 
   usbHostBegin();
-  Serial.println("[USB] USB-Host initialized - waiting for device");
-
-  xtatBegin(XT_CLK_PIN_DEFAULT, XT_DATA_PIN_DEFAULT, XT_BIT_DELAY_US_DEFAULT);
-  Serial.println("[XTAT] XT/AT output initialized");
-
-  extern bool xtat_debug_enabled;
-  extern bool xtat_timestamp_enabled;
-  extern bool xtat_bitdump_enabled;
-  extern bool xtat_hostecho_enabled;
+  bootPhaseMark("usb");
 
-  xtat_debug_enabled     = true;
-  xtat_timestamp_enabled = true;
-  xtat_bitdump_enabled   = false;
-  xtat_hostecho_enabled  = true;
+  flightrecBegin();
+  bootPhaseMark("flightrec");
 
-  setupOTA(server);
-  Serial.println("[OTA] OTA endpoints initialized");
+  laCaptureBegin(XT_CLK_PIN_DEFAULT, XT_DATA_PIN_DEFAULT);
+  detectProtocolBegin();
 
-  server.begin();
-  delay(500);
-  Serial.printf("[NETWORK] IP (STA or AP): %s\n", wifiIP().c_str());
+  bootPhaseMark("keyboard_ready");
+  Serial.printf("[BOOT] Keyboard ready after %luus\n", (unsigned long)bootPhaseUs("keyboard_ready"));
+}
 
-  if (isFirstBootAfterOTA()) {
-    Serial.println("[ROLLBACK] First boot after OTA detected (rollback module active)");
+static void networkBootStep() {
+  switch (netBootStep++) {
+    case 0:
+      wifiStart(&server);
+      Serial.println("[WIFI] Started AP + STA (if configured)");
+      bootPhaseMark("wifi");
+      break;
+    case 1:
+      realtimeInit(server);
+      Serial.println("[WS] Realtime websocket initialized");
+      apiInit(server);
+      stateInit(server);
+      timingInit(server);
+      detectProtocolInit(server);
+      laCaptureInit(server);
+      metricsInit(server);
+      memInit(server);
+      profInit(server);
+      bootPhasesInit(server);
+      logInit(server);
+      flightrecInit(server);
+      storageInit(server);
+      snapshotInit(server);
+      ps2MouseInit(server);
+      Serial.println("[API] REST endpoints initialized");
+      bootPhaseMark("api");
+      break;
+    case 2:
+      setupOTA(server);
+      autoOtaInit(server);
+      deltaOtaInit(server);
+      Serial.println("[OTA] OTA endpoints initialized");
+      bootPhaseMark("ota");
+      break;
+    case 3:
+      keymapInit(&server);
+      keymapExInit(&server);
+      keymapWsInit(server);
+      Serial.println("[KEYMAP] Keymap systems initialized");
+      bootPhaseMark("keymaps");
+      break;
+    case 4:
+      webAssetsInit(server);   // last: the filesystem fallback matches every path
+      server.begin();
+      Serial.printf("[NETWORK] IP (STA or AP): %s\n", wifiIP().c_str());
+      if (isFirstBootAfterOTA()) {
+        Serial.println("[ROLLBACK] First boot after OTA detected (rollback module active)");
+      }
+      bootPhaseMark("network_ready");
+      netReady = true;
+      bootPhasesLog();
+      Serial.println("=== boot complete ===");
+      break;
   }
-
-  Serial.println("=== setup() complete ===");
 }
 
 void loop() {
-  wifiHandlePeriodic();
-  otaPeriodic();
-  usbHostTask();
-  xtatTask();
-  rollbackPeriodic();
+  { PROF_STAGE("usb");       usbHostTask(); }
+  { PROF_STAGE("xtat");      xtatTask(); }
+  { PROF_STAGE("mouse");     ps2MouseTask(); }
+  { PROF_STAGE("detect");    detectProtocolTask(); }
+  if (!netReady) {
+    PROF_STAGE("netboot");
+    networkBootStep();
+    return;
+  }
+  { PROF_STAGE("wifi");      wifiHandlePeriodic(); }
+  { PROF_STAGE("ota");       otaPeriodic(); }
+  { PROF_STAGE("timing");    timingCalibrationTask(); }
+  { PROF_STAGE("la");        laCaptureTask(); }
+  { PROF_STAGE("metrics");   metricsTask(); }
+  { PROF_STAGE("mem");       memTask(); }
+  { PROF_STAGE("keymap");    keymapExTask(); keymapWsTask(); }
+  { PROF_STAGE("state");     stateTask(); }
+  { PROF_STAGE("realtime");  realtimeTask(); }
+  { PROF_STAGE("snapshot");  snapshotTask(); }
+  { PROF_STAGE("rollback");  rollbackPeriodic(); }
   delay(1);
-  otaPeriodic();
 }
@@ -2,6 +2,14 @@
 #include "config.h"
 #include "xt_at_output.h"
 #include "keymap.h"
+#include "typematic.h"
+#include "timing_profile.h"
+#include "profiler.h"
+#include "flightrec.h"
+#include "keymap_ex.h"
+#include "keymap_image.h"
+#include "mem_stats.h"
+#include "web_state.h"
 #include <ArduinoJson.h>
 #include <WiFi.h>
 #include <LittleFS.h>
@@ -9,6 +17,7 @@
 extern String firmware_version;
 
 static void sendJson(AsyncWebServerRequest *req, int code, const String &bodyJson) {
+  memNote(MEM_WEB, bodyJson.length());
   req->send(code, "application/json", bodyJson);
 }
 
@@ -25,8 +34,23 @@ uint8_t charToHID(char c) {
   }
 }
 
+// True if s is exactly one UTF-8 character in the BMP.
+static bool utf8Single(const char *s, uint16_t &cp) {
+  const uint8_t *p = (const uint8_t *)s;
+  if (p[0] < 0x80) { cp = p[0]; return p[0] && !p[1]; }
+  if ((p[0] & 0xE0) == 0xC0 && (p[1] & 0xC0) == 0x80 && !p[2]) {
+    cp = ((p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+    return true;
+  }
+  if ((p[0] & 0xF0) == 0xE0 && (p[1] & 0xC0) == 0x80 && (p[2] & 0xC0) == 0x80 && !p[3]) {
+    cp = ((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+    return true;
+  }
+  return false;
+}
+
 static String keymapToJsonArray() {
-  StaticJsonDocument<2048> doc;
+  MemJsonDocument<MEM_KEYMAP> doc(JSON_ARRAY_SIZE(256));
   JsonArray arr = doc.to<JsonArray>();
   for (int i = 0; i < 256; ++i) arr.add((uint8_t)config.keymap[i]);
   String out;
@@ -70,12 +94,14 @@ void apiInit(AsyncWebServer &server) {
     configSave();
     WiFi.mode(WIFI_MODE_APSTA);
     WiFi.begin(config.sta_ssid.c_str(), config.sta_pass.c_str());
+    stateChanged(STATE_WIFI);
     req->send(200, "application/json", "{"status":"connecting"}");
   });
 
   server.on("/api/mode", HTTP_GET, [](AsyncWebServerRequest *req){
     StaticJsonDocument<128> doc;
-    String modeName = (config.kb_mode == MODE_XT) ? "XT" : (config.kb_mode == MODE_AT ? "AT" : "PS2");
+    uint8_t mode = xtatMode();
+    String modeName = (mode == MODE_XT) ? "XT" : (mode == MODE_AT ? "AT" : "PS2");
     doc["mode"] = modeName;
     String out; serializeJson(doc, out);
     sendJson(req, 200, out);
@@ -88,23 +114,81 @@ void apiInit(AsyncWebServer &server) {
     DeserializationError err = deserializeJson(doc, data, len);
     if (err) { req->send(400, "application/json", "{"error":"bad json"}"); return; }
     String mode = String((const char*)doc["mode"] | "");
-    if (mode == "XT") config.kb_mode = MODE_XT;
-    else if (mode == "AT") config.kb_mode = MODE_AT;
-    else config.kb_mode = MODE_PS2;
-    configSave();
+    uint8_t m = MODE_PS2;
+    if (mode == "XT") m = MODE_XT;
+    else if (mode == "AT") m = MODE_AT;
+    xtatSetMode(m);
+    flightrecLog(FR_MODE, m);
     req->send(200, "application/json", "{"status":"saved"}");
   });
 
+  // Output ports: /api/ports lists them, /api/ports_select?port=N|all picks
+  // where keystrokes go. /api/mode and the timing endpoints address the
+  // selected port (port 0 while broadcasting).
+  server.on("/api/ports", HTTP_GET, [](AsyncWebServerRequest *req){
+    sendJson(req, 200, xtatPortsJSON());
+  });
+
+  server.on("/api/ports_select", HTTP_POST, [](AsyncWebServerRequest *req){
+    String v = req->hasParam("port") ? req->getParam("port")->value() : String("");
+    uint8_t port = v == "all" ? XTAT_PORT_ALL : (uint8_t)v.toInt();
+    if (v.length() == 0 || !xtatSelectPort(port)) {
+      req->send(400, "application/json", "{\"error\":\"no such port\"}");
+      return;
+    }
+    // Applied by the next xtatTask pass; /api/ports shows it from then on.
+    sendJson(req, 202, "{\"status\":\"switching\"}");
+  });
+
+  server.on("/api/xtat_bench", HTTP_GET, [](AsyncWebServerRequest *req){
+    uint16_t bytes = req->hasParam("bytes") ? req->getParam("bytes")->value().toInt() : 0;
+    xtatBenchmarkStart(bytes);
+    sendJson(req, 202, "{\"status\":\"running\"}");
+  });
+  server.on("/api/xtat_bench_result", HTTP_GET, [](AsyncWebServerRequest *req){
+    sendJson(req, 200, xtatBenchmarkResult());
+  });
+
+  server.on("/api/typematic", HTTP_GET, [](AsyncWebServerRequest *req){
+    StaticJsonDocument<128> doc;
+    doc["delay_ms"] = typematicDelayMs();
+    doc["period_ms"] = typematicPeriodMs();
+    doc["default_delay_ms"] = config.typematic_delay_ms;
+    doc["default_period_ms"] = config.typematic_period_ms;
+    String out; serializeJson(doc, out);
+    sendJson(req, 200, out);
+  });
+
+  server.on("/api/typematic_set", HTTP_POST, [](AsyncWebServerRequest *req){
+  }, NULL, [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+    StaticJsonDocument<128> doc;
+    DeserializationError err = deserializeJson(doc, data, len);
+    if (err) { req->send(400, "application/json", "{\"error\":\"bad json\"}"); return; }
+    int d = doc["delay_ms"] | (int)config.typematic_delay_ms;
+    int p = doc["period_ms"] | (int)config.typematic_period_ms;
+    if (d < 100 || d > 2000 || p < 20 || p > 1000) { req->send(400, "application/json", "{\"error\":\"invalid params\"}"); return; }
+    config.typematic_delay_ms = (uint16_t)d;
+    config.typematic_period_ms = (uint16_t)p;
+    configSave();
+    typematicDefaultsChanged();
+    req->send(200, "application/json", "{\"status\":\"saved\"}");
+  });
+
   server.on("/api/send_key", HTTP_POST, [](AsyncWebServerRequest *req){
     req->send(200, "application/json", "{"status":"ok"}");
   }, NULL, [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+    PROF_STAGE("http:/api/send_key");
     StaticJsonDocument<256> doc;
     DeserializationError err = deserializeJson(doc, data, len);
     if (err) { req->send(400, "application/json", "{"error":"bad json"}"); return; }
     const char* key = doc["key"] | "";
     if (!key || strlen(key) == 0) { req->send(400, "application/json", "{"error":"missing key"}"); return; }
+    // A single character the compiled layout can type wins; it may need Shift or AltGr.
+    uint8_t hid = 0, mods = 0;
+    uint16_t cp = 0;
+    if (utf8Single(key, cp)) keymapExCharToHID(cp, hid, mods);
     char c = key[0];
-    uint8_t hid = charToHID(c);
+    if (hid == 0) hid = charToHID(c);
     if (hid == 0) {
       String ks = String(key);
       if (ks == "Space") hid = 44;
@@ -115,9 +199,8 @@ void apiInit(AsyncWebServer &server) {
       else if (ks == "Ö") hid = 53;
     }
     if (hid == 0) { req->send(400,"application/json","{"error":"unmapped key"}"); return; }
-    xtatSendFromUSB(hid, true);
-    delay(5);
-    xtatSendFromUSB(hid, false);
+    // Typed by the loop; this runs on the AsyncTCP task.
+    if (!xtatTypeKey(hid, mods)) { req->send(503, "application/json", "{\"error\":\"busy\"}"); return; }
     req->send(200, "application/json", "{"status":"sent"}");
   });
 
@@ -140,6 +223,7 @@ void apiInit(AsyncWebServer &server) {
     if (usb < 0 || usb > 255 || xt < 0 || xt > 255) { req->send(400,"application/json","{"error":"invalid params"}"); return; }
     config.keymap[usb] = (uint8_t)xt;
     configSave();
+    keymapExCompile();
     req->send(200, "application/json", "{"status":"saved"}");
   });
 
@@ -0,0 +1,386 @@
+#include "auto_ota.h"
+#include "ota.h"
+#include "config.h"
+#include "rollback.h"
+#include "snapshot.h"
+#include "delta_ota.h"
+#include "mem_stats.h"
+#include <ArduinoJson.h>
+#include <HTTPClient.h>
+#include <Preferences.h>
+#include <Update.h>
+#include <WiFi.h>
+#include <mbedtls/sha256.h>
+
+#define AO_POLL_MS 1000
+#define AO_FIRST_CHECK_MS 30000UL      // after boot, let STA connect first
+#define AO_MIN_INTERVAL_MS 60000UL
+#define AO_TIMEOUT_MS 15000
+#define AO_CHUNK 1024
+
+enum AoState { AO_IDLE, AO_CHECKING, AO_DOWNLOADING, AO_REBOOTING, AO_ERROR };
+static const char *STATE_NAMES[] = { "idle", "checking", "downloading", "rebooting", "error" };
+
+static volatile AoState state = AO_IDLE;
+static volatile bool checkRequested = false;
+static volatile uint32_t lastCheckMs = 0;
+static volatile uint32_t received = 0;
+static volatile uint32_t imageSize = 0;
+static portMUX_TYPE aoMux = portMUX_INITIALIZER_UNLOCKED;
+static char remoteVersion[32];
+static char lastResult[64];
+// config.ota_manifest_url as the updater sees it. The String is reassigned
+// on the AsyncTCP task, so the updater only ever copies this, under aoMux.
+#define AO_URL_MAX 256
+static char manifestUrlCopy[AO_URL_MAX];
+
+// Conditional-request validators for the manifest, persisted so a reboot
+// does not force a full fetch. Owned by the updater task.
+static String validatorUrl, etag, lastModified;
+static uint8_t chunk[AO_CHUNK];
+
+static void setResult(AoState s, const char *msg) {
+  portENTER_CRITICAL(&aoMux);
+  state = s;
+  strlcpy(lastResult, msg, sizeof(lastResult));
+  portEXIT_CRITICAL(&aoMux);
+  Serial.printf("[AUTO-OTA] %s\n", msg);
+}
+
+// Numeric fields left to right: "1.10.0" > "1.9.3". Anything that is not a
+// digit separates fields.
+static int compareVersions(const char *a, const char *b) {
+  while (*a || *b) {
+    while (*a && !isdigit((unsigned char)*a)) a++;
+    while (*b && !isdigit((unsigned char)*b)) b++;
+    char *ea, *eb;
+    unsigned long x = strtoul(a, &ea, 10);
+    unsigned long y = strtoul(b, &eb, 10);
+    a = ea; b = eb;
+    if (x != y) return x < y ? -1 : 1;
+  }
+  return 0;
+}
+
+static bool parseSha256(const char *hex, uint8_t *out) {
+  if (!hex || strlen(hex) != 64) return false;
+  for (int i = 0; i < 32; i++) {
+    char b[3] = { hex[2 * i], hex[2 * i + 1], 0 };
+    char *end;
+    out[i] = (uint8_t)strtoul(b, &end, 16);
+    if (*end) return false;
+  }
+  return true;
+}
+
+static String resolveUrl(const String &base, const String &url) {
+  if (url.indexOf("://") > 0) return url;
+  if (url.startsWith("/")) {
+    int p = base.indexOf('/', base.indexOf("://") + 3);
+    return (p < 0 ? base : base.substring(0, p)) + url;
+  }
+  return base.substring(0, base.lastIndexOf('/') + 1) + url;
+}
+
+static void loadValidators() {
+  Preferences p;
+  p.begin("autoota", true);
+  validatorUrl = p.getString("url", "");
+  etag = p.getString("etag", "");
+  lastModified = p.getString("lm", "");
+  p.end();
+}
+
+static void saveValidators() {
+  Preferences p;
+  p.begin("autoota", false);
+  p.putString("url", validatorUrl);
+  p.putString("etag", etag);
+  p.putString("lm", lastModified);
+  p.end();
+}
+
+// Sinks for fetchStream(): a full image hashed on the way into Update, or
+// a patch handed to the delta applier.
+struct StreamSink {
+  bool (*start)(uint32_t total);
+  bool (*write)(const uint8_t *data, size_t n);
+};
+
+static mbedtls_sha256_context imageSha;
+static bool imageStarted = false;
+
+static bool imageStart(uint32_t total) {
+  if (!Update.begin(total ? total : UPDATE_SIZE_UNKNOWN)) return false;
+  mbedtls_sha256_init(&imageSha);
+  mbedtls_sha256_starts(&imageSha, 0);
+  imageStarted = true;
+  return true;
+}
+
+static bool imageWrite(const uint8_t *data, size_t n) {
+  mbedtls_sha256_update(&imageSha, data, n);
+  return Update.write((uint8_t *)data, n) == n;
+}
+
+static bool deltaStart(uint32_t) { return true; }
+static const StreamSink IMAGE_SINK = { imageStart, imageWrite };
+static const StreamSink DELTA_SINK = { deltaStart, deltaFeed };
+
+// GETs url and pushes the body through sink in AO_CHUNK pieces. Returns
+// false (with the result set) on HTTP errors, stalls or short bodies.
+static bool fetchStream(const String &url, uint32_t size, const StreamSink &sink) {
+  HTTPClient http;
+  http.setTimeout(AO_TIMEOUT_MS);
+  http.useHTTP10(true);                 // no chunked framing in the raw stream
+  if (!http.begin(url)) { setResult(AO_ERROR, "bad download url"); return false; }
+  int code = http.GET();
+  if (code != 200) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), "download failed: HTTP %d", code);
+    http.end();
+    setResult(AO_ERROR, msg);
+    return false;
+  }
+  int len = http.getSize();
+  if (size && len > 0 && (uint32_t)len != size) {
+    http.end();
+    setResult(AO_ERROR, "download size does not match manifest");
+    return false;
+  }
+  uint32_t total = len > 0 ? (uint32_t)len : size;
+  received = 0;
+  imageSize = total;
+  state = AO_DOWNLOADING;
+  if (!sink.start(total)) {
+    http.end();
+    setResult(AO_ERROR, "no room for image");
+    return false;
+  }
+
+  WiFiClient *stream = http.getStreamPtr();
+  uint32_t lastData = millis();
+  bool ok = true;
+  while (total == 0 || received < total) {
+    size_t avail = stream->available();
+    if (!avail) {
+      if (!http.connected()) break;
+      if (millis() - lastData > AO_TIMEOUT_MS) { ok = false; break; }
+      delay(1);
+      continue;
+    }
+    int n = stream->readBytes(chunk, min(avail, sizeof(chunk)));
+    if (n <= 0) continue;
+    lastData = millis();
+    if (!sink.write(chunk, n)) { ok = false; break; }
+    received += n;
+  }
+  http.end();
+  if (!ok || (total && received != total)) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), "download failed at %u bytes", (unsigned)received);
+    setResult(AO_ERROR, msg);
+    return false;
+  }
+  return true;
+}
+
+// Streams the image into the inactive partition, hashing as it goes. Nothing
+// is committed unless the length and SHA-256 match.
+static bool downloadImage(const String &url, const uint8_t *sha, uint32_t size) {
+  imageStarted = false;
+  bool ok = fetchStream(url, size, IMAGE_SINK);
+  if (!imageStarted) return false;
+  imageStarted = false;
+  uint8_t digest[32];
+  mbedtls_sha256_finish(&imageSha, digest);
+  mbedtls_sha256_free(&imageSha);
+  if (!ok) { Update.abort(); return false; }
+  if (memcmp(digest, sha, sizeof(digest)) != 0) {
+    Update.abort();
+    setResult(AO_ERROR, "sha256 mismatch, image discarded");
+    return false;
+  }
+  if (!Update.end(true)) {
+    setResult(AO_ERROR, "image rejected by bootloader check");
+    return false;
+  }
+  return true;
+}
+
+// The patch must rebuild exactly the image the manifest's sha256 names.
+static bool downloadDelta(const String &url, const uint8_t *sha, uint32_t size) {
+  if (!deltaBegin(sha)) { setResult(AO_ERROR, deltaError()); return false; }
+  bool ok = fetchStream(url, size, DELTA_SINK);
+  if (!ok) {
+    if (deltaError()[0]) setResult(AO_ERROR, deltaError());
+    deltaAbort();
+    return false;
+  }
+  if (!deltaFinish()) { setResult(AO_ERROR, deltaError()); return false; }
+  return true;
+}
+
+static void checkManifest(const char *url) {
+  String manifestUrl = url;
+  if (validatorUrl != manifestUrl) {
+    validatorUrl = manifestUrl;
+    etag = lastModified = "";
+  }
+  state = AO_CHECKING;
+  HTTPClient http;
+  http.setTimeout(AO_TIMEOUT_MS);
+  if (!http.begin(manifestUrl)) { setResult(AO_ERROR, "bad manifest url"); return; }
+  const char *keep[] = { "ETag", "Last-Modified" };
+  http.collectHeaders(keep, 2);
+  if (etag.length()) http.addHeader("If-None-Match", etag);
+  if (lastModified.length()) http.addHeader("If-Modified-Since", lastModified);
+  int code = http.GET();
+  lastCheckMs = millis();
+  if (code == 304) {
+    http.end();
+    setResult(AO_IDLE, "manifest not modified");
+    return;
+  }
+  if (code != 200) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), "manifest fetch failed: HTTP %d", code);
+    http.end();
+    setResult(AO_ERROR, msg);
+    return;
+  }
+  String body = http.getString();
+  String newEtag = http.header("ETag");
+  String newLastModified = http.header("Last-Modified");
+  http.end();
+  memNote(MEM_OTA, body.length());
+
+  MemJsonDocument<MEM_OTA> doc(1024);
+  uint8_t sha[32];
+  if (deserializeJson(doc, body) || !doc["version"].is<const char *>() || !doc["url"].is<const char *>()
+      || !parseSha256(doc["sha256"], sha)) {
+    setResult(AO_ERROR, "manifest needs version, url and sha256");
+    return;
+  }
+  const char *version = doc["version"];
+  portENTER_CRITICAL(&aoMux);
+  strlcpy(remoteVersion, version, sizeof(remoteVersion));
+  portEXIT_CRITICAL(&aoMux);
+
+  if (compareVersions(version, firmware_version.c_str()) <= 0) {
+    etag = newEtag;
+    lastModified = newLastModified;
+    saveValidators();
+    setResult(AO_IDLE, "up to date");
+    return;
+  }
+  if (!otaClaim(OTA_AUTO)) { setResult(AO_ERROR, "another update in progress"); return; }
+
+  Serial.printf("[AUTO-OTA] Updating %s -> %s\n", firmware_version.c_str(), version);
+  snapshotCapture(SNAP_REASON_OTA);
+  // A patch from the running version is tried first; the full image is
+  // the fallback. Validators are only kept once the manifest has been acted
+  // on, so a failed download is retried on the next check.
+  bool done = false;
+  for (JsonObjectConst d : doc["deltas"].as<JsonArrayConst>()) {
+    if (firmware_version != (const char *)(d["from"] | "")) continue;
+    Serial.printf("[AUTO-OTA] Trying delta from %s\n", firmware_version.c_str());
+    done = downloadDelta(resolveUrl(manifestUrl, d["url"].as<String>()), sha, d["size"] | 0);
+    break;
+  }
+  if (!done && !downloadImage(resolveUrl(manifestUrl, doc["url"].as<String>()), sha, doc["size"] | 0)) {
+    otaRelease(OTA_AUTO);
+    return;
+  }
+  etag = newEtag;
+  lastModified = newLastModified;
+  saveValidators();
+  markNextBootAsOTA();
+  setResult(AO_REBOOTING, "image verified, rebooting");
+  delay(500);
+  ESP.restart();
+}
+
+static void updaterTask(void *) {
+  loadValidators();
+  uint32_t nextCheck = millis() + AO_FIRST_CHECK_MS;
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(AO_POLL_MS));
+    bool due = config.auto_ota_enabled && (int32_t)(millis() - nextCheck) >= 0;
+    if (!due && !checkRequested) continue;
+    bool manual = checkRequested;
+    checkRequested = false;
+    char url[AO_URL_MAX];
+    portENTER_CRITICAL(&aoMux);
+    memcpy(url, manifestUrlCopy, sizeof(url));
+    portEXIT_CRITICAL(&aoMux);
+    if (!url[0] || WiFi.status() != WL_CONNECTED) {
+      if (manual) setResult(AO_ERROR, "no manifest url or not connected");
+      nextCheck = millis() + AO_MIN_INTERVAL_MS;
+      continue;
+    }
+    checkManifest(url);
+    nextCheck = millis() + max(config.auto_ota_interval_ms, AO_MIN_INTERVAL_MS);
+  }
+}
+
+bool autoOtaBusy() { return state == AO_DOWNLOADING || state == AO_REBOOTING; }
+
+void autoOtaRequestCheck() { checkRequested = true; }
+
+void autoOtaConfigChanged() {
+  portENTER_CRITICAL(&aoMux);
+  strlcpy(manifestUrlCopy, config.ota_manifest_url.c_str(), sizeof(manifestUrlCopy));
+  portEXIT_CRITICAL(&aoMux);
+}
+
+void autoOtaInit(AsyncWebServer &server) {
+  autoOtaConfigChanged();
+  // HTTPClient over TLS needs most of this.
+  xTaskCreatePinnedToCore(updaterTask, "autoota", 10240, NULL, 1, NULL, 0);
+
+  server.on("/api/ota_auto", HTTP_GET, [](AsyncWebServerRequest *req){
+    MemJsonDocument<MEM_OTA> doc(512);
+    doc["enabled"] = config.auto_ota_enabled;
+    doc["manifest_url"] = config.ota_manifest_url;
+    doc["interval_ms"] = config.auto_ota_interval_ms;
+    doc["version"] = firmware_version;
+    char remote[sizeof(remoteVersion)], result[sizeof(lastResult)];
+    portENTER_CRITICAL(&aoMux);
+    memcpy(remote, remoteVersion, sizeof(remote));
+    memcpy(result, lastResult, sizeof(result));
+    portEXIT_CRITICAL(&aoMux);
+    if (remote[0]) doc["remote_version"] = (const char *)remote;
+    doc["state"] = STATE_NAMES[state];
+    doc["result"] = (const char *)result;
+    if (lastCheckMs) doc["last_check_ms_ago"] = millis() - lastCheckMs;
+    if (state == AO_DOWNLOADING) {
+      doc["received"] = received;
+      doc["size"] = imageSize;
+    }
+    String out; serializeJson(doc, out);
+    req->send(200, "application/json", out);
+  });
+  server.on("/api/ota_auto_set", HTTP_POST, [](AsyncWebServerRequest *req){
+  }, NULL, [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+    if (!req->authenticate(config.ota_user.c_str(), config.ota_pass.c_str())) { req->requestAuthentication(); return; }
+    MemJsonDocument<MEM_OTA> doc(512);
+    if (deserializeJson(doc, data, len)) { req->send(400, "application/json", "{\"error\":\"bad json\"}"); return; }
+    if (doc.containsKey("manifest_url") && strlen(doc["manifest_url"] | "") >= AO_URL_MAX) {
+      req->send(400, "application/json", "{\"error\":\"manifest url too long\"}");
+      return;
+    }
+    if (doc.containsKey("enabled")) config.auto_ota_enabled = doc["enabled"];
+    if (doc.containsKey("manifest_url")) config.ota_manifest_url = doc["manifest_url"].as<String>();
+    if (doc.containsKey("interval_ms")) config.auto_ota_interval_ms = max((unsigned long)(doc["interval_ms"] | 0UL), AO_MIN_INTERVAL_MS);
+    autoOtaConfigChanged();
+    configSave();
+    req->send(200, "application/json", "{\"status\":\"saved\"}");
+  });
+  server.on("/api/ota_check", HTTP_POST, [](AsyncWebServerRequest *req){
+    if (!req->authenticate(config.ota_user.c_str(), config.ota_pass.c_str())) { req->requestAuthentication(); return; }
+    autoOtaRequestCheck();
+    req->send(202, "application/json", "{\"status\":\"checking\"}");
+  });
+  Serial.println("[AUTO-OTA] Updater started");
+}
@@ -0,0 +1,27 @@
+#ifndef AUTO_OTA_H
+#define AUTO_OTA_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Background updater driven by config.ota_manifest_url. Every
+// config.auto_ota_interval_ms (and on /api/ota_check) it fetches the manifest
+//   { "version": "1.4.0", "url": "http://host/fw.bin", "sha256": "<hex>", "size": 123456 }
+// with If-None-Match / If-Modified-Since. A version newer than
+// firmware_version is streamed straight into the inactive OTA partition while
+// SHA-256 is computed on the fly; only a verified image is committed, after a
+// snapshot and markNextBootAsOTA(). "url" may be relative to the manifest.
+// An optional "deltas": [{ "from": "1.3.0", "url": "...", "size": N }] entry
+// matching firmware_version is tried first (delta_ota.h), the full image
+// being the fallback.
+// tools/ota_manifest.py writes a manifest and serves it for testing.
+
+bool autoOtaBusy();                  // an image is being downloaded
+void autoOtaRequestCheck();
+// The updater keeps its own copy of config.ota_manifest_url; call after
+// changing it (the task that assigned the String).
+void autoOtaConfigChanged();
+void autoOtaInit(AsyncWebServer &server);
+
+#endif
@@ -0,0 +1,55 @@
+#include "boot_phases.h"
+#include "mem_stats.h"
+#include <ArduinoJson.h>
+
+#define BOOT_MAX_PHASES 24
+
+struct BootPhase {
+  const char *name;
+  uint32_t us;                    // since boot (esp_timer), not since setup()
+};
+
+static BootPhase phases[BOOT_MAX_PHASES];
+static uint8_t phaseCount = 0;
+
+void bootPhaseMark(const char *name) {
+  if (phaseCount >= BOOT_MAX_PHASES) return;
+  phases[phaseCount].name = name;
+  phases[phaseCount].us = (uint32_t)micros();
+  phaseCount++;
+}
+
+uint32_t bootPhaseUs(const char *name) {
+  for (uint8_t i = 0; i < phaseCount; i++) {
+    if (strcmp(phases[i].name, name) == 0) return phases[i].us;
+  }
+  return 0;
+}
+
+void bootPhasesLog() {
+  uint32_t prev = 0;
+  for (uint8_t i = 0; i < phaseCount; i++) {
+    Serial.printf("[BOOT] %-16s at %7luus (+%luus)\n", phases[i].name,
+                  (unsigned long)phases[i].us, (unsigned long)(phases[i].us - prev));
+    prev = phases[i].us;
+  }
+}
+
+void bootPhasesInit(AsyncWebServer &server) {
+  server.on("/api/boot", HTTP_GET, [](AsyncWebServerRequest *req){
+    MemJsonDocument<MEM_WEB> doc(1536);
+    doc["keyboard_ready_us"] = bootPhaseUs("keyboard_ready");
+    doc["network_ready_us"] = bootPhaseUs("network_ready");
+    JsonArray arr = doc.createNestedArray("phases");
+    uint32_t prev = 0;
+    for (uint8_t i = 0; i < phaseCount; i++) {
+      JsonObject o = arr.createNestedObject();
+      o["name"] = phases[i].name;
+      o["at_us"] = phases[i].us;
+      o["took_us"] = phases[i].us - prev;
+      prev = phases[i].us;
+    }
+    String out; serializeJson(doc, out);
+    req->send(200, "application/json", out);
+  });
+}
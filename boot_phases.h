@@ -0,0 +1,17 @@
+#ifndef BOOT_PHASES_H
+#define BOOT_PHASES_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Boot phase timing. Each mark records micros() since the chip booted, so
+// ROM and bootloader time is included; the phase duration is the gap to the
+// previous mark (to boot for the first one). Exposed at /api/boot.
+
+void bootPhaseMark(const char *name);
+void bootPhasesLog();
+uint32_t bootPhaseUs(const char *name);
+void bootPhasesInit(AsyncWebServer &server);
+
+#endif
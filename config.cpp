@@ -16,6 +16,8 @@ void setDefaults() {
   config.ota_manifest_url = "";
   config.auto_ota_enabled = false;
   config.auto_ota_interval_ms = 3600000UL;
+  config.typematic_delay_ms = DEFAULT_TYPEMATIC_DELAY_MS;
+  config.typematic_period_ms = DEFAULT_TYPEMATIC_PERIOD_MS;
   for (int i=0;i<256;i++) config.keymap[i] = 0x00;
 }
 
@@ -31,6 +33,8 @@ void configLoad() {
   config.ota_manifest_url = prefs.getString("ota_manifest_url", "");
   config.auto_ota_enabled = prefs.getBool("auto_ota_enabled", false);
   config.auto_ota_interval_ms = prefs.getULong("auto_ota_interval_ms", 3600000UL);
+  config.typematic_delay_ms = prefs.getUShort("tm_delay", DEFAULT_TYPEMATIC_DELAY_MS);
+  config.typematic_period_ms = prefs.getUShort("tm_period", DEFAULT_TYPEMATIC_PERIOD_MS);
 
   size_t len = prefs.getBytesLength("keymap");
   if (len == 256) {
@@ -53,6 +57,8 @@ void configSave() {
   prefs.putString("ota_manifest_url", config.ota_manifest_url);
   prefs.putBool("auto_ota_enabled", config.auto_ota_enabled);
   prefs.putULong("auto_ota_interval_ms", config.auto_ota_interval_ms);
+  prefs.putUShort("tm_delay", config.typematic_delay_ms);
+  prefs.putUShort("tm_period", config.typematic_period_ms);
   prefs.putBytes("keymap", config.keymap, 256);
   prefs.end();
 }
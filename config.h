@@ -10,6 +10,9 @@
 #define MODE_AT 2
 #define MODE_PS2 3
 
+#define DEFAULT_TYPEMATIC_DELAY_MS 500
+#define DEFAULT_TYPEMATIC_PERIOD_MS 92
+
 struct AppConfig {
   String ap_ssid;
   String ap_pass;
@@ -22,6 +25,8 @@ struct AppConfig {
   uint8_t keymap[256];
   bool auto_ota_enabled;
   unsigned long auto_ota_interval_ms;
+  uint16_t typematic_delay_ms;
+  uint16_t typematic_period_ms;
 };
 
 extern AppConfig config;
@@ -1,5 +1,11 @@
 let keymapEx = [];
+let baseCodes = [];
+let overrides = {};
 let selectedIndex = -1;
+let kws = null;
+let kwsGen = 0;        // keymap generation overrides is based on
+let nextId = 1;
+const pending = {};
 
 document.addEventListener('DOMContentLoaded', () => {
   document.getElementById('btnReload').addEventListener('click', loadMap);
@@ -10,7 +16,7 @@ document.addEventListener('DOMContentLoaded', () => {
   document.getElementById('btnSave').addEventListener('click', saveEntry);
   document.getElementById('btnCancel').addEventListener('click', clearEditor);
   buildGrid();
-  loadMap();
+  connectEditor();   // loads the map once connected
 });
 
 function buildGrid(){
@@ -26,21 +32,78 @@ function buildGrid(){
   }
 }
 
+// The device sends only overrides keyed by HID code; the full table is
+// the base codes with those applied.
+function defaultEntry(i){
+  const b = baseCodes[i] || 0;
+  return {base:b, shift:b, altgr:b, ctrl:b, dead:0};
+}
+
+function materialise(){
+  keymapEx = [];
+  for(let i=0;i<256;i++) keymapEx[i] = Object.assign(defaultEntry(i), overrides[i] || {});
+}
+
+// Editor channel /ws/keymap: requests are answered by id, edits made in
+// other editors arrive as deltas and anything else as "changed".
+function connectEditor(){
+  kws = new WebSocket('ws://'+location.host+'/ws/keymap');
+  kws.onopen = loadMap;
+  kws.onmessage = (m) => {
+    let msg;
+    try { msg = JSON.parse(m.data); } catch(e){ return; }
+    if (msg.id !== undefined && pending[msg.id]) {
+      const done = pending[msg.id];
+      delete pending[msg.id];
+      done(msg);
+    } else if (msg.type === 'delta') applyDelta(msg);
+    else if (msg.type === 'changed' && msg.gen !== kwsGen) loadMap();
+  };
+  kws.onclose = () => {
+    kws = null;
+    for (const id in pending) { pending[id]({ok:false, error:'connection closed'}); delete pending[id]; }
+    setTimeout(connectEditor, 3000);
+  };
+}
+
+function request(msg){
+  return new Promise((resolve, reject) => {
+    if (!kws || kws.readyState !== WebSocket.OPEN) { reject(new Error('ingen anslutning')); return; }
+    msg.id = nextId++;
+    pending[msg.id] = resolve;
+    kws.send(JSON.stringify(msg));
+  });
+}
+
 async function loadMap(){
   try {
-    const r = await fetch('/api/map_ex');
-    if (!r.ok) throw new Error('HTTP '+r.status);
-    const arr = await r.json();
-    keymapEx = arr;
+    const r = await request({op:'get', base: !baseCodes.length});
+    if (!r.ok) throw new Error(r.error);
+    if (r.base) for(let i=0;i<256;i++) baseCodes[i] = parseInt(r.base.substr(i*2,2),16);
+    kwsGen = r.gen;
+    overrides = r.map || {};
+    materialise();
     refreshGrid();
     clearEditor();
-    alert('Keymap laddad');
   } catch(e){
     console.error(e);
     alert('Kunde inte ladda keymap: '+e.message);
   }
 }
 
+// Our own writes come back too; those are already applied. A delta that
+// does not follow our generation means one was missed.
+function applyDelta(ev){
+  if (ev.gen <= kwsGen) return;
+  if (ev.from !== kwsGen) { loadMap(); return; }
+  for (const k in ev.map) {
+    if (ev.map[k] === null) delete overrides[k]; else overrides[k] = ev.map[k];
+  }
+  kwsGen = ev.gen;
+  materialise();
+  refreshGrid();
+}
+
 function refreshGrid(){
   for(let i=0;i<256;i++){
     const el = document.getElementById('cell-'+i);
@@ -48,6 +111,7 @@ function refreshGrid(){
     if (!entry) continue;
     if (entry.base && entry.base !== 0) el.innerText = toHex(entry.base);
     else el.innerText = i.toString(16).toUpperCase().padStart(2,'0');
+    el.classList.toggle('custom', !!overrides[i]);
   }
 }
 
@@ -60,10 +124,15 @@ function openEditor(i){
   document.getElementById('editAltgr').value = entry.altgr ? toHex(entry.altgr) : '';
   document.getElementById('editCtrl').value = entry.ctrl ? toHex(entry.ctrl) : '';
   document.getElementById('editDead').checked = !!entry.dead;
-  document.getElementById('pvBase')?.innerText = entry.base ? toHex(entry.base) : '—';
-  document.getElementById('pvShift')?.innerText = entry.shift ? toHex(entry.shift) : '—';
-  document.getElementById('pvAltgr')?.innerText = entry.altgr ? toHex(entry.altgr) : '—';
-  document.getElementById('pvCtrl')?.innerText = entry.ctrl ? toHex(entry.ctrl) : '—';
+  setPreview('pvBase', entry.base);
+  setPreview('pvShift', entry.shift);
+  setPreview('pvAltgr', entry.altgr);
+  setPreview('pvCtrl', entry.ctrl);
+}
+
+function setPreview(id, v){
+  const el = document.getElementById(id);
+  if (el) el.innerText = v ? toHex(v) : '—';
 }
 
 function clearEditor(){
@@ -89,13 +158,17 @@ async function saveEntry(){
   if (base === null || shift === null || altgr === null || ctrl === null) {
     alert('Fel i hexkod — använd 00–FF eller lämna fält tomt för 0'); return;
   }
-  const payload = { usb: selectedIndex, base: base, shift: shift, altgr: altgr, ctrl: ctrl, dead: dead };
+  const payload = { base: base, shift: shift, altgr: altgr, ctrl: ctrl, dead: dead };
   try {
-    const r = await fetch('/api/map_ex_set', {
-      method:'POST', headers: {'Content-Type':'application/json'}, body: JSON.stringify(payload)
-    });
-    if (!r.ok) throw new Error('HTTP '+r.status);
-    keymapEx[selectedIndex] = payload;
+    const r = await request({op:'set', gen:kwsGen, hid:selectedIndex, entry:payload});
+    if (!r.ok && r.error === 'conflict') { alert('Keymap har ändrats någon annanstans — laddar om'); loadMap(); return; }
+    if (!r.ok) throw new Error(r.error);
+    kwsGen = r.gen;
+    const d = defaultEntry(selectedIndex), diff = {};
+    for (const k of ['base','shift','altgr','ctrl','dead']) if (payload[k] !== d[k]) diff[k] = payload[k];
+    if (Object.keys(diff).length && (base||shift||altgr||ctrl||dead)) overrides[selectedIndex] = diff;
+    else delete overrides[selectedIndex];
+    materialise();
     refreshGrid();
     clearEditor();
     alert('Sparat');
@@ -113,7 +186,8 @@ function uploadFile(ev){
   reader.onload = async () => {
     try {
       const json = JSON.parse(reader.result);
-      if (!Array.isArray(json) || json.length !== 256) { alert('Filen måste vara en array med 256 objekt'); return; }
+      const isFull = Array.isArray(json) && json.length === 256;
+      if (!isFull && !(json && json.map)) { alert('Filen måste vara en sparse keymap ({"map":{...}}) eller en array med 256 objekt'); return; }
       const r = await fetch('/api/map_ex_upload', { method:'POST', headers: {'Content-Type':'application/json'}, body: JSON.stringify(json) });
       if (!r.ok) throw new Error('HTTP '+r.status);
       alert('Upload lyckades — uppdaterar lokalt');
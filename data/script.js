@@ -1,28 +1,80 @@
 let mapCache = [];
 
+let stateGen = 0;
+let keymapGen = -1;
+let stateTag = null;
+
+// The state is fetched when the WebSocket opens: once on load, and again
+// after each reconnect for what was missed while away.
 window.onload = () => {
-    loadFirmware();
-    loadWiFi();
-    loadMode();
-    loadMap();
+    connectState();
     buildKeyboard();
     buildUSBKeyList();
 };
 
-function loadFirmware() {
-    fetch("/api/fw")
-    .then(r => r.json())
+// Firmware, Wi-Fi, mode, profile and keymap generation in one request; later
+// changes arrive as "state" events on the WebSocket (see applyState).
+function loadState() {
+    let opts = stateTag ? {headers: {"If-None-Match": stateTag}} : {};
+    fetch("/api/state", opts)
+    .then(r => {
+        if (r.status === 304) return null;
+        stateTag = r.headers.get("ETag");
+        return r.json();
+    })
     .then(j => {
-        document.getElementById("fwver").innerText = "Firmware: " + j.version;
+        if (!j) return;
+        stateGen = 0;
+        document.getElementById("fwver").innerText = "Firmware: " + j.fw;
+        applyState(j);
     });
 }
 
-function loadWiFi() {
-    fetch("/api/wifi")
-    .then(r => r.json())
-    .then(j => {
-        document.getElementById("sta_ssid").value = j.ssid;
-    });
+function applyState(j) {
+    if (j.gen < stateGen) return;       // older than what is shown
+    stateGen = j.gen;
+    if (j.wifi) {
+        let ssid = document.getElementById("sta_ssid");
+        if (document.activeElement !== ssid) ssid.value = j.wifi.ssid;
+        document.getElementById("wifi_status").innerText =
+            j.wifi.connected ? "Ansluten, IP " + j.wifi.ip : "Ej ansluten";
+    }
+    if (j.mode) document.getElementById("mode").value = j.mode.name;
+    if (j.keymap && j.keymap.gen !== keymapGen) {
+        keymapGen = j.keymap.gen;
+        loadMap();
+    }
+}
+
+// Binary frames from /ws/scancodes: [ver][class][u16 count] then records of
+// [type][len][u32 ts] + payload; type 6 is JSON text, led by type 7 parts
+// when it is longer than 255 bytes.
+function connectState() {
+    let ws = new WebSocket(`ws://${location.host}/ws/scancodes`);
+    ws.binaryType = "arraybuffer";
+    ws.onopen = () => {
+        ws.send(JSON.stringify({sub: ["events"]}));
+        loadState();
+    };
+    ws.onmessage = ev => {
+        if (!(ev.data instanceof ArrayBuffer)) return;
+        let b = new Uint8Array(ev.data);
+        let n = b[2] | (b[3] << 8);
+        let dec = new TextDecoder(), text = "";
+        for (let i = 0, p = 4; i < n && p + 6 <= b.length; i++) {
+            let type = b[p], len = b[p + 1];
+            if (type === 7) {
+                text += dec.decode(b.subarray(p + 6, p + 6 + len), {stream: true});
+            } else if (type === 6) {
+                text += dec.decode(b.subarray(p + 6, p + 6 + len));
+                let j = JSON.parse(text);
+                text = "";
+                if (j.type === "state") applyState(j);
+            }
+            p += 6 + len;
+        }
+    };
+    ws.onclose = () => setTimeout(connectState, 3000);
 }
 
 function saveWiFi() {
@@ -38,14 +90,6 @@ function saveWiFi() {
     });
 }
 
-function loadMode() {
-    fetch("/api/mode")
-    .then(r=>r.json())
-    .then(j=>{
-        document.getElementById("mode").value = j.mode;
-    });
-}
-
 function saveMode() {
     let mode = document.getElementById("mode").value;
     fetch("/api/mode_set", {
@@ -0,0 +1,254 @@
+#include "delta_ota.h"
+#include "config.h"
+#include "ota.h"
+#include "rollback.h"
+#include "snapshot.h"
+#include <Update.h>
+#include <esp_image_format.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+
+#define DELTA_MAGIC 0x314C4458UL       // "XDL1"
+#define DELTA_HDR 76
+#define DELTA_COPY_BUF 1024
+#define DELTA_HASH_STEP 16384          // hashed between yields at boot
+
+enum DeltaOp { DELTA_END = 0, DELTA_COPY = 1, DELTA_INSERT = 2 };
+enum DeltaPhase { DP_IDLE, DP_HEADER, DP_OP, DP_INSERT, DP_DONE, DP_FAILED };
+
+static DeltaPhase phase = DP_IDLE;
+static bool started = false;           // Update.begin() done, sha initialised
+static const esp_partition_t *running = nullptr;
+static mbedtls_sha256_context sha;
+static uint8_t expectSha[32];
+static bool haveExpect = false;
+static uint8_t hdr[DELTA_HDR];
+static uint8_t opBuf[9];
+static size_t fill = 0;                // bytes collected in hdr / opBuf
+static uint32_t oldSize = 0, newSize = 0;
+static uint32_t written = 0;
+static uint32_t insertLeft = 0;
+static uint8_t copyBuf[DELTA_COPY_BUF];
+static const char *err = "";
+static AsyncWebServerRequest *uploader = nullptr;   // request holding OTA_DELTA
+
+// SHA-256 of the running image, hashed once after boot by baseHashTask so
+// a patch header is checked without reading 1 MB on the AsyncTCP task.
+static uint32_t baseSize = 0;
+static uint8_t baseSha[32];
+static volatile bool baseReady = false;
+
+static void stopImage() {
+  if (!started) return;
+  Update.abort();
+  mbedtls_sha256_free(&sha);
+  started = false;
+}
+
+static bool fail(const char *msg) {
+  stopImage();
+  phase = DP_FAILED;
+  err = msg;
+  Serial.printf("[DELTA] %s\n", msg);
+  return false;
+}
+
+static bool emit(const uint8_t *data, size_t n) {
+  if (written + n > newSize) return fail("patch writes past new image size");
+  mbedtls_sha256_update(&sha, data, n);
+  if (Update.write((uint8_t *)data, n) != n) return fail("flash write failed");
+  written += n;
+  return true;
+}
+
+static bool copyFromRunning(uint32_t off, uint32_t len) {
+  if (off > oldSize || len > oldSize - off) return fail("copy outside old image");
+  while (len) {
+    size_t n = min((uint32_t)sizeof(copyBuf), len);
+    if (esp_partition_read(running, off, copyBuf, n) != ESP_OK) return fail("read of running image failed");
+    if (!emit(copyBuf, n)) return false;
+    off += n;
+    len -= n;
+  }
+  return true;
+}
+
+// The image length from its header is the size of the .bin that
+// make_delta.py was given. Reads go through the cache (mmap), so the other
+// core is not stalled the way a flash read would stall it.
+static void baseHashTask(void *) {
+  const esp_partition_t *part = esp_ota_get_running_partition();
+  esp_partition_pos_t pos = { part->address, part->size };
+  esp_image_metadata_t md;
+  const uint8_t *image;
+  spi_flash_mmap_handle_t handle;
+  if (esp_image_get_metadata(&pos, &md) != ESP_OK ||
+      esp_partition_mmap(part, 0, md.image_len, SPI_FLASH_MMAP_DATA, (const void **)&image, &handle) != ESP_OK) {
+    Serial.println("[DELTA] Cannot read running image, patches will be refused");
+    vTaskDelete(NULL);
+    return;
+  }
+  unsigned long t0 = millis();
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts(&ctx, 0);
+  for (uint32_t off = 0; off < md.image_len; off += DELTA_HASH_STEP) {
+    mbedtls_sha256_update(&ctx, image + off, min((uint32_t)DELTA_HASH_STEP, md.image_len - off));
+    vTaskDelay(1);
+  }
+  mbedtls_sha256_finish(&ctx, baseSha);
+  mbedtls_sha256_free(&ctx);
+  spi_flash_munmap(handle);
+  baseSize = md.image_len;
+  baseReady = true;
+  Serial.printf("[DELTA] Running image hashed in %lums (%u bytes)\n", millis() - t0, (unsigned)baseSize);
+  vTaskDelete(NULL);
+}
+
+static bool startImage() {
+  uint32_t magic;
+  memcpy(&magic, hdr, 4);
+  memcpy(&oldSize, hdr + 4, 4);
+  memcpy(&newSize, hdr + 8, 4);
+  if (magic != DELTA_MAGIC) return fail("not a delta patch");
+  if (haveExpect && memcmp(hdr + 44, expectSha, 32) != 0) return fail("patch builds a different image than expected");
+  if (!baseReady) return fail("running image not hashed yet, retry shortly");
+  if (oldSize != baseSize || memcmp(hdr + 12, baseSha, 32) != 0) return fail("patch was made for a different base image");
+  Serial.printf("[DELTA] Base image matches, building %u bytes\n", (unsigned)newSize);
+  if (!Update.begin(newSize)) return fail("no room for new image");
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  started = true;
+  written = 0;
+  return true;
+}
+
+bool deltaBegin(const uint8_t *expectedNewSha) {
+  if (deltaActive()) deltaAbort();
+  if (Update.isRunning()) { err = "another update in progress"; phase = DP_FAILED; return false; }
+  running = esp_ota_get_running_partition();
+  if (!running) { err = "no running partition"; phase = DP_FAILED; return false; }
+  haveExpect = expectedNewSha != nullptr;
+  if (haveExpect) memcpy(expectSha, expectedNewSha, 32);
+  phase = DP_HEADER;
+  fill = 0;
+  err = "";
+  return true;
+}
+
+bool deltaFeed(const uint8_t *data, size_t len) {
+  while (len) {
+    switch (phase) {
+      case DP_HEADER: {
+        size_t n = min(len, (size_t)(DELTA_HDR - fill));
+        memcpy(hdr + fill, data, n);
+        fill += n; data += n; len -= n;
+        if (fill < DELTA_HDR) return true;
+        if (!startImage()) return false;
+        phase = DP_OP;
+        fill = 0;
+        break;
+      }
+      case DP_OP: {
+        opBuf[fill++] = *data++;
+        len--;
+        uint8_t op = opBuf[0];
+        size_t need = op == DELTA_COPY ? 9 : op == DELTA_INSERT ? 5 : 1;
+        if (op > DELTA_INSERT) return fail("unknown patch op");
+        if (fill < need) break;
+        fill = 0;
+        if (op == DELTA_END) { phase = DP_DONE; break; }
+        uint32_t a, b;
+        memcpy(&a, opBuf + 1, 4);
+        if (op == DELTA_INSERT) { insertLeft = a; if (a) phase = DP_INSERT; break; }
+        memcpy(&b, opBuf + 5, 4);
+        if (!copyFromRunning(a, b)) return false;
+        break;
+      }
+      case DP_INSERT: {
+        size_t n = min(len, (size_t)insertLeft);
+        if (!emit(data, n)) return false;
+        data += n; len -= n; insertLeft -= n;
+        if (!insertLeft) phase = DP_OP;
+        break;
+      }
+      case DP_DONE:
+        return fail("data after end of patch");
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+bool deltaFinish() {
+  if (phase == DP_FAILED) return false;
+  if (phase != DP_DONE) return fail("patch truncated");
+  uint8_t got[32];
+  mbedtls_sha256_finish(&sha, got);
+  if (written != newSize || memcmp(got, hdr + 44, 32) != 0) return fail("result hash mismatch, image discarded");
+  mbedtls_sha256_free(&sha);
+  started = false;
+  phase = DP_IDLE;
+  if (!Update.end(true)) { err = "image rejected by bootloader check"; Serial.printf("[DELTA] %s\n", err); return false; }
+  Serial.printf("[DELTA] New image verified (%u bytes)\n", (unsigned)written);
+  return true;
+}
+
+void deltaAbort() {
+  stopImage();
+  phase = DP_IDLE;
+}
+
+bool deltaActive() {
+  return phase == DP_HEADER || phase == DP_OP || phase == DP_INSERT || phase == DP_DONE;
+}
+
+const char *deltaError() { return err; }
+
+// Drops the upload in progress and the OTA claim.
+static void endUpload() {
+  deltaAbort();
+  uploader = nullptr;
+  otaRelease(OTA_DELTA);
+}
+
+void deltaOtaInit(AsyncWebServer &server) {
+  xTaskCreatePinnedToCore(baseHashTask, "deltahash", 3072, NULL, 1, NULL, 0);
+
+  // Raw patch body, basic auth with config.ota_user / ota_pass. _tempObject
+  // marks an accepted upload so later chunks of a rejected one are dropped.
+  // A connection that drops before the end takes its update with it.
+  server.on("/api/ota_delta", HTTP_POST, [](AsyncWebServerRequest *req){
+  }, NULL, [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+    if (index == 0) {
+      if (!req->authenticate(config.ota_user.c_str(), config.ota_pass.c_str())) { req->requestAuthentication(); return; }
+      if (!otaClaim(OTA_DELTA)) { req->send(409, "application/json", "{\"error\":\"another update in progress\"}"); return; }
+      if (!deltaBegin()) {
+        endUpload();
+        req->send(409, "application/json", String("{\"error\":\"") + deltaError() + "\"}");
+        return;
+      }
+      uploader = req;
+      req->onDisconnect([req]() { if (uploader == req) endUpload(); });
+      req->_tempObject = malloc(1);
+      snapshotCapture(SNAP_REASON_OTA);
+    }
+    if (!req->_tempObject) return;
+    if (deltaActive()) deltaFeed(data, len);
+    if (index + len < total) return;
+    if (!deltaFinish()) {
+      endUpload();
+      String out = String("{\"error\":\"") + deltaError() + "\"}";
+      req->send(400, "application/json", out);
+      return;
+    }
+    markNextBootAsOTA();
+    AsyncWebServerResponse *resp = req->beginResponse(200, "application/json", "{\"status\":\"ok\",\"rebooting\":true}");
+    resp->addHeader("Connection", "close");
+    req->send(resp);
+    req->onDisconnect([]() { ESP.restart(); });
+  });
+  Serial.println("[DELTA] Endpoint registered");
+}
@@ -0,0 +1,35 @@
+#ifndef DELTA_OTA_H
+#define DELTA_OTA_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Delta OTA: rebuilds the new firmware from the running one plus a patch
+// made by tools/make_delta.py, without ever holding either image in RAM.
+//
+// Patch layout, little endian:
+//   header 76 bytes: [u32 magic "XDL1"][u32 old size][u32 new size]
+//                    [32 sha256 of old image][32 sha256 of new image]
+//   ops:  DELTA_COPY   [u8 1][u32 offset in old][u32 len]
+//         DELTA_INSERT [u8 2][u32 len][len literal bytes]
+//         DELTA_END    [u8 0]
+//
+// The patch is fed in arbitrary pieces; COPY reads the running partition
+// and every output byte goes to Update.write() and the running SHA-256.
+// The base image is checked before anything is written (against a hash of
+// the running image taken once after boot) and the result is checked before
+// Update.end(), so a wrong or corrupt patch never switches the boot
+// partition. Full images still go through AsyncElegantOTA (/update).
+
+// expectedNewSha (32 bytes) is optional: the patch must produce that image.
+bool deltaBegin(const uint8_t *expectedNewSha = nullptr);
+bool deltaFeed(const uint8_t *data, size_t len);
+bool deltaFinish();                    // verify and commit; true = reboot into it
+void deltaAbort();
+bool deltaActive();
+const char *deltaError();
+
+void deltaOtaInit(AsyncWebServer &server);   // POST /api/ota_delta
+
+#endif
@@ -1,49 +1,243 @@
 #include "detect_protocol.h"
 #include "xt_at_output.h"
 #include "realtime_ws.h"
+#include "timing_profile.h"
 #include <Arduino.h>
+#include <ArduinoJson.h>
+#include <soc/gpio_reg.h>
 
-static void clearHostEchoBuffer() {
-  uint8_t tmp[64];
+#define PASSIVE_MS        1200   // no probes yet, covers BIOS reset/inhibit
+#define BAT_WINDOW_MS     400    // host reaction to 0xAA (AT BIOS sends ED/F4/...)
+#define ECHO_WINDOW_MS    150
+#define XT_RESET_MIN_US   8000   // XT soft reset holds CLK low ~20 ms
+#define XT_RESET_MAX_US   40000  // longer is an AT host inhibiting
+#define RTS_MAX_US        1000   // AT request-to-send: short CLK low, then DATA low
+
+enum DetectState { DET_IDLE, DET_PASSIVE, DET_PROBE_BAT, DET_PROBE_ECHO, DET_DONE };
+
+static DetectState state = DET_IDLE;
+static uint32_t jobId = 0;
+static unsigned long phaseStart = 0;
+static bool savedHostEcho = false;
+
+// A start asked for by the web server (AsyncTCP task). Listening attaches
+// an interrupt and changes what xtatTask sends, so detectProtocolTask
+// starts the job on the loop.
+static portMUX_TYPE startMux = portMUX_INITIALIZER_UNLOCKED;
+static bool startWanted = false;
+
+// Passive phase: no keystrokes go out on the port (xtatListen), host
+// commands are still answered by xtatTask, and every CLK edge is
+// timestamped by an interrupt, so a 100 us AT request-to-send is not missed
+// between loop passes.
+static uint8_t clkPin = 0, dataPin = 0;
+static uint32_t clkInReg = 0, clkMask = 0, dataInReg = 0, dataMask = 0;
+static volatile uint32_t clkLowSince = 0;
+static volatile bool clkLowWithDataLow = false;
+static bool listening = false;
+
+// evidence counters
+static volatile uint16_t xtResetPulses = 0;
+static volatile uint16_t rtsSeen = 0;
+static uint16_t hostBytes = 0;
+static uint16_t ps2Commands = 0;
+static uint16_t resends = 0;
+static uint8_t lastHostByte = 0;
+static const char *result = "unknown";
+
+static void resetEvidence() {
+  xtResetPulses = rtsSeen = hostBytes = ps2Commands = resends = 0;
+  lastHostByte = 0;
+  clkLowSince = 0;
+  clkLowWithDataLow = false;
+}
+
+static void drainHostBytes() {
+  uint8_t buf[16];
+  size_t n;
+  while ((n = xtatPopHostEcho(buf, sizeof(buf))) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      uint8_t b = buf[i];
+      hostBytes++;
+      lastHostByte = b;
+      if (b == 0xFE) resends++;
+      // Read ID, enable/disable scanning and scan-set select only exist on PS/2 hosts
+      if (b == 0xF2 || b == 0xF4 || b == 0xF5 || b == 0xF0) ps2Commands++;
+    }
+  }
+}
+
+// AT request-to-send: CLK low, DATA pulled low before CLK is released.
+// XT soft reset: CLK held low for milliseconds with DATA high.
+static void IRAM_ATTR clkEdge() {
+  uint32_t now = (uint32_t)micros();
+  bool dataLow = !(REG_READ(dataInReg) & dataMask);
+  if (!(REG_READ(clkInReg) & clkMask)) {
+    clkLowSince = now ? now : 1;
+    clkLowWithDataLow = dataLow;
+    return;
+  }
+  if (!clkLowSince) return;
+  uint32_t dur = now - clkLowSince;
+  if ((clkLowWithDataLow || dataLow) && dur <= RTS_MAX_US) rtsSeen++;
+  else if (!clkLowWithDataLow && !dataLow && dur >= XT_RESET_MIN_US && dur <= XT_RESET_MAX_US) xtResetPulses++;
+  clkLowSince = 0;
+}
+
+static void startListening() {
+  xtatListen(true);
+  xtatControlPins(clkPin, dataPin);
+  clkInReg = clkPin < 32 ? GPIO_IN_REG : GPIO_IN1_REG;
+  clkMask = 1UL << (clkPin & 31);
+  dataInReg = dataPin < 32 ? GPIO_IN_REG : GPIO_IN1_REG;
+  dataMask = 1UL << (dataPin & 31);
+  attachInterrupt(digitalPinToInterrupt(clkPin), clkEdge, CHANGE);
+  listening = true;
+}
+
+static void stopListening() {
+  if (!listening) return;
+  detachInterrupt(digitalPinToInterrupt(clkPin));
+  xtatListen(false);
+  listening = false;
+}
+
+static const char *decide() {
+  if (ps2Commands > 0) return "PS2";
+  if (hostBytes > 0 || rtsSeen > 0) return "AT";
+  // An XT host never talks to the keyboard, but it does pulse a soft reset.
+  if (xtResetPulses > 0) return "XT";
+  return "unknown";   // silent: no host, or one that is switched off
+}
+
+static void publishResult() {
+  String msg = detectProtocolStatusJSON(jobId);
+  realtimeBroadcastScancode(msg);
+}
+
+static void finish() {
+  stopListening();
+  drainHostBytes();
+  result = decide();
+  state = DET_DONE;
+  xtat_hostecho_enabled = savedHostEcho;
+  Serial.printf("[DETECT] job %u: %s (xt_reset=%u rts=%u host_bytes=%u ps2_cmds=%u resends=%u)\n",
+                jobId, result, xtResetPulses, rtsSeen, hostBytes, ps2Commands, resends);
+  publishResult();
+}
+
+static void startJob() {
+  portENTER_CRITICAL(&startMux);
+  jobId++;
+  startWanted = false;
+  state = DET_PASSIVE;
+  portEXIT_CRITICAL(&startMux);
+  resetEvidence();
+  result = "unknown";
+  savedHostEcho = xtat_hostecho_enabled;
+  xtat_hostecho_enabled = true;
+  uint8_t tmp[16];
   while (xtatPopHostEcho(tmp, sizeof(tmp)) > 0) { }
+  phaseStart = millis();
+  startListening();
 }
 
-String detectProtocolSync(unsigned long timeoutMs) {
-  unsigned long start = millis();
-  clearHostEchoBuffer();
-  uint8_t testHID = 4;
-  uint8_t xt = config.keymap[testHID] ? config.keymap[testHID] : default_usb_to_xt[testHID];
-  if (xt == 0) xt = 0x1C;
-  xt_send_make(xt);
-  delay(20);
-  xt_send_break_code(xt);
-  unsigned long deadline = millis() + 300;
-  while (millis() < deadline) {
-    uint8_t buf[16];
-    size_t n = xtatPopHostEcho(buf, sizeof(buf));
-    if (n > 0) {
-      for (size_t i=0;i<n;i++) {
-        if (buf[i] == 0xFA) return "PS2";
+// The job that will report the result: the running one, or the next.
+uint32_t detectProtocolStart() {
+  portENTER_CRITICAL(&startMux);
+  if (state != DET_PASSIVE && state != DET_PROBE_BAT && state != DET_PROBE_ECHO) startWanted = true;
+  uint32_t job = startWanted ? jobId + 1 : jobId;
+  portEXIT_CRITICAL(&startMux);
+  return job;
+}
+
+void detectProtocolBegin() {
+  startJob();
+  Serial.printf("[DETECT] Background detection started (job %u)\n", jobId);
+}
+
+bool detectProtocolRunning() {
+  return startWanted || state == DET_PASSIVE || state == DET_PROBE_BAT || state == DET_PROBE_ECHO;
+}
+
+const char *detectProtocolResult() {
+  return result;
+}
+
+void detectProtocolTask() {
+  if (!detectProtocolRunning()) return;
+  if (timingCalibrationRunning()) return;
+  if (startWanted) startJob();
+  unsigned long now = millis();
+  switch (state) {
+    case DET_PASSIVE:
+      if (now - phaseStart >= PASSIVE_MS) {
+        stopListening();
+        drainHostBytes();
+        // a host that already spoke has told us enough; skip the probes
+        if (hostBytes > 0) { finish(); return; }
+        xtatSendProbe(0xAA);
+        state = DET_PROBE_BAT;
+        phaseStart = now;
       }
-      return "PS2";
-    }
-    delay(20);
+      break;
+    case DET_PROBE_BAT:
+      drainHostBytes();
+      if (now - phaseStart >= BAT_WINDOW_MS) {
+        if (hostBytes > 0) { finish(); return; }
+        xtatSendProbe(0xEE);
+        state = DET_PROBE_ECHO;
+        phaseStart = now;
+      }
+      break;
+    case DET_PROBE_ECHO:
+      drainHostBytes();
+      if (now - phaseStart >= ECHO_WINDOW_MS) finish();
+      break;
+    default:
+      break;
   }
-  xt_send_make(xt);
-  delay(20);
-  xt_send_break_code(xt);
-  deadline = millis() + 300;
-  while (millis() < deadline) {
-    uint8_t buf[16];
-    size_t n = xtatPopHostEcho(buf, sizeof(buf));
-    if (n > 0) return "PS2";
-    delay(20);
+}
+
+String detectProtocolStatusJSON(uint32_t job) {
+  static const char *names[] = { "idle", "passive", "probe_bat", "probe_echo", "done" };
+  StaticJsonDocument<384> doc;
+  doc["type"] = "detect";
+  doc["job"] = jobId;
+  if (startWanted && job == jobId + 1) {
+    doc["job"] = job;
+    doc["state"] = "pending";
+  } else if (job != jobId) {
+    doc["state"] = "expired";
+  } else {
+    doc["state"] = names[state];
+    doc["suggested"] = result;
+    JsonObject ev = doc.createNestedObject("evidence");
+    ev["xt_reset"] = xtResetPulses;
+    ev["rts"] = rtsSeen;
+    ev["host_bytes"] = hostBytes;
+    ev["ps2_cmds"] = ps2Commands;
+    ev["resends"] = resends;
+    ev["last_host_byte"] = lastHostByte;
   }
-  return "AT";
+  String out;
+  serializeJson(doc, out);
+  return out;
 }
 
 void detectProtocolAsync(AsyncWebServerRequest *req) {
-  String result = detectProtocolSync(2000);
-  String json = "{ "suggested":"" + result + "", "note":"heuristic detection; verify in UI" }";
-  req->send(200, "application/json", json);
+  uint32_t job = detectProtocolStart();
+  String json = "{\"job\":" + String(job) + ",\"status\":\"running\"}";
+  req->send(202, "application/json", json);
+}
+
+void detectProtocolInit(AsyncWebServer &server) {
+  server.on("/api/detect_protocol", HTTP_GET, detectProtocolAsync);
+  server.on("/api/detect_protocol", HTTP_POST, detectProtocolAsync);
+  server.on("/api/detect_status", HTTP_GET, [](AsyncWebServerRequest *req){
+    uint32_t job = jobId;
+    if (req->hasParam("job")) job = (uint32_t)req->getParam("job")->value().toInt();
+    req->send(200, "application/json", detectProtocolStatusJSON(job));
+  });
+  Serial.println("[DETECT] Endpoints registered");
 }
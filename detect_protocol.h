@@ -5,7 +5,25 @@
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 
-String detectProtocolSync(unsigned long timeoutMs=3000);
+// Background host protocol detection. Listens first with the lines
+// released, timestamping CLK edges from an interrupt (reset pulses,
+// request-to-send), then sends only harmless probes (0xAA BAT, 0xEE echo).
+// A host that never shows itself is reported as "unknown". Results are
+// reported per job ID and over the scancode WebSocket. While the port is
+// observed its host commands are still ACKed, so an AT BIOS reset at boot
+// is answered.
+//
+// detectProtocolStart may be called from any task: it only records the
+// request and returns the job ID; the next detectProtocolTask starts it.
+
+void detectProtocolBegin();
+uint32_t detectProtocolStart();
+void detectProtocolTask();
+bool detectProtocolRunning();
+const char *detectProtocolResult();
+String detectProtocolStatusJSON(uint32_t job);
+
+void detectProtocolInit(AsyncWebServer &server);
 void detectProtocolAsync(AsyncWebServerRequest *req);
 
 #endif
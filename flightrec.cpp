@@ -0,0 +1,361 @@
+#include "flightrec.h"
+#include "config.h"
+#include "xt_at_output.h"
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <rom/crc.h>
+
+#define FR_PARTITION_LABEL "flightrec"
+#define FR_PARTITION_SUBTYPE 0x40
+#define FR_MAGIC 0x31435246UL          // "FRC1"
+#define FR_SECTOR 4096
+#define FR_REC 8
+#define FR_HDR_SLOTS 2                  // 16-byte header
+#define FR_SLOTS (FR_SECTOR / FR_REC)
+#define FR_PAGE_RECS 32                 // 256-byte flash page
+#define FR_STAGE 128                    // RAM staging ring, records
+#define FR_FLUSH_MS 1000
+#define FR_POLL_MS 100
+#define FR_QUERY_MAX 256
+
+struct FrRecord {
+  uint8_t type;
+  uint8_t a;
+  uint16_t b;
+  uint32_t ms;
+};
+
+struct FrHeader {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t reserved;
+  uint32_t crc;
+};
+
+static const esp_partition_t *part = nullptr;
+static uint16_t sectorCount = 0;
+static uint16_t curSector = 0;
+static uint16_t curSlot = FR_HDR_SLOTS;
+static uint32_t curSeq = 0;
+static uint16_t bootNumber = 0;
+static bool recordKeys = false;        // opt-in: the log would hold everything typed
+
+static FrRecord stage[FR_STAGE];
+static uint16_t stHead = 0, stTail = 0;
+static portMUX_TYPE frMux = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool flushRequested = false;
+static volatile bool clearRequested = false;
+static uint32_t droppedRecords = 0;
+static uint32_t writtenRecords = 0;
+static uint32_t sectorErases = 0;
+static int32_t erasedSector = -1;       // erased ahead of use, see writerTask
+static int32_t clearAt = -1;            // next sector a clear erases
+
+static const char *TYPE_NAMES[FR_TYPE_COUNT] = {
+  "", "boot", "make", "break", "host_cmd", "resend", "queue_overflow", "host_reset", "mode"
+};
+
+void flightrecLog(FlightRecType type, uint8_t a, uint16_t b) {
+  if (!part) return;
+  if ((type == FR_MAKE || type == FR_BREAK) && !recordKeys) return;
+  uint32_t ms = millis();
+  portENTER_CRITICAL(&frMux);
+  uint16_t next = (stTail + 1) % FR_STAGE;
+  if (next == stHead) {
+    droppedRecords++;
+  } else {
+    stage[stTail] = { (uint8_t)type, a, b, ms };
+    stTail = next;
+  }
+  portEXIT_CRITICAL(&frMux);
+}
+
+void flightrecFlush() {
+  flushRequested = true;
+}
+
+bool flightrecKeysEnabled() { return recordKeys; }
+
+static uint16_t stagedCount() {
+  return (uint16_t)((stTail - stHead + FR_STAGE) % FR_STAGE);
+}
+
+static bool readHeader(uint16_t sector, FrHeader &h) {
+  if (esp_partition_read(part, (size_t)sector * FR_SECTOR, &h, sizeof(h)) != ESP_OK) return false;
+  return h.magic == FR_MAGIC && h.crc == crc32_le(0, (const uint8_t *)&h, 12);
+}
+
+static uint16_t nextSector() {
+  return (curSector + 1) % sectorCount;
+}
+
+static void eraseSector(uint16_t sector) {
+  esp_partition_erase_range(part, (size_t)sector * FR_SECTOR, FR_SECTOR);
+  sectorErases++;
+}
+
+// sector must be erased.
+static void startSector(uint16_t sector, uint32_t seq) {
+  FrHeader h = { FR_MAGIC, seq, 0xFFFFFFFFUL, 0 };
+  h.crc = crc32_le(0, (const uint8_t *)&h, 12);
+  esp_partition_write(part, (size_t)sector * FR_SECTOR, &h, sizeof(h));
+  curSector = sector;
+  curSeq = seq;
+  curSlot = FR_HDR_SLOTS;
+  if (erasedSector == sector) erasedSector = -1;
+}
+
+// Boot only; the writer task goes through the flash hold instead.
+static void openSector(uint16_t sector, uint32_t seq) {
+  eraseSector(sector);
+  startSector(sector, seq);
+}
+
+// Newest valid sector and its first erased slot; starts fresh if none.
+static void recover() {
+  uint32_t best = 0;
+  int bestSector = -1;
+  FrHeader h;
+  for (uint16_t s = 0; s < sectorCount; s++) {
+    if (readHeader(s, h) && h.seq >= best) { best = h.seq; bestSector = s; }
+  }
+  if (bestSector < 0) { openSector(0, 1); return; }
+  curSector = bestSector;
+  curSeq = best;
+  curSlot = FR_SLOTS;
+  uint8_t page[FR_PAGE_RECS * FR_REC];
+  for (uint16_t slot = FR_HDR_SLOTS; slot < FR_SLOTS; ) {
+    uint16_t n = min((uint16_t)(FR_SLOTS - slot), (uint16_t)FR_PAGE_RECS);
+    esp_partition_read(part, (size_t)curSector * FR_SECTOR + slot * FR_REC, page, n * FR_REC);
+    bool found = false;
+    for (uint16_t i = 0; i < n; i++) {
+      if (page[i * FR_REC] == 0xFF) { curSlot = slot + i; found = true; break; }
+    }
+    if (found) break;
+    slot += n;
+  }
+}
+
+// Flash hold taken. Stops at a full sector whose successor is not erased
+// yet; the next pass erases it.
+static void writeStaged() {
+  FrRecord buf[FR_PAGE_RECS];
+  for (;;) {
+    if (curSlot >= FR_SLOTS) {
+      if (erasedSector != nextSector()) return;
+      startSector(nextSector(), curSeq + 1);
+    }
+    uint16_t room = FR_SLOTS - curSlot;
+    uint16_t n = 0;
+    portENTER_CRITICAL(&frMux);
+    while (n < FR_PAGE_RECS && n < room && stHead != stTail) {
+      buf[n++] = stage[stHead];
+      stHead = (stHead + 1) % FR_STAGE;
+    }
+    portEXIT_CRITICAL(&frMux);
+    if (!n) return;
+    esp_partition_write(part, (size_t)curSector * FR_SECTOR + curSlot * FR_REC, buf, n * FR_REC);
+    curSlot += n;
+    writtenRecords += n;
+  }
+}
+
+// Every erase and write happens under xtatFlashHold(): flash operations
+// pause the loop core, and must not do so in the middle of a byte on the
+// wire. At most one sector is erased per hold. The sector after the
+// current one is erased once that is half full, so a full sector rarely
+// has to wait. Records stay staged while the output is busy.
+static void writerTask(void *) {
+  uint32_t lastFlush = millis();
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(clearAt >= 0 ? 1 : FR_POLL_MS));
+    if (clearRequested) {
+      clearRequested = false;
+      clearAt = 0;
+    }
+    if (clearAt >= 0) {
+      if (!xtatFlashHold()) continue;
+      eraseSector(clearAt);
+      if (++clearAt == sectorCount) {
+        clearAt = -1;
+        startSector(0, 1);
+        Serial.println("[FLIGHTREC] Cleared");
+      }
+      xtatFlashRelease();
+      continue;
+    }
+    uint16_t pending = stagedCount();
+    bool due = pending && (pending >= FR_PAGE_RECS || flushRequested || millis() - lastFlush >= FR_FLUSH_MS);
+    bool eraseAhead = erasedSector != nextSector() && (curSlot >= FR_SLOTS / 2);
+    if (!due && !eraseAhead) continue;
+    if (!xtatFlashHold()) continue;
+    if (eraseAhead) {
+      eraseSector(nextSector());
+      erasedSector = nextSector();
+    } else {
+      flushRequested = false;
+      writeStaged();
+      lastFlush = millis();
+    }
+    xtatFlashRelease();
+  }
+}
+
+void flightrecBegin() {
+  part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)FR_PARTITION_SUBTYPE, FR_PARTITION_LABEL);
+  if (!part) { Serial.println("[FLIGHTREC] No flightrec partition, recorder disabled"); return; }
+  sectorCount = part->size / FR_SECTOR;
+  recover();
+
+  Preferences prefs;
+  prefs.begin("flightrec", false);
+  bootNumber = prefs.getUShort("boot", 0) + 1;
+  prefs.putUShort("boot", bootNumber);
+  recordKeys = prefs.getBool("keys", false);
+  prefs.end();
+
+  flightrecLog(FR_BOOT, (uint8_t)esp_reset_reason(), bootNumber);
+  flightrecLog(FR_MODE, config.kb_mode);
+  xTaskCreatePinnedToCore(writerTask, "flightrec", 3072, NULL, 1, NULL, 0);
+  Serial.printf("[FLIGHTREC] %u sectors, seq=%u slot=%u boot=%u\n", sectorCount, curSeq, curSlot, bootNumber);
+}
+
+// Walks sectors oldest-first; cb returns false to stop.
+template <class F>
+static void forEachRecord(F cb) {
+  FrHeader h;
+  uint8_t page[FR_PAGE_RECS * FR_REC];
+  for (uint16_t k = 1; k <= sectorCount; k++) {
+    uint16_t s = (curSector + k) % sectorCount;
+    if (!readHeader(s, h)) continue;
+    for (uint16_t slot = FR_HDR_SLOTS; slot < FR_SLOTS; slot += FR_PAGE_RECS) {
+      uint16_t n = min((uint16_t)(FR_SLOTS - slot), (uint16_t)FR_PAGE_RECS);
+      esp_partition_read(part, (size_t)s * FR_SECTOR + slot * FR_REC, page, n * FR_REC);
+      for (uint16_t i = 0; i < n; i++) {
+        FrRecord r;
+        memcpy(&r, page + i * FR_REC, FR_REC);
+        if (r.type == 0xFF) break;
+        if (!cb(r)) return;
+      }
+    }
+  }
+}
+
+static int typeFromName(const String &s) {
+  for (int i = 1; i < FR_TYPE_COUNT; i++) if (s == TYPE_NAMES[i]) return i;
+  return -1;
+}
+
+void flightrecInit(AsyncWebServer &server) {
+  server.on("/api/flightrec", HTTP_GET, [](AsyncWebServerRequest *req){
+    StaticJsonDocument<384> doc;
+    doc["present"] = part != nullptr;
+    doc["sectors"] = sectorCount;
+    doc["sector"] = curSector;
+    doc["seq"] = curSeq;
+    doc["slot"] = curSlot;
+    doc["boot"] = bootNumber;
+    doc["uptime_ms"] = millis();
+    doc["staged"] = stagedCount();
+    doc["written"] = writtenRecords;
+    doc["dropped"] = droppedRecords;
+    doc["erases"] = sectorErases;
+    doc["record_keys"] = recordKeys;
+    String out; serializeJson(doc, out);
+    req->send(200, "application/json", out);
+  });
+
+  // The log can hold what was typed, so everything past the status above
+  // takes the OTA credentials.
+  // Filtered view: ?type=make,host_cmd&boot=N&since_ms=T&last=N (newest N matches)
+  server.on("/api/flightrec_events", HTTP_GET, [](AsyncWebServerRequest *req){
+    if (!req->authenticate(config.ota_user.c_str(), config.ota_pass.c_str())) { req->requestAuthentication(); return; }
+    if (!part) { req->send(404, "application/json", "{\"error\":\"no partition\"}"); return; }
+    uint32_t typeMask = 0xFFFFFFFFUL;
+    if (req->hasParam("type")) {
+      typeMask = 0;
+      String list = req->getParam("type")->value() + ",";
+      int start = 0, comma;
+      while ((comma = list.indexOf(',', start)) >= 0) {
+        int t = typeFromName(list.substring(start, comma));
+        if (t > 0) typeMask |= 1UL << t;
+        start = comma + 1;
+      }
+    }
+    int32_t wantBoot = req->hasParam("boot") ? req->getParam("boot")->value().toInt() : -1;
+    uint32_t sinceMs = req->hasParam("since_ms") ? req->getParam("since_ms")->value().toInt() : 0;
+    uint16_t last = req->hasParam("last") ? req->getParam("last")->value().toInt() : 100;
+    if (last == 0 || last > FR_QUERY_MAX) last = FR_QUERY_MAX;
+
+    struct Match { FrRecord r; uint16_t boot; };
+    Match *hits = (Match *)malloc(sizeof(Match) * last);
+    if (!hits) { req->send(503, "application/json", "{\"error\":\"no memory\"}"); return; }
+    uint32_t total = 0;
+    int32_t boot = -1;
+    flightrecFlush();
+    forEachRecord([&](const FrRecord &r) {
+      if (r.type == FR_BOOT) boot = r.b;
+      if (r.type >= FR_TYPE_COUNT || !(typeMask & (1UL << r.type))) return true;
+      if (wantBoot >= 0 && boot != wantBoot) return true;
+      if (r.ms < sinceMs) return true;
+      hits[total % last] = { r, (uint16_t)boot };
+      total++;
+      return true;
+    });
+
+    uint32_t n = total < last ? total : last;
+    String out = "{\"total\":" + String(total) + ",\"events\":[";
+    char line[96];
+    for (uint32_t i = 0; i < n; i++) {
+      const Match &m = hits[(total - n + i) % last];
+      snprintf(line, sizeof(line), "%s{\"boot\":%u,\"ms\":%lu,\"type\":\"%s\",\"a\":%u,\"b\":%u}",
+               i ? "," : "", m.boot, (unsigned long)m.r.ms, TYPE_NAMES[m.r.type], m.r.a, m.r.b);
+      out += line;
+    }
+    out += "]}";
+    free(hits);
+    req->send(200, "application/json", out);
+  });
+
+  // Raw partition dump, oldest sector first, for tools/flightrec_decode.py.
+  server.on("/api/flightrec.bin", HTTP_GET, [](AsyncWebServerRequest *req){
+    if (!req->authenticate(config.ota_user.c_str(), config.ota_pass.c_str())) { req->requestAuthentication(); return; }
+    if (!part) { req->send(404, "application/json", "{\"error\":\"no partition\"}"); return; }
+    flightrecFlush();
+    uint16_t first = (curSector + 1) % sectorCount;
+    size_t total = (size_t)sectorCount * FR_SECTOR;
+    AsyncWebServerResponse *resp = req->beginResponse("application/octet-stream", total,
+      [first, total](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+        if (index >= total) return 0;
+        size_t sector = (first + index / FR_SECTOR) % sectorCount;
+        size_t off = index % FR_SECTOR;
+        size_t n = min(maxLen, (size_t)FR_SECTOR - off);
+        esp_partition_read(part, sector * FR_SECTOR + off, buf, n);
+        return n;
+      });
+    resp->addHeader("Content-Disposition", "attachment; filename=\"flightrec.bin\"");
+    resp->addHeader("X-Boot", String(bootNumber));
+    resp->addHeader("X-Uptime-Ms", String(millis()));
+    req->send(resp);
+  });
+
+  server.on("/api/flightrec_config", HTTP_POST, [](AsyncWebServerRequest *req){
+  }, NULL, [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+    if (!req->authenticate(config.ota_user.c_str(), config.ota_pass.c_str())) { req->requestAuthentication(); return; }
+    StaticJsonDocument<128> doc;
+    if (deserializeJson(doc, data, len)) { req->send(400, "application/json", "{\"error\":\"bad json\"}"); return; }
+    if (doc.containsKey("record_keys")) {
+      recordKeys = doc["record_keys"];
+      Preferences prefs;
+      prefs.begin("flightrec", false);
+      prefs.putBool("keys", recordKeys);
+      prefs.end();
+    }
+    if (doc["clear"] | false) clearRequested = true;
+    req->send(200, "application/json", "{\"status\":\"ok\"}");
+  });
+
+  Serial.println("[FLIGHTREC] Endpoints registered");
+}
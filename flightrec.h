@@ -0,0 +1,41 @@
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Persistent flight recorder in the "flightrec" data partition (partitions.csv).
+//
+// The partition is a ring of 4 KB sectors. Each sector starts with a 16-byte
+// header [u32 magic "FRC1"][u32 seq][u32 reserved][u32 crc32 of first 12]
+// followed by 510 8-byte records [u8 type][u8 a][u16 b LE][u32 ms LE].
+// ms is millis() since the boot announced by the preceding FR_BOOT record;
+// erased slots read as type 0xFF. tools/flightrec_decode.py reads the dump.
+//
+// flightrecLog() only appends to a RAM staging ring; a background task
+// writes it out in page-sized batches, so the log survives reboot and OTA
+// without a flash write per key. The task erases and writes only under
+// xtatFlashHold(), between bytes on the keyboard port. Key records are off
+// until record_keys is set; the download endpoints take the OTA login.
+
+enum FlightRecType {
+  FR_BOOT = 1,          // a = esp_reset_reason(), b = boot number
+  FR_MAKE,              // a = scancode, b = HID usage
+  FR_BREAK,             // a = scancode, b = HID usage
+  FR_HOST_CMD,          // a = byte from host, b = pending command
+  FR_RESEND,            // a = byte sent again
+  FR_QUEUE_OVERFLOW,    // a = scancode sent synchronously
+  FR_HOST_RESET,        // host 0xFF
+  FR_MODE,              // a = new kb_mode
+  FR_TYPE_COUNT
+};
+
+void flightrecLog(FlightRecType type, uint8_t a = 0, uint16_t b = 0);
+void flightrecFlush();                 // queue pending records for writing now
+bool flightrecKeysEnabled();
+
+void flightrecBegin();                 // scan partition, log FR_BOOT, start writer
+void flightrecInit(AsyncWebServer &server);
+
+#endif
@@ -0,0 +1,241 @@
+#include "hid_parser.h"
+#include <string.h>
+
+#define HID_PAGE_KEYBOARD 0x07
+#define HID_MAX_REPORT_IDS 16
+
+// Short item tags (HID 1.11, 6.2.2)
+#define HID_TYPE_MAIN   0
+#define HID_TYPE_GLOBAL 1
+#define HID_TYPE_LOCAL  2
+
+#define HID_MAIN_INPUT          0x8
+#define HID_GLOBAL_USAGE_PAGE   0x0
+#define HID_GLOBAL_LOGICAL_MIN  0x1
+#define HID_GLOBAL_LOGICAL_MAX  0x2
+#define HID_GLOBAL_REPORT_SIZE  0x7
+#define HID_GLOBAL_REPORT_ID    0x8
+#define HID_GLOBAL_REPORT_COUNT 0x9
+#define HID_GLOBAL_PUSH         0xA
+#define HID_GLOBAL_POP          0xB
+#define HID_LOCAL_USAGE         0x0
+#define HID_LOCAL_USAGE_MIN     0x1
+#define HID_LOCAL_USAGE_MAX     0x2
+
+#define HID_INPUT_CONSTANT 0x01
+#define HID_INPUT_VARIABLE 0x02
+
+void hidStateClear(HidKeyState &s) {
+  memset(s.w, 0, sizeof(s.w));
+}
+
+bool hidStateTest(const HidKeyState &s, uint8_t usage) {
+  return (s.w[usage >> 5] >> (usage & 31)) & 1u;
+}
+
+void hidStateSet(HidKeyState &s, uint8_t usage) {
+  s.w[usage >> 5] |= 1u << (usage & 31);
+}
+
+void hidLayoutBoot(HidKeyboardLayout &out) {
+  memset(&out, 0, sizeof(out));
+  out.boot = true;
+  out.report_bits = 64;
+  out.bitmap_count = 1;
+  out.bitmap[0].bit_offset = 0;
+  out.bitmap[0].count = 8;
+  out.bitmap[0].usage_min = 0xE0;
+  out.has_array = true;
+  out.array.bit_offset = 16;
+  out.array.size = 8;
+  out.array.count = 6;
+  out.array.usage_min = 0;
+  out.array.usage_max = 0xFF;
+}
+
+struct HidGlobals {
+  uint16_t usage_page;
+  int32_t logical_min;
+  int32_t logical_max;
+  uint8_t report_size;
+  uint8_t report_id;
+  uint16_t report_count;
+};
+
+static uint16_t *offsetFor(uint8_t id, uint8_t *ids, uint16_t *offs, uint8_t &n) {
+  for (uint8_t i = 0; i < n; i++) if (ids[i] == id) return &offs[i];
+  if (n >= HID_MAX_REPORT_IDS) return nullptr;
+  ids[n] = id;
+  offs[n] = 0;
+  return &offs[n++];
+}
+
+bool hidParseReportDescriptor(const uint8_t *desc, size_t len, HidKeyboardLayout &out) {
+  memset(&out, 0, sizeof(out));
+  HidGlobals g = {0, 0, 0, 0, 0, 0};
+  HidGlobals stack[4];
+  uint8_t sp = 0;
+  uint32_t usage_min = 0, usage_max = 0, first_usage = 0, last_usage = 0;
+  bool have_min = false, have_max = false, have_usage = false;
+  uint8_t ids[HID_MAX_REPORT_IDS];
+  uint16_t offs[HID_MAX_REPORT_IDS];
+  uint8_t nids = 0;
+  bool locked = false;
+
+  size_t i = 0;
+  while (i < len) {
+    uint8_t prefix = desc[i++];
+    if (prefix == 0xFE) {                   // long item: skip
+      if (i + 2 > len) return false;
+      i += 2 + desc[i];
+      continue;
+    }
+    uint8_t size = prefix & 0x03;
+    if (size == 3) size = 4;
+    uint8_t type = (prefix >> 2) & 0x03;
+    uint8_t tag  = (prefix >> 4) & 0x0F;
+    if (i + size > len) return false;
+    uint32_t uval = 0;
+    for (uint8_t b = 0; b < size; b++) uval |= (uint32_t)desc[i + b] << (8 * b);
+    int32_t sval = (int32_t)uval;
+    if (size == 1) sval = (int8_t)uval;
+    else if (size == 2) sval = (int16_t)uval;
+    i += size;
+
+    if (type == HID_TYPE_GLOBAL) {
+      switch (tag) {
+        case HID_GLOBAL_USAGE_PAGE:   g.usage_page = (uint16_t)uval; break;
+        case HID_GLOBAL_LOGICAL_MIN:  g.logical_min = sval; break;
+        case HID_GLOBAL_LOGICAL_MAX:  g.logical_max = sval; break;
+        case HID_GLOBAL_REPORT_SIZE:  g.report_size = (uint8_t)uval; break;
+        case HID_GLOBAL_REPORT_ID:    g.report_id = (uint8_t)uval; break;
+        case HID_GLOBAL_REPORT_COUNT: g.report_count = (uint16_t)uval; break;
+        case HID_GLOBAL_PUSH:         if (sp < 4) stack[sp++] = g; break;
+        case HID_GLOBAL_POP:          if (sp > 0) g = stack[--sp]; break;
+        default: break;
+      }
+    } else if (type == HID_TYPE_LOCAL) {
+      // 4-byte usages carry their own page in the upper 16 bits
+      if (size == 4 && (tag == HID_LOCAL_USAGE || tag == HID_LOCAL_USAGE_MIN || tag == HID_LOCAL_USAGE_MAX)) {
+        if ((uval >> 16) != HID_PAGE_KEYBOARD) continue;
+        uval &= 0xFFFF;
+      }
+      switch (tag) {
+        case HID_LOCAL_USAGE:
+          if (!have_usage) { first_usage = uval; have_usage = true; }
+          last_usage = uval;
+          break;
+        case HID_LOCAL_USAGE_MIN: usage_min = uval; have_min = true; break;
+        case HID_LOCAL_USAGE_MAX: usage_max = uval; have_max = true; break;
+        default: break;
+      }
+    } else if (type == HID_TYPE_MAIN) {
+      if (tag == HID_MAIN_INPUT) {
+        uint16_t *off = offsetFor(g.report_id, ids, offs, nids);
+        if (!off) return false;
+        uint16_t bits = (uint16_t)(g.report_size * g.report_count);
+        bool keyboard = g.usage_page == HID_PAGE_KEYBOARD && !(uval & HID_INPUT_CONSTANT);
+        if (keyboard && (!locked || g.report_id == out.report_id)) {
+          uint32_t umin = have_min ? usage_min : first_usage;
+          // Without Usage Maximum: the last listed usage, else the logical
+          // range for arrays, else one usage per reported field.
+          uint32_t umax = usage_max;
+          if (!have_max) {
+            if (!have_min && have_usage) umax = last_usage;
+            else if (g.logical_max > g.logical_min) umax = umin + (uint32_t)(g.logical_max - g.logical_min);
+            else umax = umin + (g.report_count ? g.report_count - 1 : 0);
+          }
+          if (!locked) { locked = true; out.report_id = g.report_id; }
+          if ((uval & HID_INPUT_VARIABLE) && g.report_size == 1) {
+            if (out.bitmap_count < HID_MAX_BITMAP_FIELDS && umin <= 0xFF) {
+              HidBitmapField &f = out.bitmap[out.bitmap_count++];
+              f.bit_offset = *off;
+              f.count = g.report_count;
+              f.usage_min = (uint8_t)umin;
+            }
+          } else if (!(uval & HID_INPUT_VARIABLE) && !out.has_array && g.report_size <= 16) {
+            out.has_array = true;
+            out.array.bit_offset = *off;
+            out.array.size = g.report_size;
+            out.array.count = (uint8_t)g.report_count;
+            out.array.usage_min = (uint8_t)(umin - g.logical_min);
+            out.array.usage_max = (uint8_t)(umax > 0xFF ? 0xFF : umax);
+          }
+        }
+        *off += bits;
+      }
+      // locals are scoped to a single main item
+      usage_min = usage_max = first_usage = last_usage = 0;
+      have_min = have_max = have_usage = false;
+    }
+  }
+  if (!locked) return false;
+  uint16_t *off = offsetFor(out.report_id, ids, offs, nids);
+  out.report_bits = off ? *off : 0;
+  return out.bitmap_count > 0 || out.has_array;
+}
+
+static uint32_t getBits(const uint8_t *p, size_t len, uint16_t bit, uint8_t size) {
+  uint32_t v = 0;
+  for (uint8_t b = 0; b < size; b++) {
+    uint16_t pos = bit + b;
+    if ((size_t)(pos >> 3) >= len) break;
+    v |= (uint32_t)((p[pos >> 3] >> (pos & 7)) & 1u) << b;
+  }
+  return v;
+}
+
+bool hidDecodeReport(const HidKeyboardLayout &layout, const uint8_t *data, size_t len, HidKeyState &out) {
+  if (layout.report_id) {
+    if (len < 1 || data[0] != layout.report_id) return false;
+    data++; len--;
+  }
+  if (len * 8 < layout.report_bits) return false;
+  hidStateClear(out);
+
+  for (uint8_t f = 0; f < layout.bitmap_count; f++) {
+    const HidBitmapField &bf = layout.bitmap[f];
+    for (uint16_t k = 0; k < bf.count; k++) {
+      uint32_t usage = (uint32_t)bf.usage_min + k;
+      if (usage > 0xFF) break;
+      if (getBits(data, len, bf.bit_offset + k, 1)) hidStateSet(out, (uint8_t)usage);
+    }
+  }
+
+  if (layout.has_array) {
+    const HidArrayField &af = layout.array;
+    for (uint8_t k = 0; k < af.count; k++) {
+      uint32_t v = getBits(data, len, af.bit_offset + k * af.size, af.size);
+      uint32_t usage = af.usage_min + v;
+      if (usage == 0) continue;
+      if (usage == HID_USAGE_ERR_ROLLOVER) return false;
+      if (usage > af.usage_max || usage > 0xFF) continue;
+      hidStateSet(out, (uint8_t)usage);
+    }
+  }
+  return true;
+}
+
+static int emitBits(uint32_t x, int word, bool pressed, hid_key_event_cb_t cb, void *ctx) {
+  int n = 0;
+  while (x) {
+    int b = __builtin_ctz(x);
+    cb((uint8_t)(word * 32 + b), pressed, ctx);
+    x &= x - 1;
+    n++;
+  }
+  return n;
+}
+
+int hidDiffState(const HidKeyState &prev, const HidKeyState &cur, hid_key_event_cb_t cb, void *ctx) {
+  int n = 0;
+  for (int w = 0; w < HID_STATE_WORDS; w++) {
+    n += emitBits(prev.w[w] & ~cur.w[w], w, false, cb, ctx);
+  }
+  // word 7 holds the modifiers (0xE0-0xE7); press them before anything else
+  n += emitBits(cur.w[HID_STATE_WORDS - 1] & ~prev.w[HID_STATE_WORDS - 1], HID_STATE_WORDS - 1, true, cb, ctx);
+  for (int w = 0; w < HID_STATE_WORDS - 1; w++) {
+    n += emitBits(cur.w[w] & ~prev.w[w], w, true, cb, ctx);
+  }
+  return n;
+}
@@ -0,0 +1,70 @@
+#ifndef HID_PARSER_H
+#define HID_PARSER_H
+
+// HID keyboard report parsing and key-state diffing.
+// Pure C/C++ (no Arduino dependency) so it can be fed captured descriptor and
+// report dumps on a host machine as well as live reports on the device.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HID_STATE_WORDS 8          // 8 x 32 bit = 256 usages (keyboard page 0x07)
+#define HID_MAX_BITMAP_FIELDS 4
+#define HID_USAGE_ERR_ROLLOVER 0x01
+
+struct HidKeyState {
+  uint32_t w[HID_STATE_WORDS];
+};
+
+// A run of 1-bit variable fields: usage (usage_min + i) is bit (bit_offset + i).
+struct HidBitmapField {
+  uint16_t bit_offset;
+  uint16_t count;
+  uint8_t usage_min;
+};
+
+// An array field: count slots of size bits each, every slot holds a usage.
+struct HidArrayField {
+  uint16_t bit_offset;
+  uint8_t size;
+  uint8_t count;
+  uint8_t usage_min;
+  uint8_t usage_max;
+};
+
+struct HidKeyboardLayout {
+  bool boot;                 // fixed 8-byte boot protocol layout
+  uint8_t report_id;         // 0 = reports carry no ID byte
+  uint16_t report_bits;      // payload length excluding the ID byte
+  uint8_t bitmap_count;
+  HidBitmapField bitmap[HID_MAX_BITMAP_FIELDS];
+  bool has_array;
+  HidArrayField array;
+};
+
+typedef void (*hid_key_event_cb_t)(uint8_t usage, bool pressed, void *ctx);
+
+void hidStateClear(HidKeyState &s);
+bool hidStateTest(const HidKeyState &s, uint8_t usage);
+void hidStateSet(HidKeyState &s, uint8_t usage);
+
+// Layout for the 8-byte boot report: modifiers, reserved, 6 keycodes.
+void hidLayoutBoot(HidKeyboardLayout &out);
+
+// Walks a report descriptor and extracts the first keyboard-page input report.
+// Returns false if the descriptor has no usable keyboard input fields.
+bool hidParseReportDescriptor(const uint8_t *desc, size_t len, HidKeyboardLayout &out);
+
+// Decodes one input report into a full key state.
+// Returns false if the report does not belong to this layout or is a phantom
+// (ErrorRollOver) report; the caller should then keep the previous state.
+bool hidDecodeReport(const HidKeyboardLayout &layout, const uint8_t *data, size_t len, HidKeyState &out);
+
+// Emits the differences between prev and cur as key events.
+// Order is deterministic: releases ascending by usage, then presses with
+// modifiers (0xE0-0xE7) first and the rest ascending, so a chord like
+// Shift+A always reaches the host as Shift down, A down.
+// Returns the number of events emitted.
+int hidDiffState(const HidKeyState &prev, const HidKeyState &cur, hid_key_event_cb_t cb, void *ctx);
+
+#endif
@@ -1,7 +1,7 @@
 #ifndef KEYMAP_H
 #define KEYMAP_H
 
-#include <Arduino.h>
+#include <stdint.h>   // shared with tools/keymapc
 
 extern const uint8_t default_usb_to_xt[256];
 
@@ -1,62 +1,154 @@
 #include "keymap_ex.h"
 #include "config.h"
 #include "keymap.h"
-#include <LittleFS.h>
+#include "profiler.h"
+#include "realtime_ws.h"
+#include "storage.h"
+#include "mem_stats.h"
+#include "keymap_image.h"
+#include "web_state.h"
 #include <ArduinoJson.h>
+#include <atomic>
 
 KeymapEntry keymapEx[256];
-static const char *KEX_PATH = "/keymap_ex.json";
+static const char *KEX_PATH = "/keymap_ex.bin";
+static const char *KEX_JSON_PATH = "/keymap_ex.json";   // older firmware, converted once
 
-static void loadFromLegacy() {
-    for (int i = 0; i < 256; i++) {
-        uint8_t base = config.keymap[i];
-        keymapEx[i] = { base, base, base, base, 0 };
-    }
+// Character reverse lookup from the last compiled image (tools/keymapc).
+// Edits made on the device keep it; replacing the whole map drops it.
+static uint8_t reverseTab[KMI_MAX_REVERSE * KMI_REVERSE_SIZE];
+static uint16_t reverseCount = 0;
+static char imageName[KMI_NAME_LEN + 1] = "";
+
+// Staged edits (keymapExStage) are written once editing pauses, or at the
+// latest KEX_SAVE_MAX_MS after the first unsaved one.
+#define KEX_SAVE_IDLE_MS 1500
+#define KEX_SAVE_MAX_MS  10000
+static std::atomic<bool> saveDue(false);
+static unsigned long stagedFirstMs = 0, stagedLastMs = 0;
+
+// Bumped on every change to the compiled table; the editor channel uses it
+// for optimistic concurrency.
+static std::atomic<uint32_t> generation(1);
+
+static void changed() {
+    generation.fetch_add(1, std::memory_order_relaxed);
+    stateChanged(STATE_KEYMAP);
 }
 
-bool keymapExSaveFS() {
-    if (!LittleFS.begin(true)) return false;
-    File f = LittleFS.open(KEX_PATH, FILE_WRITE);
-    if (!f) return false;
-    StaticJsonDocument<8192> doc;
-    JsonArray arr = doc.to<JsonArray>();
+// Bit i set = keymapEx[i] is a user override; every other entry is the
+// legacy mapping and is never stored or sent. keymapEx[] itself is the
+// compiled table that translation reads.
+static uint32_t overridden[8];
+
+// Single-entry writes (storeEntry, so keymapExStage on the AsyncTCP task)
+// and keymapExPack (so keymapExSaveFS on the loop) hold this, so a save
+// never packs an entry whose override bit and value disagree.
+static portMUX_TYPE kexMux = portMUX_INITIALIZER_UNLOCKED;
+
+static inline bool isOverridden(int i) { return (overridden[i >> 5] >> (i & 31)) & 1u; }
+static inline void setOverridden(int i, bool on) {
+    if (on) overridden[i >> 5] |= 1u << (i & 31);
+    else overridden[i >> 5] &= ~(1u << (i & 31));
+}
+
+KeymapEntry keymapExDefault(uint8_t hid) {
+    uint8_t base = config.keymap[hid] ? config.keymap[hid] : default_usb_to_xt[hid];
+    return { base, base, base, base, 0 };
+}
+
+static inline bool sameEntry(const KeymapEntry &a, const KeymapEntry &b) {
+    return a.base == b.base && a.shift == b.shift && a.altgr == b.altgr && a.ctrl == b.ctrl && a.dead == b.dead;
+}
+
+static inline bool zeroEntry(const KeymapEntry &e) {
+    return !e.base && !e.shift && !e.altgr && !e.ctrl && !e.dead;
+}
+
+// An all-zero entry translates to nothing and falls back to the legacy map,
+// so it is the same as no override.
+static void storeEntry(int i, const KeymapEntry &e) {
+    KeymapEntry d = keymapExDefault(i);
+    bool custom = !zeroEntry(e) && !sameEntry(e, d);
+    const KeymapEntry &next = custom ? e : d;
+    if (custom == isOverridden(i) && sameEntry(keymapEx[i], next)) return;
+    portENTER_CRITICAL(&kexMux);
+    setOverridden(i, custom);
+    keymapEx[i] = next;
+    portEXIT_CRITICAL(&kexMux);
+    changed();
+}
+
+void keymapExCompile() {
     for (int i = 0; i < 256; i++) {
-        JsonObject o = arr.createNestedObject();
-        o["base"]  = keymapEx[i].base;
-        o["shift"] = keymapEx[i].shift;
-        o["altgr"] = keymapEx[i].altgr;
-        o["ctrl"]  = keymapEx[i].ctrl;
-        o["dead"]  = keymapEx[i].dead;
+        if (!isOverridden(i)) keymapEx[i] = keymapExDefault(i);
     }
-    serializeJson(doc, f);
-    f.close();
-    return true;
+    changed();
 }
 
-bool keymapExLoadFS() {
-    if (!LittleFS.begin(true)) return false;
-    if (!LittleFS.exists(KEX_PATH)) return false;
-    File f = LittleFS.open(KEX_PATH, FILE_READ);
-    if (!f) return false;
-    StaticJsonDocument<8192> doc;
-    DeserializationError err = deserializeJson(doc, f);
-    f.close();
-    if (err) return false;
-    JsonArray arr = doc.as<JsonArray>();
-    if (arr.size() != 256) return false;
-    for (int i = 0; i < 256; i++) {
-        JsonObject o = arr[i];
-        keymapEx[i].base  = o["base"]  | 0;
-        keymapEx[i].shift = o["shift"] | 0;
-        keymapEx[i].altgr = o["altgr"] | 0;
-        keymapEx[i].ctrl  = o["ctrl"]  | 0;
-        keymapEx[i].dead  = o["dead"]  | 0;
+uint32_t keymapExGeneration() { return generation.load(std::memory_order_relaxed); }
+
+int keymapExOverrideCount() {
+    int n = 0;
+    for (int w = 0; w < 8; w++) n += __builtin_popcount(overridden[w]);
+    return n;
+}
+
+// Only fields that differ from the default are written.
+static void entryToSparse(JsonObject o, int i) {
+    const KeymapEntry &e = keymapEx[i];
+    KeymapEntry d = keymapExDefault(i);
+    if (e.base  != d.base)  o["base"]  = e.base;
+    if (e.shift != d.shift) o["shift"] = e.shift;
+    if (e.altgr != d.altgr) o["altgr"] = e.altgr;
+    if (e.ctrl  != d.ctrl)  o["ctrl"]  = e.ctrl;
+    if (e.dead  != d.dead)  o["dead"]  = e.dead;
+}
+
+KeymapEntry keymapExFromSparse(JsonObjectConst o, uint8_t i) {
+    KeymapEntry e = keymapExDefault(i);
+    e.base  = o["base"]  | e.base;
+    e.shift = o["shift"] | e.shift;
+    e.altgr = o["altgr"] | e.altgr;
+    e.ctrl  = o["ctrl"]  | e.ctrl;
+    e.dead  = o["dead"]  | e.dead;
+    return e;
+}
+
+size_t keymapExSparseDocSize(int entries) {
+    return JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(entries) + entries * (JSON_OBJECT_SIZE(5) + 8) + 64;
+}
+
+void keymapExSparseInto(JsonObject map, const uint8_t *hids, int n) {
+    if (!hids) {
+        for (int i = 0; i < 256; i++) {
+            if (isOverridden(i)) entryToSparse(map.createNestedObject(String(i)), i);
+        }
+        return;
     }
-    return true;
+    for (int k = 0; k < n; k++) {
+        int i = hids[k];
+        if (isOverridden(i)) entryToSparse(map.createNestedObject(String(i)), i);
+        else map[String(i)] = nullptr;
+    }
+}
+
+// {"format":"sparse","count":N,"map":{"<hid>":{"shift":18,...},...}}
+String keymapExSparseJSON() {
+    int n = keymapExOverrideCount();
+    MemJsonDocument<MEM_KEYMAP> doc(keymapExSparseDocSize(n));
+    doc["format"] = "sparse";
+    doc["count"] = n;
+    if (imageName[0]) doc["layout"] = (const char *)imageName;
+    keymapExSparseInto(doc.createNestedObject("map"), nullptr, 0);
+    String out;
+    serializeJson(doc, out);
+    return out;
 }
 
+// The old 256-element array, for tools that still expect it.
 String keymapExJSON() {
-    StaticJsonDocument<8192> doc;
+    MemJsonDocument<MEM_KEYMAP> doc(JSON_ARRAY_SIZE(256) + 256 * JSON_OBJECT_SIZE(5));
     JsonArray arr = doc.to<JsonArray>();
     for (int i = 0; i < 256; i++) {
         JsonObject o = arr.createNestedObject();
@@ -71,20 +163,196 @@ String keymapExJSON() {
     return out;
 }
 
+// Sends the listed entries to WebSocket event subscribers. Entries that
+// went back to default are sent as null.
+static void broadcastDelta(const uint8_t *hids, int n, bool reset) {
+    MemJsonDocument<MEM_KEYMAP> doc(keymapExSparseDocSize(n) + JSON_OBJECT_SIZE(2));
+    doc["type"] = "keymap_ex";
+    if (reset) doc["reset"] = true;
+    JsonObject map = doc.createNestedObject("map");
+    if (hids) keymapExSparseInto(map, hids, n);
+    String out;
+    serializeJson(doc, out);
+    realtimeBroadcastScancode(out);
+}
+
+static void clearLayout() {
+    reverseCount = 0;
+    imageName[0] = 0;
+}
+
+// Accepts the sparse object or the legacy 256-element array and replaces
+// the whole map with it.
+bool keymapExApplyJSON(JsonVariantConst v) {
+    if (v.is<JsonArrayConst>()) {
+        JsonArrayConst arr = v.as<JsonArrayConst>();
+        if (arr.size() != 256) return false;
+        clearLayout();
+        for (int i = 0; i < 256; i++) {
+            JsonObjectConst o = arr[i];
+            KeymapEntry e;
+            e.base  = o["base"]  | 0;
+            e.shift = o["shift"] | e.base;
+            e.altgr = o["altgr"] | e.base;
+            e.ctrl  = o["ctrl"]  | e.base;
+            e.dead  = o["dead"]  | 0;
+            storeEntry(i, e);
+        }
+        return true;
+    }
+    JsonObjectConst map = v["map"];
+    if (map.isNull()) return false;
+    clearLayout();
+    memset(overridden, 0, sizeof(overridden));
+    keymapExCompile();
+    for (JsonPairConst kv : map) {
+        int i = atoi(kv.key().c_str());
+        if (i < 0 || i > 255 || !kv.value().is<JsonObjectConst>()) continue;
+        storeEntry(i, keymapExFromSparse(kv.value().as<JsonObjectConst>(), i));
+    }
+    return true;
+}
+
+bool keymapExSaveFS() {
+    if (!storageMounted()) return false;
+    StorageScratch s;
+    if (!s.data()) return false;
+    // Cleared before packing: an edit staged meanwhile sets it again.
+    saveDue = false;
+    uint8_t *buf = (uint8_t *)s.data();
+    int n = keymapExPack(buf + KMI_HDR, 256);   // already where the image wants them
+    size_t len = keymapImageBuild(buf, s.size(), imageName, buf + KMI_HDR, n, reverseTab, reverseCount);
+    return len && storageWriteAtomic(KEX_PATH, (const uint8_t *)s.data(), len);
+}
+
+static void applyRecords(const uint8_t *records, int n) {
+    memset(overridden, 0, sizeof(overridden));
+    keymapExCompile();
+    for (int k = 0; k < n; k++) {
+        const uint8_t *r = records + k * KMI_ENTRY_SIZE;
+        storeEntry(r[0], { r[1], r[2], r[3], r[4], r[5] });
+    }
+}
+
+// The image is used straight from the buffer it was read into: no parsing,
+// no document.
+static const char *useImage(const uint8_t *buf, size_t len) {
+    KeymapImageView v;
+    const char *err = keymapImageCheck(buf, len, v);
+    if (err) return err;
+    applyRecords(v.entries, v.entryCount);
+    memcpy(reverseTab, v.reverse, (size_t)v.reverseCount * KMI_REVERSE_SIZE);
+    reverseCount = v.reverseCount;
+    memcpy(imageName, v.name, sizeof(imageName));
+    return nullptr;
+}
+
+static bool loadImage() {
+    StorageScratch s;
+    size_t len = 0;
+    if (!s.data() || !storageRead(KEX_PATH, (uint8_t *)s.data(), s.size(), len)) return false;
+    const char *err = useImage((const uint8_t *)s.data(), len);
+    if (err) Serial.printf("[KEYMAP-EX] %s: %s\n", KEX_PATH, err);
+    return !err;
+}
+
+static bool loadLegacyJSON() {
+    // Old files hold the full array; size for that, the sparse form is smaller.
+    MemJsonDocument<MEM_KEYMAP> doc(JSON_ARRAY_SIZE(256) + 256 * JSON_OBJECT_SIZE(5));
+    DeserializationError err;
+    {
+        StorageTimer t(ST_READ);
+        File f = storageOpen(KEX_JSON_PATH, FILE_READ);
+        if (!f) return false;
+        size_t size = f.size();
+        err = deserializeJson(doc, f);
+        f.close();
+        t.done(size, !err);
+    }
+    return !err && keymapExApplyJSON(doc.as<JsonVariantConst>());
+}
+
+bool keymapExLoadFS() {
+    if (storageExists(KEX_PATH) && loadImage()) return true;
+    if (!storageExists(KEX_JSON_PATH) || !loadLegacyJSON()) return false;
+    Serial.println("[KEYMAP-EX] Converted stored JSON keymap to a binary image");
+    if (keymapExSaveFS()) storageRemove(KEX_JSON_PATH);
+    return true;
+}
+
+const char *keymapExApplyImage(const uint8_t *buf, size_t len) {
+    const char *err = useImage(buf, len);
+    if (err) return err;
+    keymapExSaveFS();
+    broadcastDelta(nullptr, 0, true);
+    return nullptr;
+}
+
+bool keymapExCharToHID(uint16_t cp, uint8_t &hid, uint8_t &mods) {
+    return keymapImageLookup(reverseTab, reverseCount, cp, hid, mods);
+}
+
+const char *keymapExLayoutName() { return imageName; }
+int keymapExReverseCount() { return reverseCount; }
+
 bool keymapExSet(uint8_t usb, KeymapEntry e) {
-    if (usb > 255) return false;
-    keymapEx[usb] = e;
+    storeEntry(usb, e);
     keymapExSaveFS();
+    broadcastDelta(&usb, 1, false);
     return true;
 }
 
+void keymapExStage(uint8_t usb, const KeymapEntry *e) {
+    storeEntry(usb, e ? *e : keymapExDefault(usb));
+    unsigned long now = millis();
+    if (!saveDue) stagedFirstMs = now;
+    stagedLastMs = now;
+    saveDue = true;
+}
+
+void keymapExTask() {
+    if (!saveDue) return;
+    unsigned long now = millis();
+    if (now - stagedLastMs < KEX_SAVE_IDLE_MS && now - stagedFirstMs < KEX_SAVE_MAX_MS) return;
+    saveDue = false;   // not retried every pass if storage is gone
+    if (keymapExSaveFS()) Serial.printf("[KEYMAP-EX] Saved staged edits (%d overrides)\n", keymapExOverrideCount());
+    else Serial.println("[KEYMAP-EX] Saving staged edits failed");
+}
+
 void keymapExResetDefault() {
-    loadFromLegacy();
+    clearLayout();
+    memset(overridden, 0, sizeof(overridden));
+    keymapExCompile();
+    keymapExSaveFS();
+    broadcastDelta(nullptr, 0, true);
+}
+
+int keymapExPack(uint8_t *out, int maxRecords) {
+    int n = 0;
+    portENTER_CRITICAL(&kexMux);
+    for (int i = 0; i < 256 && n < maxRecords; i++) {
+        if (!isOverridden(i)) continue;
+        const KeymapEntry &e = keymapEx[i];
+        uint8_t *r = out + n++ * 6;
+        r[0] = i; r[1] = e.base; r[2] = e.shift; r[3] = e.altgr; r[4] = e.ctrl; r[5] = e.dead;
+    }
+    portEXIT_CRITICAL(&kexMux);
+    return n;
+}
+
+void keymapExReplace(const uint8_t *records, int n) {
+    clearLayout();
+    applyRecords(records, n);
     keymapExSaveFS();
+    broadcastDelta(nullptr, 0, true);
+}
+
+uint8_t keymapExTranslate(uint8_t hid, uint8_t mods) {
+    uint8_t code = mapHIDToXT_Advanced(hid, mods & HID_MOD_SHIFT, mods & HID_MOD_ALTGR, mods & HID_MOD_CTRL);
+    return code ? code : keymapExDefault(hid).base;
 }
 
 uint8_t mapHIDToXT_Advanced(uint8_t hid, bool shift, bool altgr, bool ctrl) {
-    if (hid > 255) return 0;
     KeymapEntry &e = keymapEx[hid];
     if (e.dead) {
         return e.base;
@@ -95,13 +363,21 @@ uint8_t mapHIDToXT_Advanced(uint8_t hid, bool shift, bool altgr, bool ctrl) {
     return e.base;
 }
 
+static bool imageLoaded = false;
+
+void keymapExBegin() {
+    keymapExCompile();
+    imageLoaded = storageExists(KEX_PATH) && loadImage();
+}
+
 void keymapExInit(AsyncWebServer *server) {
-    if (!keymapExLoadFS()) {
-        Serial.println("[KEYMAP-EX] No extended keymap found, loading legacy base map...");
-        loadFromLegacy();
+    // keymapInit may have filled the legacy map since keymapExBegin.
+    keymapExCompile();
+    if (!imageLoaded && !keymapExLoadFS()) {
+        Serial.println("[KEYMAP-EX] No extended keymap found, using legacy base map...");
         keymapExSaveFS();
     } else {
-        Serial.println("[KEYMAP-EX] Loaded extended keymap.");
+        Serial.printf("[KEYMAP-EX] Loaded extended keymap (%d overrides).\n", keymapExOverrideCount());
     }
     if (server) registerKeymapExEndpoints(server);
 }
@@ -109,7 +385,15 @@ void keymapExInit(AsyncWebServer *server) {
 void registerKeymapExEndpoints(AsyncWebServer *server) {
     if (!server) return;
     server->on("/api/map_ex", HTTP_GET, [](AsyncWebServerRequest *req) {
-        req->send(200, "application/json", keymapExJSON());
+        PROF_STAGE("http:/api/map_ex");
+        bool full = req->hasParam("full") && req->getParam("full")->value() == "1";
+        req->send(200, "application/json", full ? keymapExJSON() : keymapExSparseJSON());
+    });
+    // Base table the sparse map is relative to: 256 base codes as hex.
+    server->on("/api/map_ex_base", HTTP_GET, [](AsyncWebServerRequest *req) {
+        char hex[513];
+        for (int i = 0; i < 256; i++) snprintf(hex + i * 2, 3, "%02X", keymapExDefault(i).base);
+        req->send(200, "application/json", String("{\"base\":\"") + hex + "\"}");
     });
     server->on("/api/map_ex_reset", HTTP_POST, [](AsyncWebServerRequest *req) {
         keymapExResetDefault();
@@ -133,24 +417,41 @@ void registerKeymapExEndpoints(AsyncWebServer *server) {
     });
     server->on("/api/map_ex_upload", HTTP_POST, [](AsyncWebServerRequest *req){ req->send(200,"application/json","{"status":"ok"}"); }, NULL,
         [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
-            StaticJsonDocument<8192> doc;
+            PROF_STAGE("http:/api/map_ex_upload");
+            MemJsonDocument<MEM_KEYMAP> doc(JSON_ARRAY_SIZE(256) + 256 * JSON_OBJECT_SIZE(5));
             auto err = deserializeJson(doc, data, len);
-            if (err || !doc.is<JsonArray>() || doc.size() != 256) { req->send(400,"application/json","{"error":"invalid array"}"); return; }
-            JsonArray arr = doc.as<JsonArray>();
-            for (int i = 0; i < 256; i++) {
-                JsonObject o = arr[i];
-                keymapEx[i].base  = o["base"]  | 0;
-                keymapEx[i].shift = o["shift"] | keymapEx[i].base;
-                keymapEx[i].altgr = o["altgr"] | keymapEx[i].base;
-                keymapEx[i].ctrl  = o["ctrl"]  | keymapEx[i].base;
-                keymapEx[i].dead  = o["dead"]  | 0;
-            }
+            if (err || !keymapExApplyJSON(doc.as<JsonVariantConst>())) { req->send(400,"application/json","{\"error\":\"expected sparse map or 256-element array\"}"); return; }
             keymapExSaveFS();
-            req->send(200,"application/json","{"status":"saved"}");
+            broadcastDelta(nullptr, 0, true);
+            req->send(200,"application/json","{\"status\":\"saved\"}");
     });
     server->on("/api/map_ex_download", HTTP_GET, [](AsyncWebServerRequest *req){
-        if (!LittleFS.begin(true) || !LittleFS.exists(KEX_PATH)) { req->send(404,"application/json","{"error":"no file"}"); return; }
-        req->send(LittleFS, KEX_PATH, "application/json");
+        AsyncWebServerResponse *resp = req->beginResponse(200, "application/json", keymapExSparseJSON());
+        resp->addHeader("Content-Disposition", "attachment; filename=\"keymap_ex.json\"");
+        req->send(resp);
+    });
+    // Compiled image from tools/keymapc, applied without parsing.
+    server->on("/api/map_ex_image", HTTP_GET, [](AsyncWebServerRequest *req){
+        if (!storageExists(KEX_PATH)) { req->send(404,"application/json","{\"error\":\"no image\"}"); return; }
+        req->send(storageFS(), KEX_PATH, "application/octet-stream", true);
+    });
+    server->on("/api/map_ex_image", HTTP_POST, [](AsyncWebServerRequest *req){
+    }, NULL, [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+        if (total > KMI_MAX_SIZE) {
+            if (index == 0) req->send(413,"application/json","{\"error\":\"too large\"}");
+            return;
+        }
+        if (index == 0) req->_tempObject = malloc(total);
+        uint8_t *buf = (uint8_t *)req->_tempObject;
+        if (!buf) return;
+        memcpy(buf + index, data, len);
+        if (index + len < total) return;
+        const char *err = keymapExApplyImage(buf, total);
+        if (err) { req->send(400,"application/json",String("{\"error\":\"") + err + "\"}"); return; }
+        char out[96];
+        snprintf(out, sizeof(out), "{\"status\":\"saved\",\"overrides\":%d,\"reverse\":%d}",
+                 keymapExOverrideCount(), keymapExReverseCount());
+        req->send(200,"application/json",out);
     });
     Serial.println("[KEYMAP-EX] Endpoints registered.");
 }
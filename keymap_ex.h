@@ -3,6 +3,12 @@
 
 #include <Arduino.h>
 #include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+
+// HID modifier byte bits (left | right)
+#define HID_MOD_CTRL  0x11
+#define HID_MOD_SHIFT 0x22
+#define HID_MOD_ALTGR 0x40
 
 struct KeymapEntry {
     uint8_t base;
@@ -12,14 +18,46 @@ struct KeymapEntry {
     uint8_t dead;
 };
 
+// Compiled translation table: the legacy map plus user overrides. Only the
+// overrides are stored (/keymap_ex.bin, see keymap_image.h) and exchanged
+// (sparse JSON keyed by HID code).
 extern KeymapEntry keymapEx[256];
 
+// Early boot, storage mounted: the compiled table from /keymap_ex.bin only
+// (no JSON), so keys typed before the network is up translate already.
+// keymapExInit finishes the job (legacy JSON conversion, endpoints).
+void keymapExBegin();
 void keymapExInit(AsyncWebServer *server = nullptr);
-String keymapExJSON();
+String keymapExJSON();                     // full 256-entry array
+String keymapExSparseJSON();               // overrides only
+bool keymapExApplyJSON(JsonVariantConst v); // sparse object or full array
+KeymapEntry keymapExDefault(uint8_t hid);
+void keymapExCompile();                    // call after the legacy map changes
+int keymapExOverrideCount();
+uint8_t keymapExTranslate(uint8_t hid, uint8_t mods);
 bool keymapExSet(uint8_t usb, KeymapEntry e);
+// Live edit for the editor channel: translation uses it at once, the image
+// is written later by keymapExTask(). nullptr = back to default. Not broadcast.
+void keymapExStage(uint8_t usb, const KeymapEntry *e);
+void keymapExTask();
+uint32_t keymapExGeneration();             // moves on every change to keymapEx[]
 bool keymapExLoadFS();
 bool keymapExSaveFS();
 void keymapExResetDefault();
+// Overrides as packed 6-byte records [hid, base, shift, altgr, ctrl, dead].
+int keymapExPack(uint8_t *out, int maxRecords);
+void keymapExReplace(const uint8_t *records, int n);  // saves and broadcasts a reset
+// Sparse JSON pieces: "<hid>": changed fields, or null when back to default.
+// hids == nullptr writes every override.
+size_t keymapExSparseDocSize(int entries);
+void keymapExSparseInto(JsonObject map, const uint8_t *hids, int n);
+KeymapEntry keymapExFromSparse(JsonObjectConst o, uint8_t hid);
+// Compiled image (tools/keymapc); nullptr on success, else why it was refused.
+const char *keymapExApplyImage(const uint8_t *buf, size_t len);
+// Key and modifiers (KMI_MOD_*) that type cp, from the image's reverse table.
+bool keymapExCharToHID(uint16_t cp, uint8_t &hid, uint8_t &mods);
+const char *keymapExLayoutName();          // "" unless an image set one
+int keymapExReverseCount();
 uint8_t mapHIDToXT_Advanced(uint8_t hid, bool shift, bool altgr, bool ctrl);
 void registerKeymapExEndpoints(AsyncWebServer *server);
 
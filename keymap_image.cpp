@@ -0,0 +1,86 @@
+#include "keymap_image.h"
+#include <string.h>
+#ifdef ARDUINO
+#include <rom/crc.h>
+#endif
+
+static inline void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static inline void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+static inline uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p + 2) << 16); }
+
+// Same CRC as zlib and the ROM crc32_le(0, ...), so tools can use either.
+uint32_t keymapImageCrc32(const uint8_t *data, size_t len) {
+#ifdef ARDUINO
+  return crc32_le(0, data, len);
+#else
+  uint32_t c = 0xFFFFFFFFu;
+  for (size_t i = 0; i < len; i++) {
+    c ^= data[i];
+    for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0xEDB88320u & (0u - (c & 1)));
+  }
+  return ~c;
+#endif
+}
+
+size_t keymapImageSize(uint16_t entries, uint16_t reverse) {
+  return KMI_HDR + (size_t)entries * KMI_ENTRY_SIZE + (size_t)reverse * KMI_REVERSE_SIZE;
+}
+
+size_t keymapImageBuild(uint8_t *out, size_t cap, const char *name,
+                        const uint8_t *entries, uint16_t entryCount,
+                        const uint8_t *reverse, uint16_t reverseCount) {
+  size_t size = keymapImageSize(entryCount, reverseCount);
+  if (size > cap || entryCount > 256 || reverseCount > KMI_MAX_REVERSE) return 0;
+  size_t entryBytes = (size_t)entryCount * KMI_ENTRY_SIZE;
+  memmove(out + KMI_HDR, entries, entryBytes);   // may already be in place
+  memcpy(out + KMI_HDR + entryBytes, reverse, (size_t)reverseCount * KMI_REVERSE_SIZE);
+  put32(out, KMI_MAGIC);
+  put16(out + 4, KMI_VERSION);
+  put16(out + 6, entryCount);
+  put16(out + 8, reverseCount);
+  put16(out + 10, 0);
+  memset(out + 12, 0, KMI_NAME_LEN);
+  if (name) strncpy((char *)out + 12, name, KMI_NAME_LEN);
+  put32(out + 28, keymapImageCrc32(out + KMI_HDR, size - KMI_HDR));
+  put32(out + 32, keymapImageCrc32(out, KMI_HDR - 4));
+  return size;
+}
+
+const char *keymapImageCheck(const uint8_t *buf, size_t len, KeymapImageView &v) {
+  if (len < KMI_HDR) return "too short";
+  if (get32(buf) != KMI_MAGIC) return "not a keymap image";
+  if (get16(buf + 4) != KMI_VERSION) return "unsupported version";
+  if (get32(buf + 32) != keymapImageCrc32(buf, KMI_HDR - 4)) return "header CRC mismatch";
+  v.entryCount = get16(buf + 6);
+  v.reverseCount = get16(buf + 8);
+  if (v.entryCount > 256 || v.reverseCount > KMI_MAX_REVERSE) return "too many records";
+  size_t size = keymapImageSize(v.entryCount, v.reverseCount);
+  if (size > len) return "truncated";
+  if (get32(buf + 28) != keymapImageCrc32(buf + KMI_HDR, size - KMI_HDR)) return "payload CRC mismatch";
+  v.entries = buf + KMI_HDR;
+  v.reverse = v.entries + (size_t)v.entryCount * KMI_ENTRY_SIZE;
+  memcpy(v.name, buf + 12, KMI_NAME_LEN);
+  v.name[KMI_NAME_LEN] = 0;
+  // Lookups rely on the order, so an unsorted image is refused, not fixed.
+  for (uint16_t i = 1; i < v.entryCount; i++) {
+    if (v.entries[i * KMI_ENTRY_SIZE] <= v.entries[(i - 1) * KMI_ENTRY_SIZE]) return "entries not sorted";
+  }
+  for (uint16_t i = 1; i < v.reverseCount; i++) {
+    if (get16(v.reverse + i * KMI_REVERSE_SIZE) <= get16(v.reverse + (i - 1) * KMI_REVERSE_SIZE)) return "reverse not sorted";
+  }
+  return nullptr;
+}
+
+bool keymapImageLookup(const uint8_t *reverse, uint16_t count, uint16_t cp, uint8_t &hid, uint8_t &mods) {
+  int lo = 0, hi = (int)count - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    const uint8_t *r = reverse + mid * KMI_REVERSE_SIZE;
+    uint16_t c = get16(r);
+    if (c == cp) { hid = r[2]; mods = r[3]; return true; }
+    if (c < cp) lo = mid + 1;
+    else hi = mid - 1;
+  }
+  return false;
+}
@@ -0,0 +1,58 @@
+#ifndef KEYMAP_IMAGE_H
+#define KEYMAP_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary keymap image: keymapEx entries plus a character reverse lookup,
+// used as-is from the buffer it was read into. Written by the host compiler
+// (tools/keymapc) and by keymapExSaveFS(); this file and keymap_image.cpp
+// build for both, so they must not depend on Arduino.
+//
+// Layout, little endian:
+//   header 36 bytes: [u32 magic "XKM1"][u16 version][u16 entry count]
+//                    [u16 reverse count][u16 flags][16 name, NUL padded]
+//                    [u32 payload crc32][u32 crc32 of the first 32 bytes]
+//   payload: entries  6-byte records [hid, base, shift, altgr, ctrl, dead],
+//                     ascending hid, same as SNAP_KEYMAP_EX
+//            reverse  4-byte records [u16 codepoint][hid][mods], ascending
+//                     codepoint; mods is KMI_MOD_SHIFT and/or KMI_MOD_ALTGR
+
+#define KMI_MAGIC 0x314D4B58UL        // "XKM1"
+#define KMI_VERSION 1
+#define KMI_HDR 36
+#define KMI_NAME_LEN 16
+#define KMI_ENTRY_SIZE 6
+#define KMI_REVERSE_SIZE 4
+#define KMI_MAX_REVERSE 512
+#define KMI_MAX_SIZE (KMI_HDR + 256 * KMI_ENTRY_SIZE + KMI_MAX_REVERSE * KMI_REVERSE_SIZE)
+
+// Reverse lookup modifiers, as HID modifier bits (left Shift, right Alt).
+#define KMI_MOD_SHIFT 0x02
+#define KMI_MOD_ALTGR 0x40
+
+// Pointers into a checked image; valid as long as the buffer is.
+struct KeymapImageView {
+  const uint8_t *entries;
+  const uint8_t *reverse;
+  uint16_t entryCount;
+  uint16_t reverseCount;
+  char name[KMI_NAME_LEN + 1];
+};
+
+uint32_t keymapImageCrc32(const uint8_t *data, size_t len);
+size_t keymapImageSize(uint16_t entries, uint16_t reverse);
+
+// Writes header and payload into out; 0 if cap is too small. Records must
+// already be sorted.
+size_t keymapImageBuild(uint8_t *out, size_t cap, const char *name,
+                        const uint8_t *entries, uint16_t entryCount,
+                        const uint8_t *reverse, uint16_t reverseCount);
+
+// nullptr if the image is intact, otherwise what is wrong with it.
+const char *keymapImageCheck(const uint8_t *buf, size_t len, KeymapImageView &v);
+
+// Binary search of the reverse records.
+bool keymapImageLookup(const uint8_t *reverse, uint16_t count, uint16_t cp, uint8_t &hid, uint8_t &mods);
+
+#endif
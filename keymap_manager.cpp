@@ -1,43 +1,43 @@
 #include "keymap_manager.h"
 #include "keymap.h"
 #include "config.h"
-#include <LittleFS.h>
+#include "profiler.h"
+#include "keymap_ex.h"
+#include "storage.h"
+#include "mem_stats.h"
 #include <ArduinoJson.h>
 
 static const char *KEYMAP_PATH = "/keymap.json";
+// 256 numbers, no strings. Documents live on the heap, not the AsyncTCP stack.
+#define KEYMAP_DOC_SIZE JSON_ARRAY_SIZE(256)
 
 bool writeKeymapToFS() {
-  if (!LittleFS.begin(true)) {
-    Serial.println("[KEYMAP] LittleFS mount failed (write)");
+  if (!storageMounted()) {
+    Serial.println("[KEYMAP] Storage not mounted (write)");
     return false;
   }
-  File f = LittleFS.open(KEYMAP_PATH, FILE_WRITE);
-  if (!f) { Serial.println("[KEYMAP] Failed to open keymap file for writing"); return false; }
-  StaticJsonDocument<4096> doc;
+  MemJsonDocument<MEM_KEYMAP> doc(KEYMAP_DOC_SIZE);
   JsonArray arr = doc.to<JsonArray>();
   for (int i = 0; i < 256; ++i) arr.add((uint8_t)config.keymap[i]);
-  if (serializeJson(doc, f) == 0) {
+  StorageScratch buf;
+  size_t n = buf.data() ? serializeJson(doc, buf.data(), buf.size()) : 0;
+  if (n == 0 || n >= buf.size() || !storageWriteAtomic(KEYMAP_PATH, (const uint8_t *)buf.data(), n)) {
     Serial.println("[KEYMAP] Failed to write JSON to file");
-    f.close();
     return false;
   }
-  f.close();
   Serial.println("[KEYMAP] Saved /keymap.json");
   return true;
 }
 
 bool readKeymapFromFS() {
-  if (!LittleFS.begin(true)) { Serial.println("[KEYMAP] LittleFS mount failed (read)"); return false; }
-  if (!LittleFS.exists(KEYMAP_PATH)) { Serial.println("[KEYMAP] No keymap file at " KEYMAP_PATH); return false; }
-  File f = LittleFS.open(KEYMAP_PATH, FILE_READ);
-  if (!f) { Serial.println("[KEYMAP] Failed open keymap file"); return false; }
-  size_t size = f.size();
-  if (size == 0) { f.close(); Serial.println("[KEYMAP] Empty keymap file"); return false; }
-  String body; body.reserve(size + 8);
-  while (f.available()) body += (char)f.read();
-  f.close();
-  StaticJsonDocument<4096> doc;
-  DeserializationError err = deserializeJson(doc, body);
+  if (!storageMounted()) { Serial.println("[KEYMAP] Storage not mounted (read)"); return false; }
+  if (!storageExists(KEYMAP_PATH)) { Serial.printf("[KEYMAP] No keymap file at %s\n", KEYMAP_PATH); return false; }
+  StorageScratch buf;
+  size_t size = 0;
+  if (!buf.data() || !storageRead(KEYMAP_PATH, (uint8_t *)buf.data(), buf.size(), size)) { Serial.println("[KEYMAP] Failed reading keymap file"); return false; }
+  if (size == 0) { Serial.println("[KEYMAP] Empty keymap file"); return false; }
+  MemJsonDocument<MEM_KEYMAP> doc(KEYMAP_DOC_SIZE);
+  DeserializationError err = deserializeJson(doc, (const char *)buf.data(), size);
   if (err) { Serial.printf("[KEYMAP] JSON parse failed: %s\n", err.c_str()); return false; }
   if (!doc.is<JsonArray>()) { Serial.println("[KEYMAP] keymap JSON is not array"); return false; }
   JsonArray arr = doc.as<JsonArray>();
@@ -80,11 +80,12 @@ void keymapResetToDefault() {
   for (int i=0;i<256;i++) config.keymap[i] = default_usb_to_xt[i];
   configSave();
   writeKeymapToFS();
+  keymapExCompile();
   Serial.println("[KEYMAP] Reset to default and saved");
 }
 
 String getKeymapJSON() {
-  StaticJsonDocument<4096> doc;
+  MemJsonDocument<MEM_KEYMAP> doc(KEYMAP_DOC_SIZE);
   JsonArray arr = doc.to<JsonArray>();
   for (int i = 0; i < 256; ++i) arr.add((uint8_t)config.keymap[i]);
   String out;
@@ -97,6 +98,7 @@ bool setKeymapEntry(uint8_t usbCode, uint8_t xtCode) {
   config.keymap[usbCode] = xtCode;
   configSave();
   writeKeymapToFS();
+  keymapExCompile();
   return true;
 }
 
@@ -122,17 +124,18 @@ void registerKeymapEndpoints(AsyncWebServer *server) {
   });
   server->on("/api/map_upload", HTTP_POST, [](AsyncWebServerRequest *req){ req->send(200, "application/json", "{"status":"ok"}"); }, NULL,
     [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
-      StaticJsonDocument<8192> doc;
+      PROF_STAGE("http:/api/map_upload");
+      MemJsonDocument<MEM_KEYMAP> doc(KEYMAP_DOC_SIZE);
       DeserializationError err = deserializeJson(doc, data, len);
       if (err || !doc.is<JsonArray>()) { req->send(400,"application/json","{"error":"bad json or not array"}"); return; }
       JsonArray arr = doc.as<JsonArray>();
       if ((int)arr.size() != 256) { req->send(400,"application/json","{"error":"array must have 256 elements"}"); return; }
       for (int i=0;i<256;i++){ int v = arr[i] | 0; config.keymap[i] = (uint8_t)v; }
-      configSave(); writeKeymapToFS(); req->send(200,"application/json","{"status":"saved"}");
+      configSave(); writeKeymapToFS(); keymapExCompile(); req->send(200,"application/json","{"status":"saved"}");
   });
   server->on("/api/map_download", HTTP_GET, [](AsyncWebServerRequest *req){
-    if (!LittleFS.begin(true) || !LittleFS.exists(KEYMAP_PATH)) { req->send(404, "application/json", "{"error":"no keymap file"}"); return; }
-    req->send(LittleFS, KEYMAP_PATH, "application/json");
+    if (!storageExists(KEYMAP_PATH)) { req->send(404, "application/json", "{\"error\":\"no keymap file\"}"); return; }
+    req->send(storageFS(), KEYMAP_PATH, "application/json");
   });
   server->on("/api/map_reset", HTTP_POST, [](AsyncWebServerRequest *req){ keymapResetToDefault(); req->send(200, "application/json", "{"status":"reset"}"); });
   Serial.println("[KEYMAP] Endpoints registered");
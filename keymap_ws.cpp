@@ -0,0 +1,189 @@
+#include "keymap_ws.h"
+#include "keymap_ex.h"
+#include "mem_stats.h"
+#include <ArduinoJson.h>
+
+#define KWS_MAX_FRAME 4096
+#define KWS_MAX_BATCH 64
+#define KWS_POLL_MS   200
+
+static AsyncWebSocket *ws = nullptr;
+
+// Generation the editors last heard about. Writes here move it together
+// with the table, under genMux, so keymapWsTask() only reports changes
+// that came from somewhere else.
+static portMUX_TYPE genMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t announcedGen = 0;
+static unsigned long lastPollMs = 0;
+
+static void sendText(AsyncWebSocketClient *client, const String &out) {
+  memNote(MEM_WS, out.length());
+  if (client) client->text(out);
+  else ws->textAll(out);
+}
+
+static void reply(AsyncWebSocketClient *client, int32_t id, bool ok, const char *error) {
+  StaticJsonDocument<128> doc;
+  doc["id"] = id;
+  doc["ok"] = ok;
+  if (error) doc["error"] = error;
+  doc["gen"] = keymapExGeneration();
+  String out;
+  serializeJson(doc, out);
+  sendText(client, out);
+}
+
+static void sendMap(AsyncWebSocketClient *client, int32_t id, bool withBase) {
+  MemJsonDocument<MEM_WS> doc(keymapExSparseDocSize(keymapExOverrideCount()) + JSON_OBJECT_SIZE(4) + 520);
+  doc["id"] = id;
+  doc["ok"] = true;
+  doc["gen"] = keymapExGeneration();
+  keymapExSparseInto(doc.createNestedObject("map"), nullptr, 0);
+  if (withBase) {
+    char hex[513];
+    for (int i = 0; i < 256; i++) snprintf(hex + i * 2, 3, "%02X", keymapExDefault(i).base);
+    doc["base"] = hex;   // copied into the document
+  }
+  String out;
+  serializeJson(doc, out);
+  sendText(client, out);
+}
+
+static void broadcastDelta(uint32_t from, uint32_t gen, const uint8_t *hids, int n) {
+  MemJsonDocument<MEM_WS> doc(keymapExSparseDocSize(n) + JSON_OBJECT_SIZE(4));
+  doc["type"] = "delta";
+  doc["from"] = from;
+  doc["gen"] = gen;
+  keymapExSparseInto(doc.createNestedObject("map"), hids, n);
+  String out;
+  serializeJson(doc, out);
+  sendText(nullptr, out);
+}
+
+static bool validEntry(JsonVariantConst v) {
+  return v.isNull() || v.is<JsonObjectConst>();
+}
+
+// Collects the writes of a set or batch; nothing is applied unless all of
+// them are valid.
+static const char *collect(JsonDocument &doc, uint8_t *hids, JsonVariantConst *entries, int &n) {
+  n = 0;
+  const char *op = doc["op"] | "";
+  if (strcmp(op, "set") == 0) {
+    int hid = doc["hid"] | -1;
+    if (hid < 0 || hid > 255) return "bad hid";
+    if (!validEntry(doc["entry"])) return "bad entry";
+    hids[0] = hid;
+    entries[0] = doc["entry"];
+    n = 1;
+    return nullptr;
+  }
+  JsonObjectConst map = doc["map"];
+  if (map.isNull()) return "missing map";
+  if (map.size() > KWS_MAX_BATCH) return "batch too large";
+  for (JsonPairConst kv : map) {
+    char *end;
+    long hid = strtol(kv.key().c_str(), &end, 10);
+    if (*end || hid < 0 || hid > 255) return "bad hid";
+    if (!validEntry(kv.value())) return "bad entry";
+    hids[n] = hid;
+    entries[n++] = kv.value();
+  }
+  return nullptr;
+}
+
+static void handleWrite(AsyncWebSocketClient *client, int32_t id, JsonDocument &doc) {
+  uint8_t hids[KWS_MAX_BATCH];
+  JsonVariantConst entries[KWS_MAX_BATCH];
+  int n;
+  const char *err = collect(doc, hids, entries, n);
+  if (err) { reply(client, id, false, err); return; }
+  if (!doc.containsKey("gen")) { reply(client, id, false, "missing gen"); return; }
+  uint32_t base = doc["gen"];
+  KeymapEntry staged[KWS_MAX_BATCH];
+  for (int k = 0; k < n; k++) {
+    if (!entries[k].isNull()) staged[k] = keymapExFromSparse(entries[k].as<JsonObjectConst>(), hids[k]);
+  }
+  // Writes come from here and the REST handlers (AsyncTCP task), and from
+  // the loop, where a rollback restore calls keymapExReplace() without
+  // genMux. genMux orders editors among themselves and keeps announcedGen
+  // in step with keymapWsTask(); a restore can still land between check
+  // and apply, and the edit then goes on top of the restored map. The
+  // restore moved the generation as well, so editors are told and re-get.
+  uint32_t from, gen;
+  bool conflict;
+  portENTER_CRITICAL(&genMux);
+  from = keymapExGeneration();
+  conflict = base != from;
+  if (!conflict) {
+    for (int k = 0; k < n; k++) keymapExStage(hids[k], entries[k].isNull() ? nullptr : &staged[k]);
+    announcedGen = keymapExGeneration();
+  }
+  gen = keymapExGeneration();
+  portEXIT_CRITICAL(&genMux);
+  if (conflict) { reply(client, id, false, "conflict"); return; }
+  reply(client, id, true, nullptr);
+  if (gen != from) broadcastDelta(from, gen, hids, n);
+}
+
+static void handleMessage(AsyncWebSocketClient *client, const uint8_t *data, size_t len) {
+  MemJsonDocument<MEM_WS> doc(len + JSON_OBJECT_SIZE(6) + JSON_OBJECT_SIZE(KWS_MAX_BATCH) +
+                              KWS_MAX_BATCH * JSON_OBJECT_SIZE(5));
+  if (deserializeJson(doc, data, len)) { reply(client, -1, false, "bad json"); return; }
+  int32_t id = doc["id"] | -1;
+  const char *op = doc["op"] | "";
+  if (strcmp(op, "get") == 0) sendMap(client, id, doc["base"] | false);
+  else if (strcmp(op, "set") == 0 || strcmp(op, "batch") == 0) handleWrite(client, id, doc);
+  else reply(client, id, false, "unknown op");
+}
+
+void keymapWsInit(AsyncWebServer &server) {
+  ws = new AsyncWebSocket("/ws/keymap");
+  server.addHandler(ws);
+  ws->onEvent([](AsyncWebSocket *server, AsyncWebSocketClient *client,
+                 AwsEventType type, void *arg, uint8_t *data, size_t len){
+    if (type == WS_EVT_CONNECT) {
+      String hello = String("{\"type\":\"hello\",\"gen\":") + keymapExGeneration() + "}";
+      client->text(hello);
+      Serial.printf("[KEYMAP-WS] Editor connected: %u\n", client->id());
+    } else if (type == WS_EVT_DISCONNECT) {
+      free(client->_tempObject);
+      client->_tempObject = nullptr;
+    } else if (type == WS_EVT_DATA) {
+      AwsFrameInfo *info = (AwsFrameInfo*)arg;
+      if (info->opcode != WS_TEXT || !info->final || info->len > KWS_MAX_FRAME) return;
+      if (info->index == 0 && info->len == len) { handleMessage(client, data, len); return; }
+      // Batches can arrive split over several TCP segments.
+      if (info->index == 0) {
+        free(client->_tempObject);
+        client->_tempObject = malloc(info->len);
+      }
+      uint8_t *buf = (uint8_t *)client->_tempObject;
+      if (!buf) return;
+      memcpy(buf + info->index, data, len);
+      if (info->index + len < info->len) return;
+      handleMessage(client, buf, info->len);
+      free(buf);
+      client->_tempObject = nullptr;
+    }
+  });
+  announcedGen = keymapExGeneration();
+  Serial.println("[KEYMAP-WS] /ws/keymap ready");
+}
+
+void keymapWsTask() {
+  if (!ws) return;
+  unsigned long now = millis();
+  if (now - lastPollMs < KWS_POLL_MS) return;
+  lastPollMs = now;
+  ws->cleanupClients();
+  uint32_t gen;
+  bool moved;
+  portENTER_CRITICAL(&genMux);
+  gen = keymapExGeneration();
+  moved = gen != announcedGen;
+  announcedGen = gen;
+  portEXIT_CRITICAL(&genMux);
+  if (!moved || !ws->count()) return;
+  sendText(nullptr, String("{\"type\":\"changed\",\"gen\":") + gen + "}");
+}
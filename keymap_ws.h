@@ -0,0 +1,32 @@
+#ifndef KEYMAP_WS_H
+#define KEYMAP_WS_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Keymap editor channel on /ws/keymap, JSON text both ways. Requests carry
+// an id that the reply echoes:
+//
+//   {"id":1,"op":"get","base":true}
+//     -> {"id":1,"ok":true,"gen":G,"map":{...},"base":"<512 hex digits>"}
+//   {"id":2,"op":"set","gen":G,"hid":4,"entry":{"base":28}}  entry null = default
+//   {"id":3,"op":"batch","gen":G,"map":{"4":{...},"5":null}}
+//     -> {"id":2,"ok":true,"gen":G2}
+//     -> {"id":2,"ok":false,"error":"conflict","gen":G}
+//
+// map and entry use the sparse form of /api/map_ex. gen is the
+// keymapExGeneration() the client's copy is based on; a write against any
+// other generation is refused whole, and the client gets and retries. Writes
+// go to the live translation table at once and are saved once editing
+// pauses (keymapExStage).
+//
+// Every editor, the writer included, then gets
+//   {"type":"delta","from":G,"gen":G2,"map":{...}}
+// and re-gets if from is not the generation it holds. Changes made elsewhere
+// (REST, image upload, legacy map) are announced as {"type":"changed","gen":G}.
+
+void keymapWsInit(AsyncWebServer &server);
+void keymapWsTask();
+
+#endif
@@ -0,0 +1,235 @@
+#include "la_capture.h"
+#include "la_sim.h"
+#include "detect_protocol.h"
+#include "xt_at_output.h"
+#include "config.h"
+#include <ArduinoJson.h>
+#include <soc/gpio_reg.h>
+#include <atomic>
+
+#define LA_SIM_MAX_BYTES 64
+
+enum { LA_REQ_NONE, LA_REQ_ARM, LA_REQ_SIM, LA_REQ_STOP };
+
+static portMUX_TYPE laMux = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t pinClk = 10, pinData = 11;
+static bool attached = false;
+static LaCaptureConfig active = { LA_TRIG_NONE, 0, 25, 100, 200 };
+static std::atomic<uint8_t> exporting(0);     // VCD downloads reading the ring
+
+// Requests from the web handlers. laCaptureTask() applies them, so the
+// interrupts and the cycle counter they read are all on the loop core.
+static uint8_t pending = LA_REQ_NONE;
+static LaCaptureConfig pendingCfg;
+static uint8_t simBytes[LA_SIM_MAX_BYTES];
+static size_t simCount = 0;
+static uint16_t simHalfUs = 0, simGapUs = 0;
+static uint8_t simMode = MODE_AT;
+
+static inline uint8_t readPin(uint8_t pin) {
+  if (pin < 32) return (REG_READ(GPIO_IN_REG) >> pin) & 1;
+  return (REG_READ(GPIO_IN1_REG) >> (pin - 32)) & 1;
+}
+
+static inline uint8_t levels() {
+  return (readPin(pinClk) ? LA_SAMPLE_CLK : 0) | (readPin(pinData) ? LA_SAMPLE_DATA : 0);
+}
+
+static void IRAM_ATTR onEdge() {
+  portENTER_CRITICAL_ISR(&laMux);
+  laRingEdge(ESP.getCycleCount(), levels());
+  portEXIT_CRITICAL_ISR(&laMux);
+}
+
+static void attach() {
+  attachInterrupt(digitalPinToInterrupt(pinClk), onEdge, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(pinData), onEdge, CHANGE);
+  attached = true;
+}
+
+static void detach() {
+  if (!attached) return;
+  detachInterrupt(digitalPinToInterrupt(pinClk));
+  detachInterrupt(digitalPinToInterrupt(pinData));
+  attached = false;
+}
+
+static void simEdge(uint32_t tick, uint8_t level, void *ctx) {
+  (void)ctx;
+  laRingEdge(tick, level);
+}
+
+// Runs with no interrupt attached, so the ring is ours alone.
+static void runSim() {
+  uint32_t tpu = getCpuFrequencyMhz();
+  LaSim sim;
+  laSimBegin(sim, simEdge, nullptr, tpu, 0);
+  laRingArm(active, tpu, sim.now, sim.level);
+  laSimWait(sim, simGapUs);
+  for (size_t i = 0; i < simCount; i++) {
+    laSimSendByte(sim, simMode, simBytes[i], simHalfUs);
+    laSimWait(sim, simGapUs);
+  }
+  laRingFinish(sim.now);
+}
+
+void laCaptureBegin(uint8_t clkPin, uint8_t dataPin) {
+  pinClk = clkPin;
+  pinData = dataPin;
+}
+
+bool laCaptureArm(const LaCaptureConfig &c) {
+  if (!laRingValid(c)) return false;
+  portENTER_CRITICAL(&laMux);
+  pendingCfg = c;
+  pending = LA_REQ_ARM;
+  portEXIT_CRITICAL(&laMux);
+  return true;
+}
+
+bool laCaptureSimulate(const LaCaptureConfig &c, uint8_t mode, const uint8_t *bytes, size_t n,
+                       uint16_t halfUs, uint16_t gapUs) {
+  if (!laRingValid(c) || n > LA_SIM_MAX_BYTES || !halfUs || mode < MODE_XT || mode > MODE_PS2) return false;
+  portENTER_CRITICAL(&laMux);
+  pendingCfg = c;
+  memcpy(simBytes, bytes, n);
+  simCount = n;
+  simHalfUs = halfUs;
+  simGapUs = gapUs;
+  simMode = mode;
+  pending = LA_REQ_SIM;
+  portEXIT_CRITICAL(&laMux);
+  return true;
+}
+
+void laCaptureStop() {
+  portENTER_CRITICAL(&laMux);
+  pending = LA_REQ_STOP;
+  portEXIT_CRITICAL(&laMux);
+}
+
+static void apply() {
+  // detection owns the CLK interrupt while it runs; a download still reads the ring
+  bool busy = detectProtocolRunning();
+  uint8_t req;
+  portENTER_CRITICAL(&laMux);
+  req = pending;
+  bool wait = req != LA_REQ_STOP && (busy || exporting.load());
+  if (!wait) {
+    pending = LA_REQ_NONE;
+    if (req == LA_REQ_ARM || req == LA_REQ_SIM) active = pendingCfg;
+  }
+  portEXIT_CRITICAL(&laMux);
+  if (wait || req == LA_REQ_NONE) return;
+  detach();
+  if (req == LA_REQ_STOP) {
+    laRingStop();
+  } else if (req == LA_REQ_SIM) {
+    runSim();
+    Serial.printf("[LA] Simulated %u byte(s): %lu edges\n", (unsigned)simCount, (unsigned long)laRingCount());
+  } else {
+    portENTER_CRITICAL(&laMux);
+    laRingArm(active, getCpuFrequencyMhz(), ESP.getCycleCount(), levels());
+    portEXIT_CRITICAL(&laMux);
+    attach();
+    Serial.printf("[LA] Armed: trigger=%u pre=%u%% window=%ums\n", active.trigger, active.pre_pct, active.window_ms);
+  }
+}
+
+void laCaptureTask() {
+  if (pending != LA_REQ_NONE) apply();
+  if (!attached) return;
+  bool lost = detectProtocolRunning();
+  portENTER_CRITICAL(&laMux);
+  uint32_t now = ESP.getCycleCount();
+  bool done = laRingPoll(now);
+  if (lost && !done) { laRingFinish(now); done = true; }
+  portEXIT_CRITICAL(&laMux);
+  if (!done) return;
+  detach();
+  if (lost) Serial.println("[LA] Detection took the CLK line; capture ended early");
+  Serial.printf("[LA] Capture complete (%lu edges, trigger at %lu)\n",
+                (unsigned long)laRingCount(), (unsigned long)laRingTriggerIndex());
+}
+
+static const char *stateName() {
+  static const char *names[] = { "idle", "armed", "triggered", "done" };
+  return names[laRingState()];
+}
+
+static void parseConfig(JsonDocument &doc, LaCaptureConfig &c) {
+  String trig = String((const char*)(doc["trigger"] | "none"));
+  c.trigger = trig == "inhibit" ? LA_TRIG_INHIBIT : (trig == "byte" ? LA_TRIG_BYTE : LA_TRIG_NONE);
+  c.trigger_byte = doc["byte"] | 0;
+  c.pre_pct = doc["pre_pct"] | 25;
+  c.inhibit_us = doc["inhibit_us"] | 100;
+  c.window_ms = doc["window_ms"] | 200;
+}
+
+void laCaptureInit(AsyncWebServer &server) {
+  server.on("/api/la/arm", HTTP_POST, [](AsyncWebServerRequest *req){
+    req->send(200, "application/json", "{\"status\":\"ok\"}");
+  }, NULL, [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+    StaticJsonDocument<256> doc;
+    if (deserializeJson(doc, data, len)) { req->send(400, "application/json", "{\"error\":\"bad json\"}"); return; }
+    LaCaptureConfig c;
+    parseConfig(doc, c);
+    if (!laCaptureArm(c)) { req->send(400, "application/json", "{\"error\":\"invalid params\"}"); return; }
+    req->send(200, "application/json", "{\"status\":\"armed\"}");
+  });
+  // {"bytes":[28,240,28],"mode":"AT","half_us":40,"gap_us":1000} plus the
+  // /api/la/arm trigger fields; mode and timing default to the control port's.
+  server.on("/api/la/sim", HTTP_POST, [](AsyncWebServerRequest *req){
+    req->send(200, "application/json", "{\"status\":\"ok\"}");
+  }, NULL, [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+    StaticJsonDocument<1024> doc;
+    if (deserializeJson(doc, data, len)) { req->send(400, "application/json", "{\"error\":\"bad json\"}"); return; }
+    LaCaptureConfig c;
+    parseConfig(doc, c);
+    uint8_t bytes[LA_SIM_MAX_BYTES];
+    size_t n = 0;
+    JsonArray arr = doc["bytes"];
+    for (JsonVariant v : arr) {
+      if (n == LA_SIM_MAX_BYTES) { req->send(400, "application/json", "{\"error\":\"too many bytes\"}"); return; }
+      bytes[n++] = v.as<uint8_t>();
+    }
+    uint16_t halfUs = doc["half_us"] | (uint16_t)xtatBitDelayUs();
+    uint16_t gapUs = doc["gap_us"] | (uint16_t)xtatInterByteUs();
+    const char *m = doc["mode"] | "";
+    uint8_t mode = !strcmp(m, "XT") ? MODE_XT : !strcmp(m, "AT") ? MODE_AT : !strcmp(m, "PS2") ? MODE_PS2 : xtatMode();
+    if (!laCaptureSimulate(c, mode, bytes, n, halfUs, gapUs)) { req->send(400, "application/json", "{\"error\":\"invalid params\"}"); return; }
+    req->send(200, "application/json", "{\"status\":\"simulated\"}");
+  });
+  server.on("/api/la/stop", HTTP_POST, [](AsyncWebServerRequest *req){
+    laCaptureStop();
+    req->send(200, "application/json", "{\"status\":\"stopped\"}");
+  });
+  server.on("/api/la/status", HTTP_GET, [](AsyncWebServerRequest *req){
+    StaticJsonDocument<256> doc;
+    doc["state"] = stateName();
+    doc["pending"] = pending != LA_REQ_NONE;
+    doc["edges"] = laRingCount();
+    doc["capacity"] = LA_RING_EDGES;
+    doc["trigger"] = active.trigger;
+    doc["window_ms"] = active.window_ms;
+    String out; serializeJson(doc, out);
+    req->send(200, "application/json", out);
+  });
+  server.on("/api/la/capture.vcd", HTTP_GET, [](AsyncWebServerRequest *req){
+    portENTER_CRITICAL(&laMux);
+    bool ready = laRingState() == LA_DONE && pending == LA_REQ_NONE;
+    if (ready) exporting++;
+    portEXIT_CRITICAL(&laMux);
+    if (!ready) { req->send(409, "application/json", "{\"error\":\"no completed capture\"}"); return; }
+    LaVcdWriter *w = new LaVcdWriter;
+    laVcdBegin(*w, laRingAt, nullptr, laRingCount(), laRingTicksPerUs(), laRingTriggerIndex());
+    AsyncWebServerResponse *resp = req->beginChunkedResponse("application/octet-stream",
+      [w](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+        return laVcdRead(*w, buf, maxLen);
+      });
+    resp->addHeader("Content-Disposition", "attachment; filename=\"xtat_capture.vcd\"");
+    req->onDisconnect([w](){ delete w; exporting--; });
+    req->send(resp);
+  });
+  Serial.println("[LA] Endpoints registered");
+}
@@ -0,0 +1,27 @@
+#ifndef LA_CAPTURE_H
+#define LA_CAPTURE_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include "la_ring.h"
+
+// Logic-analyzer capture of the CLK/DATA lines. A GPIO interrupt on either
+// line stores the edge with a CPU cycle timestamp in the edge ring
+// (la_ring.h); nothing runs between edges, so the bit-banged output being
+// measured is not disturbed. The capture is exported as VCD at
+// /api/la/capture.vcd. /api/la/sim fills the same ring from the simulated
+// bus (la_sim.h), which gives the VCD the host test compares against.
+
+void laCaptureBegin(uint8_t clkPin, uint8_t dataPin);
+// Checked at once, armed by laCaptureTask() on the loop core.
+bool laCaptureArm(const LaCaptureConfig &cfg);
+// mode is MODE_XT / MODE_AT / MODE_PS2: the framing the engine uses for it.
+bool laCaptureSimulate(const LaCaptureConfig &cfg, uint8_t mode, const uint8_t *bytes, size_t n,
+                       uint16_t halfUs, uint16_t gapUs);
+void laCaptureStop();
+void laCaptureTask();
+
+void laCaptureInit(AsyncWebServer &server);
+
+#endif
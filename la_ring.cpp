@@ -0,0 +1,159 @@
+#include "la_ring.h"
+
+#define LA_DT_MAX        ((1UL << 30) - 1)
+#define LA_KEEPALIVE     (1UL << 29)          // poll adds a record before dt can overflow
+#define LA_FRAME_IDLE_US 200                  // CLK high this long ends a frame
+#define LA_NO_RECORD     0xFFFFFFFFUL
+
+static uint32_t ring[LA_RING_EDGES];
+static volatile uint8_t laState = LA_IDLE;
+static uint32_t head = 0;                     // next slot
+static uint32_t held = 0;                     // records in the ring (saturating)
+static uint32_t total = 0;                    // records since arm
+static uint32_t lastTick = 0;
+static uint8_t level = LA_SAMPLE_CLK | LA_SAMPLE_DATA;
+
+static LaCaptureConfig cfg = { LA_TRIG_NONE, 0, 25, 100, 200 };
+static uint32_t ticksPerUs = 1;
+static uint32_t preEdges = 0;
+static uint32_t inhibitTicks = 0, idleTicks = 0, windowTicks = 0;
+static uint32_t triggerRec = LA_NO_RECORD;    // absolute record number
+static uint32_t triggerTick = 0;
+static int32_t postLeft = 0;
+
+// trigger evaluation state
+static uint32_t clkSince = 0;                 // tick of the last CLK change
+static uint32_t clkFellRec = LA_NO_RECORD;
+static uint8_t frameBits = 0;                 // 0 idle, 1..8 data bits, 9 wait for idle
+static uint8_t frameShift = 0;
+
+bool laRingValid(const LaCaptureConfig &c) {
+  return c.trigger <= LA_TRIG_BYTE && c.pre_pct <= 90 && c.inhibit_us > 0 &&
+         c.window_ms > 0 && c.window_ms <= 10000;
+}
+
+static void IRAM_ATTR put(uint32_t now, uint8_t s) {
+  uint32_t dt = total ? now - lastTick : 0;
+  if (dt > LA_DT_MAX) dt = LA_DT_MAX;
+  ring[head] = (dt << 2) | s;
+  head = (head + 1) % LA_RING_EDGES;
+  if (held < LA_RING_EDGES) held++;
+  total++;
+  lastTick = now;
+  level = s;
+}
+
+static void IRAM_ATTR fire(uint32_t rec, uint32_t now) {
+  // a record that already left the ring moves to the oldest one kept
+  if (total - rec > held) rec = total - held;
+  triggerRec = rec;
+  triggerTick = now;
+  uint32_t pre = cfg.trigger == LA_TRIG_NONE ? 0 : preEdges;
+  postLeft = (int32_t)(LA_RING_EDGES - pre) - (int32_t)(total - rec);
+  laState = postLeft > 0 ? LA_TRIGGERED : LA_DONE;
+}
+
+// Decides on the record just put; s is its level, changed the lines that moved.
+static void IRAM_ATTR evalTrigger(uint32_t now, uint8_t s, uint8_t changed) {
+  if (!(changed & LA_SAMPLE_CLK)) return;
+  bool clk = s & LA_SAMPLE_CLK;
+  uint32_t run = now - clkSince;              // how long CLK sat at its old level
+  if (cfg.trigger == LA_TRIG_INHIBIT) {
+    if (clk && run >= inhibitTicks && clkFellRec != LA_NO_RECORD) fire(clkFellRec, now);
+    return;
+  }
+  // LA_TRIG_BYTE: data is valid on the falling clock edge; start bit, 8 data bits LSB first
+  if (clk) return;
+  if (run > idleTicks) frameBits = 0;
+  if (frameBits == 0) {
+    if (!(s & LA_SAMPLE_DATA)) { frameBits = 1; frameShift = 0; }
+    return;
+  }
+  if (frameBits > 8) return;                  // parity and stop bits
+  if (s & LA_SAMPLE_DATA) frameShift |= 1 << (frameBits - 1);
+  if (++frameBits == 9 && frameShift == cfg.trigger_byte) fire(total - 1, now);
+}
+
+void laRingArm(const LaCaptureConfig &c, uint32_t tpu, uint32_t now, uint8_t s) {
+  cfg = c;
+  ticksPerUs = tpu ? tpu : 1;
+  preEdges = (uint32_t)((uint64_t)LA_RING_EDGES * cfg.pre_pct / 100);
+  inhibitTicks = (uint32_t)cfg.inhibit_us * ticksPerUs;
+  idleTicks = LA_FRAME_IDLE_US * ticksPerUs;
+  windowTicks = (uint32_t)((uint64_t)cfg.window_ms * 1000 * ticksPerUs);
+  if (windowTicks > LA_KEEPALIVE) windowTicks = LA_KEEPALIVE;
+  head = held = total = 0;
+  triggerRec = LA_NO_RECORD;
+  frameBits = 0;
+  clkSince = now;
+  s &= LA_SAMPLE_CLK | LA_SAMPLE_DATA;
+  put(now, s);                                // the levels at arm time
+  clkFellRec = (s & LA_SAMPLE_CLK) ? LA_NO_RECORD : 0;
+  laState = LA_ARMED;
+  if (cfg.trigger == LA_TRIG_NONE) fire(0, now);
+}
+
+void laRingStop() {
+  if (laState != LA_DONE) laState = LA_IDLE;
+}
+
+static bool IRAM_ATTR windowOver(uint32_t now) {
+  if (laState != LA_TRIGGERED || now - triggerTick < windowTicks) return false;
+  laRingFinish(triggerTick + windowTicks);
+  return true;
+}
+
+bool IRAM_ATTR laRingEdge(uint32_t now, uint8_t s) {
+  uint8_t st = laState;
+  if (st != LA_ARMED && st != LA_TRIGGERED) return st == LA_DONE;
+  if (windowOver(now)) return true;
+  s &= LA_SAMPLE_CLK | LA_SAMPLE_DATA;
+  uint8_t changed = s ^ level;
+  if (!changed) return false;                 // a pulse shorter than the interrupt latency
+  put(now, s);
+  if (st == LA_ARMED) evalTrigger(now, s, changed);
+  else if (--postLeft <= 0) laState = LA_DONE;
+  if (changed & LA_SAMPLE_CLK) {
+    clkSince = now;
+    if (!(s & LA_SAMPLE_CLK)) clkFellRec = total - 1;
+  }
+  return laState == LA_DONE;
+}
+
+bool laRingPoll(uint32_t now) {
+  uint8_t st = laState;
+  if (st != LA_ARMED && st != LA_TRIGGERED) return st == LA_DONE;
+  if (windowOver(now)) return true;
+  if (st == LA_ARMED && cfg.trigger == LA_TRIG_INHIBIT && !(level & LA_SAMPLE_CLK) &&
+      clkFellRec != LA_NO_RECORD && now - clkSince >= inhibitTicks) {
+    fire(clkFellRec, now);
+  }
+  if (now - lastTick > LA_KEEPALIVE) {
+    put(now, level);
+    if (laState == LA_TRIGGERED && --postLeft <= 0) laState = LA_DONE;
+  }
+  return laState == LA_DONE;
+}
+
+void IRAM_ATTR laRingFinish(uint32_t now) {
+  if (laState != LA_ARMED && laState != LA_TRIGGERED) return;
+  if (now != lastTick) put(now, level);       // marks where the capture ended
+  laState = LA_DONE;
+}
+
+uint8_t laRingState() { return laState; }
+uint32_t laRingCount() { return held; }
+uint32_t laRingTicksPerUs() { return ticksPerUs; }
+
+uint32_t laRingTriggerIndex() {
+  if (triggerRec == LA_NO_RECORD || total - triggerRec > held) return held;
+  return held - (total - triggerRec);
+}
+
+LaEdge laRingAt(uint32_t index, void *ctx) {
+  (void)ctx;
+  uint32_t start = (head + LA_RING_EDGES - held) % LA_RING_EDGES;
+  uint32_t r = ring[(start + index) % LA_RING_EDGES];
+  LaEdge e = { r >> 2, (uint8_t)(r & 3) };
+  return e;
+}
@@ -0,0 +1,55 @@
+#ifndef LA_RING_H
+#define LA_RING_H
+
+// Edge ring and trigger logic of the logic analyzer. Every CLK or DATA edge
+// becomes one 32-bit record: the line levels in the low two bits and the
+// ticks since the previous record above them. Time is in caller ticks (CPU
+// cycles on the device), so nothing here depends on Arduino; the GPIO
+// interrupt in la_capture.cpp and the simulated bus in la_sim.cpp both feed
+// laRingEdge(). None of the functions lock: the caller serialises them.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "la_vcd.h"
+
+#ifdef ARDUINO
+#include <esp_attr.h>
+#else
+#define IRAM_ATTR
+#endif
+
+#define LA_TRIG_NONE    0   // capture starts immediately
+#define LA_TRIG_INHIBIT 1   // CLK held low by the host for >= inhibit_us
+#define LA_TRIG_BYTE    2   // a frame carrying trigger_byte (either direction)
+
+#define LA_RING_EDGES   4096
+
+enum LaState { LA_IDLE, LA_ARMED, LA_TRIGGERED, LA_DONE };
+
+struct LaCaptureConfig {
+  uint8_t trigger;
+  uint8_t trigger_byte;
+  uint8_t pre_pct;          // share of the ring kept from before the trigger
+  uint16_t inhibit_us;
+  uint16_t window_ms;       // capture ends this long after the trigger
+};
+
+bool laRingValid(const LaCaptureConfig &cfg);
+void laRingArm(const LaCaptureConfig &cfg, uint32_t ticksPerUs, uint32_t now, uint8_t level);
+void laRingStop();
+
+// One edge; level holds LA_SAMPLE_* after it. Returns true once the capture is done.
+bool laRingEdge(uint32_t now, uint8_t level);
+// Called often between edges: keeps the tick deltas in range, fires an
+// inhibit trigger on a CLK that is still low, and ends the window.
+bool laRingPoll(uint32_t now);
+// Ends the capture at now, whether or not it triggered.
+void laRingFinish(uint32_t now);
+
+uint8_t laRingState();
+uint32_t laRingCount();
+uint32_t laRingTriggerIndex();      // count when there is none in the ring
+uint32_t laRingTicksPerUs();
+LaEdge laRingAt(uint32_t index, void *ctx);   // oldest first, for laVcdBegin()
+
+#endif
@@ -0,0 +1,52 @@
+#include "la_sim.h"
+#include "la_vcd.h"
+
+void laSimBegin(LaSim &sim, la_sim_sink_t sink, void *ctx, uint32_t ticksPerUs, uint32_t start) {
+  sim.sink = sink;
+  sim.ctx = ctx;
+  sim.ticksPerUs = ticksPerUs ? ticksPerUs : 1;
+  sim.now = start;
+  sim.level = LA_SAMPLE_CLK | LA_SAMPLE_DATA;
+}
+
+void laSimWait(LaSim &sim, uint32_t us) {
+  sim.now += us * sim.ticksPerUs;
+}
+
+static void set(LaSim &sim, uint8_t mask, bool high) {
+  uint8_t s = high ? (sim.level | mask) : (sim.level & ~mask);
+  if (s == sim.level) return;
+  sim.level = s;
+  sim.sink(sim.now, s, sim.ctx);
+}
+
+void laSimClk(LaSim &sim, bool high) { set(sim, LA_SAMPLE_CLK, high); }
+void laSimData(LaSim &sim, bool high) { set(sim, LA_SAMPLE_DATA, high); }
+
+// XtatTx bus on a LaSim: lines and time are the simulation's. One
+// simulation clocks at a time (the loop on the device, the test on the host).
+struct LaSimBus {
+  static LaSim *sim;
+  static inline void clk(XtatWire &, bool hi) { laSimClk(*sim, hi); }
+  static inline void data(XtatWire &, bool hi) { laSimData(*sim, hi); }
+  static inline uint8_t readData(XtatWire &) { return (sim->level & LA_SAMPLE_DATA) ? 1 : 0; }
+  static inline void wait(unsigned int us) { laSimWait(*sim, us); }
+};
+LaSim *LaSimBus::sim = nullptr;
+
+void laSimSendByte(LaSim &sim, uint8_t proto, uint8_t b, uint16_t halfUs) {
+  XtatWire w = {};
+  w.bitDelayUs = halfUs;
+  LaSimBus::sim = &sim;
+  switch (proto) {
+    case XTAT_PROTO_XT:  XtatTx<LaSimBus, XTAT_PROTO_XT,  XTAT_TRACE_OFF>::sendByte(w, b); break;
+    case XTAT_PROTO_PS2: XtatTx<LaSimBus, XTAT_PROTO_PS2, XTAT_TRACE_OFF>::sendByte(w, b); break;
+    default:             XtatTx<LaSimBus, XTAT_PROTO_AT,  XTAT_TRACE_OFF>::sendByte(w, b); break;
+  }
+}
+
+void laSimInhibit(LaSim &sim, uint32_t us) {
+  laSimClk(sim, false);
+  laSimWait(sim, us);
+  laSimClk(sim, true);
+}
@@ -0,0 +1,35 @@
+#ifndef LA_SIM_H
+#define LA_SIM_H
+
+// Simulated CLK/DATA bus for the logic analyzer. Bytes are clocked by the
+// transmit engine itself (XtatTx in xtat_tx.h) on a bus that moves these
+// lines on a simulated clock, so every edge has exact timing; each one goes
+// to a sink. la_capture.cpp feeds them to the edge ring,
+// test/la_capture_test.cpp to the same ring on the host.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "xtat_tx.h"
+
+typedef void (*la_sim_sink_t)(uint32_t tick, uint8_t level, void *ctx);
+
+struct LaSim {
+  la_sim_sink_t sink;
+  void *ctx;
+  uint32_t ticksPerUs;
+  uint32_t now;
+  uint8_t level;            // LA_SAMPLE_*; both lines idle high at start
+};
+
+void laSimBegin(LaSim &sim, la_sim_sink_t sink, void *ctx, uint32_t ticksPerUs, uint32_t start);
+void laSimWait(LaSim &sim, uint32_t us);
+void laSimClk(LaSim &sim, bool high);
+void laSimData(LaSim &sim, bool high);
+
+// One byte through XtatTx<.., proto, XTAT_TRACE_OFF>::sendByte (proto is
+// XTAT_PROTO_*; AT/PS2 is the 11-bit frame with odd parity).
+void laSimSendByte(LaSim &sim, uint8_t proto, uint8_t b, uint16_t halfUs);
+// The host pulls CLK low for us, then lets it go.
+void laSimInhibit(LaSim &sim, uint32_t us);
+
+#endif
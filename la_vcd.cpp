@@ -0,0 +1,99 @@
+#include "la_vcd.h"
+#include <stdio.h>
+#include <string.h>
+
+enum { VCD_HEADER, VCD_BODY, VCD_TAIL, VCD_DONE };
+
+void laVcdBegin(LaVcdWriter &w, la_edge_fn_t edgeAt, void *ctx,
+                uint32_t count, uint32_t ticksPerUs, uint32_t triggerIndex) {
+  memset(&w, 0, sizeof(w));
+  w.edgeAt = edgeAt;
+  w.ctx = ctx;
+  w.count = count;
+  w.ticksPerUs = ticksPerUs ? ticksPerUs : 1;
+  w.triggerIndex = triggerIndex;
+  w.phase = VCD_HEADER;
+}
+
+static uint64_t toNs(const LaVcdWriter &w) {
+  return w.ticks * 1000 / w.ticksPerUs;
+}
+
+// Produces the next line into w.line; returns false when there is nothing left.
+static bool nextLine(LaVcdWriter &w) {
+  int n = 0;
+  switch (w.phase) {
+    case VCD_HEADER: {
+      n = snprintf(w.line, sizeof(w.line),
+                   "$version xtat la_capture $end\n"
+                   "$comment edges=%lu trigger=%ld $end\n"
+                   "$timescale 1ns $end\n"
+                   "$scope module xtat $end\n"
+                   "$var wire 1 c CLK $end\n"
+                   "$var wire 1 d DATA $end\n"
+                   "$upscope $end\n"
+                   "$enddefinitions $end\n",
+                   (unsigned long)w.count,
+                   w.triggerIndex < w.count ? (long)w.triggerIndex : -1L);
+      w.phase = w.count ? VCD_BODY : VCD_TAIL;
+      break;
+    }
+    case VCD_BODY: {
+      while (w.index < w.count) {
+        uint32_t i = w.index++;
+        LaEdge e = w.edgeAt(i, w.ctx);
+        uint8_t s = e.s & (LA_SAMPLE_CLK | LA_SAMPLE_DATA);
+        if (i == 0) {
+          n = snprintf(w.line, sizeof(w.line), "#0\n$dumpvars\n%dc\n%dd\n$end\n",
+                       s & LA_SAMPLE_CLK ? 1 : 0, s & LA_SAMPLE_DATA ? 1 : 0);
+        } else {
+          w.ticks += e.dt;
+          if (s != w.last) {
+            // Two edges inside one ns share the timestamp line.
+            uint64_t ns = toNs(w);
+            if (ns != w.lastNs) n = snprintf(w.line, sizeof(w.line), "#%llu\n", (unsigned long long)ns);
+            w.lastNs = ns;
+            if ((s ^ w.last) & LA_SAMPLE_CLK)
+              n += snprintf(w.line + n, sizeof(w.line) - n, "%dc\n", s & LA_SAMPLE_CLK ? 1 : 0);
+            if ((s ^ w.last) & LA_SAMPLE_DATA)
+              n += snprintf(w.line + n, sizeof(w.line) - n, "%dd\n", s & LA_SAMPLE_DATA ? 1 : 0);
+          }
+        }
+        w.last = s;
+        if (n > 0) break;
+      }
+      if (w.index >= w.count && n == 0) {
+        w.phase = VCD_TAIL;
+        return nextLine(w);
+      }
+      break;
+    }
+    case VCD_TAIL: {
+      // Records without a change (end of capture) still extend the time axis.
+      uint64_t ns = toNs(w);
+      if (ns > w.lastNs) n = snprintf(w.line, sizeof(w.line), "#%llu\n", (unsigned long long)ns);
+      w.phase = VCD_DONE;
+      if (n == 0) return false;
+      break;
+    }
+    default:
+      return false;
+  }
+  if (n >= (int)sizeof(w.line)) n = sizeof(w.line) - 1;
+  w.lineLen = (uint16_t)n;
+  w.linePos = 0;
+  return n > 0;
+}
+
+size_t laVcdRead(LaVcdWriter &w, uint8_t *buf, size_t max) {
+  size_t out = 0;
+  while (out < max) {
+    if (w.linePos >= w.lineLen && !nextLine(w)) break;
+    size_t take = w.lineLen - w.linePos;
+    if (take > max - out) take = max - out;
+    memcpy(buf + out, w.line + w.linePos, take);
+    w.linePos += (uint16_t)take;
+    out += take;
+  }
+  return out;
+}
@@ -0,0 +1,46 @@
+#ifndef LA_VCD_H
+#define LA_VCD_H
+
+// Incremental VCD (Value Change Dump) writer for two-line CLK/DATA captures.
+// Input is a list of edge records, each carrying the line levels after the
+// edge and the ticks since the record before it. Pure C/C++, and times are
+// written in ns, so a capture from the device and the same edges from the
+// simulated bus give byte-identical files; no wall-clock date is emitted
+// for that reason.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LA_SAMPLE_CLK  0x01
+#define LA_SAMPLE_DATA 0x02
+
+struct LaEdge {
+  uint32_t dt;               // ticks since the previous record (ignored for the first)
+  uint8_t s;                 // LA_SAMPLE_* levels after the edge
+};
+
+typedef LaEdge (*la_edge_fn_t)(uint32_t index, void *ctx);
+
+struct LaVcdWriter {
+  la_edge_fn_t edgeAt;
+  void *ctx;
+  uint32_t count;            // number of records
+  uint32_t ticksPerUs;
+  uint32_t triggerIndex;     // record index of the trigger, or count if none
+  uint8_t phase;
+  uint32_t index;
+  uint64_t ticks;            // since record 0
+  uint64_t lastNs;           // last timestamp written
+  uint8_t last;
+  char line[256];
+  uint16_t lineLen;
+  uint16_t linePos;
+};
+
+void laVcdBegin(LaVcdWriter &w, la_edge_fn_t edgeAt, void *ctx,
+                uint32_t count, uint32_t ticksPerUs, uint32_t triggerIndex);
+
+// Fills buf with up to max bytes of VCD text; returns 0 once finished.
+size_t laVcdRead(LaVcdWriter &w, uint8_t *buf, size_t max);
+
+#endif
@@ -0,0 +1,180 @@
+#include "logger.h"
+#include "realtime_ws.h"
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <atomic>
+
+#define LOG_RING      128        // power of two
+#define LOG_LINE_MAX  192
+#define LOG_IDLE_MS   10
+
+struct LogRecord {
+  const char *fmt;
+  uint32_t ts;
+  uint8_t module;
+  uint8_t level;
+  uint32_t args[4];
+};
+
+// Bounded MPSC queue (Vyukov): each slot's sequence number says whether it
+// is free for the producer holding position pos (seq == pos) or filled for
+// the consumer (seq == pos + 1).
+struct LogSlot {
+  std::atomic<uint32_t> seq;
+  LogRecord rec;
+};
+
+static LogSlot ring[LOG_RING];
+static std::atomic<uint32_t> enqPos(0);
+static uint32_t deqPos = 0;
+
+static std::atomic<uint32_t> written[LOG_MOD_COUNT];
+static std::atomic<uint32_t> dropped[LOG_MOD_COUNT];
+static uint32_t drained = 0;
+static uint32_t highWater = 0;
+
+static const char *MODULE_NAMES[LOG_MOD_COUNT] = { "xtat", "host", "usb", "typematic" };
+static const char *LEVEL_NAMES[] = { "off", "error", "warn", "info", "debug" };
+
+uint8_t logLevels[LOG_MOD_COUNT] = { LOG_DEBUG, LOG_INFO, LOG_INFO, LOG_INFO };
+
+bool logEvent(LogModule m, LogLevel lvl, const char *fmt,
+              uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3) {
+  if (lvl == LOG_OFF || !logEnabled(m, lvl)) return false;
+  uint32_t pos = enqPos.load(std::memory_order_relaxed);
+  LogSlot *s;
+  for (;;) {
+    s = &ring[pos & (LOG_RING - 1)];
+    uint32_t seq = s->seq.load(std::memory_order_acquire);
+    int32_t dif = (int32_t)(seq - pos);
+    if (dif == 0) {
+      if (enqPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+    } else if (dif < 0) {
+      dropped[m].fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = enqPos.load(std::memory_order_relaxed);
+    }
+  }
+  s->rec.fmt = fmt;
+  s->rec.ts = (uint32_t)micros();
+  s->rec.module = (uint8_t)m;
+  s->rec.level = (uint8_t)lvl;
+  s->rec.args[0] = a0; s->rec.args[1] = a1; s->rec.args[2] = a2; s->rec.args[3] = a3;
+  s->seq.store(pos + 1, std::memory_order_release);
+  written[m].fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+static bool logPop(LogRecord &out) {
+  LogSlot &s = ring[deqPos & (LOG_RING - 1)];
+  if (s.seq.load(std::memory_order_acquire) != deqPos + 1) return false;
+  out = s.rec;
+  s.seq.store(deqPos + LOG_RING, std::memory_order_release);
+  deqPos++;
+  return true;
+}
+
+static void forwardToWs(const LogRecord &r, const char *line) {
+  StaticJsonDocument<LOG_LINE_MAX + 64> doc;
+  doc["type"] = "log";
+  doc["mod"] = MODULE_NAMES[r.module];
+  doc["level"] = LEVEL_NAMES[r.level];
+  doc["ts"] = r.ts;
+  doc["msg"] = line;
+  char buf[255];
+  size_t n = serializeJson(doc, buf, sizeof(buf));
+  if (n > 0 && n < sizeof(buf)) realtimePublish(RT_CLASS_EVENTS, RT_REC_JSON, (const uint8_t *)buf, (uint8_t)n);
+}
+
+static void drainTask(void *) {
+  char line[LOG_LINE_MAX];
+  LogRecord r;
+  for (;;) {
+    uint32_t backlog = enqPos.load(std::memory_order_relaxed) - deqPos;
+    if (backlog > highWater) highWater = backlog;
+    if (!logPop(r)) {
+      vTaskDelay(pdMS_TO_TICKS(LOG_IDLE_MS));
+      continue;
+    }
+    snprintf(line, sizeof(line), r.fmt, r.args[0], r.args[1], r.args[2], r.args[3]);
+    Serial.println(line);
+    if (r.level <= LOG_INFO && realtimeWants(RT_CLASS_EVENTS)) forwardToWs(r, line);
+    drained++;
+  }
+}
+
+void logSetLevel(LogModule m, LogLevel lvl) {
+  if (m >= LOG_MOD_COUNT) return;
+  logLevels[m] = (uint8_t)lvl;
+  Preferences prefs;
+  prefs.begin("log", false);
+  prefs.putBytes("levels", logLevels, sizeof(logLevels));
+  prefs.end();
+}
+
+uint32_t logDropped() {
+  uint32_t n = 0;
+  for (int i = 0; i < LOG_MOD_COUNT; i++) n += dropped[i].load(std::memory_order_relaxed);
+  return n;
+}
+
+static int levelFromName(const char *s) {
+  for (int i = 0; i <= LOG_DEBUG; i++) if (strcmp(s, LEVEL_NAMES[i]) == 0) return i;
+  return -1;
+}
+
+static int moduleFromName(const char *s) {
+  for (int i = 0; i < LOG_MOD_COUNT; i++) if (strcmp(s, MODULE_NAMES[i]) == 0) return i;
+  return -1;
+}
+
+void logBegin() {
+  for (uint32_t i = 0; i < LOG_RING; i++) ring[i].seq.store(i, std::memory_order_relaxed);
+  enqPos.store(0, std::memory_order_relaxed);
+  deqPos = 0;
+
+  Preferences prefs;
+  prefs.begin("log", true);
+  if (prefs.getBytesLength("levels") == sizeof(logLevels)) prefs.getBytes("levels", logLevels, sizeof(logLevels));
+  prefs.end();
+
+  // Core 0, priority 1: never competes with the keyboard loop on core 1.
+  xTaskCreatePinnedToCore(drainTask, "logdrain", 3072, NULL, 1, NULL, 0);
+  Serial.printf("[LOG] Deferred logger ready (%u slots)\n", LOG_RING);
+}
+
+void logInit(AsyncWebServer &server) {
+  server.on("/api/log", HTTP_GET, [](AsyncWebServerRequest *req){
+    StaticJsonDocument<768> doc;
+    doc["ring"] = LOG_RING;
+    doc["backlog"] = enqPos.load(std::memory_order_relaxed) - deqPos;
+    doc["high_water"] = highWater;
+    doc["drained"] = drained;
+    doc["dropped"] = logDropped();
+    JsonObject mods = doc.createNestedObject("modules");
+    for (int i = 0; i < LOG_MOD_COUNT; i++) {
+      JsonObject m = mods.createNestedObject(MODULE_NAMES[i]);
+      m["level"] = LEVEL_NAMES[logLevels[i]];
+      m["written"] = written[i].load(std::memory_order_relaxed);
+      m["dropped"] = dropped[i].load(std::memory_order_relaxed);
+    }
+    String out; serializeJson(doc, out);
+    req->send(200, "application/json", out);
+  });
+
+  server.on("/api/log_level", HTTP_POST, [](AsyncWebServerRequest *req){
+    // The body handler answers; without a body it is never called.
+    if (!req->contentLength()) req->send(400, "application/json", "{\"error\":\"empty body\"}");
+  }, NULL, [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+    StaticJsonDocument<128> doc;
+    if (deserializeJson(doc, data, len)) { req->send(400, "application/json", "{\"error\":\"bad json\"}"); return; }
+    int m = moduleFromName(doc["module"] | "");
+    int lvl = levelFromName(doc["level"] | "");
+    if (m < 0 || lvl < 0) { req->send(400, "application/json", "{\"error\":\"unknown module or level\"}"); return; }
+    logSetLevel((LogModule)m, (LogLevel)lvl);
+    req->send(200, "application/json", "{\"status\":\"ok\"}");
+  });
+
+  Serial.println("[LOG] Endpoints registered");
+}
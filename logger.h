@@ -0,0 +1,52 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Deferred logger for hot paths. logEvent() copies a format pointer and up to
+// four 32-bit arguments into a lock-free MPSC ring (safe from any task or ISR)
+// and returns; a low-priority task formats records and writes them to Serial,
+// forwarding LOG_INFO and above to WebSocket subscribers of RT_CLASS_EVENTS.
+//
+// The format string is stored by pointer, so it must be a literal. %s
+// arguments must point at static storage too; wrap them in LOG_STR().
+// If the ring is full the record is dropped and counted, never waited for.
+// Records below the module's level are discarded by logEvent() itself;
+// logEnabled() only saves building the arguments. Returns false for both.
+
+enum LogModule {
+  LOG_MOD_XTAT = 0,     // make/break traces and bit dumps
+  LOG_MOD_HOST,         // host -> device commands
+  LOG_MOD_USB,          // USB HID ingestion
+  LOG_MOD_TYPEMATIC,    // repeat timing changes
+  LOG_MOD_COUNT
+};
+
+enum LogLevel {
+  LOG_OFF = 0,
+  LOG_ERROR,
+  LOG_WARN,
+  LOG_INFO,
+  LOG_DEBUG
+};
+
+#define LOG_STR(s) ((uint32_t)(uintptr_t)(const char *)(s))
+
+extern uint8_t logLevels[LOG_MOD_COUNT];
+
+static inline bool logEnabled(LogModule m, LogLevel lvl) {
+  return logLevels[m] >= lvl;
+}
+
+bool logEvent(LogModule m, LogLevel lvl, const char *fmt,
+              uint32_t a0 = 0, uint32_t a1 = 0, uint32_t a2 = 0, uint32_t a3 = 0);
+
+void logSetLevel(LogModule m, LogLevel lvl);
+uint32_t logDropped();
+
+void logBegin();                      // ring + drainer task; call right after Serial.begin()
+void logInit(AsyncWebServer &server); // /api/log, /api/log_level
+
+#endif
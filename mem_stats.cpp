@@ -0,0 +1,205 @@
+#include "mem_stats.h"
+#include <atomic>
+
+#define MEM_SAMPLE_MS 5000
+#define MEM_HISTORY   60              // 5 minutes at one sample per 5 s
+
+struct SubsysStats {
+  std::atomic<uint32_t> allocs;
+  std::atomic<uint32_t> frees;
+  std::atomic<uint32_t> bytesTotal;
+  std::atomic<int32_t> live;
+  std::atomic<int32_t> peak;
+  std::atomic<uint32_t> largest;
+};
+
+struct MemSample { uint32_t ms, freeBytes, largestBlock, minFree; };
+
+static SubsysStats subsys[MEM_SUBSYS_COUNT];
+static const char *SUBSYS_NAMES[MEM_SUBSYS_COUNT] = { "web", "ws", "keymap", "ota" };
+
+static portMUX_TYPE histMux = portMUX_INITIALIZER_UNLOCKED;
+static MemSample history[MEM_HISTORY];
+static uint8_t histHead = 0, histCount = 0;
+static unsigned long lastSampleMs = 0;
+
+// Tasks whose stacks are worth watching. Looked up by name on every sample,
+// so tasks started late (autoota) appear once they exist.
+static const char *TASK_NAMES[] = {
+  "loopTask", "async_tcp", "logdrain", "flightrec", "autoota", "tiT", "sys_evt",
+};
+#define MEM_TASKS (sizeof(TASK_NAMES) / sizeof(TASK_NAMES[0]))
+static uint32_t stackFree[MEM_TASKS];  // bytes never touched, UINT32_MAX = not running
+
+static inline void atomicMax(std::atomic<int32_t> &a, int32_t v) {
+  int32_t cur = a.load(std::memory_order_relaxed);
+  while (v > cur && !a.compare_exchange_weak(cur, v, std::memory_order_relaxed)) { }
+}
+
+static inline void atomicMaxU(std::atomic<uint32_t> &a, uint32_t v) {
+  uint32_t cur = a.load(std::memory_order_relaxed);
+  while (v > cur && !a.compare_exchange_weak(cur, v, std::memory_order_relaxed)) { }
+}
+
+void memNote(MemSubsys s, size_t bytes) {
+  SubsysStats &st = subsys[s];
+  st.allocs.fetch_add(1, std::memory_order_relaxed);
+  st.bytesTotal.fetch_add(bytes, std::memory_order_relaxed);
+  atomicMaxU(st.largest, bytes);
+}
+
+void memCountAlloc(MemSubsys s, size_t bytes) {
+  memNote(s, bytes);
+  SubsysStats &st = subsys[s];
+  int32_t live = st.live.fetch_add((int32_t)bytes, std::memory_order_relaxed) + (int32_t)bytes;
+  atomicMax(st.peak, live);
+}
+
+void memCountFree(MemSubsys s, size_t bytes) {
+  SubsysStats &st = subsys[s];
+  st.frees.fetch_add(1, std::memory_order_relaxed);
+  st.live.fetch_sub((int32_t)bytes, std::memory_order_relaxed);
+}
+
+static MemSample sampleHeap() {
+  MemSample m;
+  m.ms = millis();
+  m.freeBytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  m.largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  m.minFree = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  return m;
+}
+
+// ESP-IDF counts stack in bytes, so the high-water mark is bytes left.
+static void sampleStacks() {
+  for (size_t i = 0; i < MEM_TASKS; i++) {
+    TaskHandle_t h = xTaskGetHandle(TASK_NAMES[i]);
+    stackFree[i] = h ? (uint32_t)uxTaskGetStackHighWaterMark(h) : UINT32_MAX;
+  }
+}
+
+static void takeSample() {
+  MemSample m = sampleHeap();
+  sampleStacks();
+  portENTER_CRITICAL(&histMux);
+  history[histHead] = m;
+  histHead = (histHead + 1) % MEM_HISTORY;
+  if (histCount < MEM_HISTORY) histCount++;
+  portEXIT_CRITICAL(&histMux);
+}
+
+void memBegin() {
+  for (size_t i = 0; i < MEM_TASKS; i++) stackFree[i] = UINT32_MAX;
+  takeSample();
+  lastSampleMs = millis();
+}
+
+void memTask() {
+  unsigned long now = millis();
+  if (now - lastSampleMs < MEM_SAMPLE_MS) return;
+  lastSampleMs = now;
+  takeSample();
+}
+
+void memPrometheus(String &out) {
+  char line[128];
+  MemSample m = sampleHeap();
+  snprintf(line, sizeof(line), "# TYPE heap_free_bytes gauge\nheap_free_bytes %lu\n", (unsigned long)m.freeBytes);
+  out += line;
+  snprintf(line, sizeof(line), "# TYPE heap_largest_free_block_bytes gauge\nheap_largest_free_block_bytes %lu\n",
+           (unsigned long)m.largestBlock);
+  out += line;
+  snprintf(line, sizeof(line), "# TYPE heap_min_free_bytes gauge\nheap_min_free_bytes %lu\n", (unsigned long)m.minFree);
+  out += line;
+  out += "# TYPE mem_allocs_total counter\n";
+  for (int i = 0; i < MEM_SUBSYS_COUNT; i++) {
+    snprintf(line, sizeof(line), "mem_allocs_total{subsys=\"%s\"} %lu\n", SUBSYS_NAMES[i],
+             (unsigned long)subsys[i].allocs.load(std::memory_order_relaxed));
+    out += line;
+  }
+  out += "# TYPE mem_alloc_bytes_total counter\n";
+  for (int i = 0; i < MEM_SUBSYS_COUNT; i++) {
+    snprintf(line, sizeof(line), "mem_alloc_bytes_total{subsys=\"%s\"} %lu\n", SUBSYS_NAMES[i],
+             (unsigned long)subsys[i].bytesTotal.load(std::memory_order_relaxed));
+    out += line;
+  }
+  out += "# TYPE mem_live_bytes gauge\n";
+  for (int i = 0; i < MEM_SUBSYS_COUNT; i++) {
+    snprintf(line, sizeof(line), "mem_live_bytes{subsys=\"%s\"} %ld\n", SUBSYS_NAMES[i],
+             (long)subsys[i].live.load(std::memory_order_relaxed));
+    out += line;
+  }
+  out += "# TYPE mem_peak_bytes gauge\n";
+  for (int i = 0; i < MEM_SUBSYS_COUNT; i++) {
+    snprintf(line, sizeof(line), "mem_peak_bytes{subsys=\"%s\"} %ld\n", SUBSYS_NAMES[i],
+             (long)subsys[i].peak.load(std::memory_order_relaxed));
+    out += line;
+  }
+  out += "# TYPE task_stack_free_min_bytes gauge\n";
+  for (size_t i = 0; i < MEM_TASKS; i++) {
+    if (stackFree[i] == UINT32_MAX) continue;
+    snprintf(line, sizeof(line), "task_stack_free_min_bytes{task=\"%s\"} %lu\n", TASK_NAMES[i],
+             (unsigned long)stackFree[i]);
+    out += line;
+  }
+}
+
+static String memJSON() {
+  MemJsonDocument<MEM_WEB> doc(JSON_OBJECT_SIZE(8) + JSON_ARRAY_SIZE(MEM_HISTORY) + MEM_HISTORY * JSON_ARRAY_SIZE(4) +
+                               (MEM_SUBSYS_COUNT + 1) * JSON_OBJECT_SIZE(6) + MEM_TASKS * JSON_OBJECT_SIZE(1) + 256);
+  MemSample now = sampleHeap();
+  JsonObject heap = doc.createNestedObject("heap");
+  heap["free"] = now.freeBytes;
+  heap["largest_block"] = now.largestBlock;
+  heap["min_free"] = now.minFree;
+  heap["total"] = heap_caps_get_total_size(MALLOC_CAP_8BIT);
+  // Refresh the calling task (AsyncTCP) now; the rest are from the last sample.
+  JsonObject stacks = doc.createNestedObject("stack_free_min");
+  const char *self = pcTaskGetName(NULL);
+  for (size_t i = 0; i < MEM_TASKS; i++) {
+    if (strcmp(TASK_NAMES[i], self) == 0) stackFree[i] = (uint32_t)uxTaskGetStackHighWaterMark(NULL);
+  }
+  for (size_t i = 0; i < MEM_TASKS; i++) {
+    if (stackFree[i] != UINT32_MAX) stacks[TASK_NAMES[i]] = stackFree[i];
+  }
+  JsonObject alloc = doc.createNestedObject("alloc");
+  for (int i = 0; i < MEM_SUBSYS_COUNT; i++) {
+    const SubsysStats &st = subsys[i];
+    JsonObject o = alloc.createNestedObject(SUBSYS_NAMES[i]);
+    o["count"] = st.allocs.load(std::memory_order_relaxed);
+    o["frees"] = st.frees.load(std::memory_order_relaxed);
+    o["bytes"] = st.bytesTotal.load(std::memory_order_relaxed);
+    o["live"] = st.live.load(std::memory_order_relaxed);
+    o["peak"] = st.peak.load(std::memory_order_relaxed);
+    o["largest"] = st.largest.load(std::memory_order_relaxed);
+  }
+  doc["sample_ms"] = MEM_SAMPLE_MS;
+  JsonArray hist = doc.createNestedArray("history");   // oldest first: [ms, free, largest, min_free]
+  MemSample snap[MEM_HISTORY];
+  uint8_t n, head;
+  portENTER_CRITICAL(&histMux);
+  n = histCount;
+  head = histHead;
+  memcpy(snap, history, sizeof(snap));
+  portEXIT_CRITICAL(&histMux);
+  for (uint8_t k = 0; k < n; k++) {
+    const MemSample &m = snap[(head + MEM_HISTORY - n + k) % MEM_HISTORY];
+    JsonArray row = hist.createNestedArray();
+    row.add(m.ms);
+    row.add(m.freeBytes);
+    row.add(m.largestBlock);
+    row.add(m.minFree);
+  }
+  String out;
+  serializeJson(doc, out);
+  return out;
+}
+
+void memInit(AsyncWebServer &server) {
+  server.on("/api/mem", HTTP_GET, [](AsyncWebServerRequest *req){
+    String out = memJSON();
+    memNote(MEM_WEB, out.length());
+    req->send(200, "application/json", out);
+  });
+  Serial.println("[MEM] /api/mem ready");
+}
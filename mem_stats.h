@@ -0,0 +1,63 @@
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+#include <esp_heap_caps.h>
+
+// Memory observability: a heap history (free, largest free block, all-time
+// minimum) sampled from the loop, per-task stack high-water marks, and
+// allocations attributed to the subsystems that make them. Exposed at
+// /api/mem and as gauges/counters in /api/metrics.
+//
+// Attribution is explicit. JSON documents use MemJsonDocument<subsystem>,
+// which counts its pool on the heap; buffers handed off to the web stack
+// (response bodies, WebSocket frames) are counted with memNote().
+
+enum MemSubsys {
+  MEM_WEB = 0,      // REST handlers and response bodies
+  MEM_WS,           // WebSocket frames
+  MEM_KEYMAP,       // keymap and keymapEx documents
+  MEM_OTA,          // manifest, update bookkeeping
+  MEM_SUBSYS_COUNT
+};
+
+void memCountAlloc(MemSubsys s, size_t bytes);
+void memCountFree(MemSubsys s, size_t bytes);
+void memNote(MemSubsys s, size_t bytes);   // counted, but freed by someone else
+
+// ArduinoJson allocator that keeps the document pool off the caller's stack
+// (the AsyncTCP task has 8 KB) and charges it to S.
+template <MemSubsys S>
+struct MemAllocator {
+  void *allocate(size_t n) {
+    void *p = malloc(n);
+    if (p) memCountAlloc(S, heap_caps_get_allocated_size(p));
+    return p;
+  }
+  void deallocate(void *p) {
+    if (!p) return;
+    memCountFree(S, heap_caps_get_allocated_size(p));
+    free(p);
+  }
+  void *reallocate(void *p, size_t n) {
+    size_t was = p ? heap_caps_get_allocated_size(p) : 0;
+    void *q = realloc(p, n);
+    if (!q) return nullptr;
+    memCountFree(S, was);
+    memCountAlloc(S, heap_caps_get_allocated_size(q));
+    return q;
+  }
+};
+
+template <MemSubsys S>
+using MemJsonDocument = BasicJsonDocument<MemAllocator<S> >;
+
+void memBegin();
+void memTask();                              // samples the heap every MEM_SAMPLE_MS
+void memPrometheus(String &out);             // appended by metricsPrometheus()
+void memInit(AsyncWebServer &server);        // GET /api/mem
+
+#endif
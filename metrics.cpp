@@ -0,0 +1,115 @@
+#include "metrics.h"
+#include "realtime_ws.h"
+#include "mem_stats.h"
+
+#define METRICS_WS_INTERVAL_MS 1000
+#define METRICS_WS_VERSION     1
+
+std::atomic<uint32_t> metricCounters[M_COUNTER_COUNT];
+std::atomic<uint32_t> metricQueueHighWater(0);
+
+struct Histogram {
+  std::atomic<uint32_t> buckets[METRICS_BUCKETS];
+  std::atomic<uint32_t> count;
+  std::atomic<uint32_t> sumUs;
+};
+
+static Histogram histograms[H_HIST_COUNT];
+static unsigned long lastPublishMs = 0;
+
+static const char *COUNTER_NAMES[M_COUNTER_COUNT] = {
+  "xtat_events_ingested_total",
+  "xtat_events_translated_total",
+  "xtat_events_queued_total",
+  "xtat_queue_overflow_total",
+  "xtat_sequences_transmitted_total",
+  "xtat_bytes_sent_total",
+  "xtat_host_bytes_total",
+  "xtat_host_resends_total",
+  "xtat_host_rx_errors_total",
+};
+
+static const char *HIST_NAMES[H_HIST_COUNT] = {
+  "xtat_ingress_to_wire_us",
+  "xtat_tx_duration_us",
+};
+
+void metricsObserveUs(MetricHistogram h, uint32_t us) {
+  uint32_t b = us ? 32 - __builtin_clz(us) : 0;
+  if (b >= METRICS_BUCKETS) b = METRICS_BUCKETS - 1;
+  Histogram &hist = histograms[h];
+  hist.buckets[b].fetch_add(1, std::memory_order_relaxed);
+  hist.count.fetch_add(1, std::memory_order_relaxed);
+  hist.sumUs.fetch_add(us, std::memory_order_relaxed);
+}
+
+uint32_t metricsCounter(MetricCounter c) {
+  return metricCounters[c].load(std::memory_order_relaxed);
+}
+
+String metricsPrometheus() {
+  String out;
+  out.reserve(4096);
+  char line[96];
+  for (int i = 0; i < M_COUNTER_COUNT; i++) {
+    snprintf(line, sizeof(line), "# TYPE %s counter\n%s %lu\n", COUNTER_NAMES[i], COUNTER_NAMES[i],
+             (unsigned long)metricsCounter((MetricCounter)i));
+    out += line;
+  }
+  snprintf(line, sizeof(line), "# TYPE xtat_queue_high_water gauge\nxtat_queue_high_water %lu\n",
+           (unsigned long)metricQueueHighWater.load(std::memory_order_relaxed));
+  out += line;
+  for (int h = 0; h < H_HIST_COUNT; h++) {
+    const Histogram &hist = histograms[h];
+    snprintf(line, sizeof(line), "# TYPE %s histogram\n", HIST_NAMES[h]);
+    out += line;
+    uint32_t cum = 0;
+    for (int b = 0; b < METRICS_BUCKETS - 1; b++) {
+      cum += hist.buckets[b].load(std::memory_order_relaxed);
+      snprintf(line, sizeof(line), "%s_bucket{le=\"%lu\"} %lu\n", HIST_NAMES[h],
+               (unsigned long)((1UL << b) - 1), (unsigned long)cum);
+      out += line;
+    }
+    cum += hist.buckets[METRICS_BUCKETS - 1].load(std::memory_order_relaxed);
+    snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %lu\n", HIST_NAMES[h], (unsigned long)cum);
+    out += line;
+    snprintf(line, sizeof(line), "%s_sum %lu\n%s_count %lu\n",
+             HIST_NAMES[h], (unsigned long)hist.sumUs.load(std::memory_order_relaxed),
+             HIST_NAMES[h], (unsigned long)hist.count.load(std::memory_order_relaxed));
+    out += line;
+  }
+  memPrometheus(out);
+  return out;
+}
+
+static inline uint8_t *putU32(uint8_t *p, uint32_t v) {
+  p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF; p[2] = (v >> 16) & 0xFF; p[3] = v >> 24;
+  return p + 4;
+}
+
+// RT_REC_METRICS payload:
+// [u8 version][u8 n counters][u32 counters...][u32 queue hwm]
+// [u8 n buckets][u32 ingress-to-wire buckets...]
+void metricsTask() {
+  unsigned long now = millis();
+  if (now - lastPublishMs < METRICS_WS_INTERVAL_MS) return;
+  lastPublishMs = now;
+  if (!realtimeWants(RT_CLASS_METRICS)) return;
+  uint8_t payload[3 + 4 * M_COUNTER_COUNT + 4 + 4 * METRICS_BUCKETS];
+  uint8_t *p = payload;
+  *p++ = METRICS_WS_VERSION;
+  *p++ = M_COUNTER_COUNT;
+  for (int i = 0; i < M_COUNTER_COUNT; i++) p = putU32(p, metricsCounter((MetricCounter)i));
+  p = putU32(p, metricQueueHighWater.load(std::memory_order_relaxed));
+  *p++ = METRICS_BUCKETS;
+  for (int b = 0; b < METRICS_BUCKETS; b++)
+    p = putU32(p, histograms[H_INGRESS_TO_WIRE].buckets[b].load(std::memory_order_relaxed));
+  realtimePublish(RT_CLASS_METRICS, RT_REC_METRICS, payload, (uint8_t)(p - payload));
+}
+
+void metricsInit(AsyncWebServer &server) {
+  server.on("/api/metrics", HTTP_GET, [](AsyncWebServerRequest *req){
+    req->send(200, "text/plain; version=0.0.4", metricsPrometheus());
+  });
+  Serial.println("[METRICS] /api/metrics ready");
+}
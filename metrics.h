@@ -0,0 +1,52 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include <atomic>
+
+// Pipeline counters and log2-bucket latency histograms. Updates are single
+// relaxed atomic ops so they are safe from any task and cheap on the hot path.
+
+enum MetricCounter {
+  M_INGESTED = 0,       // key events handed to xtatSendFromUSB()
+  M_TRANSLATED,         // events that mapped to a scancode
+  M_QUEUED,             // events accepted by the output queue
+  M_QUEUE_OVERFLOW,     // queue full, sent synchronously instead
+  M_TRANSMITTED,        // make/break sequences put on the wire
+  M_BYTES_SENT,         // raw bytes clocked out
+  M_HOST_BYTES,         // bytes received from the host
+  M_HOST_RESENDS,       // host 0xFE resend requests
+  M_HOST_RX_ERRORS,     // host bytes with bad parity or stop bit, or cut short
+  M_COUNTER_COUNT
+};
+
+enum MetricHistogram {
+  H_INGRESS_TO_WIRE = 0,  // xtatSendFromUSB() to last bit on the wire
+  H_TX_DURATION,          // time spent clocking one sequence
+  H_HIST_COUNT
+};
+
+#define METRICS_BUCKETS 24   // bucket i counts values < 2^i us, last one is +Inf
+
+extern std::atomic<uint32_t> metricCounters[M_COUNTER_COUNT];
+extern std::atomic<uint32_t> metricQueueHighWater;
+
+static inline void metricsInc(MetricCounter c) {
+  metricCounters[c].fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline void metricsQueueDepth(uint32_t depth) {
+  uint32_t cur = metricQueueHighWater.load(std::memory_order_relaxed);
+  while (depth > cur && !metricQueueHighWater.compare_exchange_weak(cur, depth, std::memory_order_relaxed)) { }
+}
+
+void metricsObserveUs(MetricHistogram h, uint32_t us);
+uint32_t metricsCounter(MetricCounter c);
+String metricsPrometheus();
+
+void metricsInit(AsyncWebServer &server);
+void metricsTask();
+
+#endif
@@ -1,12 +1,40 @@
 #include "ota.h"
+#include "rollback.h"
+#include "snapshot.h"
 #include <Arduino.h>
+#include <Update.h>
+
+String firmware_version = FIRMWARE_VERSION;
 
 static bool ota_initialized = false;
+static bool ota_was_running = false;
+static portMUX_TYPE ota_mux = portMUX_INITIALIZER_UNLOCKED;
+static OtaOwner ota_owner = OTA_NONE;
 
 // Optional: OTA password protection
 static const char* OTA_USERNAME = "admin";     // ändra vid behov
 static const char* OTA_PASSWORD = "espupdate"; // ändra vid behov
 
+bool otaClaim(OtaOwner who)
+{
+    // En uppladdning till /update syns först när Update redan körs.
+    bool idle = who == OTA_UPLOAD || !Update.isRunning();
+    portENTER_CRITICAL(&ota_mux);
+    bool ok = idle && ota_owner == OTA_NONE;
+    if (ok) ota_owner = who;
+    portEXIT_CRITICAL(&ota_mux);
+    return ok;
+}
+
+void otaRelease(OtaOwner who)
+{
+    portENTER_CRITICAL(&ota_mux);
+    if (ota_owner == who) ota_owner = OTA_NONE;
+    portEXIT_CRITICAL(&ota_mux);
+}
+
+OtaOwner otaOwner() { return ota_owner; }
+
 void setupOTA(AsyncWebServer &server)
 {
     if (ota_initialized) return;
@@ -14,6 +42,16 @@ void setupOTA(AsyncWebServer &server)
 
     Serial.println("[OTA] Initializing AsyncElegantOTA...");
 
+    // Registreras före AsyncElegantOTA så att den här tar /update medan en
+    // annan uppdatering pågår; annars skulle den nya uppladdningen skriva
+    // in i den som körs. Kroppen slängs.
+    server.on("/update", HTTP_POST, [](AsyncWebServerRequest *request) {
+        request->send(409, "text/plain", "another update in progress");
+    }, [](AsyncWebServerRequest *, const String &, size_t, uint8_t *, size_t, bool) {
+    }).setFilter([](AsyncWebServerRequest *) {
+        return otaOwner() != OTA_NONE;
+    });
+
     // ==========================
     // Uncomment ONE of these:
     // ==========================
@@ -30,6 +68,29 @@ void setupOTA(AsyncWebServer &server)
 // Körs i loopen
 void otaPeriodic()
 {
-    // Måste köras för att OTA ska fungera korrekt i Async-miljö
-    AsyncElegantOTA.loop();
+    // AsyncElegantOTA har inga callbacks: en uppladdning till /update syns
+    // bara som att Update körs och sedan slutar. Update.end(true) nollställer
+    // Update, så ett stopp utan fel betyder att den nya imagen är klar; då
+    // sparas en snapshot och nästa boot markeras som OTA-boot. Avbryts den
+    // tas markeringen bort. auto_ota och delta_ota har otaClaim() och
+    // sköter det själva.
+    bool running = Update.isRunning();
+    if (!ota_was_running) {
+        ota_was_running = running && otaClaim(OTA_UPLOAD);
+    } else if (!running) {
+        ota_was_running = false;
+        if (Update.hasError()) {
+            Serial.printf("[OTA] Update aborted (error %u)\n", Update.getError());
+            clearNextBootAsOTA();
+            otaRelease(OTA_UPLOAD);
+        } else {
+            Serial.println("[OTA] Update finished, taking snapshot");
+            snapshotCapture(SNAP_REASON_OTA);
+            markNextBootAsOTA();
+        }
+    }
+
+    // Måste köras för att OTA ska fungera korrekt i Async-miljö. Den startar
+    // om efter en uppladdning, så den körs inte förrän stoppet ovan är sett.
+    if (!ota_was_running) AsyncElegantOTA.loop();
 }
@@ -2,5 +2,19 @@
 #include <AsyncElegantOTA.h>
 #include <ESPAsyncWebServer.h>
 
+#ifndef FIRMWARE_VERSION
+  #define FIRMWARE_VERSION "0.0.0"
+#endif
+
+extern String firmware_version;   // FIRMWARE_VERSION, compared by auto_ota
+
+// One update at a time, whether it comes through /update, /api/ota_delta
+// or auto_ota. Whoever writes an image claims first and releases after a
+// failure; a successful update keeps the claim until the reboot.
+enum OtaOwner : uint8_t { OTA_NONE, OTA_UPLOAD, OTA_DELTA, OTA_AUTO };
+bool otaClaim(OtaOwner who);       // false while another update runs
+void otaRelease(OtaOwner who);
+OtaOwner otaOwner();
+
 void setupOTA(AsyncWebServer &server);
 void otaPeriodic();
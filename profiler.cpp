@@ -0,0 +1,156 @@
+#include "profiler.h"
+#include "mem_stats.h"
+#include <ArduinoJson.h>
+
+#define PROF_WINDOW_MS     5000   // stats roll over every window
+#define PROF_BUCKETS       32     // log2 buckets of cycles, for p99
+#define PROF_REPORT_GAP_MS 1000   // at most one overrun log line per stage per second
+
+struct ProfWindow {
+  uint32_t count;
+  uint64_t sum;
+  uint32_t min;
+  uint32_t max;
+  uint32_t buckets[PROF_BUCKETS];
+};
+
+struct ProfStage {
+  const char *name;
+  ProfWindow cur;
+  ProfWindow last;
+  uint32_t overruns;
+  uint32_t worst;                 // all-time max cycles
+  unsigned long lastReportMs;
+};
+
+static ProfStage stages[PROF_MAX_STAGES];
+static int stageCount = 0;
+static uint32_t budgetUs = 2000;
+static unsigned long windowStartMs = 0;
+static portMUX_TYPE profMux = portMUX_INITIALIZER_UNLOCKED;
+
+static inline uint32_t cyclesPerUs() {
+  return ESP.getCpuFreqMHz();
+}
+
+static void resetWindow(ProfWindow &w) {
+  memset(&w, 0, sizeof(w));
+  w.min = UINT32_MAX;
+}
+
+int profRegister(const char *name) {
+  portENTER_CRITICAL(&profMux);
+  int id = -1;
+  for (int i = 0; i < stageCount; i++) {
+    if (strcmp(stages[i].name, name) == 0) { id = i; break; }
+  }
+  if (id < 0 && stageCount < PROF_MAX_STAGES) {
+    id = stageCount++;
+    memset(&stages[id], 0, sizeof(ProfStage));
+    stages[id].name = name;
+    resetWindow(stages[id].cur);
+    resetWindow(stages[id].last);
+  }
+  portEXIT_CRITICAL(&profMux);
+  return id;
+}
+
+static void rollWindows(unsigned long now) {
+  windowStartMs = now;
+  for (int i = 0; i < stageCount; i++) {
+    stages[i].last = stages[i].cur;
+    resetWindow(stages[i].cur);
+  }
+}
+
+void profRecord(int id, uint32_t cycles) {
+  if (id < 0) return;
+  unsigned long now = millis();
+  bool report = false;
+  portENTER_CRITICAL(&profMux);
+  if (now - windowStartMs >= PROF_WINDOW_MS) rollWindows(now);
+  ProfStage &s = stages[id];
+  ProfWindow &w = s.cur;
+  w.count++;
+  w.sum += cycles;
+  if (cycles < w.min) w.min = cycles;
+  if (cycles > w.max) w.max = cycles;
+  if (cycles > s.worst) s.worst = cycles;
+  uint32_t b = cycles ? 32 - __builtin_clz(cycles) : 0;
+  w.buckets[b >= PROF_BUCKETS ? PROF_BUCKETS - 1 : b]++;
+  if (budgetUs && cycles > budgetUs * cyclesPerUs()) {
+    s.overruns++;
+    if (now - s.lastReportMs >= PROF_REPORT_GAP_MS) { s.lastReportMs = now; report = true; }
+  }
+  portEXIT_CRITICAL(&profMux);
+  if (report) {
+    Serial.printf("[PROF] Stage '%s' took %luus (budget %luus)\n", stages[id].name,
+                  (unsigned long)(cycles / cyclesPerUs()), (unsigned long)budgetUs);
+  }
+}
+
+void profSetBudgetUs(uint32_t us) { budgetUs = us; }
+uint32_t profBudgetUs() { return budgetUs; }
+
+// Upper bound of the log2 bucket holding the 99th percentile.
+static uint32_t p99Cycles(const ProfWindow &w) {
+  if (!w.count) return 0;
+  uint32_t target = w.count - w.count / 100;
+  uint32_t cum = 0;
+  for (int b = 0; b < PROF_BUCKETS; b++) {
+    cum += w.buckets[b];
+    if (cum >= target) {
+      uint32_t upper = (1UL << b) - 1;
+      return upper < w.max ? upper : w.max;
+    }
+  }
+  return w.max;
+}
+
+String profJSON() {
+  MemJsonDocument<MEM_WEB> doc(4096);
+  doc["budget_us"] = budgetUs;
+  doc["window_ms"] = PROF_WINDOW_MS;
+  JsonArray arr = doc.createNestedArray("stages");
+  uint32_t cpu = cyclesPerUs();
+  // snapshot on the heap: the table is too large for the AsyncTCP stack
+  ProfStage *snap = (ProfStage*)malloc(sizeof(ProfStage) * PROF_MAX_STAGES);
+  if (!snap) return "{\"error\":\"oom\"}";
+  portENTER_CRITICAL(&profMux);
+  int n = stageCount;
+  memcpy(snap, stages, sizeof(ProfStage) * n);
+  portEXIT_CRITICAL(&profMux);
+  for (int i = 0; i < n; i++) {
+    const ProfStage &s = snap[i];
+    // report the last complete window, or the current one before the first rollover
+    const ProfWindow &w = s.last.count ? s.last : s.cur;
+    JsonObject o = arr.createNestedObject();
+    o["name"] = s.name;
+    o["count"] = w.count;
+    o["min_us"] = w.count ? w.min / cpu : 0;
+    o["avg_us"] = w.count ? (uint32_t)(w.sum / w.count / cpu) : 0;
+    o["p99_us"] = p99Cycles(w) / cpu;
+    o["max_us"] = w.max / cpu;
+    o["worst_us"] = s.worst / cpu;
+    o["overruns"] = s.overruns;
+  }
+  free(snap);
+  String out;
+  serializeJson(doc, out);
+  return out;
+}
+
+void profInit(AsyncWebServer &server) {
+  server.on("/api/profile", HTTP_GET, [](AsyncWebServerRequest *req){
+    req->send(200, "application/json", profJSON());
+  });
+  server.on("/api/profile_budget", HTTP_POST, [](AsyncWebServerRequest *req){
+    req->send(200, "application/json", "{\"status\":\"ok\"}");
+  }, NULL, [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+    StaticJsonDocument<64> doc;
+    if (deserializeJson(doc, data, len)) { req->send(400, "application/json", "{\"error\":\"bad json\"}"); return; }
+    profSetBudgetUs(doc["budget_us"] | budgetUs);
+    req->send(200, "application/json", "{\"status\":\"saved\"}");
+  });
+  Serial.println("[PROF] /api/profile ready");
+}
@@ -0,0 +1,37 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Stage profiler: per-stage cycle counts with rolling min/avg/p99/max and a
+// budget check. Usable for main-loop stages and AsyncTCP handlers alike:
+//
+//   PROF_STAGE("usb");            // times the rest of the enclosing scope
+
+#define PROF_MAX_STAGES 24
+
+int profRegister(const char *name);
+void profRecord(int id, uint32_t cycles);
+void profSetBudgetUs(uint32_t us);
+uint32_t profBudgetUs();
+String profJSON();
+void profInit(AsyncWebServer &server);
+
+class ProfScope {
+public:
+  explicit ProfScope(int id) : id_(id), t0_(ESP.getCycleCount()) {}
+  ~ProfScope() { profRecord(id_, ESP.getCycleCount() - t0_); }
+private:
+  int id_;
+  uint32_t t0_;
+};
+
+#define PROF_CONCAT2(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT2(a, b)
+#define PROF_STAGE(name) \
+  static int PROF_CONCAT(_prof_id_, __LINE__) = profRegister(name); \
+  ProfScope PROF_CONCAT(_prof_scope_, __LINE__)(PROF_CONCAT(_prof_id_, __LINE__))
+
+#endif
@@ -0,0 +1,374 @@
+#include "ps2_mouse.h"
+#include "logger.h"
+
+// Clock 12.5 kHz; the spec allows 10-16.7 kHz.
+#define PS2M_HALF_US       40
+#define PS2M_QUARTER_US    20
+#define PS2M_GAP_US        60
+#define PS2M_OUT_SLOTS     16
+#define PS2M_ACC_LIMIT     4096       // cap on pending motion while the host is slow
+
+enum MouseMode { MM_STREAM = 0, MM_REMOTE = 1 };
+
+static uint8_t clkPin = 0xFF, dataPin = 0xFF;
+
+// Host-visible state, loop task only.
+static MouseMode mode = MM_STREAM;
+static bool reporting = false;
+static bool wrapMode = false;
+static bool scale21 = false;
+static uint8_t sampleRate = 100;
+static uint8_t resolution = 2;       // 0..3 = 1, 2, 4, 8 counts/mm
+static uint8_t deviceId = 0;         // 3 after the IntelliMouse rate sequence
+static uint8_t rateHistory[3] = {0, 0, 0};
+static uint8_t pendingArg = 0;       // F3 / E8 waiting for its argument
+static uint32_t lastPacketMs = 0;
+
+static uint8_t outBuf[PS2M_OUT_SLOTS];
+static uint8_t outHead = 0, outTail = 0;
+static uint8_t lastSent[4];
+static uint8_t lastSentLen = 0;
+
+// Accumulator, written from the USB task.
+static portMUX_TYPE accMux = portMUX_INITIALIZER_UNLOCKED;
+static int32_t accX = 0, accY = 0, accZ = 0;   // PS/2 directions: up and wheel-down positive
+static uint8_t accButtons = 0, sentButtons = 0;
+static bool accPending = false;
+
+static struct {
+  uint32_t usbReports, coalesced, packets, hostCmds, aborted, rxErrors;
+} stats;
+
+// ---- Wire: open drain, the host and the mouse both pull low ----
+
+static inline void lineClk(bool hi) { digitalWrite(clkPin, hi ? HIGH : LOW); }
+static inline void lineData(bool hi) { digitalWrite(dataPin, hi ? HIGH : LOW); }
+static inline bool clkHigh() { return digitalRead(clkPin) == HIGH; }
+static inline bool dataHigh() { return digitalRead(dataPin) == HIGH; }
+
+static inline int32_t clampI(int32_t v, int32_t lo, int32_t hi) {
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+static inline uint8_t oddParity(uint8_t b) {
+  b ^= b >> 4; b ^= b >> 2; b ^= b >> 1;
+  return (~b) & 1;
+}
+
+// Device -> host: start 0, 8 data bits LSB first, odd parity, stop 1. The host
+// reads on the falling clock edge. False if it inhibits (holds clock low)
+// before the stop bit; the caller keeps the byte and retries.
+static bool sendByte(uint8_t b) {
+  if (!clkHigh() || !dataHigh()) return false;
+  uint16_t frame = ((uint16_t)b << 1) | ((uint16_t)oddParity(b) << 9) | (1u << 10);
+  for (int i = 0; i < 11; i++) {
+    lineData((frame >> i) & 1);
+    delayMicroseconds(PS2M_QUARTER_US);
+    lineClk(false);
+    delayMicroseconds(PS2M_HALF_US);
+    lineClk(true);
+    delayMicroseconds(PS2M_QUARTER_US);
+    if (i < 10 && !clkHigh()) {
+      lineData(true);
+      stats.aborted++;
+      return false;
+    }
+  }
+  delayMicroseconds(PS2M_GAP_US);
+  return true;
+}
+
+// Host -> device, after its request-to-send (clock released, data low): the
+// mouse clocks in 8 data bits, parity and stop, sampling while clock is high,
+// then acknowledges by holding data low for one more clock.
+static bool receiveByte(uint8_t &out) {
+  uint16_t bits = 0;
+  for (int i = 0; i < 10; i++) {
+    delayMicroseconds(PS2M_QUARTER_US);
+    lineClk(false);
+    delayMicroseconds(PS2M_HALF_US);
+    lineClk(true);
+    delayMicroseconds(PS2M_QUARTER_US);
+    if (!clkHigh()) { stats.rxErrors++; return false; }   // host gave up
+    if (dataHigh()) bits |= 1u << i;
+  }
+  lineData(false);
+  delayMicroseconds(PS2M_QUARTER_US);
+  lineClk(false);
+  delayMicroseconds(PS2M_HALF_US);
+  lineClk(true);
+  lineData(true);
+  delayMicroseconds(PS2M_GAP_US);
+  out = bits & 0xFF;
+  if (((bits >> 8) & 1) != oddParity(out) || !(bits & (1u << 9))) {
+    stats.rxErrors++;
+    return false;
+  }
+  return true;
+}
+
+// ---- Output queue: command responses go before movement packets ----
+
+static void queueByte(uint8_t b) {
+  uint8_t next = (outTail + 1) % PS2M_OUT_SLOTS;
+  if (next == outHead) return;
+  outBuf[outTail] = b;
+  outTail = next;
+}
+
+static bool flushQueue() {
+  while (outHead != outTail) {
+    if (!sendByte(outBuf[outHead])) return false;
+    lastSent[0] = outBuf[outHead];
+    lastSentLen = 1;
+    outHead = (outHead + 1) % PS2M_OUT_SLOTS;
+  }
+  return true;
+}
+
+// ---- Movement ----
+
+void ps2MouseReport(uint8_t buttons, int16_t dx, int16_t dy, int8_t wheel) {
+  portENTER_CRITICAL(&accMux);
+  if (accPending) stats.coalesced++;
+  stats.usbReports++;
+  accX = clampI(accX + dx, -PS2M_ACC_LIMIT, PS2M_ACC_LIMIT);
+  accY = clampI(accY - dy, -PS2M_ACC_LIMIT, PS2M_ACC_LIMIT);
+  accZ = clampI(accZ - wheel, -PS2M_ACC_LIMIT, PS2M_ACC_LIMIT);
+  accButtons = buttons & 0x07;
+  accPending = accX || accY || accZ || accButtons != sentButtons;
+  portEXIT_CRITICAL(&accMux);
+}
+
+static void clearMotion() {
+  portENTER_CRITICAL(&accMux);
+  accX = accY = accZ = 0;
+  accPending = accButtons != sentButtons;
+  portEXIT_CRITICAL(&accMux);
+}
+
+// 2:1 scaling as the spec defines it: small moves pass, larger ones double.
+static int32_t scaleMove(int32_t v) {
+  static const uint8_t small[6] = {0, 1, 1, 3, 6, 9};
+  int32_t a = v < 0 ? -v : v;
+  a = a < 6 ? small[a] : a * 2;
+  return v < 0 ? -a : a;
+}
+
+// Takes at most one packet's worth of motion out of the accumulator, at the
+// current resolution (USB counts are treated as 8 counts/mm).
+static uint8_t buildPacket(uint8_t *p) {
+  uint8_t shift = 3 - resolution;
+  int32_t x, y, z;
+  uint8_t buttons;
+  portENTER_CRITICAL(&accMux);
+  x = clampI(accX / (1 << shift), -255, 255);
+  y = clampI(accY / (1 << shift), -255, 255);
+  z = deviceId == 3 ? clampI(accZ, -8, 7) : 0;
+  accX -= x * (1 << shift);
+  accY -= y * (1 << shift);
+  accZ = deviceId == 3 ? accZ - z : 0;
+  buttons = accButtons;
+  sentButtons = buttons;
+  accPending = accX / (1 << shift) || accY / (1 << shift) || accZ;
+  portEXIT_CRITICAL(&accMux);
+
+  uint8_t flags = 0x08 | buttons;          // L R M match the USB bit order
+  if (scale21 && mode == MM_STREAM) {
+    x = scaleMove(x);
+    y = scaleMove(y);
+    if (x > 255 || x < -255) { flags |= 0x40; x = x < 0 ? -255 : 255; }
+    if (y > 255 || y < -255) { flags |= 0x80; y = y < 0 ? -255 : 255; }
+  }
+  if (x < 0) flags |= 0x10;
+  if (y < 0) flags |= 0x20;
+  p[0] = flags;
+  p[1] = (uint8_t)(x & 0xFF);
+  p[2] = (uint8_t)(y & 0xFF);
+  if (deviceId != 3) return 3;
+  p[3] = (uint8_t)(int8_t)z;              // full byte, sign-extended: -1 is 0xFF
+  return 4;
+}
+
+static bool sendPacket(const uint8_t *p, uint8_t n) {
+  for (uint8_t i = 0; i < n; i++) {
+    if (!sendByte(p[i])) return false;
+  }
+  memcpy(lastSent, p, n);
+  lastSentLen = n;
+  stats.packets++;
+  return true;
+}
+
+// A packet cut short by an inhibit is resent whole; the host discards partial
+// packets anyway.
+static uint8_t heldPacket[4];
+static uint8_t heldLen = 0;
+
+// ---- Host commands ----
+
+static void setDefaults() {
+  sampleRate = 100;
+  resolution = 2;
+  scale21 = false;
+  reporting = false;
+  mode = MM_STREAM;
+  pendingArg = 0;
+  heldLen = 0;
+  clearMotion();
+}
+
+static void noteRate(uint8_t rate) {
+  rateHistory[0] = rateHistory[1];
+  rateHistory[1] = rateHistory[2];
+  rateHistory[2] = rate;
+  if (rateHistory[0] == 200 && rateHistory[1] == 100 && rateHistory[2] == 80) {
+    deviceId = 3;
+    Serial.println("[MOUSE] IntelliMouse mode (wheel) enabled by host");
+  }
+}
+
+static void handleHostByte(uint8_t b) {
+  stats.hostCmds++;
+  // A command cancels whatever the mouse was about to send.
+  outHead = outTail;
+  heldLen = 0;
+  if (logEnabled(LOG_MOD_HOST, LOG_DEBUG)) logEvent(LOG_MOD_HOST, LOG_DEBUG, "[MOUSE] Host byte 0x%02X", b);
+
+  if (pendingArg) {
+    uint8_t cmd = pendingArg;
+    pendingArg = 0;
+    if (cmd == 0xF3 && b >= 10 && b <= 200) {
+      sampleRate = b;
+      noteRate(b);
+      queueByte(0xFA);
+      return;
+    }
+    if (cmd == 0xE8 && b <= 3) {
+      resolution = b;
+      queueByte(0xFA);
+      return;
+    }
+    queueByte(0xFE);
+    return;
+  }
+
+  if (wrapMode && b != 0xEC && b != 0xFF) {
+    queueByte(b);
+    return;
+  }
+
+  switch (b) {
+    case 0xFF:                           // reset
+      setDefaults();
+      wrapMode = false;
+      deviceId = 0;
+      memset(rateHistory, 0, sizeof(rateHistory));
+      queueByte(0xFA);
+      queueByte(0xAA);
+      queueByte(0x00);
+      break;
+    case 0xFE:                           // resend
+      for (uint8_t i = 0; i < lastSentLen; i++) queueByte(lastSent[i]);
+      break;
+    case 0xF6: setDefaults(); queueByte(0xFA); break;
+    case 0xF5: reporting = false; clearMotion(); queueByte(0xFA); break;
+    case 0xF4: reporting = true; clearMotion(); queueByte(0xFA); break;
+    case 0xF3:
+    case 0xE8: pendingArg = b; queueByte(0xFA); break;
+    case 0xF2: queueByte(0xFA); queueByte(deviceId); break;
+    case 0xF0: mode = MM_REMOTE; clearMotion(); queueByte(0xFA); break;
+    case 0xEE: wrapMode = true; clearMotion(); queueByte(0xFA); break;
+    case 0xEC: wrapMode = false; clearMotion(); queueByte(0xFA); break;
+    case 0xEB: {                         // read data: one packet, even if empty
+      queueByte(0xFA);
+      uint8_t p[4];
+      uint8_t n = buildPacket(p);
+      for (uint8_t i = 0; i < n; i++) queueByte(p[i]);
+      stats.packets++;
+      break;
+    }
+    case 0xEA: mode = MM_STREAM; clearMotion(); queueByte(0xFA); break;
+    case 0xE9: {                         // status: mode, enable, scaling, L M R
+      uint8_t s = (mode == MM_REMOTE ? 0x40 : 0) | (reporting ? 0x20 : 0) | (scale21 ? 0x10 : 0);
+      uint8_t btn = sentButtons;
+      s |= ((btn & 0x01) << 2) | (btn & 0x04 ? 0x02 : 0) | (btn & 0x02 ? 0x01 : 0);
+      queueByte(0xFA);
+      queueByte(s);
+      queueByte(resolution);
+      queueByte(sampleRate);
+      break;
+    }
+    case 0xE7: scale21 = true; queueByte(0xFA); break;
+    case 0xE6: scale21 = false; queueByte(0xFA); break;
+    default:   queueByte(0xFE); break;
+  }
+}
+
+// ---- Task ----
+
+void ps2MouseBegin(uint8_t clk, uint8_t data) {
+  clkPin = clk;
+  dataPin = data;
+  pinMode(clkPin, OUTPUT_OPEN_DRAIN | PULLUP);
+  pinMode(dataPin, OUTPUT_OPEN_DRAIN | PULLUP);
+  lineClk(true);
+  lineData(true);
+  setDefaults();
+  // Power-on self test result, as a real mouse sends it.
+  queueByte(0xAA);
+  queueByte(0x00);
+  Serial.printf("[MOUSE] PS/2 mouse output on CLK=%u DATA=%u\n", clkPin, dataPin);
+}
+
+void ps2MouseTask() {
+  if (clkPin == 0xFF) return;
+
+  // Request-to-send: the host released clock but keeps data low.
+  if (clkHigh() && !dataHigh()) {
+    uint8_t b;
+    if (receiveByte(b)) handleHostByte(b);
+    else queueByte(0xFE);
+    return;
+  }
+
+  if (!flushQueue()) return;
+
+  if (heldLen) {
+    if (sendPacket(heldPacket, heldLen)) heldLen = 0;
+    return;
+  }
+
+  if (mode != MM_STREAM || !reporting || wrapMode) return;
+  uint32_t now = millis();
+  if (now - lastPacketMs < 1000u / sampleRate) return;
+  if (!accPending) return;
+  heldLen = buildPacket(heldPacket);
+  lastPacketMs = now;
+  if (sendPacket(heldPacket, heldLen)) heldLen = 0;
+}
+
+void ps2MouseInit(AsyncWebServer &server) {
+  server.on("/api/mouse", HTTP_GET, [](AsyncWebServerRequest *req){
+    String out = "{";
+    out += "\"mode\":\"" + String(mode == MM_REMOTE ? "remote" : "stream") + "\"";
+    out += ",\"reporting\":" + String(reporting ? "true" : "false");
+    out += ",\"wrap\":" + String(wrapMode ? "true" : "false");
+    out += ",\"id\":" + String(deviceId);
+    out += ",\"sample_rate\":" + String(sampleRate);
+    out += ",\"resolution\":" + String(resolution);
+    out += ",\"scaling\":\"" + String(scale21 ? "2:1" : "1:1") + "\"";
+    portENTER_CRITICAL(&accMux);
+    uint32_t reports = stats.usbReports, merged = stats.coalesced;
+    portEXIT_CRITICAL(&accMux);
+    out += ",\"usb_reports\":" + String(reports);
+    out += ",\"coalesced\":" + String(merged);
+    out += ",\"packets\":" + String(stats.packets);
+    out += ",\"host_cmds\":" + String(stats.hostCmds);
+    out += ",\"aborted\":" + String(stats.aborted);
+    out += ",\"rx_errors\":" + String(stats.rxErrors);
+    out += "}";
+    req->send(200, "application/json", out);
+  });
+  Serial.println("[MOUSE] Endpoint registered");
+}
@@ -0,0 +1,29 @@
+#ifndef PS2_MOUSE_H
+#define PS2_MOUSE_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Second output channel: a PS/2 mouse on its own CLK/DATA pair, fed from USB
+// mouse reports. Reports only add to a motion accumulator; ps2MouseTask()
+// turns it into a packet at the host's sample rate (stream mode) or on 0xEB
+// (remote mode), so a 1 kHz USB mouse folds into however many packets the
+// PS/2 link can carry instead of overflowing it. Motion beyond one packet's
+// +-255 range stays in the accumulator for the next one.
+//
+// Host commands: FF reset, FE resend, F6 defaults, F5/F4 disable/enable,
+// F3 sample rate, F2 device ID, F0 remote, EE/EC wrap mode, EB read data,
+// EA stream, E9 status, E8 resolution, E7/E6 scaling. Setting the rate to
+// 200, 100, 80 switches to IntelliMouse (ID 3, 4-byte packets with wheel).
+
+void ps2MouseBegin(uint8_t clkPin, uint8_t dataPin);
+void ps2MouseTask();                 // loop task: host commands and packets
+
+// Boot-protocol style movement; safe from the USB host task.
+// dy and wheel use USB directions (down / away from the user positive).
+void ps2MouseReport(uint8_t buttons, int16_t dx, int16_t dy, int8_t wheel);
+
+void ps2MouseInit(AsyncWebServer &server);   // GET /api/mouse
+
+#endif
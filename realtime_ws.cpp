@@ -1,25 +1,381 @@
 #include "realtime_ws.h"
 #include <Arduino.h>
+#include "mem_stats.h"
+#include <ArduinoJson.h>
+
+#define RT_MAX_CLIENTS    4
+#define RT_QUEUE_MAX      16
+#define RT_QUEUE_DEFAULT  8
+#define RT_BATCH_MAX      1024
+#define RT_FLUSH_MS       20
+#define RT_RECORD_HDR     6
+#define RT_FRAME_HDR      4
+#define RT_SHARED_MAX     (RT_MAX_CLIENTS * RT_QUEUE_MAX)
+#define RT_JSON_PART      255
+
+#define RT_POLICY_DROP_OLDEST 0
+#define RT_POLICY_COALESCE    1
+
+// A serialized frame shared by the client queues. The library's own
+// lock() is a flag, not a count, so references are counted here and the
+// buffer is deleted once they are gone and no send still holds it.
+struct RtShared {
+  AsyncWebSocketMessageBuffer *buf;   // nullptr = free slot
+  uint8_t refs;
+};
+
+struct RtFrameRef {
+  uint8_t slot;
+  uint8_t cls;
+};
+
+struct RtClient {
+  uint32_t id;                      // 0 = free slot
+  uint8_t mask;
+  uint8_t policy;
+  uint8_t queueMax;
+  uint16_t minIntervalMs;
+  unsigned long lastSendMs;
+  RtFrameRef q[RT_QUEUE_MAX];
+  uint8_t qHead, qLen;
+  uint32_t sent, dropped, coalesced;
+};
+
+struct RtBatch {
+  uint8_t data[RT_BATCH_MAX];
+  uint16_t len;
+  uint16_t count;
+};
 
 static AsyncWebSocket *ws = nullptr;
 static AsyncWebServer *gserver = nullptr;
+static RtClient clients[RT_MAX_CLIENTS];
+static RtShared shared[RT_SHARED_MAX];
+// Two batches per class: publishers fill one while a full one waits for
+// realtimeTask(), so nothing is fanned out from inside a publish (which
+// may be in the middle of bit-banging a byte).
+static RtBatch batches[RT_CLASS_COUNT][2];
+static uint8_t fillIdx[RT_CLASS_COUNT];
+static volatile uint8_t dueMask = 0;
+static volatile uint8_t activeMask = 0;
+static unsigned long lastFlushMs = 0;
+static portMUX_TYPE rtMux = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE clientMux = portMUX_INITIALIZER_UNLOCKED;
+
+static inline uint8_t classIndex(uint8_t cls) {
+  return (uint8_t)__builtin_ctz(cls);
+}
+
+static void recomputeMask() {
+  uint8_t m = 0;
+  for (int i = 0; i < RT_MAX_CLIENTS; i++) if (clients[i].id) m |= clients[i].mask;
+  activeMask = m;
+}
+
+static RtClient *findClient(uint32_t id) {
+  for (int i = 0; i < RT_MAX_CLIENTS; i++) if (clients[i].id == id) return &clients[i];
+  return nullptr;
+}
+
+// clientMux held
+static inline void unref(uint8_t slot) {
+  if (shared[slot].refs) shared[slot].refs--;
+}
+
+static void releaseQueue(RtClient &c) {
+  while (c.qLen) {
+    unref(c.q[c.qHead].slot);
+    c.qHead = (c.qHead + 1) % RT_QUEUE_MAX;
+    c.qLen--;
+  }
+}
+
+static uint8_t parseClasses(JsonArrayConst arr) {
+  static const char *names[RT_CLASS_COUNT] = { "bits", "keys", "host", "metrics", "events" };
+  uint8_t m = 0;
+  for (JsonVariantConst v : arr) {
+    const char *n = v | "";
+    for (uint8_t ci = 0; ci < RT_CLASS_COUNT; ci++) {
+      if (strcmp(n, names[ci]) == 0) m |= 1 << ci;
+    }
+  }
+  return m;
+}
+
+static void handleSubscribe(AsyncWebSocketClient *client, uint8_t *data, size_t len) {
+  StaticJsonDocument<256> doc;
+  if (deserializeJson(doc, data, len)) return;
+  // Everything is worked out first; the lock only covers the stores.
+  bool hasSub = doc.containsKey("sub");
+  uint8_t mask = hasSub ? parseClasses(doc["sub"].as<JsonArrayConst>()) : 0;
+  int rate = doc["rate"] | 0;
+  uint16_t minIntervalMs = rate > 0 ? (uint16_t)(1000 / rate) : 0;
+  uint8_t policy = strcmp(doc["policy"] | "drop_oldest", "coalesce") == 0 ? RT_POLICY_COALESCE : RT_POLICY_DROP_OLDEST;
+  int q = doc["queue"] | RT_QUEUE_DEFAULT;
+  uint8_t queueMax = (uint8_t)constrain(q, 1, RT_QUEUE_MAX);
+  uint32_t id = client->id();
+  portENTER_CRITICAL(&clientMux);
+  RtClient *c = findClient(id);
+  if (c) {
+    if (hasSub) c->mask = mask;
+    c->minIntervalMs = minIntervalMs;
+    c->policy = policy;
+    c->queueMax = queueMax;
+  }
+  recomputeMask();
+  portEXIT_CRITICAL(&clientMux);
+}
 
 void realtimeInit(AsyncWebServer &server) {
   gserver = &server;
+  memset(clients, 0, sizeof(clients));
+  memset(shared, 0, sizeof(shared));
+  memset(batches, 0, sizeof(batches));
+  memset(fillIdx, 0, sizeof(fillIdx));
   ws = new AsyncWebSocket("/ws/scancodes");
   server.addHandler(ws);
   ws->onEvent([](AsyncWebSocket *server, AsyncWebSocketClient *client,
                  AwsEventType type, void *arg, uint8_t *data, size_t len){
     if (type == WS_EVT_CONNECT) {
+      bool ok = false;
+      portENTER_CRITICAL(&clientMux);
+      for (int i = 0; i < RT_MAX_CLIENTS; i++) {
+        if (clients[i].id) continue;
+        memset(&clients[i], 0, sizeof(RtClient));
+        clients[i].id = client->id();
+        clients[i].mask = RT_CLASS_KEYS | RT_CLASS_HOST | RT_CLASS_EVENTS;
+        clients[i].queueMax = RT_QUEUE_DEFAULT;
+        ok = true;
+        break;
+      }
+      recomputeMask();
+      portEXIT_CRITICAL(&clientMux);
+      if (!ok) { client->close(1013, "too many clients"); return; }
+      client->text("{\"type\":\"hello\",\"proto\":1,\"classes\":[\"bits\",\"keys\",\"host\",\"metrics\",\"events\"]}");
       Serial.printf("[WS] Client connected: %u\n", client->id());
     } else if (type == WS_EVT_DISCONNECT) {
+      portENTER_CRITICAL(&clientMux);
+      RtClient *c = findClient(client->id());
+      if (c) { releaseQueue(*c); c->id = 0; }
+      recomputeMask();
+      portEXIT_CRITICAL(&clientMux);
       Serial.printf("[WS] Client disconnected: %u\n", client->id());
+    } else if (type == WS_EVT_DATA) {
+      AwsFrameInfo *info = (AwsFrameInfo*)arg;
+      if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
+        handleSubscribe(client, data, len);
+      }
+    }
+  });
+  server.on("/api/ws_clients", HTTP_GET, [](AsyncWebServerRequest *req){
+    StaticJsonDocument<768> doc;
+    JsonArray arr = doc.to<JsonArray>();
+    portENTER_CRITICAL(&clientMux);
+    for (int i = 0; i < RT_MAX_CLIENTS; i++) {
+      const RtClient &c = clients[i];
+      if (!c.id) continue;
+      JsonObject o = arr.createNestedObject();
+      o["id"] = c.id;
+      o["mask"] = c.mask;
+      o["queued"] = c.qLen;
+      o["sent"] = c.sent;
+      o["dropped"] = c.dropped;
+      o["coalesced"] = c.coalesced;
     }
+    portEXIT_CRITICAL(&clientMux);
+    String out; serializeJson(doc, out);
+    req->send(200, "application/json", out);
   });
-  Serial.println("[WS] /ws/scancodes ready");
+  Serial.println("[WS] /ws/scancodes ready (binary protocol v1)");
+}
+
+bool realtimeWants(uint8_t cls) {
+  return (activeMask & cls) != 0;
 }
 
-void realtimeBroadcastScancode(const String &msg) {
+// Takes one batch of a class (the full one waiting, or the one being
+// filled) and fans it out as a single shared buffer. Loop task only.
+static void flushClass(uint8_t ci, bool due) {
+  uint8_t cls = 1 << ci;
+  uint8_t frame[RT_FRAME_HDR + RT_BATCH_MAX];
+  uint16_t len, count;
+  portENTER_CRITICAL(&rtMux);
+  if (due && !(dueMask & cls)) due = false;
+  RtBatch &b = batches[ci][due ? fillIdx[ci] ^ 1 : fillIdx[ci]];
+  len = b.len; count = b.count;
+  if (count) memcpy(frame + RT_FRAME_HDR, b.data, len);
+  b.len = b.count = 0;
+  if (due) dueMask &= ~cls;
+  portEXIT_CRITICAL(&rtMux);
+  if (!count || !ws) return;
+  frame[0] = RT_PROTO_VERSION;
+  frame[1] = cls;
+  frame[2] = count & 0xFF;
+  frame[3] = count >> 8;
+
+  int slot = -1;
+  for (int i = 0; i < RT_SHARED_MAX && slot < 0; i++) if (!shared[i].buf) slot = i;
+  if (slot < 0) return;             // every slot still queued or in flight
+  AsyncWebSocketMessageBuffer *buf = new AsyncWebSocketMessageBuffer(frame, RT_FRAME_HDR + len);
+  if (!buf->get()) { delete buf; return; }
+  memNote(MEM_WS, RT_FRAME_HDR + len);
+  portENTER_CRITICAL(&clientMux);
+  shared[slot].buf = buf;
+  shared[slot].refs = 0;
+  for (int i = 0; i < RT_MAX_CLIENTS; i++) {
+    RtClient &c = clients[i];
+    if (!c.id || !(c.mask & cls)) continue;
+    if (c.policy == RT_POLICY_COALESCE) {
+      bool replaced = false;
+      for (uint8_t k = 0; k < c.qLen; k++) {
+        RtFrameRef &r = c.q[(c.qHead + k) % RT_QUEUE_MAX];
+        if (r.cls != cls) continue;
+        unref(r.slot);
+        r.slot = slot;
+        shared[slot].refs++;
+        c.coalesced++;
+        replaced = true;
+        break;
+      }
+      if (replaced) continue;
+    }
+    if (c.qLen >= c.queueMax) {     // full: drop the oldest frame
+      unref(c.q[c.qHead].slot);
+      c.qHead = (c.qHead + 1) % RT_QUEUE_MAX;
+      c.qLen--;
+      c.dropped++;
+    }
+    RtFrameRef &r = c.q[(c.qHead + c.qLen) % RT_QUEUE_MAX];
+    r.slot = slot;
+    r.cls = cls;
+    shared[slot].refs++;
+    c.qLen++;
+  }
+  portEXIT_CRITICAL(&clientMux);
+}
+
+static void drainClients(unsigned long now) {
+  for (int i = 0; i < RT_MAX_CLIENTS; i++) {
+    RtClient &c = clients[i];
+    if (!c.id || !c.qLen) continue;
+    AsyncWebSocketClient *client = ws->client(c.id);
+    if (!client || client->status() != WS_CONNECTED) continue;
+    while (c.qLen && !client->queueIsFull()) {
+      if (c.minIntervalMs && now - c.lastSendMs < c.minIntervalMs) break;
+      uint8_t slot;
+      portENTER_CRITICAL(&clientMux);
+      slot = c.q[c.qHead].slot;
+      c.qHead = (c.qHead + 1) % RT_QUEUE_MAX;
+      c.qLen--;
+      portEXIT_CRITICAL(&clientMux);
+      // still referenced, and only this task frees slots
+      client->binary(shared[slot].buf);
+      portENTER_CRITICAL(&clientMux);
+      unref(slot);
+      portEXIT_CRITICAL(&clientMux);
+      c.sent++;
+      c.lastSendMs = now;
+    }
+  }
+}
+
+// Deletes frames no queue refers to once the library has sent them.
+static void reapShared() {
+  for (int i = 0; i < RT_SHARED_MAX; i++) {
+    AsyncWebSocketMessageBuffer *victim = nullptr;
+    portENTER_CRITICAL(&clientMux);
+    if (shared[i].buf && !shared[i].refs && !shared[i].buf->count()) {
+      victim = shared[i].buf;
+      shared[i].buf = nullptr;
+    }
+    portEXIT_CRITICAL(&clientMux);
+    delete victim;
+  }
+}
+
+void realtimeTask() {
   if (!ws) return;
-  ws->textAll(msg);
+  unsigned long now = millis();
+  bool tick = now - lastFlushMs >= RT_FLUSH_MS;
+  if (tick) lastFlushMs = now;
+  for (uint8_t ci = 0; ci < RT_CLASS_COUNT; ci++) {
+    if (dueMask & (1 << ci)) flushClass(ci, true);
+    if (tick) flushClass(ci, false);
+  }
+  drainClients(now);
+  reapShared();
+  ws->cleanupClients();
+}
+
+// rtMux held. The batch being filled when it has room for need bytes,
+// otherwise the spare one, which it then becomes; nullptr while the spare
+// still waits for realtimeTask() (the records are dropped).
+static RtBatch *reserve(uint8_t ci, size_t need) {
+  RtBatch *b = &batches[ci][fillIdx[ci]];
+  if (b->len + need <= RT_BATCH_MAX) return b;
+  uint8_t cls = 1 << ci;
+  if (dueMask & cls) return nullptr;
+  dueMask |= cls;
+  fillIdx[ci] ^= 1;
+  return &batches[ci][fillIdx[ci]];
+}
+
+static void appendRecord(RtBatch &b, uint8_t type, const uint8_t *payload, uint8_t len, uint32_t ts) {
+  uint8_t *p = b.data + b.len;
+  p[0] = type;
+  p[1] = len;
+  p[2] = ts & 0xFF; p[3] = (ts >> 8) & 0xFF; p[4] = (ts >> 16) & 0xFF; p[5] = ts >> 24;
+  if (len) memcpy(p + RT_RECORD_HDR, payload, len);
+  b.len += RT_RECORD_HDR + len;
+  b.count++;
+}
+
+void realtimePublish(uint8_t cls, uint8_t type, const uint8_t *payload, uint8_t len) {
+  if (!(activeMask & cls)) return;
+  uint8_t ci = classIndex(cls);
+  if (ci >= RT_CLASS_COUNT) return;
+  uint32_t ts = (uint32_t)micros();
+  portENTER_CRITICAL(&rtMux);
+  RtBatch *b = reserve(ci, RT_RECORD_HDR + len);
+  if (b) appendRecord(*b, type, payload, len, ts);
+  portEXIT_CRITICAL(&rtMux);
+}
+
+void realtimePublishBit(uint8_t phase, uint8_t clk, uint8_t data) {
+  uint8_t p[3] = { phase, clk, data };
+  realtimePublish(RT_CLASS_BITS, RT_REC_BIT, p, sizeof(p));
+}
+
+void realtimePublishKey(bool isBreak, uint8_t code, uint8_t proto) {
+  uint8_t p[2] = { code, proto };
+  realtimePublish(RT_CLASS_KEYS, isBreak ? RT_REC_BREAK : RT_REC_MAKE, p, sizeof(p));
+}
+
+void realtimePublishHost(uint8_t code) {
+  realtimePublish(RT_CLASS_HOST, RT_REC_HOST, &code, 1);
+}
+
+// Text longer than one record goes out as RT_REC_JSON_PART records and a
+// final RT_REC_JSON, all in the same frame.
+bool realtimeBroadcastScancode(const String &msg) {
+  size_t n = msg.length();
+  size_t parts = n ? (n + RT_JSON_PART - 1) / RT_JSON_PART : 1;
+  size_t need = n + parts * RT_RECORD_HDR;
+  if (need > RT_BATCH_MAX) {
+    Serial.printf("[WS] JSON event of %u bytes is too long, not sent\n", (unsigned)n);
+    return false;
+  }
+  if (!(activeMask & RT_CLASS_EVENTS)) return true;
+  uint8_t ci = classIndex(RT_CLASS_EVENTS);
+  const uint8_t *p = (const uint8_t *)msg.c_str();
+  uint32_t ts = (uint32_t)micros();
+  portENTER_CRITICAL(&rtMux);
+  RtBatch *b = reserve(ci, need);
+  if (b) {
+    for (; n > RT_JSON_PART; n -= RT_JSON_PART, p += RT_JSON_PART)
+      appendRecord(*b, RT_REC_JSON_PART, p, RT_JSON_PART, ts);
+    appendRecord(*b, RT_REC_JSON, p, (uint8_t)n, ts);
+  }
+  portEXIT_CRITICAL(&rtMux);
+  return b != nullptr;
 }
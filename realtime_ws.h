@@ -5,8 +5,48 @@
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 
+// Binary event protocol on /ws/scancodes (version 1).
+//
+// Frame:  [u8 version][u8 class][u16 record count LE] records...
+// Record: [u8 type][u8 payload len][u32 ts_us LE] payload
+//
+// Clients subscribe with a text message, e.g.
+//   {"sub":["keys","host"],"rate":50,"policy":"drop_oldest","queue":8}
+// rate = max frames/s per client, policy = "drop_oldest" | "coalesce".
+// A JSON event over 255 bytes is split into RT_REC_JSON_PART records ended
+// by an RT_REC_JSON, always within one frame; events that do not fit in a
+// frame are refused.
+// Every frame is serialized once and shared by all subscribers.
+
+#define RT_PROTO_VERSION 1
+
+#define RT_CLASS_BITS    0x01   // wire bit samples
+#define RT_CLASS_KEYS    0x02   // make/break bytes sent to the host
+#define RT_CLASS_HOST    0x04   // host -> device bytes
+#define RT_CLASS_METRICS 0x08   // pipeline metrics snapshots
+#define RT_CLASS_EVENTS  0x10   // JSON events (detect results, ...)
+#define RT_CLASS_COUNT   5
+
+#define RT_REC_BIT     1        // [phase][clk][data]
+#define RT_REC_MAKE    2        // [code][proto]
+#define RT_REC_BREAK   3        // [code][proto]
+#define RT_REC_HOST    4        // [code]
+#define RT_REC_METRICS 5        // metrics-defined
+#define RT_REC_JSON    6        // UTF-8 JSON text
+#define RT_REC_JSON_PART 7      // leading part of a JSON text; the next record continues it
+
+#define RT_BIT_PRE  0
+#define RT_BIT_LOW  1
+#define RT_BIT_HIGH 2
+
 void realtimeInit(AsyncWebServer &server);
-void realtimeBroadcastScancode(const String &msg);
-void detectProtocolAsync(AsyncWebServerRequest *req);
+void realtimeTask();
+
+bool realtimeWants(uint8_t cls);
+void realtimePublish(uint8_t cls, uint8_t type, const uint8_t *payload, uint8_t len);
+void realtimePublishBit(uint8_t phase, uint8_t clk, uint8_t data);
+void realtimePublishKey(bool isBreak, uint8_t code, uint8_t proto);
+void realtimePublishHost(uint8_t code);
+bool realtimeBroadcastScancode(const String &msg);   // JSON event, RT_CLASS_EVENTS; false if refused
 
 #endif
@@ -1,10 +1,11 @@
 #include "rollback.h"
 #include <Preferences.h>
-#include <LittleFS.h>
+#include "snapshot.h"
 
 static Preferences prefs;
 static bool firstBootAfterOTA = false;
 static bool restorePerformed = false;
+static bool failsafePending = false;   // NVS P_FAILSAFE, read once at boot
 
 static const char *P_BOOT_COUNT   = "boot_cnt";
 static const char *P_OTA_BOOTFLAG = "ota_boot";
@@ -13,15 +14,8 @@ static const char *P_FAILSAFE     = "failsafe";
 static void loadBackupAndRestore() {
     if (restorePerformed) return;
     restorePerformed = true;
-    if (!LittleFS.begin(true)) { Serial.println("[ROLLBACK] Could not mount LittleFS"); return; }
-    if (!LittleFS.exists("/backup.json")) { Serial.println("[ROLLBACK] No /backup.json available for restore"); return; }
-    File f = LittleFS.open("/backup.json", "r");
-    if (!f) { Serial.println("[ROLLBACK] Failed to open backup.json"); return; }
-    String content = f.readString();
-    f.close();
-    Serial.println("[ROLLBACK] Restoring from backup.json...");
-    Serial.println("[ROLLBACK] Backup content:");
-    Serial.println(content);
+    Serial.println("[ROLLBACK] Restoring from snapshot...");
+    if (!snapshotRestore()) Serial.println("[ROLLBACK] No snapshot available for restore");
 }
 
 void rollbackInitialize() {
@@ -38,6 +32,7 @@ void rollbackInitialize() {
         prefs.putBool(P_OTA_BOOTFLAG, false);
         prefs.putBool(P_FAILSAFE, true);
     }
+    failsafePending = prefs.getBool(P_FAILSAFE, false);
     prefs.end();
 }
 
@@ -48,6 +43,12 @@ void markNextBootAsOTA() {
     Serial.println("[ROLLBACK] Marked next boot as OTA boot");
 }
 
+void clearNextBootAsOTA() {
+    prefs.begin("rollback", false);
+    prefs.putBool(P_OTA_BOOTFLAG, false);
+    prefs.end();
+}
+
 bool rollbackForce() {
     Serial.println("[ROLLBACK] Forced rollback requested");
     loadBackupAndRestore();
@@ -55,18 +56,14 @@ bool rollbackForce() {
 }
 
 void rollbackPeriodic() {
-    if (!firstBootAfterOTA) return;
+    if (!failsafePending) return;
+    failsafePending = false;
+    Serial.println("[ROLLBACK] FAILSAFE RESTORE TRIGGERED");
+    loadBackupAndRestore();
     prefs.begin("rollback", false);
-    bool failsafe = prefs.getBool(P_FAILSAFE, false);
+    prefs.putBool(P_FAILSAFE, false);
     prefs.end();
-    if (failsafe) {
-        Serial.println("[ROLLBACK] FAILSAFE RESTORE TRIGGERED");
-        loadBackupAndRestore();
-        prefs.begin("rollback", false);
-        prefs.putBool(P_FAILSAFE, false);
-        prefs.end();
-        Serial.println("[ROLLBACK] Restore complete. System marked stable.");
-    }
+    Serial.println("[ROLLBACK] Restore complete. System marked stable.");
 }
 
 bool isFirstBootAfterOTA() { return firstBootAfterOTA; }
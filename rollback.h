@@ -8,5 +8,6 @@ void rollbackPeriodic();
 bool isFirstBootAfterOTA();
 bool rollbackForce();
 void markNextBootAsOTA();
+void clearNextBootAsOTA();
 
 #endif
@@ -0,0 +1,371 @@
+#include "snapshot.h"
+#include "config.h"
+#include "storage.h"
+#include "keymap_manager.h"
+#include "keymap_ex.h"
+#include "timing_profile.h"
+#include "typematic.h"
+#include "xt_at_output.h"
+#include "web_state.h"
+#include "auto_ota.h"
+#include <ArduinoJson.h>
+#include <rom/crc.h>
+#include <atomic>
+
+#define SNAP_MAGIC 0x31534B58UL       // "XKS1"
+#define SNAP_VERSION 1
+#define SNAP_HDR 28
+
+struct SnapHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reason;
+  uint32_t seq;
+  uint32_t ms;
+  uint32_t len;
+  uint32_t crc;
+  uint32_t hcrc;
+};
+
+struct SlotState {
+  bool valid;
+  uint32_t seq;
+  uint16_t reason;
+  uint32_t ms;
+  uint32_t bytes;
+};
+
+static const char *SLOT_PATHS[2] = { "/snap_a.bin", "/snap_b.bin" };
+static const char *REASON_NAMES[] = { "manual", "ota", "upload" };
+static SlotState slots[2];
+static bool scanned = false;
+
+// A restore asked for over HTTP replaces config Strings the loop reads and
+// hands the mode to xtatTask, so it runs from snapshotTask on the loop.
+static std::atomic<bool> restoreWanted(false);
+static const char *restoreStatus = "none";
+
+// Appends to a fixed buffer; any overflow sticks in ok.
+struct SnapWriter {
+  uint8_t *p;
+  size_t cap;
+  size_t len;
+  bool ok;
+  void put(const void *d, size_t n) {
+    if (!ok || len + n > cap) { ok = false; return; }
+    memcpy(p + len, d, n);
+    len += n;
+  }
+  void u8(uint8_t v) { put(&v, 1); }
+  void u16(uint16_t v) { put(&v, 2); }
+  void u32(uint32_t v) { put(&v, 4); }
+  void str(const String &s) { u16(s.length()); put(s.c_str(), s.length()); }
+  size_t begin(uint8_t tag) { u8(tag); size_t at = len; u16(0); return at; }
+  void end(size_t at) {
+    if (!ok) return;
+    uint16_t n = len - at - 2;
+    memcpy(p + at, &n, 2);
+  }
+};
+
+struct SnapReader {
+  const uint8_t *p;
+  size_t len;
+  size_t pos;
+  bool ok;
+  bool get(void *d, size_t n) {
+    if (!ok || pos + n > len) { ok = false; return false; }
+    memcpy(d, p + pos, n);
+    pos += n;
+    return true;
+  }
+  uint8_t u8() { uint8_t v = 0; get(&v, 1); return v; }
+  uint16_t u16() { uint16_t v = 0; get(&v, 2); return v; }
+  uint32_t u32() { uint32_t v = 0; get(&v, 4); return v; }
+  String str() {
+    uint16_t n = u16();
+    if (!ok || pos + n > len) { ok = false; return String(); }
+    String s;
+    s.reserve(n);
+    for (uint16_t i = 0; i < n; i++) s += (char)p[pos + i];
+    pos += n;
+    return s;
+  }
+};
+
+static bool validate(const uint8_t *buf, size_t len, SnapHeader &h) {
+  if (len < SNAP_HDR) return false;
+  memcpy(&h, buf, SNAP_HDR);
+  if (h.magic != SNAP_MAGIC || h.version != SNAP_VERSION) return false;
+  if (h.hcrc != crc32_le(0, buf, SNAP_HDR - 4)) return false;
+  if (h.len > len - SNAP_HDR) return false;
+  return h.crc == crc32_le(0, buf + SNAP_HDR, h.len);
+}
+
+static void sealHeader(uint8_t *buf, SnapHeader &h) {
+  h.hcrc = crc32_le(0, (const uint8_t *)&h, SNAP_HDR - 4);
+  memcpy(buf, &h, SNAP_HDR);
+}
+
+static void scanSlots() {
+  if (scanned || !storageMounted()) return;
+  StorageScratch s;
+  for (int i = 0; i < 2; i++) {
+    slots[i] = SlotState();
+    size_t len = 0;
+    SnapHeader h;
+    if (s.data() && storageRead(SLOT_PATHS[i], (uint8_t *)s.data(), SNAP_MAX_SIZE, len) && validate((uint8_t *)s.data(), len, h)) {
+      slots[i] = { true, h.seq, h.reason, h.ms, (uint32_t)len };
+    }
+  }
+  scanned = true;
+}
+
+static int newestSlot() {
+  if (slots[0].valid && (!slots[1].valid || slots[0].seq >= slots[1].seq)) return 0;
+  return slots[1].valid ? 1 : -1;
+}
+
+// Stamps the next sequence number and writes over the older (or invalid) slot.
+static bool writeSlot(uint8_t *buf, size_t len, SnapHeader &h) {
+  int newest = newestSlot();
+  int target = newest < 0 ? 0 : 1 - newest;
+  h.seq = newest < 0 ? 1 : slots[newest].seq + 1;
+  sealHeader(buf, h);
+  if (!storageWriteAtomic(SLOT_PATHS[target], buf, len)) return false;
+  slots[target] = { true, h.seq, h.reason, h.ms, (uint32_t)len };
+  Serial.printf("[SNAPSHOT] Wrote slot %c seq %u (%u bytes, %s)\n", 'a' + target, (unsigned)h.seq,
+                (unsigned)len, REASON_NAMES[h.reason < 3 ? h.reason : 0]);
+  return true;
+}
+
+bool snapshotCapture(SnapshotReason reason) {
+  scanSlots();
+  if (!storageMounted()) return false;
+  StorageScratch s;
+  if (!s.data()) return false;
+  SnapWriter w = { (uint8_t *)s.data(), SNAP_MAX_SIZE, SNAP_HDR, true };
+
+  size_t at = w.begin(SNAP_CONFIG);
+  w.str(config.ap_ssid);
+  w.str(config.ap_pass);
+  w.str(config.sta_ssid);
+  w.str(config.sta_pass);
+  w.str(config.ota_user);
+  w.str(config.ota_pass);
+  w.str(config.ota_manifest_url);
+  w.u8(config.kb_mode);
+  w.u8(config.auto_ota_enabled);
+  w.u32(config.auto_ota_interval_ms);
+  w.u16(config.typematic_delay_ms);
+  w.u16(config.typematic_period_ms);
+  w.end(at);
+
+  at = w.begin(SNAP_KEYMAP);
+  w.put(config.keymap, 256);
+  w.end(at);
+
+  at = w.begin(SNAP_KEYMAP_EX);
+  if (w.ok) w.len += 6 * keymapExPack(w.p + w.len, (w.cap - w.len) / 6);
+  w.end(at);
+
+  at = w.begin(SNAP_TIMING);
+  for (uint8_t port = 0; port < XTAT_MAX_PORTS; port++) {
+    for (uint8_t m = MODE_XT; m <= MODE_PS2; m++) {
+      TimingProfile tp;
+      if (!timingProfileLoad(port, m, tp)) continue;
+      w.u8(port << 4 | m);
+      w.u16(tp.half_period_us);
+      w.u16(tp.inter_byte_us);
+      w.u8(tp.calibrated);
+    }
+  }
+  w.end(at);
+
+  if (!w.ok) { Serial.println("[SNAPSHOT] Capture does not fit"); return false; }
+  SnapHeader h = { SNAP_MAGIC, SNAP_VERSION, (uint16_t)reason, 0, (uint32_t)millis(),
+                   (uint32_t)(w.len - SNAP_HDR), crc32_le(0, w.p + SNAP_HDR, w.len - SNAP_HDR), 0 };
+  return writeSlot(w.p, w.len, h);
+}
+
+// Parses every section before touching live state, so a bad snapshot
+// changes nothing.
+static bool restoreFrom(const uint8_t *buf, size_t len) {
+  SnapHeader h;
+  if (!validate(buf, len, h)) return false;
+  AppConfig c = config;
+  const uint8_t *ex = nullptr, *timing = nullptr;
+  int exCount = -1, timingCount = -1;
+  SnapReader r = { buf + SNAP_HDR, h.len, 0, true };
+  while (r.ok && r.pos < r.len) {
+    uint8_t tag = r.u8();
+    uint16_t n = r.u16();
+    if (!r.ok || r.pos + n > r.len) return false;
+    SnapReader sec = { r.p + r.pos, n, 0, true };
+    switch (tag) {
+      case SNAP_CONFIG:
+        c.ap_ssid = sec.str();
+        c.ap_pass = sec.str();
+        c.sta_ssid = sec.str();
+        c.sta_pass = sec.str();
+        c.ota_user = sec.str();
+        c.ota_pass = sec.str();
+        c.ota_manifest_url = sec.str();
+        c.kb_mode = sec.u8();
+        c.auto_ota_enabled = sec.u8();
+        c.auto_ota_interval_ms = sec.u32();
+        c.typematic_delay_ms = sec.u16();
+        c.typematic_period_ms = sec.u16();
+        if (!sec.ok || c.kb_mode < MODE_XT || c.kb_mode > MODE_PS2) return false;
+        break;
+      case SNAP_KEYMAP:
+        if (n != 256) return false;
+        memcpy(c.keymap, sec.p, 256);
+        break;
+      case SNAP_KEYMAP_EX:
+        if (n % 6) return false;
+        ex = sec.p;
+        exCount = n / 6;
+        break;
+      case SNAP_TIMING:
+        if (n % 6) return false;
+        timing = sec.p;
+        timingCount = n / 6;
+        break;
+      default:
+        break;
+    }
+    r.pos += n;
+  }
+  if (!r.ok) return false;
+
+  // The mode goes to xtatTask, which switches the port and its timing.
+  uint8_t mode = c.kb_mode;
+  c.kb_mode = config.kb_mode;
+  config = c;
+  autoOtaConfigChanged();
+  keymapSave();
+  if (exCount >= 0) keymapExReplace(ex, exCount);
+  else keymapExCompile();
+  if (timingCount >= 0) {
+    for (uint8_t port = 0; port < XTAT_MAX_PORTS; port++) {
+      for (uint8_t m = MODE_XT; m <= MODE_PS2; m++) timingProfileClear(port, m);
+    }
+    for (int i = 0; i < timingCount; i++) {
+      const uint8_t *t = timing + i * 6;
+      if ((t[0] >> 4) >= XTAT_MAX_PORTS) continue;
+      TimingProfile tp = { (uint16_t)(t[1] | (t[2] << 8)), (uint16_t)(t[3] | (t[4] << 8)), t[5] };
+      timingProfileSave(t[0] >> 4, t[0] & 0x0F, tp);
+    }
+  }
+  typematicDefaultsChanged();
+  xtatReloadTiming();
+  xtatSetPortMode(0, mode);
+  stateChanged(STATE_ALL);
+  return true;
+}
+
+bool snapshotRestore() {
+  scanSlots();
+  unsigned long t0 = millis();
+  StorageScratch s;
+  if (!s.data()) return false;
+  // Newest first; fall back to the other slot if it no longer verifies.
+  int first = newestSlot();
+  for (int k = 0; first >= 0 && k < 2; k++) {
+    int i = k == 0 ? first : 1 - first;
+    if (!slots[i].valid) continue;
+    size_t len = 0;
+    if (storageRead(SLOT_PATHS[i], (uint8_t *)s.data(), SNAP_MAX_SIZE, len) && restoreFrom((uint8_t *)s.data(), len)) {
+      Serial.printf("[SNAPSHOT] Restored slot %c seq %u in %lums\n", 'a' + i, (unsigned)slots[i].seq, millis() - t0);
+      return true;
+    }
+    Serial.printf("[SNAPSHOT] Slot %c failed verification\n", 'a' + i);
+    slots[i].valid = false;
+  }
+  Serial.println("[SNAPSHOT] No valid snapshot to restore");
+  return false;
+}
+
+bool snapshotAvailable() {
+  scanSlots();
+  return newestSlot() >= 0;
+}
+
+void snapshotRequestRestore() {
+  restoreStatus = "pending";
+  restoreWanted.store(true);
+}
+
+void snapshotTask() {
+  if (!restoreWanted.exchange(false)) return;
+  restoreStatus = snapshotRestore() ? "restored" : "failed";
+}
+
+void snapshotInit(AsyncWebServer &server) {
+  scanSlots();
+  server.on("/api/snapshot", HTTP_GET, [](AsyncWebServerRequest *req){
+    StaticJsonDocument<512> doc;
+    int newest = newestSlot();
+    doc["newest"] = newest < 0 ? nullptr : (newest ? "b" : "a");
+    doc["restore"] = restoreStatus;
+    JsonArray arr = doc.createNestedArray("slots");
+    for (int i = 0; i < 2; i++) {
+      JsonObject o = arr.createNestedObject();
+      o["slot"] = i ? "b" : "a";
+      o["valid"] = slots[i].valid;
+      if (!slots[i].valid) continue;
+      o["seq"] = slots[i].seq;
+      o["reason"] = REASON_NAMES[slots[i].reason < 3 ? slots[i].reason : 0];
+      o["uptime_ms"] = slots[i].ms;
+      o["bytes"] = slots[i].bytes;
+    }
+    String out; serializeJson(doc, out);
+    req->send(200, "application/json", out);
+  });
+  // The image carries the WiFi and OTA passwords, so download and upload
+  // take the OTA login.
+  server.on("/api/snapshot.bin", HTTP_GET, [](AsyncWebServerRequest *req){
+    if (!req->authenticate(config.ota_user.c_str(), config.ota_pass.c_str())) { req->requestAuthentication(); return; }
+    int newest = newestSlot();
+    if (newest < 0) { req->send(404, "application/json", "{\"error\":\"no snapshot\"}"); return; }
+    req->send(storageFS(), SLOT_PATHS[newest], "application/octet-stream", true);
+  });
+  server.on("/api/snapshot_capture", HTTP_POST, [](AsyncWebServerRequest *req){
+    if (!req->authenticate(config.ota_user.c_str(), config.ota_pass.c_str())) { req->requestAuthentication(); return; }
+    if (!snapshotCapture(SNAP_REASON_MANUAL)) { req->send(500, "application/json", "{\"error\":\"capture failed\"}"); return; }
+    req->send(200, "application/json", "{\"status\":\"ok\"}");
+  });
+  // Restores run on the loop; GET /api/snapshot reports how it went.
+  server.on("/api/snapshot_restore", HTTP_POST, [](AsyncWebServerRequest *req){
+    if (!req->authenticate(config.ota_user.c_str(), config.ota_pass.c_str())) { req->requestAuthentication(); return; }
+    if (!snapshotAvailable()) { req->send(404, "application/json", "{\"error\":\"no valid snapshot\"}"); return; }
+    snapshotRequestRestore();
+    req->send(202, "application/json", "{\"status\":\"restoring\"}");
+  });
+  // Raw snapshot body (e.g. from tools/snapshot_tool.py). Stored as the
+  // newest slot; ?restore=1 also applies it, as /api/snapshot_restore does.
+  server.on("/api/snapshot_upload", HTTP_POST, [](AsyncWebServerRequest *req){
+  }, NULL, [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+    if (total > SNAP_MAX_SIZE) {
+      if (index == 0) req->send(413, "application/json", "{\"error\":\"too large\"}");
+      return;
+    }
+    if (index == 0) {
+      if (!req->authenticate(config.ota_user.c_str(), config.ota_pass.c_str())) { req->requestAuthentication(); return; }
+      req->_tempObject = malloc(total);
+    }
+    uint8_t *buf = (uint8_t *)req->_tempObject;
+    if (!buf) return;
+    memcpy(buf + index, data, len);
+    if (index + len < total) return;
+    SnapHeader h;
+    if (!validate(buf, total, h)) { req->send(400, "application/json", "{\"error\":\"bad snapshot\"}"); return; }
+    h.reason = SNAP_REASON_UPLOAD;
+    if (!writeSlot(buf, total, h)) { req->send(500, "application/json", "{\"error\":\"write failed\"}"); return; }
+    bool restore = req->hasParam("restore") && req->getParam("restore")->value() == "1";
+    if (restore) snapshotRequestRestore();
+    req->send(restore ? 202 : 200, "application/json", restore ? "{\"status\":\"restoring\"}" : "{\"status\":\"stored\"}");
+  });
+  Serial.println("[SNAPSHOT] Endpoints registered");
+}
@@ -0,0 +1,54 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Binary snapshot of everything a user configures: AppConfig (Wi-Fi, mode,
+// OTA, typematic), the legacy keymap, keymapEx overrides and the per-mode
+// timing profiles. Taken before every OTA and restored by the rollback
+// failsafe.
+//
+// Two slots, /snap_a.bin and /snap_b.bin. A capture always overwrites the
+// older slot, so a reset mid-write leaves the newest good snapshot alone.
+//
+// Layout, little endian (tools/snapshot_tool.py reads and writes it):
+//   header 28 bytes: [u32 magic "XKS1"][u16 version][u16 reason][u32 seq]
+//                    [u32 uptime ms][u32 payload len][u32 payload crc32]
+//                    [u32 crc32 of the first 24 bytes]
+//   payload: sections [u8 tag][u16 len][len bytes]; unknown tags are skipped.
+//     SNAP_CONFIG     strings as [u16 len][bytes]: ap_ssid, ap_pass, sta_ssid,
+//                     sta_pass, ota_user, ota_pass, ota_manifest_url; then
+//                     u8 kb_mode, u8 auto_ota_enabled, u32 auto_ota_interval_ms,
+//                     u16 typematic_delay_ms, u16 typematic_period_ms
+//     SNAP_KEYMAP     256 bytes
+//     SNAP_KEYMAP_EX  6-byte records [hid, base, shift, altgr, ctrl, dead]
+//     SNAP_TIMING     6-byte records [port << 4 | mode][u16 half_period_us]
+//                     [u16 inter_byte_us][calibrated]
+
+#define SNAP_MAX_SIZE 4096
+
+enum SnapshotSection {
+  SNAP_CONFIG = 1,
+  SNAP_KEYMAP,
+  SNAP_KEYMAP_EX,
+  SNAP_TIMING
+};
+
+enum SnapshotReason {
+  SNAP_REASON_MANUAL = 0,
+  SNAP_REASON_OTA,
+  SNAP_REASON_UPLOAD
+};
+
+bool snapshotCapture(SnapshotReason reason);
+bool snapshotRestore();                  // newest valid slot, loop task only
+bool snapshotAvailable();
+// snapshotRestore from the next snapshotTask; safe from any task.
+void snapshotRequestRestore();
+void snapshotTask();
+
+void snapshotInit(AsyncWebServer &server);
+
+#endif
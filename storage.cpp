@@ -0,0 +1,143 @@
+#include "storage.h"
+#include "mem_stats.h"
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+
+struct OpStats {
+  uint32_t count;
+  uint32_t errors;
+  uint32_t total_us;
+  uint32_t max_us;
+  uint32_t bytes;
+};
+
+static bool mounted = false;
+static OpStats stats[ST_OP_COUNT];
+static portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+static char *scratch = nullptr;
+static SemaphoreHandle_t scratchLock = nullptr;
+
+static const char *OP_NAMES[ST_OP_COUNT] = { "mount", "read", "write", "rename", "remove", "exists" };
+
+void storageRecord(StorageOp op, uint32_t us, size_t bytes, bool ok) {
+  portENTER_CRITICAL(&statsMux);
+  OpStats &s = stats[op];
+  s.count++;
+  if (!ok) s.errors++;
+  s.total_us += us;
+  if (us > s.max_us) s.max_us = us;
+  s.bytes += bytes;
+  portEXIT_CRITICAL(&statsMux);
+}
+
+bool storageBegin() {
+  if (mounted) return true;
+  if (!scratch) {
+    scratch = (char *)malloc(STORAGE_SCRATCH_SIZE);
+    scratchLock = xSemaphoreCreateMutex();
+  }
+  StorageTimer t(ST_MOUNT);
+  mounted = LittleFS.begin(true);
+  t.done(0, mounted);
+  if (mounted) Serial.printf("[STORAGE] LittleFS mounted (%u/%u bytes used)\n", (unsigned)LittleFS.usedBytes(), (unsigned)LittleFS.totalBytes());
+  else Serial.println("[STORAGE] LittleFS mount failed");
+  return mounted;
+}
+
+bool storageMounted() { return mounted; }
+
+fs::FS &storageFS() { return LittleFS; }
+
+bool storageExists(const char *path) {
+  if (!mounted) return false;
+  StorageTimer t(ST_EXISTS);
+  bool ok = LittleFS.exists(path);
+  t.done(0, true);
+  return ok;
+}
+
+bool storageRemove(const char *path) {
+  if (!mounted) return false;
+  StorageTimer t(ST_REMOVE);
+  bool ok = LittleFS.remove(path);
+  t.done(0, ok);
+  return ok;
+}
+
+bool storageRead(const char *path, uint8_t *buf, size_t cap, size_t &len) {
+  len = 0;
+  if (!mounted) return false;
+  StorageTimer t(ST_READ);
+  File f = LittleFS.open(path, FILE_READ);
+  if (!f) return false;
+  size_t size = f.size();
+  bool ok = size <= cap && f.read(buf, size) == size;
+  f.close();
+  if (ok) len = size;
+  t.done(len, ok);
+  return ok;
+}
+
+bool storageWriteAtomic(const char *path, const uint8_t *data, size_t len) {
+  if (!mounted) return false;
+  String tmp = String(path) + ".tmp";
+  bool ok;
+  {
+    StorageTimer t(ST_WRITE);
+    File f = LittleFS.open(tmp, FILE_WRITE);
+    ok = f && f.write(data, len) == len;
+    if (f) f.close();
+    t.done(len, ok);
+  }
+  if (!ok) { LittleFS.remove(tmp); return false; }
+  StorageTimer t(ST_RENAME);
+  // littlefs replaces an existing destination atomically
+  ok = LittleFS.rename(tmp, path);
+  if (!ok) {
+    LittleFS.remove(path);
+    ok = LittleFS.rename(tmp, path);
+  }
+  t.done(0, ok);
+  return ok;
+}
+
+File storageOpen(const char *path, const char *mode) {
+  if (!mounted) return File();
+  return LittleFS.open(path, mode);
+}
+
+StorageScratch::StorageScratch() : _buf(scratch) {
+  if (scratchLock) xSemaphoreTake(scratchLock, portMAX_DELAY);
+}
+
+StorageScratch::~StorageScratch() {
+  if (scratchLock) xSemaphoreGive(scratchLock);
+}
+
+void storageInit(AsyncWebServer &server) {
+  server.on("/api/storage", HTTP_GET, [](AsyncWebServerRequest *req){
+    MemJsonDocument<MEM_WEB> doc(1024);
+    doc["mounted"] = mounted;
+    if (mounted) {
+      doc["total_bytes"] = LittleFS.totalBytes();
+      doc["used_bytes"] = LittleFS.usedBytes();
+    }
+    doc["scratch_bytes"] = STORAGE_SCRATCH_SIZE;
+    OpStats snap[ST_OP_COUNT];
+    portENTER_CRITICAL(&statsMux);
+    memcpy(snap, stats, sizeof(snap));
+    portEXIT_CRITICAL(&statsMux);
+    JsonObject ops = doc.createNestedObject("ops");
+    for (int i = 0; i < ST_OP_COUNT; i++) {
+      JsonObject o = ops.createNestedObject(OP_NAMES[i]);
+      o["count"] = snap[i].count;
+      o["errors"] = snap[i].errors;
+      o["avg_us"] = snap[i].count ? snap[i].total_us / snap[i].count : 0;
+      o["max_us"] = snap[i].max_us;
+      o["bytes"] = snap[i].bytes;
+    }
+    String out; serializeJson(doc, out);
+    req->send(200, "application/json", out);
+  });
+  Serial.println("[STORAGE] Endpoints registered");
+}
@@ -0,0 +1,68 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include <FS.h>
+
+// Single owner of the on-flash filesystem (LittleFS). It is mounted once by
+// storageBegin(); everything else uses storageFS() and never remounts.
+//
+// storageWriteAtomic() writes <path>.tmp and renames it over <path>, so a
+// reset mid-write leaves the previous file intact. Small files can be
+// serialized into a preallocated scratch buffer (StorageScratch) instead of
+// growing a String. Every operation is timed for /api/storage.
+
+#define STORAGE_SCRATCH_SIZE 8192
+
+enum StorageOp {
+  ST_MOUNT = 0,
+  ST_READ,
+  ST_WRITE,
+  ST_RENAME,
+  ST_REMOVE,
+  ST_EXISTS,
+  ST_OP_COUNT
+};
+
+bool storageBegin();
+bool storageMounted();
+fs::FS &storageFS();
+
+bool storageExists(const char *path);
+bool storageRemove(const char *path);
+// Reads the whole file into buf; false if missing or larger than cap.
+bool storageRead(const char *path, uint8_t *buf, size_t cap, size_t &len);
+bool storageWriteAtomic(const char *path, const uint8_t *data, size_t len);
+File storageOpen(const char *path, const char *mode);  // untimed, for streaming
+
+void storageRecord(StorageOp op, uint32_t us, size_t bytes, bool ok);
+
+// Times a block of streaming work as one operation.
+class StorageTimer {
+public:
+  explicit StorageTimer(StorageOp op) : _op(op), _t0(micros()) {}
+  ~StorageTimer() { storageRecord(_op, micros() - _t0, _bytes, _ok); }
+  void done(size_t bytes, bool ok) { _bytes = bytes; _ok = ok; }
+private:
+  StorageOp _op;
+  uint32_t _t0;
+  size_t _bytes = 0;
+  bool _ok = false;
+};
+
+// Exclusive use of the preallocated scratch buffer for the lifetime of the object.
+class StorageScratch {
+public:
+  StorageScratch();
+  ~StorageScratch();
+  char *data() { return _buf; }
+  size_t size() const { return STORAGE_SCRATCH_SIZE; }
+private:
+  char *_buf;
+};
+
+void storageInit(AsyncWebServer &server);   // /api/storage
+
+#endif
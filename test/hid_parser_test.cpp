@@ -0,0 +1,117 @@
+// Host test for hid_parser: real boot and NKRO descriptors, plus one that
+// leaves out Usage Maximum.
+#include "hid_parser.h"
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+  if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } \
+} while (0)
+
+// HID 1.11 appendix B.1, the boot keyboard descriptor.
+static const uint8_t BOOT_DESC[] = {
+  0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7,
+  0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01,
+  0x75, 0x08, 0x81, 0x01, 0x95, 0x05, 0x75, 0x01, 0x05, 0x08, 0x19, 0x01,
+  0x29, 0x05, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x01, 0x95, 0x06,
+  0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65,
+  0x81, 0x00, 0xC0,
+};
+
+// NKRO keyboard with report ID 6: modifier bitmap, LEDs, then a 240-bit
+// bitmap for usages 0x00-0xEF (QMK's layout).
+static const uint8_t NKRO_DESC[] = {
+  0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x06, 0x05, 0x07, 0x19, 0xE0,
+  0x29, 0xE7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+  0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x95, 0x05, 0x75, 0x01, 0x91, 0x02,
+  0x95, 0x01, 0x75, 0x03, 0x91, 0x03, 0x05, 0x07, 0x19, 0x00, 0x29, 0xEF,
+  0x15, 0x00, 0x25, 0x01, 0x95, 0xF0, 0x75, 0x01, 0x81, 0x02, 0xC0,
+};
+
+// Boot layout without Usage Maximum on the key array.
+static const uint8_t NO_MAX_DESC[] = {
+  0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7,
+  0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01,
+  0x75, 0x08, 0x81, 0x01, 0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65,
+  0x05, 0x07, 0x19, 0x00, 0x81, 0x00, 0xC0,
+};
+
+// Same, with neither Usage Maximum nor Logical Maximum.
+static const uint8_t NO_MAX_NO_LOGICAL_DESC[] = {
+  0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x95, 0x06, 0x75, 0x08,
+  0x19, 0x04, 0x81, 0x00, 0xC0,
+};
+
+struct Events { uint8_t usage[32]; bool pressed[32]; int n; };
+
+static void record(uint8_t usage, bool pressed, void *ctx) {
+  Events *e = (Events *)ctx;
+  if (e->n < 32) { e->usage[e->n] = usage; e->pressed[e->n] = pressed; e->n++; }
+}
+
+static void testBoot() {
+  HidKeyboardLayout l;
+  CHECK(hidParseReportDescriptor(BOOT_DESC, sizeof(BOOT_DESC), l));
+  CHECK(l.report_id == 0);
+  CHECK(l.report_bits == 64);
+  CHECK(l.bitmap_count == 1 && l.bitmap[0].usage_min == 0xE0 && l.bitmap[0].count == 8);
+  CHECK(l.has_array && l.array.bit_offset == 16 && l.array.count == 6 && l.array.usage_max == 0x65);
+
+  const uint8_t shiftA[8] = { 0x02, 0, 0x04, 0, 0, 0, 0, 0 };
+  HidKeyState prev, cur;
+  hidStateClear(prev);
+  CHECK(hidDecodeReport(l, shiftA, sizeof(shiftA), cur));
+  CHECK(hidStateTest(cur, 0xE1) && hidStateTest(cur, 0x04));
+  Events ev = {};
+  CHECK(hidDiffState(prev, cur, record, &ev) == 2);
+  CHECK(ev.usage[0] == 0xE1 && ev.pressed[0]);   // modifier first
+  CHECK(ev.usage[1] == 0x04 && ev.pressed[1]);
+
+  const uint8_t rollover[8] = { 0, 0, 1, 1, 1, 1, 1, 1 };
+  CHECK(!hidDecodeReport(l, rollover, sizeof(rollover), cur));
+}
+
+static void testNkro() {
+  HidKeyboardLayout l;
+  CHECK(hidParseReportDescriptor(NKRO_DESC, sizeof(NKRO_DESC), l));
+  CHECK(l.report_id == 6);
+  CHECK(l.report_bits == 8 + 240);
+  CHECK(l.bitmap_count == 2 && !l.has_array);
+
+  uint8_t report[1 + 31] = { 6 };
+  report[1] = 0x01;                               // Left Ctrl
+  for (uint8_t u = 0x04; u <= 0x0B; u++) report[2 + u / 8] |= 1 << (u % 8);   // A..H at once
+  report[2 + 0x39 / 8] |= 1 << (0x39 % 8);        // Caps Lock
+  HidKeyState cur;
+  CHECK(hidDecodeReport(l, report, sizeof(report), cur));
+  CHECK(hidStateTest(cur, 0xE0) && hidStateTest(cur, 0x39));
+  for (uint8_t u = 0x04; u <= 0x0B; u++) CHECK(hidStateTest(cur, u));
+  CHECK(!hidStateTest(cur, 0x0C));
+
+  report[0] = 1;                                  // another report ID
+  CHECK(!hidDecodeReport(l, report, sizeof(report), cur));
+}
+
+static void testNoUsageMaximum() {
+  HidKeyboardLayout l;
+  CHECK(hidParseReportDescriptor(NO_MAX_DESC, sizeof(NO_MAX_DESC), l));
+  CHECK(l.has_array && l.array.usage_max == 0x65);
+  const uint8_t a[8] = { 0, 0, 0x04, 0x2C, 0, 0, 0, 0 };
+  HidKeyState cur;
+  CHECK(hidDecodeReport(l, a, sizeof(a), cur));
+  CHECK(hidStateTest(cur, 0x04) && hidStateTest(cur, 0x2C));
+
+  CHECK(hidParseReportDescriptor(NO_MAX_NO_LOGICAL_DESC, sizeof(NO_MAX_NO_LOGICAL_DESC), l));
+  CHECK(l.array.usage_min == 0x04 && l.array.usage_max == 0x04 + 6 - 1);
+}
+
+int main() {
+  testBoot();
+  testNkro();
+  testNoUsageMaximum();
+  if (failures) { printf("hid_parser_test: %d failure(s)\n", failures); return 1; }
+  printf("hid_parser_test: ok\n");
+  return 0;
+}
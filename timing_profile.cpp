@@ -0,0 +1,289 @@
+#include "timing_profile.h"
+#include "xt_at_output.h"
+#include "config.h"
+#include "web_state.h"
+#include <Preferences.h>
+#include <ArduinoJson.h>
+
+static Preferences prefs;
+
+#define TP_VERSION 1
+
+// Sweep from slow to fast; the first failing candidate ends the sweep.
+static const uint16_t HALF_PERIOD_STEPS[] = { 60, 50, 40, 35, 30, 25, 20, 16, 12, 10 };
+static const uint16_t GAP_STEPS[]         = { 200, 150, 100, 75, 50, 30, 20, 10, 0 };
+#define N_HALF (sizeof(HALF_PERIOD_STEPS) / sizeof(HALF_PERIOD_STEPS[0]))
+#define N_GAP  (sizeof(GAP_STEPS) / sizeof(GAP_STEPS[0]))
+
+// A speed is accepted only when the host answers. The probe is 0xAA (BAT
+// passed), which AT/PS/2 hosts answer by reinitialising the keyboard
+// (identify, LEDs, enable...); 0xFE back means the byte arrived corrupted.
+// The gap sweep sends 0xEE first, ignored by keyboard drivers, so only an
+// intact second byte gets an answer.
+#define PROBES_PER_STEP    3
+#define PROBE_WINDOW_MS    500   // time the host gets to start answering
+#define PROBE_QUIET_MS     50    // host silent this long = its answer is complete
+#define PROBE_BYTE         0xAA
+#define PROBE_LEAD_BYTE    0xEE
+#define INHIBIT_WAIT_US    2000
+
+enum CalState { CAL_IDLE, CAL_HALF, CAL_GAP, CAL_DONE, CAL_FAILED };
+
+static CalState calState = CAL_IDLE;
+static uint8_t calPort = 0;
+static uint8_t calMode = MODE_AT;
+static uint8_t stepIdx = 0;
+static uint8_t probeIdx = 0;
+static unsigned long probeAt = 0;
+static bool probePending = false;
+static uint16_t bestHalf = 0;
+static uint16_t bestGap = 0;
+static uint16_t failures = 0;
+static bool savedHostEcho = false;
+static bool answered = false, rejected = false;
+static unsigned long lastHostMs = 0;
+
+// Requests from the web server (AsyncTCP task). The wire timing and
+// xtat_hostecho_enabled belong to the loop, so timingCalibrationTask, which
+// runs there next to xtatTask, carries them out.
+static portMUX_TYPE reqMux = portMUX_INITIALIZER_UNLOCKED;
+static bool startWanted = false;
+static bool resetWanted = false;
+static uint8_t resetPort = 0, resetMode = MODE_AT;
+
+static const char *modeKey(uint8_t mode) {
+  return mode == MODE_XT ? "xt" : (mode == MODE_PS2 ? "ps2" : "at");
+}
+
+// "at" for port 0, "at2" for port 2.
+struct ProfileKey {
+  char s[8];
+  ProfileKey(uint8_t port, uint8_t mode) {
+    if (port) snprintf(s, sizeof(s), "%s%u", modeKey(mode), port);
+    else strlcpy(s, modeKey(mode), sizeof(s));
+  }
+};
+
+bool timingProfileLoad(uint8_t port, uint8_t mode, TimingProfile &out) {
+  uint8_t blob[6];
+  ProfileKey key(port, mode);
+  prefs.begin("timing", true);
+  size_t n = prefs.getBytesLength(key.s) == sizeof(blob) ? prefs.getBytes(key.s, blob, sizeof(blob)) : 0;
+  prefs.end();
+  if (n != sizeof(blob) || blob[0] != TP_VERSION) return false;
+  out.half_period_us = (uint16_t)(blob[1] | (blob[2] << 8));
+  out.inter_byte_us  = (uint16_t)(blob[3] | (blob[4] << 8));
+  out.calibrated     = blob[5];
+  return out.half_period_us > 0;
+}
+
+bool timingProfileSave(uint8_t port, uint8_t mode, const TimingProfile &p) {
+  uint8_t blob[6] = { TP_VERSION,
+                      (uint8_t)(p.half_period_us & 0xFF), (uint8_t)(p.half_period_us >> 8),
+                      (uint8_t)(p.inter_byte_us & 0xFF),  (uint8_t)(p.inter_byte_us >> 8),
+                      p.calibrated };
+  prefs.begin("timing", false);
+  size_t n = prefs.putBytes(ProfileKey(port, mode).s, blob, sizeof(blob));
+  prefs.end();
+  stateChanged(STATE_PROFILE);
+  return n == sizeof(blob);
+}
+
+void timingProfileClear(uint8_t port, uint8_t mode) {
+  prefs.begin("timing", false);
+  prefs.remove(ProfileKey(port, mode).s);
+  prefs.end();
+  stateChanged(STATE_PROFILE);
+}
+
+void timingProfileApply(uint8_t port, uint8_t mode) {
+  TimingProfile p;
+  if (timingProfileLoad(port, mode, p)) {
+    xtatSetTiming(p.half_period_us, p.inter_byte_us);
+    Serial.printf("[TIMING] port %u %s profile: half=%uus gap=%uus\n", port, modeKey(mode), p.half_period_us, p.inter_byte_us);
+  } else {
+    xtatSetTiming(xtatDefaultBitDelayUs(), xtatDefaultBitDelayUs());
+  }
+}
+
+// Host bytes since the probe: 0xFE asks for a resend, anything else is the
+// host reacting to the probe.
+static void pollHost(unsigned long now) {
+  uint8_t buf[16];
+  size_t n;
+  while ((n = xtatPopHostEcho(buf, sizeof(buf))) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      if (buf[i] == 0xFE) rejected = true;
+      else answered = true;
+    }
+    lastHostMs = now;
+  }
+}
+
+static void finishCalibration(bool ok) {
+  xtat_hostecho_enabled = savedHostEcho;
+  if (!ok) {
+    calState = CAL_FAILED;
+    timingProfileApply(calPort, calMode);
+    Serial.println("[TIMING] Calibration failed: host did not answer at the slowest timing");
+    return;
+  }
+  // safety margin: +25% (at least +5us) on the clock, +25% +10us on the gap
+  TimingProfile p;
+  p.half_period_us = max<uint16_t>((uint16_t)((bestHalf * 5 + 3) / 4), (uint16_t)(bestHalf + 5));
+  p.inter_byte_us  = (uint16_t)((bestGap * 5 + 3) / 4 + 10);
+  p.calibrated = 1;
+  timingProfileSave(calPort, calMode, p);
+  calState = CAL_DONE;
+  timingProfileApply(calPort, calMode);
+  Serial.printf("[TIMING] Calibration done: fastest half=%uus gap=%uus -> using half=%uus gap=%uus\n",
+                bestHalf, bestGap, p.half_period_us, p.inter_byte_us);
+}
+
+const char *timingCalibrationStart() {
+  if (timingCalibrationRunning()) return "calibration running";
+  if (xtatMode() == MODE_XT) return "XT hosts do not answer; nothing to calibrate against";
+  portENTER_CRITICAL(&reqMux);
+  startWanted = true;
+  portEXIT_CRITICAL(&reqMux);
+  return nullptr;
+}
+
+// Forget the control port's profile and go back to the default speed.
+static void timingReset() {
+  portENTER_CRITICAL(&reqMux);
+  resetPort = xtatControlPort();
+  resetMode = xtatMode();
+  resetWanted = true;
+  portEXIT_CRITICAL(&reqMux);
+}
+
+static void beginCalibration() {
+  calPort = xtatControlPort();
+  calMode = xtatMode();
+  savedHostEcho = xtat_hostecho_enabled;
+  xtat_hostecho_enabled = true;
+  uint8_t tmp[16];
+  while (xtatPopHostEcho(tmp, sizeof(tmp)) > 0) { }
+  calState = CAL_HALF;
+  stepIdx = probeIdx = 0;
+  probePending = false;
+  bestHalf = bestGap = 0;
+  failures = 0;
+  xtatSetTiming(HALF_PERIOD_STEPS[0], GAP_STEPS[0]);
+  Serial.printf("[TIMING] Calibration started for port %u %s\n", calPort, modeKey(calMode));
+}
+
+bool timingCalibrationRunning() {
+  return startWanted || calState == CAL_HALF || calState == CAL_GAP;
+}
+
+// Takes the web server's requests over; a reset waits for a running
+// calibration, which would otherwise save over it.
+static void takeRequests() {
+  portENTER_CRITICAL(&reqMux);
+  bool start = startWanted;
+  bool reset = resetWanted && calState != CAL_HALF && calState != CAL_GAP;
+  uint8_t port = resetPort, mode = resetMode;
+  if (reset) resetWanted = false;
+  portEXIT_CRITICAL(&reqMux);
+  if (reset) {
+    timingProfileClear(port, mode);
+    xtatReloadTiming();
+  }
+  if (start) {
+    if (xtatMode() != MODE_XT) beginCalibration();
+    portENTER_CRITICAL(&reqMux);
+    startWanted = false;
+    portEXIT_CRITICAL(&reqMux);
+  }
+}
+
+// One probe (or one probe result) per call so the loop never blocks.
+void timingCalibrationTask() {
+  takeRequests();
+  if (calState != CAL_HALF && calState != CAL_GAP) return;
+  unsigned long now = millis();
+  if (probePending) {
+    pollHost(now);
+    bool done = answered && now - lastHostMs >= PROBE_QUIET_MS;
+    if (!done && now - probeAt < PROBE_WINDOW_MS) return;
+    probePending = false;
+    if (rejected || !answered) failures++;
+    if (++probeIdx < PROBES_PER_STEP && failures == 0) return;
+
+    bool passed = failures == 0;
+    failures = 0;
+    probeIdx = 0;
+    if (calState == CAL_HALF) {
+      if (passed) bestHalf = HALF_PERIOD_STEPS[stepIdx];
+      if (!passed || ++stepIdx >= N_HALF) {
+        if (bestHalf == 0) { finishCalibration(false); return; }
+        calState = CAL_GAP;
+        stepIdx = 0;
+        bestGap = GAP_STEPS[0];
+      }
+    } else {
+      if (passed) bestGap = GAP_STEPS[stepIdx];
+      if (!passed || ++stepIdx >= N_GAP) { finishCalibration(true); return; }
+    }
+    if (calState == CAL_HALF) xtatSetTiming(HALF_PERIOD_STEPS[stepIdx], GAP_STEPS[0]);
+    else xtatSetTiming(bestHalf, GAP_STEPS[stepIdx]);
+    return;
+  }
+
+  answered = rejected = false;
+  bool ok;
+  if (calState == CAL_GAP) {
+    ok = xtatSendProbe(PROBE_LEAD_BYTE);
+    if (ok) {
+      delayMicroseconds(xtatInterByteUs());
+      // Like the normal send path, wait out an inhibit after the first byte.
+      unsigned long t0 = micros();
+      while (xtatHostInhibiting() && micros() - t0 < INHIBIT_WAIT_US) { }
+      ok = xtatSendProbe(PROBE_BYTE);
+    }
+  } else {
+    ok = xtatSendProbe(PROBE_BYTE);
+  }
+  if (!ok) failures++;
+  probeAt = now;
+  probePending = true;
+}
+
+static String statusJSON() {
+  StaticJsonDocument<384> doc;
+  static const char *names[] = { "idle", "clock", "gap", "done", "failed" };
+  doc["state"] = names[calState];
+  doc["port"] = xtatControlPort();
+  doc["mode"] = modeKey(xtatMode());
+  doc["half_period_us"] = xtatBitDelayUs();
+  doc["inter_byte_us"] = xtatInterByteUs();
+  doc["default_us"] = xtatDefaultBitDelayUs();
+  TimingProfile p;
+  if (timingProfileLoad(xtatControlPort(), xtatMode(), p)) {
+    JsonObject o = doc.createNestedObject("profile");
+    o["half_period_us"] = p.half_period_us;
+    o["inter_byte_us"] = p.inter_byte_us;
+    o["calibrated"] = p.calibrated;
+  }
+  String out;
+  serializeJson(doc, out);
+  return out;
+}
+
+void timingInit(AsyncWebServer &server) {
+  server.on("/api/timing", HTTP_GET, [](AsyncWebServerRequest *req){
+    req->send(200, "application/json", statusJSON());
+  });
+  server.on("/api/timing_calibrate", HTTP_POST, [](AsyncWebServerRequest *req){
+    const char *err = timingCalibrationStart();
+    if (err) { req->send(409, "application/json", String("{\"error\":\"") + err + "\"}"); return; }
+    req->send(202, "application/json", "{\"status\":\"started\"}");
+  });
+  server.on("/api/timing_reset", HTTP_POST, [](AsyncWebServerRequest *req){
+    timingReset();
+    req->send(202, "application/json", "{\"status\":\"reset\"}");
+  });
+  Serial.println("[TIMING] Endpoints registered");
+}
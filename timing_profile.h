@@ -0,0 +1,31 @@
+#ifndef TIMING_PROFILE_H
+#define TIMING_PROFILE_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Per-port, per-protocol wire timing, found by calibration against the host
+// on that port and persisted in NVS so the transmitter starts at its best
+// safe speed on boot. Port 0 keeps the keys it had before there were ports.
+struct TimingProfile {
+  uint16_t half_period_us;
+  uint16_t inter_byte_us;
+  uint8_t calibrated;
+};
+
+bool timingProfileLoad(uint8_t port, uint8_t mode, TimingProfile &out);
+bool timingProfileSave(uint8_t port, uint8_t mode, const TimingProfile &p);
+void timingProfileClear(uint8_t port, uint8_t mode);
+void timingProfileApply(uint8_t port, uint8_t mode);   // onto the control port
+
+// nullptr once requested, otherwise why not; the next timingCalibrationTask
+// starts it. Safe from any task. XT hosts never answer the keyboard, so
+// there is nothing to calibrate against.
+const char *timingCalibrationStart();
+void timingCalibrationTask();
+bool timingCalibrationRunning();
+
+void timingInit(AsyncWebServer &server);
+
+#endif
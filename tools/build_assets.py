@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Build gzip-compressed, content-hashed web assets from data/.
+
+    tools/build_assets.py            # writes web_assets_gen.h (flash-embedded)
+    tools/build_assets.py --fs       # also writes data/<name>.gz + data/assets.json
+
+Every .html/.js/.css file in data/ gets a strong ETag (first 16 hex digits
+of the SHA-256 of its served content). References from HTML to other
+assets are rewritten to "name?v=<etag>" so those can be cached forever;
+HTML itself is always revalidated. Output is deterministic (gzip mtime 0),
+so an unchanged tree gives an unchanged header.
+"""
+
+import argparse
+import gzip
+import hashlib
+import json
+import os
+import re
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+MIME = {
+    ".html": "text/html",
+    ".js": "application/javascript",
+    ".css": "text/css",
+}
+
+
+def etag(data):
+    return hashlib.sha256(data).hexdigest()[:16]
+
+
+def compress(data):
+    return gzip.compress(data, compresslevel=9, mtime=0)
+
+
+def sub_bytes(m, hashes):
+    name = m.group(2).decode()
+    if name in hashes:
+        return b'%s="%s?v=%s"' % (m.group(1), name.encode(), hashes[name].encode())
+    return m.group(0)
+
+
+def c_ident(name):
+    return "WA_" + re.sub(r"[^A-Za-z0-9]", "_", name).upper()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--data", default=os.path.join(ROOT, "data"))
+    ap.add_argument("--header", default=os.path.join(ROOT, "web_assets_gen.h"))
+    ap.add_argument("--no-header", action="store_true", help="skip the flash-embedded header")
+    ap.add_argument("--fs", action="store_true", help="write <name>.gz and assets.json into the data dir")
+    args = ap.parse_args()
+
+    names = sorted(n for n in os.listdir(args.data) if os.path.splitext(n)[1] in MIME)
+    content = {}
+    for n in names:
+        with open(os.path.join(args.data, n), "rb") as f:
+            content[n] = f.read()
+
+    # Non-HTML first so HTML can reference their hashes.
+    hashes = {n: etag(content[n]) for n in names if not n.endswith(".html")}
+    for n in names:
+        if n.endswith(".html"):
+            content[n] = re.sub(rb'(href|src)="([^"?#:]+)"', lambda m: sub_bytes(m, hashes), content[n])
+            hashes[n] = etag(content[n])
+
+    assets = []
+    raw_total = gz_total = 0
+    for n in names:
+        gz = compress(content[n])
+        raw_total += len(content[n])
+        gz_total += len(gz)
+        assets.append((n, MIME[os.path.splitext(n)[1]], hashes[n], gz))
+
+    if not args.no_header:
+        out = ["// Generated by tools/build_assets.py - do not edit.",
+               "#ifndef WEB_ASSETS_GEN_H", "#define WEB_ASSETS_GEN_H", "",
+               '#include "web_assets.h"', ""]
+        for n, _mime, _tag, gz in assets:
+            out.append("static const uint8_t %s[] PROGMEM = {" % c_ident(n))
+            for i in range(0, len(gz), 20):
+                out.append("  " + ",".join("0x%02x" % b for b in gz[i:i + 20]) + ",")
+            out.append("};")
+        out.append("")
+        out.append("static const WebAsset WEB_ASSETS[] = {")
+        for n, mime, tag, gz in assets:
+            out.append('  { "/%s", "%s", "%s", %s, %d },' % (n, mime, tag, c_ident(n), len(gz)))
+        out.append("};")
+        out.append("#define WEB_ASSET_COUNT %d" % len(assets))
+        out.append("")
+        out.append("#endif")
+        with open(args.header, "w") as f:
+            f.write("\n".join(out) + "\n")
+
+    if args.fs:
+        manifest = {}
+        for n, mime, tag, gz in assets:
+            with open(os.path.join(args.data, n + ".gz"), "wb") as f:
+                f.write(gz)
+            manifest["/" + n] = {"etag": tag, "mime": mime}
+        with open(os.path.join(args.data, "assets.json"), "w") as f:
+            json.dump(manifest, f, indent=1, sort_keys=True)
+
+    for n, _mime, tag, gz in assets:
+        print("%-22s %6d -> %6d  %s" % (n, len(content[n]), len(gz), tag))
+    print("total %d -> %d bytes (%.0f%%)" % (raw_total, gz_total, 100.0 * gz_total / max(raw_total, 1)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""Decode a flight recorder dump from /api/flightrec.bin.
+
+    flightrec_decode.py flightrec.bin [--type make,host_cmd] [--boot N] [--json]
+    flightrec_decode.py --url http://192.168.4.1/api/flightrec.bin --auth admin:pass --wallclock
+
+Layout (see flightrec.h): 4 KB sectors, each a 16-byte header
+[magic "FRC1"][seq][reserved][crc32 of first 12 bytes] followed by 8-byte
+records [type][a][b u16][ms u32], little endian, 0xFF type = erased.
+"""
+
+import argparse
+import base64
+import datetime
+import json
+import struct
+import sys
+import urllib.request
+import zlib
+
+SECTOR = 4096
+HEADER = 16
+RECORD = 8
+MAGIC = 0x31435246
+
+TYPES = {
+    1: "boot", 2: "make", 3: "break", 4: "host_cmd", 5: "resend",
+    6: "queue_overflow", 7: "host_reset", 8: "mode",
+}
+
+RESET_REASONS = {
+    0: "unknown", 1: "poweron", 2: "ext", 3: "sw", 4: "panic", 5: "int_wdt",
+    6: "task_wdt", 7: "wdt", 8: "deepsleep", 9: "brownout", 10: "sdio",
+}
+
+MODES = {1: "XT", 2: "AT", 3: "PS2"}
+
+
+def sectors(blob):
+    out = []
+    for off in range(0, len(blob) - SECTOR + 1, SECTOR):
+        magic, seq, _res, crc = struct.unpack_from("<IIII", blob, off)
+        if magic != MAGIC or crc != zlib.crc32(blob[off:off + 12]):
+            continue
+        out.append((seq, off))
+    out.sort()
+    return out
+
+
+def records(blob):
+    """Yields (boot, type, a, b, ms) oldest first."""
+    boot = None
+    for _seq, off in sectors(blob):
+        for pos in range(off + HEADER, off + SECTOR, RECORD):
+            rtype, a, b, ms = struct.unpack_from("<BBHI", blob, pos)
+            if rtype == 0xFF:
+                break
+            if rtype == 1:
+                boot = b
+            yield boot, rtype, a, b, ms
+
+
+def describe(rtype, a, b):
+    if rtype == 1:
+        return "reason=%s boot=%d" % (RESET_REASONS.get(a, a), b)
+    if rtype in (2, 3, 6):
+        return "code=%02X hid=%02X" % (a, b)
+    if rtype == 4:
+        return "byte=%02X pending=%02X" % (a, b)
+    if rtype == 5:
+        return "byte=%02X" % a
+    if rtype == 8:
+        return "mode=%s" % MODES.get(a, a)
+    return ""
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("file", nargs="?", help="dump saved from /api/flightrec.bin")
+    ap.add_argument("--url", help="fetch the dump from the device instead")
+    ap.add_argument("--auth", help="user:pass for the device (the OTA login)")
+    ap.add_argument("--type", help="comma separated record types to keep")
+    ap.add_argument("--boot", type=int, help="only this boot number")
+    ap.add_argument("--since-ms", type=int, default=0, help="only records at or after this uptime")
+    ap.add_argument("--wallclock", action="store_true",
+                    help="with --url: convert the current boot's times to local time")
+    ap.add_argument("--json", action="store_true", help="one JSON object per line")
+    args = ap.parse_args()
+
+    anchor = None
+    if args.url:
+        headers = {}
+        if args.auth:
+            headers["Authorization"] = "Basic " + base64.b64encode(args.auth.encode()).decode()
+        with urllib.request.urlopen(urllib.request.Request(args.url, headers=headers)) as resp:
+            blob = resp.read()
+            if args.wallclock and resp.headers.get("X-Uptime-Ms"):
+                anchor = (int(resp.headers["X-Boot"]), int(resp.headers["X-Uptime-Ms"]),
+                          datetime.datetime.now())
+    elif args.file:
+        with open(args.file, "rb") as f:
+            blob = f.read()
+    else:
+        ap.error("give a dump file or --url")
+
+    wanted = None
+    if args.type:
+        names = set(args.type.split(","))
+        wanted = {t for t, n in TYPES.items() if n in names}
+
+    for boot, rtype, a, b, ms in records(blob):
+        if wanted is not None and rtype not in wanted:
+            continue
+        if args.boot is not None and boot != args.boot:
+            continue
+        if ms < args.since_ms:
+            continue
+        name = TYPES.get(rtype, "type%d" % rtype)
+        when = None
+        if anchor and boot == anchor[0]:
+            when = anchor[2] - datetime.timedelta(milliseconds=anchor[1] - ms)
+        if args.json:
+            obj = {"boot": boot, "ms": ms, "type": name, "a": a, "b": b}
+            if when:
+                obj["time"] = when.isoformat(timespec="milliseconds")
+            print(json.dumps(obj))
+        else:
+            stamp = when.strftime("%Y-%m-%d %H:%M:%S.%f")[:-3] if when else "%10.3fs" % (ms / 1000.0)
+            print("boot %-5s %s  %-14s %s" % (boot, stamp, name, describe(rtype, a, b)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,1005 @@
+// keymapc: compiles a layout into the binary keymap image the firmware
+// loads without parsing (keymap_image.h, /keymap_ex.bin).
+//
+//     keymapc -o keymap_ex.bin se                        # XKB symbols, host uses the same layout
+//     keymapc -o keymap_ex.bin --host se us              # US keys typed on a Swedish host
+//     keymapc -o keymap_ex.bin data/keymap_ex.json       # sparse map or 256-element array
+//     keymapc -o keymap_ex.bin --host se qmk_keymap.json # QMK configurator export
+//     keymapc --dump keymap_ex.bin
+//
+// Then either copy the image to data/keymap_ex.bin before flashing the
+// filesystem, or
+//     curl --data-binary @keymap_ex.bin http://192.168.4.1/api/map_ex_image
+//
+// XKB sources are symbol files ("se", "se(nodeadkeys)" or a path); includes
+// are resolved from -I directories, the source's directory and
+// /usr/share/X11/xkb/symbols. Every entry holds set 2 codes of host keys.
+// Shift is forwarded to the host, Right Alt (an E0 code) is not, so:
+//   base  -> host key that has the character on level 1
+//   shift -> host key that has it on level 2
+//   altgr -> host key that has it on level 1; with Shift, that key's level 2
+// Characters that no key and modifier can produce are reported as
+// unreachable. The host layout defaults to the source layout.
+//
+// QMK keymaps use layer 0 of LAYOUT_fullsize_iso / LAYOUT_fullsize_ansi;
+// keycodes with modifiers and layer keys cannot be expressed and are
+// reported as conflicts. Conflicts stop the image from being written
+// unless --force is given.
+//
+// Everything outside the character block, and whatever a JSON or QMK
+// source leaves out, keeps the device default (keymap.cpp, shared with the
+// firmware); the image only lists entries that differ from it.
+
+#include "keymap.h"
+#include "keymap_image.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// ---------------------------------------------------------------------------
+// Keys: XKB name, HID usage, set 2 code (0 = needs an E0 prefix, which a
+// keymapEx entry cannot hold).
+
+enum { K_CHAR = 1, K_MOD = 2 };
+
+struct KeyDef {
+  const char *xkb;
+  uint8_t hid;
+  uint8_t set2;
+  uint8_t flags;
+};
+
+static const KeyDef KEYS[] = {
+  {"ESC", 0x29, 0x76, 0},
+  {"FK01", 0x3A, 0x05, 0}, {"FK02", 0x3B, 0x06, 0}, {"FK03", 0x3C, 0x04, 0}, {"FK04", 0x3D, 0x0C, 0},
+  {"FK05", 0x3E, 0x03, 0}, {"FK06", 0x3F, 0x0B, 0}, {"FK07", 0x40, 0x83, 0}, {"FK08", 0x41, 0x0A, 0},
+  {"FK09", 0x42, 0x01, 0}, {"FK10", 0x43, 0x09, 0}, {"FK11", 0x44, 0x78, 0}, {"FK12", 0x45, 0x07, 0},
+  {"TLDE", 0x35, 0x0E, K_CHAR},
+  {"AE01", 0x1E, 0x16, K_CHAR}, {"AE02", 0x1F, 0x1E, K_CHAR}, {"AE03", 0x20, 0x26, K_CHAR},
+  {"AE04", 0x21, 0x25, K_CHAR}, {"AE05", 0x22, 0x2E, K_CHAR}, {"AE06", 0x23, 0x36, K_CHAR},
+  {"AE07", 0x24, 0x3D, K_CHAR}, {"AE08", 0x25, 0x3E, K_CHAR}, {"AE09", 0x26, 0x46, K_CHAR},
+  {"AE10", 0x27, 0x45, K_CHAR}, {"AE11", 0x2D, 0x4E, K_CHAR}, {"AE12", 0x2E, 0x55, K_CHAR},
+  {"BKSP", 0x2A, 0x66, 0}, {"TAB", 0x2B, 0x0D, 0},
+  {"AD01", 0x14, 0x15, K_CHAR}, {"AD02", 0x1A, 0x1D, K_CHAR}, {"AD03", 0x08, 0x24, K_CHAR},
+  {"AD04", 0x15, 0x2D, K_CHAR}, {"AD05", 0x17, 0x2C, K_CHAR}, {"AD06", 0x1C, 0x35, K_CHAR},
+  {"AD07", 0x18, 0x3C, K_CHAR}, {"AD08", 0x0C, 0x43, K_CHAR}, {"AD09", 0x12, 0x44, K_CHAR},
+  {"AD10", 0x13, 0x4D, K_CHAR}, {"AD11", 0x2F, 0x54, K_CHAR}, {"AD12", 0x30, 0x5B, K_CHAR},
+  {"RTRN", 0x28, 0x5A, 0}, {"CAPS", 0x39, 0x58, K_MOD},
+  {"AC01", 0x04, 0x1C, K_CHAR}, {"AC02", 0x16, 0x1B, K_CHAR}, {"AC03", 0x07, 0x23, K_CHAR},
+  {"AC04", 0x09, 0x2B, K_CHAR}, {"AC05", 0x0A, 0x34, K_CHAR}, {"AC06", 0x0B, 0x33, K_CHAR},
+  {"AC07", 0x0D, 0x3B, K_CHAR}, {"AC08", 0x0E, 0x42, K_CHAR}, {"AC09", 0x0F, 0x4B, K_CHAR},
+  {"AC10", 0x33, 0x4C, K_CHAR}, {"AC11", 0x34, 0x52, K_CHAR},
+  {"BKSL", 0x32, 0x5D, K_CHAR}, {"BKSL", 0x31, 0x5D, K_CHAR},   // ISO and ANSI position
+  {"LFSH", 0xE1, 0x12, K_MOD}, {"LSGT", 0x64, 0x61, K_CHAR},
+  {"AB01", 0x1D, 0x1A, K_CHAR}, {"AB02", 0x1B, 0x22, K_CHAR}, {"AB03", 0x06, 0x21, K_CHAR},
+  {"AB04", 0x19, 0x2A, K_CHAR}, {"AB05", 0x05, 0x32, K_CHAR}, {"AB06", 0x11, 0x31, K_CHAR},
+  {"AB07", 0x10, 0x3A, K_CHAR}, {"AB08", 0x36, 0x41, K_CHAR}, {"AB09", 0x37, 0x49, K_CHAR},
+  {"AB10", 0x38, 0x4A, K_CHAR}, {"RTSH", 0xE5, 0x59, K_MOD},
+  {"LCTL", 0xE0, 0x14, K_MOD}, {"LALT", 0xE2, 0x11, K_MOD}, {"SPCE", 0x2C, 0x29, K_CHAR},
+  {"NMLK", 0x53, 0x77, K_MOD}, {"SCLK", 0x47, 0x7E, K_MOD},
+  {"KPMU", 0x55, 0x7C, 0}, {"KPSU", 0x56, 0x7B, 0}, {"KPAD", 0x57, 0x79, 0},
+  {"KP7", 0x5F, 0x6C, 0}, {"KP8", 0x60, 0x75, 0}, {"KP9", 0x61, 0x7D, 0},
+  {"KP4", 0x5C, 0x6B, 0}, {"KP5", 0x5D, 0x73, 0}, {"KP6", 0x5E, 0x74, 0},
+  {"KP1", 0x59, 0x69, 0}, {"KP2", 0x5A, 0x72, 0}, {"KP3", 0x5B, 0x7A, 0},
+  {"KP0", 0x62, 0x70, 0}, {"KPDL", 0x63, 0x71, 0},
+  {"RCTL", 0xE4, 0, K_MOD}, {"RALT", 0xE6, 0, K_MOD}, {"LWIN", 0xE3, 0, K_MOD}, {"RWIN", 0xE7, 0, K_MOD},
+  {"MENU", 0x65, 0, 0}, {"KPDV", 0x54, 0, 0}, {"KPEN", 0x58, 0, 0}, {"PRSC", 0x46, 0, 0}, {"PAUS", 0x48, 0, 0},
+  {"INS", 0x49, 0, 0}, {"HOME", 0x4A, 0, 0}, {"PGUP", 0x4B, 0, 0}, {"DELE", 0x4C, 0, 0},
+  {"END", 0x4D, 0, 0}, {"PGDN", 0x4E, 0, 0}, {"UP", 0x52, 0, 0}, {"LEFT", 0x50, 0, 0},
+  {"DOWN", 0x51, 0, 0}, {"RGHT", 0x4F, 0, 0},
+};
+
+static const KeyDef *keyByHid(int hid) {
+  for (const KeyDef &k : KEYS) if (k.hid == hid) return &k;
+  return nullptr;
+}
+
+static const KeyDef *keyBySet2(uint8_t code) {
+  if (!code) return nullptr;
+  for (const KeyDef &k : KEYS) if (k.set2 == code) return &k;
+  return nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// Symbols: Unicode code points; dead keys are SYM_DEAD | keysym.
+
+#define SYM_DEAD 0x1000000u
+
+struct NamedSym { const char *name; uint32_t sym; };
+
+static const NamedSym ASCII_NAMES[] = {
+  {"space", ' '}, {"exclam", '!'}, {"quotedbl", '"'}, {"numbersign", '#'}, {"dollar", '$'},
+  {"percent", '%'}, {"ampersand", '&'}, {"apostrophe", '\''}, {"quoteright", '\''},
+  {"parenleft", '('}, {"parenright", ')'}, {"asterisk", '*'}, {"plus", '+'}, {"comma", ','},
+  {"minus", '-'}, {"period", '.'}, {"slash", '/'}, {"colon", ':'}, {"semicolon", ';'},
+  {"less", '<'}, {"equal", '='}, {"greater", '>'}, {"question", '?'}, {"at", '@'},
+  {"bracketleft", '['}, {"backslash", '\\'}, {"bracketright", ']'}, {"asciicircum", '^'},
+  {"underscore", '_'}, {"grave", '`'}, {"quoteleft", '`'}, {"braceleft", '{'}, {"bar", '|'},
+  {"braceright", '}'}, {"asciitilde", '~'},
+  {"EuroSign", 0x20AC}, {"oe", 0x153}, {"OE", 0x152}, {"idotless", 0x131}, {"lstroke", 0x142},
+  {"Lstroke", 0x141}, {"dstroke", 0x111}, {"Dstroke", 0x110}, {"eng", 0x14B}, {"ENG", 0x14A},
+  {"hstroke", 0x127}, {"Hstroke", 0x126}, {"tslash", 0x167}, {"Tslash", 0x166}, {"kra", 0x138},
+  {"schwa", 0x259}, {"SCHWA", 0x18F}, {"leftarrow", 0x2190}, {"uparrow", 0x2191},
+  {"rightarrow", 0x2192}, {"downarrow", 0x2193}, {"endash", 0x2013}, {"emdash", 0x2014},
+  {"leftsinglequotemark", 0x2018}, {"rightsinglequotemark", 0x2019}, {"singlelowquotemark", 0x201A},
+  {"leftdoublequotemark", 0x201C}, {"rightdoublequotemark", 0x201D}, {"doublelowquotemark", 0x201E},
+  {"dagger", 0x2020}, {"doubledagger", 0x2021}, {"ellipsis", 0x2026}, {"trademark", 0x2122},
+  {"guillemetleft", 0xAB}, {"guillemetright", 0xBB}, {"ordmasculine", 0xBA},
+  {"Ooblique", 0xD8}, {"ooblique", 0xF8}, {"Eth", 0xD0}, {"Thorn", 0xDE},
+};
+
+// Keysyms 0xA0..0xFF are the Latin-1 code points.
+static const char *LATIN1_NAMES[96] = {
+  "nobreakspace", "exclamdown", "cent", "sterling", "currency", "yen", "brokenbar", "section",
+  "diaeresis", "copyright", "ordfeminine", "guillemotleft", "notsign", "hyphen", "registered", "macron",
+  "degree", "plusminus", "twosuperior", "threesuperior", "acute", "mu", "paragraph", "periodcentered",
+  "cedilla", "onesuperior", "masculine", "guillemotright", "onequarter", "onehalf", "threequarters", "questiondown",
+  "Agrave", "Aacute", "Acircumflex", "Atilde", "Adiaeresis", "Aring", "AE", "Ccedilla",
+  "Egrave", "Eacute", "Ecircumflex", "Ediaeresis", "Igrave", "Iacute", "Icircumflex", "Idiaeresis",
+  "ETH", "Ntilde", "Ograve", "Oacute", "Ocircumflex", "Otilde", "Odiaeresis", "multiply",
+  "Oslash", "Ugrave", "Uacute", "Ucircumflex", "Udiaeresis", "Yacute", "THORN", "ssharp",
+  "agrave", "aacute", "acircumflex", "atilde", "adiaeresis", "aring", "ae", "ccedilla",
+  "egrave", "eacute", "ecircumflex", "ediaeresis", "igrave", "iacute", "icircumflex", "idiaeresis",
+  "eth", "ntilde", "ograve", "oacute", "ocircumflex", "otilde", "odiaeresis", "division",
+  "oslash", "ugrave", "uacute", "ucircumflex", "udiaeresis", "yacute", "thorn", "ydiaeresis",
+};
+
+static const NamedSym DEAD_NAMES[] = {
+  {"dead_grave", 0xFE50}, {"dead_acute", 0xFE51}, {"dead_circumflex", 0xFE52}, {"dead_tilde", 0xFE53},
+  {"dead_macron", 0xFE54}, {"dead_breve", 0xFE55}, {"dead_abovedot", 0xFE56}, {"dead_diaeresis", 0xFE57},
+  {"dead_abovering", 0xFE58}, {"dead_doubleacute", 0xFE59}, {"dead_caron", 0xFE5A}, {"dead_cedilla", 0xFE5B},
+  {"dead_ogonek", 0xFE5C}, {"dead_iota", 0xFE5D}, {"dead_belowdot", 0xFE60}, {"dead_hook", 0xFE61},
+  {"dead_horn", 0xFE62}, {"dead_stroke", 0xFE63},
+};
+
+static int unnamedSyms = 0;   // keysyms that are not characters we know (arrows, KP_*, ...)
+
+static uint32_t symFromName(const string &n) {
+  if (n.size() == 1 && isalnum((unsigned char)n[0])) return (unsigned char)n[0];
+  if (n == "NoSymbol" || n == "VoidSymbol") return 0;
+  for (const NamedSym &s : ASCII_NAMES) if (n == s.name) return s.sym;
+  for (int i = 0; i < 96; i++) if (n == LATIN1_NAMES[i]) return 0xA0 + i;
+  for (const NamedSym &s : DEAD_NAMES) if (n == s.name) return SYM_DEAD | s.sym;
+  if (n.size() >= 5 && n[0] == 'U' && isxdigit((unsigned char)n[1])) return strtoul(n.c_str() + 1, nullptr, 16);
+  if (n.size() > 2 && n[0] == '0' && n[1] == 'x') {
+    uint32_t ks = strtoul(n.c_str(), nullptr, 16);
+    if (ks >= 0x20 && ks <= 0xFF) return ks;
+    if ((ks & 0xFF000000u) == 0x01000000u) return ks & 0xFFFFFF;
+  }
+  unnamedSyms++;
+  return 0;
+}
+
+static string symText(uint32_t sym) {
+  if (sym & SYM_DEAD) {
+    for (const NamedSym &s : DEAD_NAMES) if ((sym & 0xFFFF) == s.sym) return s.name;
+    return "dead key";
+  }
+  char buf[32];
+  string u;
+  if (sym < 0x80) u = string(1, (char)sym);
+  else if (sym < 0x800) { u += (char)(0xC0 | (sym >> 6)); u += (char)(0x80 | (sym & 0x3F)); }
+  else {
+    u += (char)(0xE0 | (sym >> 12)); u += (char)(0x80 | ((sym >> 6) & 0x3F)); u += (char)(0x80 | (sym & 0x3F));
+  }
+  if (sym == ' ') u = "space";
+  snprintf(buf, sizeof(buf), " U+%04X", sym);
+  return "'" + u + "'" + buf;
+}
+
+// ---------------------------------------------------------------------------
+// Diagnostics
+
+struct Report {
+  vector<string> conflicts;
+  vector<string> warnings;
+  void conflict(const string &s) { conflicts.push_back(s); }
+  void warn(const string &s) { warnings.push_back(s); }
+};
+
+static string fmt(const char *f, ...) __attribute__((format(printf, 1, 2)));
+static string fmt(const char *f, ...) {
+  char buf[512];
+  va_list ap;
+  va_start(ap, f);
+  vsnprintf(buf, sizeof(buf), f, ap);
+  va_end(ap);
+  return buf;
+}
+
+static bool readFile(const string &path, string &out) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) return false;
+  std::stringstream ss;
+  ss << f.rdbuf();
+  out = ss.str();
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// XKB symbols
+
+struct XkbKey {
+  uint32_t sym[4] = {0, 0, 0, 0};
+  bool has[4] = {false, false, false, false};
+};
+typedef std::map<string, XkbKey> XkbLayout;
+
+enum MergeMode { MERGE_OVERRIDE, MERGE_AUGMENT, MERGE_REPLACE };
+
+struct XkbLexer {
+  const string &s;
+  size_t p = 0;
+  explicit XkbLexer(const string &src) : s(src) {}
+
+  void skipSpace() {
+    for (;;) {
+      while (p < s.size() && isspace((unsigned char)s[p])) p++;
+      if (s.compare(p, 2, "//") == 0 || (p < s.size() && s[p] == '#')) {
+        while (p < s.size() && s[p] != '\n') p++;
+      } else if (s.compare(p, 2, "/*") == 0) {
+        size_t e = s.find("*/", p + 2);
+        p = e == string::npos ? s.size() : e + 2;
+      } else {
+        return;
+      }
+    }
+  }
+  // Identifiers, "strings" (quotes kept), <KEYNAMES> (brackets kept), or one
+  // punctuation character. Empty at the end.
+  string next() {
+    skipSpace();
+    if (p >= s.size()) return "";
+    char c = s[p];
+    size_t b = p;
+    if (c == '"') {
+      size_t e = s.find('"', p + 1);
+      p = e == string::npos ? s.size() : e + 1;
+    } else if (c == '<') {
+      size_t e = s.find('>', p);
+      p = e == string::npos ? s.size() : e + 1;
+    } else if (isalnum((unsigned char)c) || c == '_') {
+      while (p < s.size() && (isalnum((unsigned char)s[p]) || s[p] == '_')) p++;
+    } else {
+      p++;
+    }
+    return s.substr(b, p - b);
+  }
+  string peek() {
+    size_t save = p;
+    string t = next();
+    p = save;
+    return t;
+  }
+};
+
+struct XkbLoader {
+  vector<string> dirs;
+  Report &rep;
+  int depth = 0;
+  explicit XkbLoader(Report &r) : rep(r) {}
+
+  static void split(const string &spec, string &file, string &section) {
+    size_t lp = spec.find('(');
+    file = spec.substr(0, lp);
+    section = lp == string::npos ? "" : spec.substr(lp + 1, spec.find(')', lp) - lp - 1);
+  }
+
+  bool findFile(const string &file, string &path) {
+    string text;
+    if (file.find('/') != string::npos && readFile(file, text)) { path = file; return true; }
+    for (const string &d : dirs) {
+      if (readFile(d + "/" + file, text)) { path = d + "/" + file; return true; }
+    }
+    if (readFile(file, text)) { path = file; return true; }
+    return false;
+  }
+
+  static void merge(XkbLayout &lay, const string &name, const XkbKey &k, MergeMode mode) {
+    XkbKey &dst = lay[name];
+    if (mode == MERGE_REPLACE) dst = XkbKey();
+    for (int l = 0; l < 4; l++) {
+      if (!k.has[l] || (mode == MERGE_AUGMENT && dst.has[l])) continue;
+      dst.has[l] = true;
+      dst.sym[l] = k.sym[l];
+    }
+  }
+
+  // Skips a bracketed group whose opening token was just read.
+  static void skipGroup(XkbLexer &lx, const string &open) {
+    int depth = 1;
+    string close = open == "{" ? "}" : open == "[" ? "]" : ")";
+    while (depth) {
+      string t = lx.next();
+      if (t.empty()) return;
+      if (t == open) depth++;
+      else if (t == close) depth--;
+    }
+  }
+
+  static void readSyms(XkbLexer &lx, XkbKey &k) {
+    int level = 0;
+    for (string t = lx.next(); !t.empty() && t != "]"; t = lx.next()) {
+      if (t == ",") { level++; continue; }
+      if (level < 4) {
+        k.has[level] = true;
+        k.sym[level] = symFromName(t);
+      }
+    }
+  }
+
+  // key <NAME> { [ a, A ], ... } or { type=..., symbols[Group1]=[ a, A ] }
+  static XkbKey readKey(XkbLexer &lx) {
+    XkbKey k;
+    bool gotGroup1 = false;
+    if (lx.next() != "{") return k;
+    for (string t = lx.next(); !t.empty() && t != "}"; t = lx.next()) {
+      if (t == "[") {
+        if (!gotGroup1) { readSyms(lx, k); gotGroup1 = true; }
+        else skipGroup(lx, "[");
+      } else if (t == "symbols") {
+        string g;
+        if (lx.peek() == "[") { lx.next(); g = lx.next(); lx.next(); }
+        lx.next();   // '='
+        if (lx.next() != "[") continue;
+        if (!gotGroup1 && (g.empty() || g == "Group1" || g == "group1" || g == "1")) {
+          readSyms(lx, k);
+          gotGroup1 = true;
+        } else {
+          skipGroup(lx, "[");
+        }
+      } else if (t == "{" || t == "(") {
+        skipGroup(lx, t);
+      }
+    }
+    return k;
+  }
+
+  bool load(const string &spec, XkbLayout &lay, MergeMode mode) {
+    if (++depth > 16) { rep.conflict("xkb: include loop at " + spec); depth--; return false; }
+    string file, section, path, text;
+    split(spec, file, section);
+    bool ok = findFile(file, path) && readFile(path, text);
+    if (!ok) rep.conflict("xkb: cannot find symbols file '" + file + "'");
+    else ok = loadSection(text, file, section, lay, mode);
+    depth--;
+    return ok;
+  }
+
+  bool loadSection(const string &text, const string &file, const string &section, XkbLayout &lay, MergeMode mode) {
+    XkbLexer lx(text);
+    bool isDefault = false;
+    for (string t = lx.next(); !t.empty(); t = lx.next()) {
+      if (t == "default") { isDefault = true; continue; }
+      if (t != "xkb_symbols") { if (t != "partial" && t != "hidden" && t.find("_keys") == string::npos && t != "alternate_group") isDefault = false; continue; }
+      string name = lx.next();
+      if (name.size() >= 2) name = name.substr(1, name.size() - 2);
+      bool want = section.empty() ? isDefault : name == section;
+      isDefault = false;
+      if (lx.next() != "{") return false;
+      if (!want) { skipGroup(lx, "{"); continue; }
+      parseBody(lx, file + "(" + name + ")", lay, mode);
+      return true;
+    }
+    // A file without a "default" section: the first one is the default.
+    if (section.empty()) {
+      XkbLexer first(text);
+      for (string t = first.next(); !t.empty(); t = first.next()) {
+        if (t != "xkb_symbols") continue;
+        string name = first.next();
+        if (name.size() >= 2) return loadSection(text, file, name.substr(1, name.size() - 2), lay, mode);
+      }
+    }
+    rep.conflict("xkb: no section '" + section + "' in " + file);
+    return false;
+  }
+
+  void parseBody(XkbLexer &lx, const string &where, XkbLayout &lay, MergeMode mode) {
+    std::map<string, XkbKey> seen;
+    MergeMode stmtMode = mode;
+    for (string t = lx.next(); !t.empty() && t != "}"; t = lx.next()) {
+      if (t == "include" || t == "augment" || t == "override" || t == "replace") {
+        MergeMode m = t == "augment" ? MERGE_AUGMENT : t == "replace" ? MERGE_REPLACE : MERGE_OVERRIDE;
+        if (lx.peek()[0] != '"') { stmtMode = m; continue; }   // "replace key <...>"
+        string inc = lx.next();
+        inc = inc.substr(1, inc.size() - 2);
+        std::stringstream parts(inc);
+        string part;
+        while (std::getline(parts, part, '+')) {
+          if (part.empty()) continue;
+          size_t bar = part.find('|');
+          if (bar != string::npos) part = part.substr(0, bar);
+          size_t colon = part.find(':');   // group index, always 1 here
+          if (colon != string::npos) part = part.substr(0, colon);
+          load(part, lay, mode == MERGE_AUGMENT ? MERGE_AUGMENT : m);
+        }
+        continue;
+      }
+      if (t == "key") {
+        string name = lx.next();
+        name = name.size() >= 2 ? name.substr(1, name.size() - 2) : name;
+        XkbKey k = readKey(lx);
+        auto prev = seen.find(name);
+        if (prev != seen.end()) {
+          bool same = true;
+          for (int l = 0; l < 4; l++) same = same && prev->second.sym[l] == k.sym[l];
+          if (!same) rep.conflict("xkb: <" + name + "> defined twice in " + where);
+        }
+        seen[name] = k;
+        merge(lay, name, k, stmtMode);
+        stmtMode = mode;
+        continue;
+      }
+      if (t == "{" || t == "[" || t == "(") { skipGroup(lx, t); continue; }
+      if (t == ";") { stmtMode = mode; continue; }
+      // name[Group1]=..., modifier_map, key.type=...: skip to the end of the statement.
+      while (!t.empty() && t != ";" && t != "}") {
+        t = lx.next();
+        if (t == "{" || t == "[" || t == "(") skipGroup(lx, t);
+      }
+      if (t == "}") return;
+    }
+  }
+};
+
+// ---------------------------------------------------------------------------
+// Minimal JSON (keymap_ex.json and QMK exports)
+
+struct Json {
+  enum Type { NUL, BOOL, NUM, STR, ARR, OBJ } type = NUL;
+  double num = 0;
+  string str;
+  vector<Json> items;
+  vector<std::pair<string, Json> > members;   // in order, duplicates kept
+
+  const Json *get(const string &k) const {
+    for (const auto &m : members) if (m.first == k) return &m.second;
+    return nullptr;
+  }
+};
+
+struct JsonParser {
+  const string &s;
+  size_t p = 0;
+  string err;
+  explicit JsonParser(const string &src) : s(src) {}
+
+  void ws() { while (p < s.size() && isspace((unsigned char)s[p])) p++; }
+  bool fail(const char *what) { if (err.empty()) err = fmt("%s at offset %zu", what, p); return false; }
+
+  bool str(string &out) {
+    if (s[p] != '"') return fail("expected string");
+    for (p++; p < s.size() && s[p] != '"'; p++) {
+      if (s[p] != '\\') { out += s[p]; continue; }
+      if (++p >= s.size()) break;
+      char c = s[p];
+      if (c == 'n') out += '\n';
+      else if (c == 't') out += '\t';
+      else if (c == 'u' && p + 4 < s.size()) {
+        uint32_t cp = strtoul(s.substr(p + 1, 4).c_str(), nullptr, 16);
+        p += 4;
+        if (cp < 0x80) out += (char)cp;
+        else if (cp < 0x800) { out += (char)(0xC0 | (cp >> 6)); out += (char)(0x80 | (cp & 0x3F)); }
+        else { out += (char)(0xE0 | (cp >> 12)); out += (char)(0x80 | ((cp >> 6) & 0x3F)); out += (char)(0x80 | (cp & 0x3F)); }
+      } else out += c;
+    }
+    if (p >= s.size()) return fail("unterminated string");
+    p++;
+    return true;
+  }
+
+  bool value(Json &v) {
+    ws();
+    if (p >= s.size()) return fail("unexpected end");
+    char c = s[p];
+    if (c == '{') {
+      v.type = Json::OBJ;
+      p++; ws();
+      if (p < s.size() && s[p] == '}') { p++; return true; }
+      for (;;) {
+        ws();
+        string k;
+        if (!str(k)) return false;
+        ws();
+        if (p >= s.size() || s[p] != ':') return fail("expected ':'");
+        p++;
+        v.members.push_back(std::make_pair(k, Json()));
+        if (!value(v.members.back().second)) return false;
+        ws();
+        if (p < s.size() && s[p] == ',') { p++; continue; }
+        if (p < s.size() && s[p] == '}') { p++; return true; }
+        return fail("expected ',' or '}'");
+      }
+    }
+    if (c == '[') {
+      v.type = Json::ARR;
+      p++; ws();
+      if (p < s.size() && s[p] == ']') { p++; return true; }
+      for (;;) {
+        v.items.push_back(Json());
+        if (!value(v.items.back())) return false;
+        ws();
+        if (p < s.size() && s[p] == ',') { p++; continue; }
+        if (p < s.size() && s[p] == ']') { p++; return true; }
+        return fail("expected ',' or ']'");
+      }
+    }
+    if (c == '"') { v.type = Json::STR; return str(v.str); }
+    if (s.compare(p, 4, "true") == 0) { v.type = Json::BOOL; v.num = 1; p += 4; return true; }
+    if (s.compare(p, 5, "false") == 0) { v.type = Json::BOOL; p += 5; return true; }
+    if (s.compare(p, 4, "null") == 0) { v.type = Json::NUL; p += 4; return true; }
+    char *end;
+    v.num = strtod(s.c_str() + p, &end);
+    if (end == s.c_str() + p) return fail("unexpected character");
+    v.type = Json::NUM;
+    p = end - s.c_str();
+    return true;
+  }
+};
+
+// ---------------------------------------------------------------------------
+// Compiled map
+
+struct Entry { uint8_t base, shift, altgr, ctrl, dead; };
+
+struct Compiled {
+  Entry e[256];
+  bool defined[256];
+  Compiled() {
+    for (int i = 0; i < 256; i++) {
+      uint8_t d = default_usb_to_xt[i];
+      e[i] = { d, d, d, d, 0 };
+      defined[i] = false;
+    }
+  }
+  bool isDefault(int i) const {
+    uint8_t d = default_usb_to_xt[i];
+    const Entry &x = e[i];
+    bool zero = !x.base && !x.shift && !x.altgr && !x.ctrl && !x.dead;
+    return zero || (x.base == d && x.shift == d && x.altgr == d && x.ctrl == d && !x.dead);
+  }
+};
+
+static int fieldValue(const Json &v, const string &where, const char *field, Report &rep) {
+  if (v.type != Json::NUM || v.num < 0 || v.num > 255 || v.num != (int)v.num) {
+    rep.conflict(where + ": " + field + " is not a byte");
+    return -1;
+  }
+  return (int)v.num;
+}
+
+static const char *EX_FIELDS[] = { "base", "shift", "altgr", "ctrl", "dead" };
+
+// Same defaults as keymapExApplyJSON(): sparse fields fall back to the
+// device default, full-array fields to base.
+static void entryFromJson(const Json &o, int hid, bool sparse, Compiled &c, Report &rep) {
+  string where = fmt("json: hid %d", hid);
+  if (o.type != Json::OBJ) { rep.conflict(where + ": entry is not an object"); return; }
+  int v[5];
+  uint8_t d = sparse ? default_usb_to_xt[hid] : 0;
+  v[0] = d;
+  bool seen[5] = {false, false, false, false, false};
+  for (const auto &m : o.members) {
+    int f = -1;
+    for (int k = 0; k < 5; k++) if (m.first == EX_FIELDS[k]) f = k;
+    if (f < 0) { rep.warn(where + ": unknown field '" + m.first + "'"); continue; }
+    if (seen[f]) rep.conflict(where + ": " + m.first + " given twice");
+    seen[f] = true;
+    int x = fieldValue(m.second, where, EX_FIELDS[f], rep);
+    if (x >= 0) v[f] = x;
+  }
+  if (!seen[0]) v[0] = d;
+  for (int k = 1; k < 4; k++) if (!seen[k]) v[k] = sparse ? d : v[0];
+  if (!seen[4]) v[4] = 0;
+  Entry &e = c.e[hid];
+  e = { (uint8_t)v[0], (uint8_t)v[1], (uint8_t)v[2], (uint8_t)v[3], (uint8_t)v[4] };
+  c.defined[hid] = true;
+  if (e.dead && (e.shift != e.base || e.altgr != e.base || e.ctrl != e.base))
+    rep.warn(where + ": dead entries always send base; shift/altgr/ctrl are ignored");
+  for (int k = 0; k < 4; k++) {
+    if (v[k] && !keyBySet2((uint8_t)v[k])) rep.warn(fmt("%s: no key sends 0x%02X in set 2", where.c_str(), v[k]));
+  }
+}
+
+static bool compileJson(const Json &root, Compiled &c, Report &rep) {
+  if (root.type == Json::ARR) {
+    if (root.items.size() != 256) { rep.conflict("json: array must have 256 entries"); return false; }
+    for (int i = 0; i < 256; i++) entryFromJson(root.items[i], i, false, c, rep);
+    return true;
+  }
+  const Json *map = root.get("map");
+  if (!map || map->type != Json::OBJ) { rep.conflict("json: expected {\"map\": {...}} or a 256-element array"); return false; }
+  std::set<int> seen;
+  for (const auto &m : map->members) {
+    char *end;
+    long hid = strtol(m.first.c_str(), &end, 10);
+    if (*end || m.first.empty() || hid < 0 || hid > 255) { rep.conflict("json: key '" + m.first + "' is not a HID code"); continue; }
+    if (!seen.insert(hid).second) rep.conflict(fmt("json: hid %ld listed twice", hid));
+    entryFromJson(m.second, hid, true, c, rep);
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// QMK
+
+struct QmkName { const char *name; uint8_t hid; };
+
+static const QmkName QMK_NAMES[] = {
+  {"ENT", 0x28}, {"ENTER", 0x28}, {"ESC", 0x29}, {"ESCAPE", 0x29}, {"BSPC", 0x2A}, {"BACKSPACE", 0x2A},
+  {"TAB", 0x2B}, {"SPC", 0x2C}, {"SPACE", 0x2C}, {"MINS", 0x2D}, {"MINUS", 0x2D}, {"EQL", 0x2E},
+  {"EQUAL", 0x2E}, {"LBRC", 0x2F}, {"LEFT_BRACKET", 0x2F}, {"RBRC", 0x30}, {"RIGHT_BRACKET", 0x30},
+  {"BSLS", 0x31}, {"BACKSLASH", 0x31}, {"NUHS", 0x32}, {"NONUS_HASH", 0x32}, {"SCLN", 0x33},
+  {"SEMICOLON", 0x33}, {"QUOT", 0x34}, {"QUOTE", 0x34}, {"GRV", 0x35}, {"GRAVE", 0x35},
+  {"COMM", 0x36}, {"COMMA", 0x36}, {"DOT", 0x37}, {"SLSH", 0x38}, {"SLASH", 0x38},
+  {"CAPS", 0x39}, {"CAPS_LOCK", 0x39}, {"PSCR", 0x46}, {"PRINT_SCREEN", 0x46}, {"SCRL", 0x47},
+  {"SCROLL_LOCK", 0x47}, {"PAUS", 0x48}, {"PAUSE", 0x48}, {"INS", 0x49}, {"INSERT", 0x49},
+  {"HOME", 0x4A}, {"PGUP", 0x4B}, {"PAGE_UP", 0x4B}, {"DEL", 0x4C}, {"DELETE", 0x4C}, {"END", 0x4D},
+  {"PGDN", 0x4E}, {"PAGE_DOWN", 0x4E}, {"RGHT", 0x4F}, {"RIGHT", 0x4F}, {"LEFT", 0x50},
+  {"DOWN", 0x51}, {"UP", 0x52}, {"NUM", 0x53}, {"NUM_LOCK", 0x53}, {"PSLS", 0x54}, {"PAST", 0x55},
+  {"PMNS", 0x56}, {"PPLS", 0x57}, {"PENT", 0x58}, {"P0", 0x62}, {"PDOT", 0x63}, {"NUBS", 0x64},
+  {"NONUS_BACKSLASH", 0x64}, {"APP", 0x65}, {"APPLICATION", 0x65},
+  {"LCTL", 0xE0}, {"LEFT_CTRL", 0xE0}, {"LSFT", 0xE1}, {"LEFT_SHIFT", 0xE1}, {"LALT", 0xE2},
+  {"LEFT_ALT", 0xE2}, {"LGUI", 0xE3}, {"LEFT_GUI", 0xE3}, {"RCTL", 0xE4}, {"RIGHT_CTRL", 0xE4},
+  {"RSFT", 0xE5}, {"RIGHT_SHIFT", 0xE5}, {"RALT", 0xE6}, {"RIGHT_ALT", 0xE6}, {"RGUI", 0xE7},
+  {"RIGHT_GUI", 0xE7},
+};
+
+// -1 unknown; otherwise the HID usage of a basic keycode.
+static int qmkHid(const string &kc) {
+  if (kc.compare(0, 3, "KC_") != 0) return -1;
+  string n = kc.substr(3);
+  if (n.size() == 1 && n[0] >= 'A' && n[0] <= 'Z') return 0x04 + n[0] - 'A';
+  if (n.size() == 1 && n[0] >= '1' && n[0] <= '9') return 0x1E + n[0] - '1';
+  if (n == "0") return 0x27;
+  if (n[0] == 'F' && n.size() <= 3 && isdigit((unsigned char)n[1])) {
+    int f = atoi(n.c_str() + 1);
+    if (f >= 1 && f <= 12) return 0x3A + f - 1;
+  }
+  if (n.size() == 2 && n[0] == 'P' && n[1] >= '1' && n[1] <= '9') return 0x59 + n[1] - '1';
+  for (const QmkName &q : QMK_NAMES) if (n == q.name) return q.hid;
+  return -1;
+}
+
+// Community layouts, in LAYOUT argument order.
+static const char *QMK_ISO =
+  "ESC F1 F2 F3 F4 F5 F6 F7 F8 F9 F10 F11 F12 PSCR SCRL PAUS "
+  "GRV 1 2 3 4 5 6 7 8 9 0 MINS EQL BSPC INS HOME PGUP NUM PSLS PAST PMNS "
+  "TAB Q W E R T Y U I O P LBRC RBRC DEL END PGDN P7 P8 P9 PPLS "
+  "CAPS A S D F G H J K L SCLN QUOT NUHS ENT P4 P5 P6 "
+  "LSFT NUBS Z X C V B N M COMM DOT SLSH RSFT UP P1 P2 P3 PENT "
+  "LCTL LGUI LALT SPC RALT RGUI APP RCTL LEFT DOWN RGHT P0 PDOT";
+static const char *QMK_ANSI =
+  "ESC F1 F2 F3 F4 F5 F6 F7 F8 F9 F10 F11 F12 PSCR SCRL PAUS "
+  "GRV 1 2 3 4 5 6 7 8 9 0 MINS EQL BSPC INS HOME PGUP NUM PSLS PAST PMNS "
+  "TAB Q W E R T Y U I O P LBRC RBRC BSLS DEL END PGDN P7 P8 P9 PPLS "
+  "CAPS A S D F G H J K L SCLN QUOT ENT P4 P5 P6 "
+  "LSFT Z X C V B N M COMM DOT SLSH RSFT UP P1 P2 P3 PENT "
+  "LCTL LGUI LALT SPC RALT RGUI APP RCTL LEFT DOWN RGHT P0 PDOT";
+
+static vector<int> qmkPositions(const char *layout) {
+  vector<int> out;
+  std::stringstream ss(layout);
+  string n;
+  while (ss >> n) out.push_back(qmkHid("KC_" + n));
+  return out;
+}
+
+static bool isTransparent(const string &kc) {
+  return kc == "KC_TRNS" || kc == "KC_TRANSPARENT" || kc == "_______";
+}
+
+static bool compileQmk(const Json &root, Compiled &c, Report &rep) {
+  const Json *layers = root.get("layers");
+  if (!layers || layers->type != Json::ARR || layers->items.empty()) { rep.conflict("qmk: no layers"); return false; }
+  const Json &l0 = layers->items[0];
+  const Json *layout = root.get("layout");
+  string lname = layout && layout->type == Json::STR ? layout->str : "";
+  vector<int> pos;
+  if (lname.find("iso") != string::npos || l0.items.size() == 105) pos = qmkPositions(QMK_ISO);
+  else if (lname.find("ansi") != string::npos || l0.items.size() == 104) pos = qmkPositions(QMK_ANSI);
+  if (pos.empty() || pos.size() != l0.items.size()) {
+    rep.conflict(fmt("qmk: layout '%s' with %zu keys is not supported (LAYOUT_fullsize_iso: 105, LAYOUT_fullsize_ansi: 104)",
+                     lname.c_str(), l0.items.size()));
+    return false;
+  }
+  for (size_t i = 0; i < pos.size(); i++) {
+    const Json &k = l0.items[i];
+    string kc = k.type == Json::STR ? k.str : "";
+    int phys = pos[i];
+    string where = fmt("qmk: position %zu (%s)", i, keyByHid(phys) ? keyByHid(phys)->xkb : "?");
+    if (kc.empty()) { rep.conflict(where + ": keycode is not a string"); continue; }
+    if (isTransparent(kc)) continue;
+    if (kc == "KC_NO" || kc == "XXXXXXX") { rep.warn(where + ": KC_NO cannot disable a key here, left as is"); continue; }
+    if (kc.find('(') != string::npos) {
+      string fn = kc.substr(0, kc.find('('));
+      bool layer = fn == "MO" || fn == "TG" || fn == "TO" || fn == "TT" || fn == "LT" || fn == "OSL" || fn == "DF" || fn == "LM";
+      rep.conflict(where + ": " + kc + (layer ? " is a layer key; the adapter has no layers" : " needs a modifier the adapter cannot inject"));
+      continue;
+    }
+    int target = qmkHid(kc);
+    if (target < 0) { rep.conflict(where + ": unknown keycode " + kc); continue; }
+    const KeyDef *t = keyByHid(target);
+    if (!t || !t->set2) {
+      if (target == phys) continue;   // unchanged E0 key: the device default sends it
+      rep.conflict(where + ": " + kc + " needs an E0-prefixed code, which entries cannot hold");
+      continue;
+    }
+    c.e[phys] = { t->set2, t->set2, t->set2, t->set2, 0 };
+    c.defined[phys] = true;
+  }
+  for (size_t n = 1; n < layers->items.size(); n++) {
+    for (const Json &k : layers->items[n].items) {
+      if (k.type == Json::STR && !isTransparent(k.str) && k.str != "KC_NO" && k.str != "XXXXXXX") {
+        rep.warn(fmt("qmk: layer %zu ignored; the adapter has no layers", n));
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// XKB source -> entries
+
+// Host key (sendable, character block) with sym on level, preferring the
+// keys in prefer, then keys whose level 2 is also want2 (0 = any).
+static const KeyDef *hostFind(const XkbLayout &host, uint32_t sym, int level, uint32_t want2,
+                              std::initializer_list<const char *> prefer) {
+  auto match = [&](const KeyDef &k, bool need2) {
+    if (!(k.flags & K_CHAR) || !k.set2) return false;
+    auto it = host.find(k.xkb);
+    if (it == host.end() || !it->second.has[level] || it->second.sym[level] != sym) return false;
+    return !need2 || !want2 || (it->second.has[1] && it->second.sym[1] == want2);
+  };
+  for (int pass = 0; pass < 2; pass++) {
+    bool need2 = pass == 0;
+    for (const char *p : prefer) {
+      if (!p) continue;
+      for (const KeyDef &k : KEYS) if (!strcmp(k.xkb, p) && match(k, need2)) return &k;
+    }
+    for (const KeyDef &k : KEYS) if (match(k, need2)) return &k;
+  }
+  return nullptr;
+}
+
+static void compileXkb(const XkbLayout &src, const XkbLayout &host, Compiled &c) {
+  for (const KeyDef &k : KEYS) {
+    if (!(k.flags & K_CHAR)) continue;
+    // Keys the layout leaves to an include it does not name (space in
+    // "us" comes from "pc") type as themselves.
+    auto it = src.find(k.xkb);
+    XkbKey s = it == src.end() ? XkbKey() : it->second;
+    uint32_t s1 = s.has[0] ? s.sym[0] : 0, s2 = s.has[1] ? s.sym[1] : 0;
+    uint32_t s3 = s.has[2] ? s.sym[2] : 0, s4 = s.has[3] ? s.sym[3] : 0;
+    const KeyDef *base = s1 ? hostFind(host, s1, 0, s2, {k.xkb}) : nullptr;
+    if (!base) base = &k;
+    const KeyDef *shift = s2 ? hostFind(host, s2, 1, 0, {base->xkb, k.xkb}) : nullptr;
+    if (!shift) shift = base;
+    const KeyDef *altgr = s3 ? hostFind(host, s3, 0, s4, {}) : nullptr;
+    if (!altgr) altgr = base;
+    c.e[k.hid] = { base->set2, shift->set2, altgr->set2, base->set2, 0 };
+    c.defined[k.hid] = true;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Reverse lookup: what the host produces for every key and modifier
+
+struct Produced { uint32_t sym; uint8_t hid; uint8_t mods; };
+
+static const uint8_t MODS_ORDER[4] = { 0, KMI_MOD_SHIFT, KMI_MOD_ALTGR, KMI_MOD_SHIFT | KMI_MOD_ALTGR };
+
+static vector<Produced> produced(const Compiled &c, const XkbLayout &host) {
+  vector<Produced> out;
+  std::set<uint32_t> seen;
+  for (uint8_t mods : MODS_ORDER) {
+    for (const KeyDef &k : KEYS) {
+      if (!(k.flags & K_CHAR)) continue;
+      const Entry &e = c.e[k.hid];
+      uint8_t code = e.dead ? e.base : (mods & KMI_MOD_ALTGR) ? e.altgr : (mods & KMI_MOD_SHIFT) ? e.shift : e.base;
+      const KeyDef *hk = keyBySet2(code);
+      if (!hk) continue;
+      auto it = host.find(hk->xkb);
+      int level = (mods & KMI_MOD_SHIFT) ? 1 : 0;
+      if (it == host.end() || !it->second.has[level] || !it->second.sym[level]) continue;
+      uint32_t sym = it->second.sym[level];
+      if (seen.insert(sym).second) out.push_back({ sym, k.hid, mods });
+    }
+  }
+  return out;
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage() {
+  fprintf(stderr,
+          "usage: keymapc [-o image.bin] [--host XKB] [--name NAME] [-I dir]... [--force] SOURCE\n"
+          "       keymapc --dump image.bin\n"
+          "SOURCE is an XKB symbols file (\"se\", \"se(nodeadkeys)\", a path), keymap_ex JSON or a QMK keymap JSON.\n");
+}
+
+static int dump(const string &path) {
+  string data;
+  if (!readFile(path, data)) { fprintf(stderr, "keymapc: cannot read %s\n", path.c_str()); return 2; }
+  KeymapImageView v;
+  const char *err = keymapImageCheck((const uint8_t *)data.data(), data.size(), v);
+  if (err) { fprintf(stderr, "keymapc: %s: %s\n", path.c_str(), err); return 1; }
+  printf("%s: layout '%s', %u entries, %u reverse, %zu bytes\n", path.c_str(), v.name, v.entryCount, v.reverseCount,
+         keymapImageSize(v.entryCount, v.reverseCount));
+  for (int i = 0; i < v.entryCount; i++) {
+    const uint8_t *r = v.entries + i * KMI_ENTRY_SIZE;
+    const KeyDef *k = keyByHid(r[0]);
+    printf("  hid %3u %-5s base %02X shift %02X altgr %02X ctrl %02X dead %u\n", r[0], k ? k->xkb : "", r[1], r[2], r[3],
+           r[4], r[5]);
+  }
+  for (int i = 0; i < v.reverseCount; i++) {
+    const uint8_t *r = v.reverse + i * KMI_REVERSE_SIZE;
+    printf("  %-14s hid %3u%s%s\n", symText(r[0] | (r[1] << 8)).c_str(), r[2], r[3] & KMI_MOD_SHIFT ? " +shift" : "",
+           r[3] & KMI_MOD_ALTGR ? " +altgr" : "");
+  }
+  return 0;
+}
+
+static bool endsWith(const string &s, const char *suffix) {
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+int main(int argc, char **argv) {
+  string out, hostSpec, name, source;
+  bool force = false;
+  Report rep;
+  XkbLoader xkb(rep);
+  vector<string> extraDirs;
+  for (int i = 1; i < argc; i++) {
+    string a = argv[i];
+    auto arg = [&]() -> string {
+      if (i + 1 >= argc) { usage(); exit(2); }
+      return argv[++i];
+    };
+    if (a == "-o") out = arg();
+    else if (a == "--host") hostSpec = arg();
+    else if (a == "--name") name = arg();
+    else if (a == "-I") extraDirs.push_back(arg());
+    else if (a == "--force") force = true;
+    else if (a == "--dump") return dump(arg());
+    else if (a == "-h" || a == "--help") { usage(); return 0; }
+    else if (!a.empty() && a[0] == '-') { usage(); return 2; }
+    else source = a;
+  }
+  if (source.empty()) { usage(); return 2; }
+
+  string srcFile, srcSection;
+  XkbLoader::split(source, srcFile, srcSection);
+  size_t slash = srcFile.rfind('/');
+  xkb.dirs = extraDirs;
+  if (slash != string::npos) xkb.dirs.push_back(srcFile.substr(0, slash));
+  xkb.dirs.push_back("/usr/share/X11/xkb/symbols");
+
+  Compiled c;
+  XkbLayout src, host;
+  bool isXkb = !endsWith(srcFile, ".json");
+  const char *kind = "xkb";
+  if (isXkb) {
+    if (!xkb.load(source, src, MERGE_OVERRIDE)) { for (auto &s : rep.conflicts) fprintf(stderr, "keymapc: %s\n", s.c_str()); return 2; }
+    if (hostSpec.empty()) host = src;
+  } else {
+    string text;
+    if (!readFile(srcFile, text)) { fprintf(stderr, "keymapc: cannot read %s\n", srcFile.c_str()); return 2; }
+    Json root;
+    JsonParser jp(text);
+    if (!jp.value(root)) { fprintf(stderr, "keymapc: %s: %s\n", srcFile.c_str(), jp.err.c_str()); return 2; }
+    bool ok;
+    if (root.get("layers")) { kind = "qmk"; ok = compileQmk(root, c, rep); }
+    else { kind = "json"; ok = compileJson(root, c, rep); }
+    if (!ok) { for (auto &s : rep.conflicts) fprintf(stderr, "keymapc: %s\n", s.c_str()); return 2; }
+  }
+  if (!hostSpec.empty() && !xkb.load(hostSpec, host, MERGE_OVERRIDE)) {
+    for (auto &s : rep.conflicts) fprintf(stderr, "keymapc: %s\n", s.c_str());
+    return 2;
+  }
+  bool haveHost = !host.empty();
+  if (isXkb) compileXkb(src, host, c);
+
+  // Image payload
+  vector<uint8_t> entries, reverse;
+  int defined = 0;
+  for (int i = 0; i < 256; i++) {
+    if (c.defined[i]) defined++;
+    if (!c.defined[i] || c.isDefault(i)) continue;
+    const Entry &e = c.e[i];
+    uint8_t r[KMI_ENTRY_SIZE] = { (uint8_t)i, e.base, e.shift, e.altgr, e.ctrl, e.dead };
+    entries.insert(entries.end(), r, r + KMI_ENTRY_SIZE);
+  }
+  vector<Produced> prod;
+  if (haveHost) prod = produced(c, host);
+  std::set<uint32_t> reach;
+  vector<Produced> rev;
+  for (const Produced &p : prod) {
+    reach.insert(p.sym);
+    if (!(p.sym & SYM_DEAD) && p.sym <= 0xFFFF) rev.push_back(p);
+  }
+  std::sort(rev.begin(), rev.end(), [](const Produced &a, const Produced &b) { return a.sym < b.sym; });
+  if (rev.size() > KMI_MAX_REVERSE) {
+    rep.warn(fmt("reverse lookup truncated to %d characters", KMI_MAX_REVERSE));
+    rev.resize(KMI_MAX_REVERSE);
+  }
+  for (const Produced &p : rev) {
+    uint8_t r[KMI_REVERSE_SIZE] = { (uint8_t)p.sym, (uint8_t)(p.sym >> 8), p.hid, p.mods };
+    reverse.insert(reverse.end(), r, r + KMI_REVERSE_SIZE);
+  }
+
+  // Report
+  printf("source     %s (%s)%s%s\n", source.c_str(), kind, haveHost ? ", host " : "",
+         haveHost ? (hostSpec.empty() ? source.c_str() : hostSpec.c_str()) : "");
+  printf("entries    %d keys defined, %zu differ from the device defaults\n", defined, entries.size() / KMI_ENTRY_SIZE);
+  if (!haveHost) {
+    printf("reverse    skipped: give --host to know which characters the keys produce\n");
+  } else {
+    string missing;
+    int ascii = 0;
+    for (uint32_t ch = 0x20; ch < 0x7F; ch++) {
+      if (reach.count(ch)) ascii++;
+      else missing += (char)ch;
+    }
+    printf("reverse    %zu characters\n", rev.size());
+    printf("coverage   printable ASCII %d/95%s%s\n", ascii, missing.empty() ? "" : ", missing: ", missing.c_str());
+    // Unreachable: source characters for XKB, host characters otherwise.
+    const XkbLayout &want = isXkb ? src : host;
+    std::map<uint32_t, string> unreachable;
+    std::set<uint32_t> all;
+    for (const KeyDef &k : KEYS) {
+      if (!(k.flags & K_CHAR)) continue;
+      auto it = want.find(k.xkb);
+      if (it == want.end()) continue;
+      for (int l = 0; l < 4; l++) {
+        uint32_t s = it->second.has[l] ? it->second.sym[l] : 0;
+        if (!s) continue;
+        if (!isXkb && l > 1) continue;   // host levels 3/4 need an AltGr the adapter does not send
+        all.insert(s);
+        if (!reach.count(s) && !unreachable.count(s)) unreachable[s] = fmt("<%s> level %d", k.xkb, l + 1);
+      }
+    }
+    printf("           %s layout %zu/%zu characters reachable\n", isXkb ? "source" : "host",
+           all.size() - unreachable.size(), all.size());
+    if (!unreachable.empty()) {
+      printf("unreachable (%zu):\n", unreachable.size());
+      for (const auto &u : unreachable) printf("  %-16s %s\n", u.second.c_str(), symText(u.first).c_str());
+    }
+  }
+  if (unnamedSyms) printf("note       %d keysyms are not characters this tool knows and were ignored\n", unnamedSyms);
+  for (const string &w : rep.warnings) printf("warning    %s\n", w.c_str());
+  for (const string &s : rep.conflicts) printf("conflict   %s\n", s.c_str());
+
+  if (!rep.conflicts.empty() && !force) {
+    fprintf(stderr, "keymapc: %zu conflict(s), no image written (--force to write anyway)\n", rep.conflicts.size());
+    return 1;
+  }
+  if (out.empty()) return 0;
+  if (name.empty()) {
+    name = srcFile.substr(slash == string::npos ? 0 : slash + 1);
+    if (!srcSection.empty()) name += "(" + srcSection + ")";
+  }
+  vector<uint8_t> img(keymapImageSize(entries.size() / KMI_ENTRY_SIZE, reverse.size() / KMI_REVERSE_SIZE));
+  size_t len = keymapImageBuild(img.data(), img.size(), name.c_str(), entries.data(), entries.size() / KMI_ENTRY_SIZE,
+                                reverse.data(), reverse.size() / KMI_REVERSE_SIZE);
+  FILE *f = len ? fopen(out.c_str(), "wb") : nullptr;
+  if (!f || fwrite(img.data(), 1, len, f) != len) { fprintf(stderr, "keymapc: cannot write %s\n", out.c_str()); if (f) fclose(f); return 2; }
+  fclose(f);
+  printf("wrote      %s, %zu bytes\n", out.c_str(), len);
+  return 0;
+}
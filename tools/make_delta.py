@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""Make (or check) a delta OTA patch between two firmware images.
+
+    make_delta.py old.bin new.bin patch.xdl       # write the patch
+    make_delta.py --apply old.bin patch.xdl out.bin  # rebuild new from old, as the device does
+
+Format (see delta_ota.h): a 76-byte header [magic "XDL1"][old size][new size]
+[sha256 old][sha256 new], then COPY (offset, len from the old image) and
+INSERT (literal bytes) ops, then END. The device streams it: COPY reads the
+running partition, so RAM use does not depend on image size.
+
+Matching indexes the old image in 4-byte-aligned 16-byte windows and
+extends every hit forwards and backwards; runs shorter than MIN_COPY bytes
+are cheaper as literals.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = 0x314C4458
+HEADER = struct.Struct("<III32s32s")
+OP_END, OP_COPY, OP_INSERT = 0, 1, 2
+WINDOW = 16
+ALIGN = 4
+MIN_COPY = 24            # a COPY op costs 9 bytes; an INSERT op costs 5
+MAX_CANDIDATES = 8
+
+
+def index_old(old):
+    table = {}
+    for off in range(0, len(old) - WINDOW + 1, ALIGN):
+        lst = table.setdefault(old[off:off + WINDOW], [])
+        if len(lst) < MAX_CANDIDATES:
+            lst.append(off)
+    return table
+
+
+def match_len(old, o, new, n):
+    k = 0
+    limit = min(len(old) - o, len(new) - n)
+    while k < limit and old[o + k] == new[n + k]:
+        k += 1
+    return k
+
+
+def diff(old, new):
+    """Yields ("copy", off, len) / ("insert", bytes)."""
+    table = index_old(old)
+    i = 0
+    lit_start = 0
+    last_off = None          # old offset that would continue the previous copy
+    while i < len(new):
+        best_off, best_len = None, 0
+        # Continuing where the last copy stopped catches edits that keep the layout.
+        if last_off is not None and last_off < len(old):
+            k = match_len(old, last_off, new, i)
+            if k >= MIN_COPY:
+                best_off, best_len = last_off, k
+        if best_len == 0 and i + WINDOW <= len(new):
+            for o in table.get(new[i:i + WINDOW], ()):
+                k = match_len(old, o, new, i)
+                if k > best_len:
+                    best_off, best_len = o, k
+        if best_len < MIN_COPY:
+            i += 1
+            if last_off is not None:
+                last_off += 1
+            continue
+        # Grow the match backwards into the pending literal.
+        back = 0
+        while back < i - lit_start and best_off - back > 0 and old[best_off - back - 1] == new[i - back - 1]:
+            back += 1
+        if i - back > lit_start:
+            yield ("insert", new[lit_start:i - back])
+        yield ("copy", best_off - back, best_len + back)
+        i += best_len
+        lit_start = i
+        last_off = best_off + best_len
+    if lit_start < len(new):
+        yield ("insert", new[lit_start:])
+
+
+def make_patch(old, new):
+    out = [HEADER.pack(MAGIC, len(old), len(new), hashlib.sha256(old).digest(), hashlib.sha256(new).digest())]
+    stats = {"copy": 0, "insert": 0, "copy_bytes": 0, "insert_bytes": 0}
+    for op in diff(old, new):
+        if op[0] == "copy":
+            out.append(struct.pack("<BII", OP_COPY, op[1], op[2]))
+            stats["copy"] += 1
+            stats["copy_bytes"] += op[2]
+        else:
+            out.append(struct.pack("<BI", OP_INSERT, len(op[1])) + op[1])
+            stats["insert"] += 1
+            stats["insert_bytes"] += len(op[1])
+    out.append(bytes([OP_END]))
+    return b"".join(out), stats
+
+
+def apply_patch(old, patch):
+    magic, old_size, new_size, old_sha, new_sha = HEADER.unpack_from(patch)
+    if magic != MAGIC:
+        raise ValueError("not a delta patch")
+    if hashlib.sha256(old[:old_size]).digest() != old_sha:
+        raise ValueError("patch was made for a different base image")
+    pos = HEADER.size
+    out = bytearray()
+    while True:
+        op = patch[pos]
+        pos += 1
+        if op == OP_END:
+            break
+        if op == OP_COPY:
+            off, n = struct.unpack_from("<II", patch, pos)
+            pos += 8
+            if off + n > old_size:
+                raise ValueError("copy outside old image")
+            out += old[off:off + n]
+        elif op == OP_INSERT:
+            (n,) = struct.unpack_from("<I", patch, pos)
+            pos += 4
+            out += patch[pos:pos + n]
+            pos += n
+        else:
+            raise ValueError("unknown op %d" % op)
+    if pos != len(patch):
+        raise ValueError("data after end of patch")
+    if len(out) != new_size or hashlib.sha256(out).digest() != new_sha:
+        raise ValueError("result hash mismatch")
+    return bytes(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--apply", action="store_true", help="apply a patch instead of making one")
+    ap.add_argument("old")
+    ap.add_argument("second", help="new image (make) or patch (--apply)")
+    ap.add_argument("out")
+    args = ap.parse_args()
+
+    with open(args.old, "rb") as f:
+        old = f.read()
+    with open(args.second, "rb") as f:
+        second = f.read()
+    if args.apply:
+        new = apply_patch(old, second)
+        with open(args.out, "wb") as f:
+            f.write(new)
+        print("rebuilt %d bytes, sha256 ok" % len(new))
+        return 0
+
+    patch, st = make_patch(old, second)
+    apply_patch(old, patch)          # never ship a patch that does not round-trip
+    with open(args.out, "wb") as f:
+        f.write(patch)
+    print("%d -> %d bytes: patch %d bytes (%.1f%% of new), %d copies / %d bytes, %d inserts / %d bytes" % (
+        len(old), len(second), len(patch), 100.0 * len(patch) / max(len(second), 1),
+        st["copy"], st["copy_bytes"], st["insert"], st["insert_bytes"]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Write an auto-OTA manifest for a firmware image and optionally serve it.
+
+    ota_manifest.py build/fw.bin --version 1.4.0               # writes manifest.json next to it
+    ota_manifest.py build/fw.bin --version 1.4.0 --serve 8000  # and serves that directory
+    ota_manifest.py build/fw.bin --version 1.4.0 --delta old/fw-1.3.0.bin:1.3.0
+
+--delta (repeatable) writes fw-<from>-<version>.xdl next to the image with
+make_delta.py and lists it under "deltas"; devices running <from> fetch the
+patch instead of the full image.
+
+Point config.ota_manifest_url (POST /api/ota_auto_set) at
+http://<host>:8000/manifest.json. The server answers conditional requests
+(If-None-Match / If-Modified-Since) with 304 like a real web server, so
+the device's polling can be checked against it.
+"""
+
+import argparse
+import email.utils
+import hashlib
+import http.server
+import json
+import os
+import sys
+
+import make_delta
+
+
+def write_manifest(image, version, url, deltas):
+    with open(image, "rb") as f:
+        data = f.read()
+    manifest = {
+        "version": version,
+        "url": url or os.path.basename(image),
+        "sha256": hashlib.sha256(data).hexdigest(),
+        "size": len(data),
+    }
+    outdir = os.path.dirname(os.path.abspath(image))
+    for spec in deltas:
+        old_path, _, from_version = spec.rpartition(":")
+        with open(old_path, "rb") as f:
+            patch, _stats = make_delta.make_patch(f.read(), data)
+        name = "fw-%s-%s.xdl" % (from_version, version)
+        with open(os.path.join(outdir, name), "wb") as f:
+            f.write(patch)
+        manifest.setdefault("deltas", []).append({"from": from_version, "url": name, "size": len(patch)})
+        print("%s: delta from %s, %d bytes" % (name, from_version, len(patch)))
+    path = os.path.join(outdir, "manifest.json")
+    with open(path, "w") as f:
+        json.dump(manifest, f, indent=1)
+    print("%s: %s %d bytes sha256 %s" % (path, version, len(data), manifest["sha256"]))
+    return path
+
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+    def send_head(self):
+        path = self.translate_path(self.path)
+        if os.path.isfile(path):
+            st = os.stat(path)
+            tag = '"%x-%x"' % (int(st.st_mtime), st.st_size)
+            stamp = email.utils.formatdate(st.st_mtime, usegmt=True)
+            if self.headers.get("If-None-Match") == tag or (
+                    "If-None-Match" not in self.headers and self.headers.get("If-Modified-Since") == stamp):
+                self.send_response(304)
+                self.send_header("ETag", tag)
+                self.end_headers()
+                return None
+            self._etag = tag
+        return super().send_head()
+
+    def end_headers(self):
+        tag = getattr(self, "_etag", None)
+        if tag:
+            self.send_header("ETag", tag)
+            self._etag = None
+        super().end_headers()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("image", help="application .bin to publish")
+    ap.add_argument("--version", required=True, help="must be newer than FIRMWARE_VERSION on the device")
+    ap.add_argument("--url", help="image URL in the manifest (default: file name, relative to the manifest)")
+    ap.add_argument("--delta", action="append", default=[], metavar="OLD.bin:VERSION",
+                    help="also publish a patch from this older build")
+    ap.add_argument("--serve", type=int, metavar="PORT", help="serve the image directory over HTTP")
+    args = ap.parse_args()
+
+    path = write_manifest(args.image, args.version, args.url, args.delta)
+    if args.serve:
+        os.chdir(os.path.dirname(path))
+        print("serving %s on port %d" % (os.getcwd(), args.serve))
+        http.server.ThreadingHTTPServer(("", args.serve), Handler).serve_forever()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
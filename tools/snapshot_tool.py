@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+"""Inspect and author config/keymap snapshots (see snapshot.h).
+
+    snapshot_tool.py show snap.bin                 # human readable
+    snapshot_tool.py show --url http://192.168.4.1 --auth admin:pass   # newest slot on the device
+    snapshot_tool.py to-json snap.bin > snap.json
+    snapshot_tool.py from-json snap.json snap.bin
+    snapshot_tool.py upload http://192.168.4.1 snap.bin --auth admin:pass [--restore]
+
+Both device endpoints take the OTA login (ota_user:ota_pass).
+
+The JSON form is editable: keymap is 256 numbers, keymap_ex maps HID code
+to {base, shift, altgr, ctrl, dead}, timing maps XT/AT/PS2 (port 0) or
+"2:AT" (port 2) to a profile.
+Sections missing from the JSON are left out of the snapshot, and the
+device then keeps its current values for them.
+"""
+
+import argparse
+import base64
+import json
+import struct
+import sys
+import urllib.request
+import zlib
+
+MAGIC = 0x31534B58
+VERSION = 1
+HEADER = struct.Struct("<IHHIIIII")
+SNAP_CONFIG, SNAP_KEYMAP, SNAP_KEYMAP_EX, SNAP_TIMING = 1, 2, 3, 4
+REASONS = {0: "manual", 1: "ota", 2: "upload"}
+MODES = {1: "XT", 2: "AT", 3: "PS2"}
+STRINGS = ["ap_ssid", "ap_pass", "sta_ssid", "sta_pass", "ota_user", "ota_pass", "ota_manifest_url"]
+EX_FIELDS = ["base", "shift", "altgr", "ctrl", "dead"]
+
+
+def parse(blob):
+    if len(blob) < HEADER.size:
+        raise ValueError("too short")
+    magic, version, reason, seq, ms, length, crc, hcrc = HEADER.unpack_from(blob)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a snapshot (magic %08X version %d)" % (magic, version))
+    if hcrc != zlib.crc32(blob[:HEADER.size - 4]):
+        raise ValueError("header CRC mismatch")
+    payload = blob[HEADER.size:HEADER.size + length]
+    if len(payload) != length or crc != zlib.crc32(payload):
+        raise ValueError("payload CRC mismatch")
+
+    snap = {"seq": seq, "reason": REASONS.get(reason, reason), "uptime_ms": ms}
+    pos = 0
+    while pos < len(payload):
+        tag, n = struct.unpack_from("<BH", payload, pos)
+        body = payload[pos + 3:pos + 3 + n]
+        pos += 3 + n
+        if tag == SNAP_CONFIG:
+            cfg, off = {}, 0
+            for name in STRINGS:
+                (sl,) = struct.unpack_from("<H", body, off)
+                cfg[name] = body[off + 2:off + 2 + sl].decode("utf-8", "replace")
+                off += 2 + sl
+            mode, auto, interval, delay, period = struct.unpack_from("<BBIHH", body, off)
+            cfg.update(kb_mode=MODES.get(mode, mode), auto_ota_enabled=bool(auto),
+                       auto_ota_interval_ms=interval, typematic_delay_ms=delay, typematic_period_ms=period)
+            snap["config"] = cfg
+        elif tag == SNAP_KEYMAP:
+            snap["keymap"] = list(body)
+        elif tag == SNAP_KEYMAP_EX:
+            snap["keymap_ex"] = {str(body[i]): dict(zip(EX_FIELDS, body[i + 1:i + 6]))
+                                 for i in range(0, len(body), 6)}
+        elif tag == SNAP_TIMING:
+            timing = {}
+            for i in range(0, len(body), 6):
+                pm, half, gap, cal = struct.unpack_from("<BHHB", body, i)
+                name = MODES.get(pm & 0x0F, str(pm & 0x0F))
+                if pm >> 4:
+                    name = "%d:%s" % (pm >> 4, name)
+                timing[name] = {"half_period_us": half, "inter_byte_us": gap, "calibrated": cal}
+            snap["timing"] = timing
+    return snap
+
+
+def section(tag, body):
+    return struct.pack("<BH", tag, len(body)) + body
+
+
+def build(snap):
+    mode_ids = {v: k for k, v in MODES.items()}
+    payload = b""
+    if "config" in snap:
+        cfg = snap["config"]
+        body = b""
+        for name in STRINGS:
+            s = cfg.get(name, "").encode()
+            body += struct.pack("<H", len(s)) + s
+        mode = cfg.get("kb_mode", "AT")
+        body += struct.pack("<BBIHH", mode_ids.get(mode, mode), int(cfg.get("auto_ota_enabled", False)),
+                            cfg.get("auto_ota_interval_ms", 3600000), cfg.get("typematic_delay_ms", 500),
+                            cfg.get("typematic_period_ms", 92))
+        payload += section(SNAP_CONFIG, body)
+    if "keymap" in snap:
+        if len(snap["keymap"]) != 256:
+            raise ValueError("keymap must have 256 entries")
+        payload += section(SNAP_KEYMAP, bytes(snap["keymap"]))
+    if "keymap_ex" in snap:
+        body = b""
+        for hid, e in sorted(snap["keymap_ex"].items(), key=lambda kv: int(kv[0])):
+            body += bytes([int(hid)] + [e.get(f, 0) for f in EX_FIELDS])
+        payload += section(SNAP_KEYMAP_EX, body)
+    if "timing" in snap:
+        body = b""
+        for name, p in snap["timing"].items():
+            port, _, mode = name.rpartition(":")
+            body += struct.pack("<BHHB", int(port or 0) << 4 | mode_ids.get(mode, mode), p["half_period_us"],
+                                p["inter_byte_us"], p.get("calibrated", 1))
+        payload += section(SNAP_TIMING, body)
+    # seq is re-stamped by the device on upload
+    head = HEADER.pack(MAGIC, VERSION, 2, snap.get("seq", 0), 0, len(payload), zlib.crc32(payload), 0)
+    head = head[:-4] + struct.pack("<I", zlib.crc32(head[:-4]))
+    return head + payload
+
+
+def show(snap):
+    print("seq %s  reason %s  uptime %.1fs" % (snap["seq"], snap["reason"], snap["uptime_ms"] / 1000.0))
+    cfg = snap.get("config")
+    if cfg:
+        print("mode %s  ap '%s'  sta '%s'  typematic %d/%d ms  auto-ota %s %s" % (
+            cfg["kb_mode"], cfg["ap_ssid"], cfg["sta_ssid"], cfg["typematic_delay_ms"],
+            cfg["typematic_period_ms"], "on" if cfg["auto_ota_enabled"] else "off", cfg["ota_manifest_url"]))
+    if "keymap" in snap:
+        print("keymap: %d non-default entries" % sum(1 for v in snap["keymap"] if v))
+    for hid, e in sorted(snap.get("keymap_ex", {}).items(), key=lambda kv: int(kv[0])):
+        print("  hid %3s  " % hid + " ".join("%s=%02X" % (f, e[f]) for f in EX_FIELDS))
+    for mode, p in snap.get("timing", {}).items():
+        print("timing %-3s half %dus gap %dus%s" % (mode, p["half_period_us"], p["inter_byte_us"],
+                                                    "" if p["calibrated"] else " (manual)"))
+
+
+def request(url, auth, data=None):
+    headers = {"Content-Type": "application/octet-stream"} if data is not None else {}
+    if auth:
+        headers["Authorization"] = "Basic " + base64.b64encode(auth.encode()).decode()
+    return urllib.request.urlopen(urllib.request.Request(url, data=data, headers=headers))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    p = sub.add_parser("show")
+    p.add_argument("file", nargs="?")
+    p.add_argument("--url")
+    p.add_argument("--auth", help="user:pass for the device")
+    p = sub.add_parser("to-json")
+    p.add_argument("file")
+    p = sub.add_parser("from-json")
+    p.add_argument("json")
+    p.add_argument("out")
+    p = sub.add_parser("upload")
+    p.add_argument("url")
+    p.add_argument("file")
+    p.add_argument("--restore", action="store_true")
+    p.add_argument("--auth", help="user:pass for the device")
+    args = ap.parse_args()
+
+    if args.cmd == "show":
+        if args.url:
+            with request(args.url.rstrip("/") + "/api/snapshot.bin", args.auth) as resp:
+                blob = resp.read()
+        elif args.file:
+            with open(args.file, "rb") as f:
+                blob = f.read()
+        else:
+            ap.error("give a snapshot file or --url")
+        show(parse(blob))
+    elif args.cmd == "to-json":
+        with open(args.file, "rb") as f:
+            print(json.dumps(parse(f.read()), indent=1))
+    elif args.cmd == "from-json":
+        with open(args.json) as f:
+            blob = build(json.load(f))
+        with open(args.out, "wb") as f:
+            f.write(blob)
+        print("%d bytes" % len(blob))
+    elif args.cmd == "upload":
+        with open(args.file, "rb") as f:
+            blob = f.read()
+        parse(blob)
+        url = args.url.rstrip("/") + "/api/snapshot_upload" + ("?restore=1" if args.restore else "")
+        with request(url, args.auth, blob) as resp:
+            print(resp.read().decode())
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
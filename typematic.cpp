@@ -0,0 +1,130 @@
+#include "typematic.h"
+#include "config.h"
+#include "logger.h"
+#include <atomic>
+
+#define TM_WHEEL_SLOTS 256          // 1 ms per slot, longer timers use rounds
+#define TM_NONE        -1
+
+struct TmTimer {
+  int16_t next;
+  int16_t prev;
+  int16_t slot;                     // TM_NONE when not armed
+  uint16_t rounds;
+};
+
+static TmTimer timers[256];
+static int16_t wheel[TM_WHEEL_SLOTS];
+static uint16_t cursor = 0;
+static unsigned long lastTickMs = 0;
+static int16_t repeatingKey = TM_NONE;
+static typematic_fire_cb_t fireCb = nullptr;
+static uint16_t delayMs = 500;
+static uint16_t periodMs = 92;
+static bool hostRate = false;               // rate came from 0xF3, not the config
+static std::atomic<bool> defaultsChanged{false};
+
+// AT typematic byte: bits 0-2 = A, bits 3-4 = B, bits 5-6 = delay.
+// period = (8 + A) * 2^B * 4.17 ms, delay = (1 + D) * 250 ms
+static uint16_t atPeriodMs(uint8_t param) {
+  uint32_t a = param & 0x07;
+  uint32_t b = (param >> 3) & 0x03;
+  return (uint16_t)(((8 + a) * (1u << b) * 417u + 50) / 100);
+}
+
+static void unlinkTimer(uint8_t k) {
+  TmTimer &t = timers[k];
+  if (t.slot == TM_NONE) return;
+  if (t.prev != TM_NONE) timers[t.prev].next = t.next;
+  else wheel[t.slot] = t.next;
+  if (t.next != TM_NONE) timers[t.next].prev = t.prev;
+  t.next = t.prev = t.slot = TM_NONE;
+}
+
+static void armTimer(uint8_t k, uint32_t ms) {
+  unlinkTimer(k);
+  if (ms == 0) ms = 1;
+  TmTimer &t = timers[k];
+  uint16_t slot = (uint16_t)((cursor + ms) % TM_WHEEL_SLOTS);
+  t.rounds = (uint16_t)((ms - 1) / TM_WHEEL_SLOTS);
+  t.slot = slot;
+  t.prev = TM_NONE;
+  t.next = wheel[slot];
+  if (t.next != TM_NONE) timers[t.next].prev = k;
+  wheel[slot] = k;
+}
+
+void typematicBegin(typematic_fire_cb_t cb) {
+  fireCb = cb;
+  for (int i = 0; i < TM_WHEEL_SLOTS; i++) wheel[i] = TM_NONE;
+  for (int i = 0; i < 256; i++) timers[i] = { TM_NONE, TM_NONE, TM_NONE, 0 };
+  cursor = 0;
+  repeatingKey = TM_NONE;
+  lastTickMs = millis();
+  typematicRestoreDefaults();
+}
+
+void typematicPress(uint8_t hidcode) {
+  // modifiers never repeat on their own and must not cancel the repeating key
+  if (hidcode >= 0xE0 && hidcode <= 0xE7) return;
+  if (repeatingKey != TM_NONE) unlinkTimer((uint8_t)repeatingKey);
+  repeatingKey = hidcode;
+  armTimer(hidcode, delayMs);
+}
+
+void typematicRelease(uint8_t hidcode) {
+  unlinkTimer(hidcode);
+  if (repeatingKey == hidcode) repeatingKey = TM_NONE;
+}
+
+void typematicReleaseAll() {
+  if (repeatingKey != TM_NONE) unlinkTimer((uint8_t)repeatingKey);
+  repeatingKey = TM_NONE;
+}
+
+void typematicSetParams(uint16_t d, uint16_t p) {
+  delayMs = d ? d : 1;
+  periodMs = p ? p : 1;
+}
+
+void typematicSetHostRate(uint8_t param) {
+  typematicSetParams((uint16_t)((1 + ((param >> 5) & 0x03)) * 250), atPeriodMs(param));
+  hostRate = true;
+  logEvent(LOG_MOD_TYPEMATIC, LOG_INFO, "[TYPEMATIC] Host rate 0x%02X -> delay=%ums period=%ums", param, delayMs, periodMs);
+}
+
+void typematicRestoreDefaults() {
+  typematicSetParams(config.typematic_delay_ms, config.typematic_period_ms);
+  hostRate = false;
+}
+
+void typematicDefaultsChanged() {
+  defaultsChanged.store(true);
+}
+
+uint16_t typematicDelayMs() { return delayMs; }
+uint16_t typematicPeriodMs() { return periodMs; }
+
+void typematicTask() {
+  if (defaultsChanged.exchange(false) && !hostRate) typematicRestoreDefaults();
+  unsigned long now = millis();
+  unsigned long elapsed = now - lastTickMs;
+  if (elapsed == 0) return;
+  lastTickMs = now;
+  // after a long stall only one lap matters; every armed timer is visited once
+  if (elapsed > TM_WHEEL_SLOTS) elapsed = TM_WHEEL_SLOTS;
+  while (elapsed--) {
+    cursor = (uint16_t)((cursor + 1) % TM_WHEEL_SLOTS);
+    int16_t k = wheel[cursor];
+    while (k != TM_NONE) {
+      int16_t next = timers[k].next;
+      if (timers[k].rounds > 0) {
+        timers[k].rounds--;
+      } else {
+        armTimer((uint8_t)k, periodMs);
+        if (fireCb) fireCb((uint8_t)k);
+      }
+      k = next;
+    }
+  }
+}
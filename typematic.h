@@ -0,0 +1,28 @@
+#ifndef TYPEMATIC_H
+#define TYPEMATIC_H
+
+#include <Arduino.h>
+
+// Typematic (auto-repeat) engine. Only the most recently pressed key repeats.
+// Timers live on a hashed timer wheel with 1 ms slots, so each tick costs O(1)
+// regardless of how many keys are held.
+
+typedef void (*typematic_fire_cb_t)(uint8_t hidcode);
+
+void typematicBegin(typematic_fire_cb_t cb);
+void typematicTask();
+
+void typematicPress(uint8_t hidcode);
+void typematicRelease(uint8_t hidcode);
+void typematicReleaseAll();
+
+void typematicSetParams(uint16_t delayMs, uint16_t periodMs);
+void typematicSetHostRate(uint8_t param);   // argument byte of host command 0xF3
+void typematicRestoreDefaults();            // config defaults (XT hosts, 0xF6/0xFF)
+// The config defaults changed (web UI). Safe from any task: the next
+// typematicTask applies them, unless the host has set its own rate.
+void typematicDefaultsChanged();
+uint16_t typematicDelayMs();
+uint16_t typematicPeriodMs();
+
+#endif
@@ -1,13 +1,377 @@
 #include "usb_host.h"
+#include "hid_parser.h"
 #include "xt_at_output.h"
+#include "ps2_mouse.h"
+#include "logger.h"
 #include <Arduino.h>
+#if __has_include("usb/usb_host.h")
+#include "usb/usb_host.h"
+#define USB_HOST_STACK 1
+#else
+#define USB_HOST_STACK 0
+#endif
+
+// Reports are copied into a small ring by the transport and decoded/diffed in
+// usbHostTask(), so key callbacks always run on the loop task.
+#define USB_REPORT_LEN   64
+#define USB_REPORT_SLOTS 8
+struct UsbReport { uint8_t len; uint8_t data[USB_REPORT_LEN]; };
+static UsbReport reportRing[USB_REPORT_SLOTS];
+static volatile int r_head = 0, r_tail = 0;
+
+static usb_key_cb_t keyCb = nullptr;
+static usb_mouse_cb_t mouseCb = nullptr;
+static HidKeyboardLayout layout;
+static HidKeyState keyState;
+static volatile bool layoutDirty = false;
+static volatile bool releaseAll = false;
+static HidKeyboardLayout pendingLayout;
+
+static void dispatchKey(uint8_t usage, bool pressed, void *ctx) {
+  (void)ctx;
+  if (keyCb) keyCb(usage, pressed);
+}
+
+void usbHostRegisterKeyCallback(usb_key_cb_t cb) {
+  keyCb = cb;
+}
+
+void usbHostSetReportDescriptor(const uint8_t *desc, size_t len) {
+  HidKeyboardLayout l;
+  if (hidParseReportDescriptor(desc, len, l)) {
+    Serial.printf("[USB_HOST] Report descriptor: id=%u bits=%u bitmap=%u array=%d\n",
+                  l.report_id, l.report_bits, l.bitmap_count, l.has_array ? l.array.count : 0);
+  } else {
+    Serial.println("[USB_HOST] No keyboard fields in descriptor, using boot layout");
+    hidLayoutBoot(l);
+  }
+  pendingLayout = l;
+  layoutDirty = true;
+}
+
+void usbHostUseBootProtocol() {
+  hidLayoutBoot(pendingLayout);
+  layoutDirty = true;
+}
+
+bool usbHostSubmitReport(const uint8_t *data, size_t len) {
+  if (len == 0 || len > USB_REPORT_LEN) return false;
+  int next = (r_tail + 1) % USB_REPORT_SLOTS;
+  if (next == r_head) {
+    logEvent(LOG_MOD_USB, LOG_WARN, "[USB_HOST] Report ring full, report dropped");
+    return false;
+  }
+  reportRing[r_tail].len = (uint8_t)len;
+  memcpy(reportRing[r_tail].data, data, len);
+  r_tail = next;
+  return true;
+}
+
+void usbHostDeviceGone() {
+  releaseAll = true;
+}
+
+void usbHostRegisterMouseCallback(usb_mouse_cb_t cb) {
+  mouseCb = cb;
+}
+
+bool usbHostSubmitMouseReport(const uint8_t *data, size_t len) {
+  if (len < 3 || !mouseCb) return false;
+  mouseCb(data[0], (int8_t)data[1], (int8_t)data[2], len > 3 ? (int8_t)data[3] : 0);
+  return true;
+}
+
+void usbHostMouseGone() {
+  if (mouseCb) mouseCb(0, 0, 0, 0);
+}
+
+#if USB_HOST_STACK
+// ---- Transport: ESP-IDF usb_host client on the S3 OTG port ----
+// One device, at most one keyboard and one mouse HID interface. Everything
+// below runs on the "usbhid" client task: transfer callbacks are invoked from
+// usb_host_client_handle_events(), so no locking is needed between them.
+// The OTG port must be free (USB Mode "Hardware CDC and JTAG" for Serial).
+#define USB_CLASS_HID_IF     0x03
+#define HID_PROTO_KEYBOARD   1
+#define HID_PROTO_MOUSE      2
+#define HID_DESC_HID         0x21
+#define HID_DESC_REPORT      0x22
+#define HID_REQ_SET_PROTOCOL 0x0B
+#define HID_REPORT_DESC_MAX  512
+
+struct HidIf {
+  bool present;
+  uint8_t num, alt, ep;
+  uint16_t mps;
+  usb_transfer_t *xfer;
+  bool busy;
+};
+
+static usb_host_client_handle_t client = nullptr;
+static usb_device_handle_t dev = nullptr;
+static volatile uint8_t newAddr = 0;
+static volatile bool devGone = false;
+static HidIf kbdIf, mouseIf;
+static uint16_t kbdReportLen = 0;
+static usb_transfer_t *ctrlXfer = nullptr;
+static bool ctrlBusy = false;
+static bool kbdBootFallback = false;
+static uint8_t ctrlStep = 0;
+
+static void clientEvent(const usb_host_client_event_msg_t *msg, void *arg) {
+  (void)arg;
+  if (msg->event == USB_HOST_CLIENT_EVENT_NEW_DEV) {
+    if (!dev) newAddr = msg->new_dev.address;
+  } else if (msg->event == USB_HOST_CLIENT_EVENT_DEV_GONE) {
+    if (dev && msg->dev_gone.dev_hdl == dev) devGone = true;
+  }
+}
+
+static void inDone(usb_transfer_t *x) {
+  HidIf *hi = (HidIf *)x->context;
+  if (x->status == USB_TRANSFER_STATUS_COMPLETED && x->actual_num_bytes > 0) {
+    if (hi == &kbdIf) usbHostSubmitReport(x->data_buffer, x->actual_num_bytes);
+    else usbHostSubmitMouseReport(x->data_buffer, x->actual_num_bytes);
+  }
+  if (devGone || x->status == USB_TRANSFER_STATUS_NO_DEVICE ||
+      x->status == USB_TRANSFER_STATUS_CANCELED ||
+      usb_host_transfer_submit(x) != ESP_OK) {
+    hi->busy = false;
+  }
+}
+
+static void startPolling(HidIf &hi) {
+  if (!hi.present || !hi.xfer) return;
+  hi.xfer->device_handle = dev;
+  hi.xfer->bEndpointAddress = hi.ep;
+  hi.xfer->num_bytes = hi.mps;
+  hi.xfer->callback = inDone;
+  hi.xfer->context = &hi;
+  hi.busy = usb_host_transfer_submit(hi.xfer) == ESP_OK;
+}
+
+static void controlDone(usb_transfer_t *x);
+
+static bool submitControl(uint8_t reqType, uint8_t req, uint16_t value, uint16_t index, uint16_t len) {
+  if (!ctrlXfer) return false;
+  usb_setup_packet_t *setup = (usb_setup_packet_t *)ctrlXfer->data_buffer;
+  setup->bmRequestType = reqType;
+  setup->bRequest = req;
+  setup->wValue = value;
+  setup->wIndex = index;
+  setup->wLength = len;
+  ctrlXfer->num_bytes = sizeof(usb_setup_packet_t) + len;
+  ctrlXfer->device_handle = dev;
+  ctrlXfer->bEndpointAddress = 0;
+  ctrlXfer->callback = controlDone;
+  ctrlXfer->context = nullptr;
+  ctrlBusy = usb_host_transfer_submit_control(client, ctrlXfer) == ESP_OK;
+  return ctrlBusy;
+}
+
+// Enumeration requests, one at a time on the shared control transfer:
+// 0 keyboard report descriptor, 1 keyboard SET_PROTOCOL(boot) if that failed,
+// 2 mouse SET_PROTOCOL(boot), then interrupt IN polling starts.
+static void nextControl() {
+  while (!devGone) {
+    uint8_t step = ctrlStep++;
+    if (step == 0 && kbdIf.present) {
+      if (kbdReportLen && submitControl(0x81, 0x06, HID_DESC_REPORT << 8, kbdIf.num, kbdReportLen)) return;
+      kbdBootFallback = true;
+      usbHostUseBootProtocol();
+    } else if (step == 1 && kbdIf.present && kbdBootFallback) {
+      if (submitControl(0x21, HID_REQ_SET_PROTOCOL, 0, kbdIf.num, 0)) return;
+    } else if (step == 2 && mouseIf.present) {
+      if (submitControl(0x21, HID_REQ_SET_PROTOCOL, 0, mouseIf.num, 0)) return;
+    } else if (step >= 3) {
+      startPolling(kbdIf);
+      startPolling(mouseIf);
+      return;
+    }
+  }
+}
+
+static void controlDone(usb_transfer_t *x) {
+  ctrlBusy = false;
+  if (ctrlStep == 1) {
+    size_t got = x->actual_num_bytes > (int)sizeof(usb_setup_packet_t)
+                   ? x->actual_num_bytes - sizeof(usb_setup_packet_t) : 0;
+    if (x->status == USB_TRANSFER_STATUS_COMPLETED && got > 0) {
+      usbHostSetReportDescriptor(x->data_buffer + sizeof(usb_setup_packet_t), got);
+    } else {
+      logEvent(LOG_MOD_USB, LOG_WARN, "[USB_HOST] Report descriptor fetch failed, using boot protocol");
+      kbdBootFallback = true;
+      usbHostUseBootProtocol();
+    }
+  } else if (x->status != USB_TRANSFER_STATUS_COMPLETED) {
+    logEvent(LOG_MOD_USB, LOG_WARN, "[USB_HOST] SET_PROTOCOL failed (status %d)", (int)x->status);
+  }
+  nextControl();
+}
+
+// Walks the active configuration for HID interfaces and their interrupt IN
+// endpoint; the HID class descriptor carries the report descriptor length.
+static void scanConfig(const usb_config_desc_t *cfg) {
+  const uint8_t *p = (const uint8_t *)cfg;
+  uint16_t total = cfg->wTotalLength;
+  HidIf *cur = nullptr;
+  for (uint16_t off = 0; off + 2 <= total && p[off] >= 2; off += p[off]) {
+    const uint8_t *d = p + off;
+    if (d[1] == USB_B_DESCRIPTOR_TYPE_INTERFACE) {
+      const usb_intf_desc_t *in = (const usb_intf_desc_t *)d;
+      cur = nullptr;
+      if (in->bInterfaceClass != USB_CLASS_HID_IF || in->bAlternateSetting != 0) continue;
+      if (in->bInterfaceProtocol == HID_PROTO_KEYBOARD && !kbdIf.present) cur = &kbdIf;
+      else if (in->bInterfaceProtocol == HID_PROTO_MOUSE && !mouseIf.present) cur = &mouseIf;
+      if (cur) { cur->num = in->bInterfaceNumber; cur->alt = in->bAlternateSetting; cur->ep = 0; }
+    } else if (cur && d[1] == HID_DESC_HID && d[0] >= 9 && d[6] == HID_DESC_REPORT && cur == &kbdIf) {
+      uint16_t len = d[7] | (d[8] << 8);
+      kbdReportLen = len > HID_REPORT_DESC_MAX ? HID_REPORT_DESC_MAX : len;
+    } else if (cur && d[1] == USB_B_DESCRIPTOR_TYPE_ENDPOINT && !cur->ep) {
+      const usb_ep_desc_t *ep = (const usb_ep_desc_t *)d;
+      if ((ep->bEndpointAddress & 0x80) && (ep->bmAttributes & 0x03) == 0x03) {
+        cur->ep = ep->bEndpointAddress;
+        cur->mps = ep->wMaxPacketSize & 0x7FF;
+        cur->present = cur->mps > 0;
+      }
+    }
+  }
+}
+
+static void claimIf(HidIf &hi, const char *what) {
+  if (!hi.present) return;
+  if (usb_host_interface_claim(client, dev, hi.num, hi.alt) != ESP_OK ||
+      usb_host_transfer_alloc(hi.mps, 0, &hi.xfer) != ESP_OK) {
+    logEvent(LOG_MOD_USB, LOG_WARN, "[USB_HOST] Could not claim %s interface %u", LOG_STR(what), hi.num);
+    if (hi.xfer) { usb_host_transfer_free(hi.xfer); hi.xfer = nullptr; }
+    usb_host_interface_release(client, dev, hi.num);
+    hi.present = false;
+    return;
+  }
+  Serial.printf("[USB_HOST] %s on interface %u, EP 0x%02X, %u bytes\n", what, hi.num, hi.ep, hi.mps);
+}
+
+static void openDevice(uint8_t addr) {
+  const usb_config_desc_t *cfg = nullptr;
+  if (usb_host_device_open(client, addr, &dev) != ESP_OK) { dev = nullptr; return; }
+  kbdIf = HidIf(); mouseIf = HidIf();
+  kbdReportLen = 0;
+  kbdBootFallback = false;
+  ctrlStep = 0;
+  devGone = false;
+  if (usb_host_get_active_config_descriptor(dev, &cfg) == ESP_OK) scanConfig(cfg);
+  if (!kbdIf.present && !mouseIf.present) {
+    Serial.println("[USB_HOST] Device has no boot keyboard/mouse interface, ignored");
+    usb_host_device_close(client, dev);
+    dev = nullptr;
+    return;
+  }
+  claimIf(kbdIf, "Keyboard");
+  claimIf(mouseIf, "Mouse");
+  if (!ctrlXfer) usb_host_transfer_alloc(sizeof(usb_setup_packet_t) + HID_REPORT_DESC_MAX, 0, &ctrlXfer);
+  nextControl();
+}
+
+// Transfers still in flight complete with NO_DEVICE after a disconnect; the
+// interfaces are only released once every callback has returned.
+static void closeDevice() {
+  if (ctrlBusy || kbdIf.busy || mouseIf.busy) return;
+  HidIf *ifs[2] = { &kbdIf, &mouseIf };
+  for (HidIf *hi : ifs) {
+    if (!hi->present) continue;
+    usb_host_transfer_free(hi->xfer);
+    hi->xfer = nullptr;
+    usb_host_interface_release(client, dev, hi->num);
+  }
+  usb_host_device_close(client, dev);
+  if (kbdIf.present) usbHostDeviceGone();
+  if (mouseIf.present) usbHostMouseGone();
+  kbdIf = HidIf(); mouseIf = HidIf();
+  dev = nullptr;
+  devGone = false;
+  Serial.println("[USB_HOST] Device removed");
+}
+
+static void hostLibTask(void *arg) {
+  (void)arg;
+  for (;;) {
+    uint32_t flags = 0;
+    usb_host_lib_handle_events(portMAX_DELAY, &flags);
+    if (flags & USB_HOST_LIB_EVENT_FLAGS_NO_CLIENTS) usb_host_device_free_all();
+  }
+}
+
+static void clientTask(void *arg) {
+  (void)arg;
+  usb_host_client_config_t cc = {};
+  cc.is_synchronous = false;
+  cc.max_num_event_msg = 5;
+  cc.async.client_event_callback = clientEvent;
+  cc.async.callback_arg = nullptr;
+  if (usb_host_client_register(&cc, &client) != ESP_OK) {
+    Serial.println("[USB_HOST] Client registration failed");
+    vTaskDelete(NULL);
+    return;
+  }
+  for (;;) {
+    usb_host_client_handle_events(client, pdMS_TO_TICKS(50));
+    if (dev && devGone) closeDevice();
+    if (!dev && newAddr) {
+      uint8_t addr = newAddr;
+      newAddr = 0;
+      openDevice(addr);
+    }
+  }
+}
+
+static bool transportBegin() {
+  usb_host_config_t hc = {};
+  hc.skip_phy_setup = false;
+  hc.intr_flags = ESP_INTR_FLAG_LEVEL1;
+  if (usb_host_install(&hc) != ESP_OK) return false;
+  xTaskCreatePinnedToCore(hostLibTask, "usbhost", 3072, NULL, 2, NULL, 0);
+  xTaskCreatePinnedToCore(clientTask, "usbhid", 4096, NULL, 2, NULL, 0);
+  return true;
+}
+#else
+static bool transportBegin() { return false; }
+#endif
 
-// Minimal stub: calls to xtatSendFromUSB should be triggered by actual USB host lib
 void usbHostBegin() {
-  Serial.println("[USB_HOST] USB host init stub (implement TinyUSB host in usb_host.cpp)");
+  hidLayoutBoot(layout);
+  hidStateClear(keyState);
+  r_head = r_tail = 0;
+  if (!keyCb) keyCb = xtatSendFromUSB;
+  if (!mouseCb) mouseCb = ps2MouseReport;
+  if (transportBegin()) {
+    Serial.println("[USB_HOST] HID host ready (boot + report protocol)");
+  } else {
+    Serial.println("[USB_HOST] No USB host stack, HID ingestion idle");
+  }
 }
 
 void usbHostTask() {
-  // Poll USB host stack here in real implementation
+  if (releaseAll) {
+    releaseAll = false;
+    HidKeyState none;
+    hidStateClear(none);
+    hidDiffState(keyState, none, dispatchKey, nullptr);
+    keyState = none;
+    r_head = r_tail;
+  }
+  if (layoutDirty) {
+    layoutDirty = false;
+    layout = pendingLayout;
+  }
+  while (r_head != r_tail) {
+    const UsbReport &r = reportRing[r_head];
+    HidKeyState next;
+    if (hidDecodeReport(layout, r.data, r.len, next)) {
+      hidDiffState(keyState, next, dispatchKey, nullptr);
+      keyState = next;
+    } else if (logEnabled(LOG_MOD_USB, LOG_DEBUG)) {
+      logEvent(LOG_MOD_USB, LOG_DEBUG, "[USB_HOST] Report ignored (len=%u id=0x%02X)", r.len, r.len ? r.data[0] : 0);
+    }
+    r_head = (r_head + 1) % USB_REPORT_SLOTS;
+  }
 }
-void usbHostRegisterKeyCallback(usb_key_cb_t cb) {}
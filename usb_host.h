@@ -9,4 +9,20 @@ void usbHostTask();
 typedef void (*usb_key_cb_t)(uint8_t hidcode, bool pressed);
 void usbHostRegisterKeyCallback(usb_key_cb_t cb);
 
+// Transport side: called by the USB host stack when a keyboard interface is
+// enumerated / reports arrive. Safe to call from the USB host task.
+void usbHostSetReportDescriptor(const uint8_t *desc, size_t len);
+void usbHostUseBootProtocol();
+bool usbHostSubmitReport(const uint8_t *data, size_t len);
+void usbHostDeviceGone();
+
+// Mouse interfaces are put in boot protocol by the transport:
+// [buttons][dx][dy][wheel (optional)], signed 8-bit deltas. Movement is
+// handed straight to the callback (default ps2MouseReport, which coalesces
+// it), not queued behind keyboard reports.
+typedef void (*usb_mouse_cb_t)(uint8_t buttons, int16_t dx, int16_t dy, int8_t wheel);
+void usbHostRegisterMouseCallback(usb_mouse_cb_t cb);
+bool usbHostSubmitMouseReport(const uint8_t *data, size_t len);
+void usbHostMouseGone();
+
 #endif
@@ -0,0 +1,110 @@
+#include "web_assets.h"
+#include <ArduinoJson.h>
+#include "storage.h"
+#include "mem_stats.h"
+
+#if __has_include("web_assets_gen.h")
+#include "web_assets_gen.h"
+#define WEB_ASSETS_EMBEDDED 1
+#else
+#define WEB_ASSETS_EMBEDDED 0
+#endif
+
+#define CACHE_IMMUTABLE "public, max-age=31536000, immutable"
+#define CACHE_REVALIDATE "no-cache"
+
+static uint32_t served200 = 0;
+static uint32_t served304 = 0;
+
+// Returns true (and has answered) if the client already holds this version.
+static bool answerNotModified(AsyncWebServerRequest *req, const String &quotedTag, const char *cache) {
+  if (!req->hasHeader("If-None-Match")) return false;
+  if (req->header("If-None-Match").indexOf(quotedTag) < 0) return false;
+  AsyncWebServerResponse *resp = req->beginResponse(304);
+  resp->addHeader("ETag", quotedTag);
+  resp->addHeader("Cache-Control", cache);
+  req->send(resp);
+  served304++;
+  return true;
+}
+
+static const char *cachePolicy(AsyncWebServerRequest *req, const char *mime, const char *etag) {
+  if (strcmp(mime, "text/html") == 0) return CACHE_REVALIDATE;
+  if (req->hasParam("v") && req->getParam("v")->value() == etag) return CACHE_IMMUTABLE;
+  return CACHE_REVALIDATE;
+}
+
+static void finish(AsyncWebServerRequest *req, AsyncWebServerResponse *resp, const String &quotedTag, const char *cache) {
+  resp->addHeader("Content-Encoding", "gzip");
+  resp->addHeader("ETag", quotedTag);
+  resp->addHeader("Cache-Control", cache);
+  resp->addHeader("Vary", "Accept-Encoding");
+  req->send(resp);
+  served200++;
+}
+
+#if WEB_ASSETS_EMBEDDED
+static void registerEmbedded(AsyncWebServer &server) {
+  for (int i = 0; i < WEB_ASSET_COUNT; i++) {
+    const WebAsset *a = &WEB_ASSETS[i];
+    server.on(a->path, HTTP_GET, [a](AsyncWebServerRequest *req){
+      String tag = String("\"") + a->etag + "\"";
+      const char *cache = cachePolicy(req, a->mime, a->etag);
+      if (answerNotModified(req, tag, cache)) return;
+      // Streams from flash in chunks, no RAM copy of the asset.
+      finish(req, req->beginResponse_P(200, a->mime, a->gz, a->len), tag, cache);
+    });
+  }
+  Serial.printf("[ASSETS] %d embedded assets\n", WEB_ASSET_COUNT);
+}
+#endif
+
+static int registerFromFS(AsyncWebServer &server) {
+  if (!storageExists("/assets.json")) return 0;
+  MemJsonDocument<MEM_WEB> doc(2048);
+  DeserializationError err;
+  {
+    StorageScratch buf;
+    size_t len = 0;
+    if (!buf.data() || !storageRead("/assets.json", (uint8_t *)buf.data(), buf.size(), len)) return 0;
+    err = deserializeJson(doc, (const char *)buf.data(), len);
+  }
+  if (err) { Serial.println("[ASSETS] assets.json parse failed"); return 0; }
+  int n = 0;
+  for (JsonPair kv : doc.as<JsonObject>()) {
+    String path = kv.key().c_str();
+    String etag = kv.value()["etag"] | "";
+    String mime = kv.value()["mime"] | "text/plain";
+    if (!storageExists((path + ".gz").c_str())) continue;
+    server.on(path.c_str(), HTTP_GET, [path, etag, mime](AsyncWebServerRequest *req){
+      String tag = "\"" + etag + "\"";
+      const char *cache = cachePolicy(req, mime.c_str(), etag.c_str());
+      if (answerNotModified(req, tag, cache)) return;
+      finish(req, req->beginResponse(storageFS(), path + ".gz", mime), tag, cache);
+    });
+    n++;
+  }
+  Serial.printf("[ASSETS] %d gzip assets from storage\n", n);
+  return n;
+}
+
+void webAssetsInit(AsyncWebServer &server) {
+#if WEB_ASSETS_EMBEDDED
+  registerEmbedded(server);
+#else
+  if (registerFromFS(server) == 0) {
+    // No build output at all: plain files, revalidated by Last-Modified.
+    server.serveStatic("/", storageFS(), "/").setCacheControl(CACHE_REVALIDATE);
+    Serial.println("[ASSETS] No asset build found, serving data/ uncompressed");
+  }
+#endif
+
+  server.on("/api/assets", HTTP_GET, [](AsyncWebServerRequest *req){
+    StaticJsonDocument<128> doc;
+    doc["embedded"] = WEB_ASSETS_EMBEDDED;
+    doc["served"] = served200;
+    doc["not_modified"] = served304;
+    String out; serializeJson(doc, out);
+    req->send(200, "application/json", out);
+  });
+}
@@ -0,0 +1,28 @@
+#ifndef WEB_ASSETS_H
+#define WEB_ASSETS_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Static web UI served gzip-compressed with strong ETags.
+//
+// tools/build_assets.py compresses data/*.html|js|css, hashes them and
+// rewrites HTML references to "name?v=<etag>". If its output
+// web_assets_gen.h is present at build time, the assets are served straight
+// from flash; otherwise <name>.gz files listed in /assets.json on LittleFS
+// are used (build_assets.py --fs). HTML is always revalidated, versioned
+// requests for the other assets are cacheable for a year, and a matching
+// If-None-Match is answered with 304.
+
+struct WebAsset {
+  const char *path;
+  const char *mime;
+  const char *etag;
+  const uint8_t *gz;
+  uint32_t len;
+};
+
+void webAssetsInit(AsyncWebServer &server);
+
+#endif
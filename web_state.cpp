@@ -0,0 +1,142 @@
+#include "web_state.h"
+#include "config.h"
+#include "xt_at_output.h"
+#include "timing_profile.h"
+#include "keymap_ex.h"
+#include "realtime_ws.h"
+#include "mem_stats.h"
+#include <ArduinoJson.h>
+#include <WiFi.h>
+#include <rom/crc.h>
+#include <atomic>
+
+extern String firmware_version;
+
+#define STATE_PUSH_MS  100            // coalesces bursts (upload = compile + save)
+#define STATE_POLL_MS  1000           // Wi-Fi has no change hook, so it is polled
+#define STATE_JSON_MAX 768
+
+static std::atomic<uint32_t> generation(1);
+static std::atomic<uint8_t> dirty(0);
+static unsigned long lastPushMs = 0, lastPollMs = 0;
+static bool lastConnected = false;
+static uint32_t lastIP = 0;
+
+void stateChanged(uint8_t fields) {
+  generation.fetch_add(1, std::memory_order_relaxed);
+  dirty.fetch_or(fields, std::memory_order_relaxed);
+}
+
+uint32_t stateGeneration() { return generation.load(std::memory_order_relaxed); }
+
+// Each section is written the same way into /api/state and into its delta.
+static void fillWifi(JsonObject o) {
+  bool up = WiFi.status() == WL_CONNECTED;
+  o["ssid"] = config.sta_ssid;
+  o["ap_ssid"] = config.ap_ssid;
+  o["connected"] = up;
+  if (up) o["ip"] = WiFi.localIP().toString();
+}
+
+static void fillMode(JsonObject o) {
+  uint8_t mode = xtatMode();
+  o["name"] = mode == MODE_XT ? "XT" : (mode == MODE_AT ? "AT" : "PS2");
+  uint8_t port = xtatActivePort();
+  if (port == XTAT_PORT_ALL) o["port"] = "all";
+  else o["port"] = port;
+  o["ports"] = xtatPortCount();
+}
+
+// null while the control port has no saved profile for its mode.
+static void fillProfile(JsonObject root) {
+  TimingProfile p;
+  if (!timingProfileLoad(xtatControlPort(), xtatMode(), p)) { root["profile"] = nullptr; return; }
+  JsonObject o = root.createNestedObject("profile");
+  o["half_period_us"] = p.half_period_us;
+  o["inter_byte_us"] = p.inter_byte_us;
+  o["calibrated"] = p.calibrated;
+}
+
+static void fillKeymap(JsonObject o) {
+  o["gen"] = keymapExGeneration();
+  o["overrides"] = keymapExOverrideCount();
+  o["reverse"] = keymapExReverseCount();
+  o["layout"] = keymapExLayoutName();
+}
+
+static void pushDelta(uint8_t field, uint32_t gen) {
+  StaticJsonDocument<256> doc;
+  doc["type"] = "state";
+  doc["gen"] = gen;
+  switch (field) {
+    case STATE_WIFI:    fillWifi(doc.createNestedObject("wifi")); break;
+    case STATE_MODE:    fillMode(doc.createNestedObject("mode")); break;
+    case STATE_PROFILE: fillProfile(doc.as<JsonObject>()); break;
+    case STATE_KEYMAP:  fillKeymap(doc.createNestedObject("keymap")); break;
+  }
+  String out;
+  serializeJson(doc, out);
+  realtimeBroadcastScancode(out);
+}
+
+static void pollWifi() {
+  bool up = WiFi.status() == WL_CONNECTED;
+  uint32_t ip = up ? (uint32_t)WiFi.localIP() : 0;
+  if (up == lastConnected && ip == lastIP) return;
+  lastConnected = up;
+  lastIP = ip;
+  stateChanged(STATE_WIFI);
+}
+
+void stateTask() {
+  unsigned long now = millis();
+  if (now - lastPollMs >= STATE_POLL_MS) {
+    lastPollMs = now;
+    pollWifi();
+  }
+  if (now - lastPushMs < STATE_PUSH_MS) return;
+  if (!dirty.load(std::memory_order_relaxed)) return;
+  lastPushMs = now;
+  uint8_t fields = dirty.exchange(0, std::memory_order_relaxed);
+  if (!realtimeWants(RT_CLASS_EVENTS)) return;
+  uint32_t gen = stateGeneration();
+  for (uint8_t f = STATE_WIFI; f & STATE_ALL; f <<= 1) {
+    if (fields & f) pushDelta(f, gen);
+  }
+}
+
+static size_t stateJSON(char *out, size_t cap) {
+  MemJsonDocument<MEM_WEB> doc(640);   // off the AsyncTCP stack
+  doc["gen"] = stateGeneration();
+  doc["fw"] = firmware_version.length() ? firmware_version : String("unknown");
+  fillWifi(doc.createNestedObject("wifi"));
+  fillMode(doc.createNestedObject("mode"));
+  fillProfile(doc.as<JsonObject>());
+  fillKeymap(doc.createNestedObject("keymap"));
+  return serializeJson(doc, out, cap);
+}
+
+void stateInit(AsyncWebServer &server) {
+  server.on("/api/state", HTTP_GET, [](AsyncWebServerRequest *req){
+    char body[STATE_JSON_MAX];
+    size_t n = stateJSON(body, sizeof(body));
+    // Hashed rather than derived from gen, so unhooked changes still show.
+    char tag[12];
+    snprintf(tag, sizeof(tag), "\"%08lx\"", (unsigned long)crc32_le(0, (const uint8_t *)body, n));
+    if (req->hasHeader("If-None-Match") && req->header("If-None-Match").indexOf(tag) >= 0) {
+      AsyncWebServerResponse *resp = req->beginResponse(304);
+      resp->addHeader("ETag", tag);
+      resp->addHeader("Cache-Control", "no-cache");
+      req->send(resp);
+      return;
+    }
+    memNote(MEM_WEB, n);
+    AsyncWebServerResponse *resp = req->beginResponse(200, "application/json", String(body));
+    resp->addHeader("ETag", tag);
+    resp->addHeader("Cache-Control", "no-cache");
+    req->send(resp);
+  });
+  lastConnected = WiFi.status() == WL_CONNECTED;
+  lastIP = lastConnected ? (uint32_t)WiFi.localIP() : 0;
+  Serial.println("[STATE] /api/state ready");
+}
@@ -0,0 +1,34 @@
+#ifndef WEB_STATE_H
+#define WEB_STATE_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Everything the web UI shows on load, in one response: GET /api/state
+// returns firmware, Wi-Fi, mode and port, the control port's timing profile
+// and the keymap generation, with an ETag (If-None-Match answers 304).
+//
+// Changes are pushed as small JSON events on /ws/scancodes (RT_CLASS_EVENTS),
+// one per changed section and at most every STATE_PUSH_MS:
+//   {"type":"state","gen":N,"mode":{...}}   same shape as in /api/state
+// gen is the state generation after the change; a client that loaded a newer
+// /api/state ignores older events. The keymap section only carries its
+// generation and counts, so clients refetch /api/map* when it moves.
+
+enum StateField : uint8_t {
+  STATE_WIFI    = 0x01,
+  STATE_MODE    = 0x02,   // mode and active port
+  STATE_PROFILE = 0x04,   // timing profile of the control port
+  STATE_KEYMAP  = 0x08,   // legacy map or keymapEx overrides
+  STATE_ALL     = 0x0F
+};
+
+// Safe from any task; the push happens from stateTask().
+void stateChanged(uint8_t fields);
+uint32_t stateGeneration();
+
+void stateInit(AsyncWebServer &server);
+void stateTask();
+
+#endif
@@ -1,16 +1,14 @@
 #include <ESPAsyncWebServer.h>
-#include <SPIFFS.h>
 #include "webui.h"
+#include "web_assets.h"
+#include "storage.h"
 #include "config.h"
 #include "wifi_manager.h"
 
 AsyncWebServer server(80);
 
 void webuiStart() {
-    SPIFFS.begin(true);
-
-    server.serveStatic("/", SPIFFS, "/")
-        .setDefaultFile("index.html");
+    storageBegin();
 
     server.on("/status", HTTP_GET, [](AsyncWebServerRequest *req){
         String json = "{";
@@ -31,5 +29,8 @@ void webuiStart() {
         req->send(200, "text/plain", "OK");
     });
 
+    webAssetsInit(server);
+    server.on("/", HTTP_GET, [](AsyncWebServerRequest *req){ req->redirect("/index.html"); });
+
     server.begin();
 }
@@ -1,8 +1,10 @@
 #include "wifi_manager.h"
 #include "config.h"
+#include "profiler.h"
+#include "mem_stats.h"
 #include <WiFi.h>
 #include <DNSServer.h>
-#include <LittleFS.h>
+#include <ArduinoJson.h>
 
 static DNSServer dnsServer;
 static bool captiveEnabled = false;
@@ -12,6 +14,20 @@ static unsigned long connectBackoff = 5000;
 static const unsigned long MAX_BACKOFF = 5 * 60 * 1000UL;
 static AsyncWebServer *gServer = nullptr;
 
+// Background scan. WiFi.scanNetworks(true) is started and polled from
+// wifiHandlePeriodic(); HTTP handlers only read the cached, already
+// serialised result and raise scanWanted when it is stale.
+static const unsigned long SCAN_STALE_MS        = 30000;
+static const unsigned long SCAN_MIN_INTERVAL_MS = 10000;
+static const unsigned long SCAN_TIMEOUT_MS      = 15000;
+static SemaphoreHandle_t scanLock = nullptr;
+static String scanJson = "[]";
+static String scanHtml;
+static unsigned long scanAt = 0;          // millis() of the cached result, 0 = none yet
+static unsigned long scanStartedAt = 0;
+static volatile bool scanRunning = false;
+static volatile bool scanWanted = false;
+
 static String qrForAP() {
   String url = "http://";
   url += wifiIP();
@@ -31,6 +47,85 @@ static void stopCaptiveDNS() {
   Serial.println("[WIFI] Captive DNS stopped");
 }
 
+static String htmlEscape(const String &in) {
+  String out;
+  out.reserve(in.length());
+  for (size_t i = 0; i < in.length(); i++) {
+    char c = in[i];
+    if (c == '<') out += "&lt;";
+    else if (c == '>') out += "&gt;";
+    else if (c == '&') out += "&amp;";
+    else if (c == '\'') out += "&#39;";
+    else out += c;
+  }
+  return out;
+}
+
+// Copies the cached result out under the lock and asks for a refresh if it
+// is stale. Returns false if no scan has completed yet.
+static bool scanCached(String *json, String *html, unsigned long *age) {
+  unsigned long now = millis();
+  bool have = false;
+  if (scanLock) xSemaphoreTake(scanLock, portMAX_DELAY);
+  have = scanAt != 0;
+  if (json) *json = scanJson;
+  if (html) *html = scanHtml;
+  if (age) *age = have ? now - scanAt : 0;
+  if (!have || now - scanAt > SCAN_STALE_MS) scanWanted = true;
+  if (scanLock) xSemaphoreGive(scanLock);
+  return have;
+}
+
+static void scanStore(int n) {
+  MemJsonDocument<MEM_WEB> doc(JSON_ARRAY_SIZE(n) + n * (JSON_OBJECT_SIZE(4) + 40));
+  JsonArray arr = doc.to<JsonArray>();
+  String html;
+  for (int i = 0; i < n; ++i) {
+    JsonObject o = arr.createNestedObject();
+    o["ssid"] = WiFi.SSID(i);
+    o["rssi"] = WiFi.RSSI(i);
+    o["channel"] = WiFi.channel(i);
+    o["auth"] = (int)WiFi.encryptionType(i);
+    html += "<li>" + htmlEscape(WiFi.SSID(i)) + " (" + String(WiFi.RSSI(i)) + " dBm) - ";
+    html += (WiFi.encryptionType(i) == WIFI_AUTH_OPEN ? "OPEN" : "SEC") + String("</li>");
+  }
+  String json;
+  serializeJson(doc, json);
+  WiFi.scanDelete();
+  xSemaphoreTake(scanLock, portMAX_DELAY);
+  scanJson = json;
+  scanHtml = html;
+  scanAt = millis();
+  if (scanAt == 0) scanAt = 1;
+  xSemaphoreGive(scanLock);
+}
+
+static void scanPoll() {
+  unsigned long now = millis();
+  if (scanRunning) {
+    int16_t r = WiFi.scanComplete();
+    if (r >= 0) {
+      scanStore(r);
+      scanRunning = false;
+      Serial.printf("[WIFI] Scan done: %d networks in %lums\n", r, now - scanStartedAt);
+    } else if (r == WIFI_SCAN_FAILED || now - scanStartedAt > SCAN_TIMEOUT_MS) {
+      WiFi.scanDelete();
+      scanRunning = false;
+      Serial.println("[WIFI] Scan failed");
+    }
+    return;
+  }
+  if (!scanWanted) return;
+  if (scanStartedAt && now - scanStartedAt < SCAN_MIN_INTERVAL_MS) return;
+  scanWanted = false;
+  if (WiFi.scanNetworks(true) == WIFI_SCAN_FAILED) {
+    Serial.println("[WIFI] Scan start failed");
+  } else {
+    scanRunning = true;
+  }
+  scanStartedAt = now ? now : 1;
+}
+
 static void registerCaptiveEndpoints(AsyncWebServer *server) {
   if (!server) return;
   server->on("/", HTTP_GET, [](AsyncWebServerRequest *req){
@@ -58,16 +153,33 @@ static void registerCaptiveEndpoints(AsyncWebServer *server) {
   });
 
   server->on("/scan", HTTP_GET, [](AsyncWebServerRequest *req){
-    int n = WiFi.scanNetworks();
-    String s = "<!doctype html><html><body><h3>Networks</h3><ul>";
-    for (int i = 0; i < n; ++i) {
-      s += "<li>" + String(WiFi.SSID(i)) + " (" + String(WiFi.RSSI(i)) + " dBm) - ";
-      s += (WiFi.encryptionType(i) == WIFI_AUTH_OPEN ? "OPEN" : "SEC") + String("</li>");
-    }
-    s += "</ul></body></html>";
+    PROF_STAGE("http:/scan");
+    String list;
+    unsigned long age;
+    bool have = scanCached(nullptr, &list, &age);
+    String s = "<!doctype html><html><head>";
+    if (!have || scanRunning) s += "<meta http-equiv='refresh' content='3'>";
+    s += "</head><body><h3>Networks</h3>";
+    if (!have) s += "<p>Scanning...</p>";
+    else s += "<ul>" + list + "</ul><p>Updated " + String(age / 1000) + " s ago" + (scanRunning ? ", rescanning..." : "") + "</p>";
+    s += "</body></html>";
     req->send(200, "text/html", s);
   });
 
+  server->on("/api/wifi_scan", HTTP_GET, [](AsyncWebServerRequest *req){
+    PROF_STAGE("http:/api/wifi_scan");
+    if (req->hasParam("refresh")) scanWanted = true;
+    String list;
+    unsigned long age;
+    bool have = scanCached(&list, nullptr, &age);
+    String j = "{\"scanning\":";
+    j += (scanRunning || scanWanted) ? "true" : "false";
+    j += ",\"age_ms\":";
+    j += have ? String(age) : String("null");
+    j += ",\"networks\":" + list + "}";
+    req->send(200, "application/json", j);
+  });
+
   server->on("/wifi_info", HTTP_GET, [](AsyncWebServerRequest *req){
     String j = "{";
     j += ""ap_ip":"" + wifiIP() + "",";
@@ -105,18 +217,10 @@ String wifiIP() {
   return apIP.toString();
 }
 
+// Cached result as a JSON array; never blocks on the radio.
 String scanNetworksJSON() {
-  int n = WiFi.scanNetworks();
-  String j = "[";
-  for (int i = 0; i < n; ++i) {
-    j += "{";
-    j += ""ssid":"" + WiFi.SSID(i) + "",";
-    j += ""rssi":" + String(WiFi.RSSI(i)) + ",";
-    j += ""auth":"" + String(WiFi.encryptionType(i)) + """;
-    j += "}";
-    if (i < n-1) j += ",";
-  }
-  j += "]";
+  String j;
+  if (!scanCached(&j, nullptr, nullptr)) return "[]";
   return j;
 }
 
@@ -131,10 +235,11 @@ void captiveRedirect(AsyncWebServerRequest *request) {
 
 void wifiHandlePeriodic() {
   if (captiveEnabled) dnsServer.processNextRequest();
+  scanPoll();
   if (config.sta_ssid.length() > 0) {
     if (WiFi.status() != WL_CONNECTED) {
       unsigned long now = millis();
-      if (now - lastConnectAttempt > connectBackoff) {
+      if (!scanRunning && now - lastConnectAttempt > connectBackoff) {
         Serial.println("[WIFI] Attempting STA reconnect...");
         WiFi.begin(config.sta_ssid.c_str(), config.sta_pass.c_str());
         lastConnectAttempt = now;
@@ -150,9 +255,7 @@ void wifiHandlePeriodic() {
 
 void wifiStart(AsyncWebServer* server) {
   gServer = server;
-  if (!LittleFS.begin(true)) {
-    Serial.println("[WIFI] LittleFS mount failed (continuing)");
-  }
+  if (!scanLock) scanLock = xSemaphoreCreateMutex();
   startAP();
   if (config.sta_ssid.length() > 0) {
     Serial.printf("[WIFI] Saved STA found, attempting connect to '%s'\n", config.sta_ssid.c_str());
@@ -2,215 +2,867 @@
 #include "keymap.h"
 #include "config.h"
 #include "realtime_ws.h"
+#include "typematic.h"
+#include "timing_profile.h"
+#include "metrics.h"
+#include "xtat_engine.h"
+#include "logger.h"
+#include "flightrec.h"
+#include "keymap_ex.h"
+#include "web_state.h"
 #include <Arduino.h>
+#include <Preferences.h>
 
 bool xtat_debug_enabled     = false;
 bool xtat_timestamp_enabled = false;
 bool xtat_bitdump_enabled   = false;
 bool xtat_hostecho_enabled  = false;
 
-static uint8_t XT_CLK_PIN = 10;
-static uint8_t XT_DATA_PIN = 11;
-static unsigned int BIT_DELAY_US = 30;
+static unsigned int BIT_DELAY_DEFAULT_US = 30;
 
 #define XT_QUEUE_LEN 32
-struct XT_Queued { uint8_t code; bool isBreak; };
-static XT_Queued xtQueue[XT_QUEUE_LEN];
-static volatile int q_head = 0, q_tail = 0;
-
-static bool q_push(uint8_t code, bool isBreak) {
-  int next = (q_tail + 1) % XT_QUEUE_LEN;
-  if (next == q_head) return false;
-  xtQueue[q_tail].code = code;
-  xtQueue[q_tail].isBreak = isBreak;
-  q_tail = next;
+#define HOST_ECHO_LEN 64
+#define TYPEMATIC_ARG_NONE 0xFF
+
+struct XT_Queued { uint8_t code; bool isBreak; uint32_t t_in; };
+
+// One attached host. Everything the wire protocol needs lives here; the USB
+// side (held keys, modifiers, typematic) is shared, since there is one
+// keyboard.
+struct XtatPort {
+  XtatWire wire;
+  uint8_t mode;
+  // Active transmit instantiation, see xtat_engine.h. engineKey packs
+  // (mode << 4 | trace) so xtatTask can cheaply notice when it is stale.
+  XtatEngine engine;
+  uint8_t engineKey;
+  XT_Queued queue[XT_QUEUE_LEN];
+  volatile int q_head, q_tail;
+  uint8_t lastSentByte;
+  uint8_t hostPendingCmd;
+  uint8_t typematicArg;          // last 0xF3 argument from this host
+  volatile uint8_t hostEchoBuf[HOST_ECHO_LEN];
+  volatile int hostEchoHead, hostEchoTail;
+};
+
+static XtatPort ports[XTAT_MAX_PORTS];
+static uint8_t portCount = 0;
+static uint8_t activePort = 0;     // index or XTAT_PORT_ALL
+static int8_t listenPort = -1;     // port released for detection, see xtatListen
+// Port and mode changes asked for by the web server (AsyncTCP task). Both
+// move held keys, queues and timing the loop works on, so xtatTask applies
+// them. -1 = nothing pending.
+static portMUX_TYPE pendMux = portMUX_INITIALIZER_UNLOCKED;
+static int16_t pendingPort = -1;
+static int8_t pendingModePort = -1;
+static uint8_t pendingMode = 0;
+
+// Keys typed through the web UI, pressed and released by xtatTask so the
+// USB-side state (held keys, modifiers) stays with the loop.
+#define TYPED_LEN 16
+struct TypedKey { uint8_t hid, mods; };
+static TypedKey typed[TYPED_LEN];
+static uint8_t typedHead = 0, typedTail = 0;
+static Preferences prefs;
+
+uint32_t SimBus::edges[XTAT_SIM_EDGES];
+uint16_t SimBus::edgeCount = 0;
+uint8_t SimBus::dataLevel = 1;
+
+// Single-port calls address the control port: the active one, or port 0
+// while broadcasting.
+static inline XtatPort &ctl() {
+  return ports[activePort == XTAT_PORT_ALL ? 0 : activePort];
+}
+
+static inline bool isTarget(uint8_t i) {
+  return activePort == XTAT_PORT_ALL || activePort == i;
+}
+
+static bool q_push(XtatPort &p, uint8_t code, bool isBreak, uint32_t t_in) {
+  int next = (p.q_tail + 1) % XT_QUEUE_LEN;
+  if (next == p.q_head) return false;
+  p.queue[p.q_tail].code = code;
+  p.queue[p.q_tail].isBreak = isBreak;
+  p.queue[p.q_tail].t_in = t_in;
+  p.q_tail = next;
+  metricsQueueDepth((uint32_t)((next - p.q_head + XT_QUEUE_LEN) % XT_QUEUE_LEN));
   return true;
 }
-static bool q_pop(XT_Queued &out) {
-  if (q_head == q_tail) return false;
-  out = xtQueue[q_head];
-  q_head = (q_head + 1) % XT_QUEUE_LEN;
+static bool q_pop(XtatPort &p, XT_Queued &out) {
+  if (p.q_head == p.q_tail) return false;
+  out = p.queue[p.q_head];
+  p.q_head = (p.q_head + 1) % XT_QUEUE_LEN;
   return true;
 }
 
-#define HOST_ECHO_LEN 64
-static volatile uint8_t hostEchoBuf[HOST_ECHO_LEN];
-static volatile int hostEchoHead = 0, hostEchoTail = 0;
-
-static void hostEchoPush(uint8_t b) {
-  int next = (hostEchoTail + 1) % HOST_ECHO_LEN;
-  if (next == hostEchoHead) {
-    hostEchoHead = (hostEchoHead + 1) % HOST_ECHO_LEN;
+static void hostEchoPush(XtatPort &p, uint8_t b) {
+  int next = (p.hostEchoTail + 1) % HOST_ECHO_LEN;
+  if (next == p.hostEchoHead) {
+    p.hostEchoHead = (p.hostEchoHead + 1) % HOST_ECHO_LEN;
   }
-  hostEchoBuf[hostEchoTail] = b;
-  hostEchoTail = next;
+  p.hostEchoBuf[p.hostEchoTail] = b;
+  p.hostEchoTail = next;
 }
 size_t xtatPopHostEcho(uint8_t *buf, size_t max) {
+  XtatPort &p = ctl();
   size_t cnt = 0;
-  while (hostEchoHead != hostEchoTail && cnt < max) {
-    buf[cnt++] = hostEchoBuf[hostEchoHead];
-    hostEchoHead = (hostEchoHead + 1) % HOST_ECHO_LEN;
+  while (p.hostEchoHead != p.hostEchoTail && cnt < max) {
+    buf[cnt++] = p.hostEchoBuf[p.hostEchoHead];
+    p.hostEchoHead = (p.hostEchoHead + 1) % HOST_ECHO_LEN;
   }
   return cnt;
 }
 
-static inline void data_drive_low() {
-  pinMode(XT_DATA_PIN, OUTPUT);
-  digitalWrite(XT_DATA_PIN, LOW);
+static inline void lines_idle_high(XtatWire &wire) {
+  xtatWirePinMode(wire);
+  GpioBus::data(wire, true);
+  GpioBus::clk(wire, true);
 }
-static inline void data_release_drive_high() {
-  pinMode(XT_DATA_PIN, OUTPUT);
-  digitalWrite(XT_DATA_PIN, HIGH);
+
+// ---- Trace hooks called from the XTAT_TRACE_EVENTS/BITS instantiations ----
+
+// LSB-first bit strings per nibble, so a bit dump is two %s arguments.
+static const char *const NIBBLE_BITS[16] = {
+  "0000", "1000", "0100", "1100", "0010", "1010", "0110", "1110",
+  "0001", "1001", "0101", "1101", "0011", "1011", "0111", "1111",
+};
+
+void xtatTraceByte(uint8_t b) {
+  if (!xtat_bitdump_enabled || !logEnabled(LOG_MOD_XTAT, LOG_DEBUG)) return;
+  logEvent(LOG_MOD_XTAT, LOG_DEBUG, "BITDUMP: %s%s", LOG_STR(NIBBLE_BITS[b & 0x0F]), LOG_STR(NIBBLE_BITS[b >> 4]));
 }
-static inline void data_release_input() {
-  pinMode(XT_DATA_PIN, INPUT_PULLUP);
+
+static_assert(XTAT_BIT_PRE == RT_BIT_PRE && XTAT_BIT_LOW == RT_BIT_LOW && XTAT_BIT_HIGH == RT_BIT_HIGH,
+              "xtat_tx.h bit phases follow realtime_ws.h");
+
+void xtatTraceBit(uint8_t phase, uint8_t clk, uint8_t data) {
+  realtimePublishBit(phase, clk, data);
 }
-static inline void clk_pulse_and_broadcast() {
-  int dataState = digitalRead(XT_DATA_PIN);
-  unsigned long ts = (unsigned long)micros();
-  {
-    char buf[128];
-    snprintf(buf, sizeof(buf), "{"type":"bit","phase":"pre","ts":%lu,"clk":1,"data":%d}", ts, dataState);
-    realtimeBroadcastScancode(String(buf));
-  }
-  digitalWrite(XT_CLK_PIN, LOW);
-  delayMicroseconds(BIT_DELAY_US);
-  dataState = digitalRead(XT_DATA_PIN);
-  ts = (unsigned long)micros();
-  {
-    char buf[128];
-    snprintf(buf, sizeof(buf), "{"type":"bit","phase":"low","ts":%lu,"clk":0,"data":%d}", ts, dataState);
-    realtimeBroadcastScancode(String(buf));
-  }
-  digitalWrite(XT_CLK_PIN, HIGH);
-  delayMicroseconds(BIT_DELAY_US);
-  dataState = digitalRead(XT_DATA_PIN);
-  ts = (unsigned long)micros();
-  {
-    char buf[128];
-    snprintf(buf, sizeof(buf), "{"type":"bit","phase":"high","ts":%lu,"clk":1,"data":%d}", ts, dataState);
-    realtimeBroadcastScancode(String(buf));
-  }
-}
-
-static void bitdump_byte_serial(uint8_t b) {
-  if (!xtat_bitdump_enabled) return;
-  Serial.print("BITDUMP: ");
-  for (int i=0;i<8;i++){ Serial.print((b & 1) ? '1':'0'); b >>= 1; }
-  Serial.println();
-}
-
-static void debug_json_serial(const char *type, uint8_t sc) {
-  if (!xtat_debug_enabled) return;
-  const char *proto = config.kb_mode == MODE_AT ? "AT" : (config.kb_mode==MODE_PS2?"PS2":"XT");
-  if (xtat_timestamp_enabled) Serial.printf("{"ts":%lu,"type":"%s","code":"%02X","proto":"%s"}\n", (unsigned long)micros(), type, sc, proto);
-  else Serial.printf("{"type":"%s","code":"%02X","proto":"%s"}\n", type, sc, proto);
-}
-
-static void ws_send_json(const char *type, uint8_t sc) {
-  char buf[128];
-  const char *proto = config.kb_mode == MODE_AT ? "AT" : (config.kb_mode==MODE_PS2?"PS2":"XT");
-  if (xtat_timestamp_enabled) snprintf(buf,sizeof(buf), "{"ts":%lu,"type":"%s","code":"%02X","proto":"%s"}", (unsigned long)micros(), type, sc, proto);
-  else snprintf(buf,sizeof(buf), "{"type":"%s","code":"%02X","proto":"%s"}", type, sc, proto);
-  realtimeBroadcastScancode(String(buf));
-}
-
-static void send_byte_raw(uint8_t b) {
-  bitdump_byte_serial(b);
-  data_drive_low();
-  delayMicroseconds(BIT_DELAY_US);
-  for (int i=0;i<8;i++) {
-    if (b & 0x01) data_release_drive_high(); else data_drive_low();
-    clk_pulse_and_broadcast();
-    b >>= 1;
+
+void xtatTraceEvent(uint8_t kind, uint8_t sc, uint8_t proto, const char *protoName) {
+  static const char *const types[] = { "make", "break", "byte" };
+  const char *type = types[kind];
+  if (xtat_debug_enabled && logEnabled(LOG_MOD_XTAT, LOG_DEBUG)) {
+    if (xtat_timestamp_enabled)
+      logEvent(LOG_MOD_XTAT, LOG_DEBUG, "{\"ts\":%lu,\"type\":\"%s\",\"code\":\"%02X\",\"proto\":\"%s\"}",
+               (uint32_t)micros(), LOG_STR(type), sc, LOG_STR(protoName));
+    else
+      logEvent(LOG_MOD_XTAT, LOG_DEBUG, "{\"type\":\"%s\",\"code\":\"%02X\",\"proto\":\"%s\"}",
+               LOG_STR(type), sc, LOG_STR(protoName));
   }
-  data_release_drive_high();
-  clk_pulse_and_broadcast();
+  if (kind != XTAT_EV_BYTE && realtimeWants(RT_CLASS_KEYS)) realtimePublishKey(kind == XTAT_EV_BREAK, sc, proto);
+}
+
+// ---- Engine selection ----
+
+static uint8_t wantedTrace() {
+  if (xtat_bitdump_enabled || realtimeWants(RT_CLASS_BITS)) return XTAT_TRACE_BITS;
+  if (xtat_debug_enabled || realtimeWants(RT_CLASS_KEYS)) return XTAT_TRACE_EVENTS;
+  return XTAT_TRACE_OFF;
+}
+
+static inline uint8_t protoIndex(uint8_t mode) {
+  return (mode >= MODE_XT && mode <= MODE_PS2) ? mode - MODE_XT : 0;
 }
 
-static bool try_read_host_byte(uint8_t &out) {
-  if (!xtat_hostecho_enabled) return false;
-  pinMode(XT_CLK_PIN, INPUT_PULLUP);
-  pinMode(XT_DATA_PIN, INPUT_PULLUP);
-  unsigned long start = micros();
-  while (digitalRead(XT_CLK_PIN) == HIGH) {
-    if (micros() - start > 2000u) return false;
+// Port 0 follows config.kb_mode, so code that sets it directly is picked
+// up here too. Only the loop task calls this: xtatTask
+// sends through p.engine, and the three pointers must not change under it.
+static void xtatSelectEngine() {
+  if (portCount) ports[0].mode = config.kb_mode;
+  uint8_t trace = wantedTrace();
+  for (uint8_t i = 0; i < portCount; i++) {
+    XtatPort &p = ports[i];
+    uint8_t key = (uint8_t)((p.mode << 4) | trace);
+    if (key == p.engineKey) continue;
+    p.engineKey = key;
+    p.engine = XtatEngineTable<GpioBus>::table[protoIndex(p.mode)][trace];
   }
-  uint8_t val = 0;
-  for (int i=0;i<8;i++) {
-    while (digitalRead(XT_CLK_PIN) == LOW) {
-      if (micros() - start > 5000u) return false;
-    }
-    int d = digitalRead(XT_DATA_PIN);
-    val |= (d ? 1 : 0) << i;
-    while (digitalRead(XT_CLK_PIN) == HIGH) {
-      if (micros() - start > 5000u) return false;
+}
+
+// ---- Flash hold ----
+
+static portMUX_TYPE holdMux = portMUX_INITIALIZER_UNLOCKED;
+static bool flashHeld = false;
+static uint8_t sending = 0;
+
+// Brackets every transmission: waits out a flash operation (which would
+// pause this core in the middle of a bit) and keeps new ones from starting.
+struct TxGuard {
+  TxGuard() {
+    for (;;) {
+      portENTER_CRITICAL(&holdMux);
+      bool ok = !flashHeld;
+      if (ok) sending++;
+      portEXIT_CRITICAL(&holdMux);
+      if (ok) return;
+      delay(1);
     }
   }
-  out = val;
-  hostEchoPush(val);
-  pinMode(XT_DATA_PIN, OUTPUT); digitalWrite(XT_DATA_PIN, HIGH);
-  pinMode(XT_CLK_PIN, OUTPUT); digitalWrite(XT_CLK_PIN, HIGH);
+  ~TxGuard() {
+    portENTER_CRITICAL(&holdMux);
+    sending--;
+    portEXIT_CRITICAL(&holdMux);
+  }
+};
+
+bool xtatFlashHold() {
+  bool queued = false;
+  for (uint8_t i = 0; i < portCount; i++) queued |= ports[i].q_head != ports[i].q_tail;
+  portENTER_CRITICAL(&holdMux);
+  bool ok = !flashHeld && !sending && !queued;
+  if (ok) flashHeld = true;
+  portEXIT_CRITICAL(&holdMux);
+  return ok;
+}
+
+void xtatFlashRelease() {
+  portENTER_CRITICAL(&holdMux);
+  flashHeld = false;
+  portEXIT_CRITICAL(&holdMux);
+}
+
+static void send_byte_raw(XtatPort &p, uint8_t b) {
+  TxGuard g;
+  p.lastSentByte = b;
+  metricsInc(M_BYTES_SENT);
+  p.engine.sendByte(p.wire, b);
+}
+
+static void send_make(XtatPort &p, uint8_t scancode) {
+  TxGuard g;
+  p.lastSentByte = scancode;
+  metricsInc(M_BYTES_SENT);
+  p.engine.make(p.wire, scancode);
+}
+
+static void send_break(XtatPort &p, uint8_t scancode) {
+  TxGuard g;
+  p.lastSentByte = scancode;
+  metricsInc(M_BYTES_SENT);
+  if (p.mode == MODE_AT) metricsInc(M_BYTES_SENT);
+  p.engine.brk(p.wire, scancode);
+}
+
+// ---- Host -> device ----
+
+// The keyboard generates the clock for host bytes too; 12.5 kHz, as
+// ps2_mouse.cpp uses, whatever the port's transmit timing is.
+#define RX_HALF_US    40
+#define RX_QUARTER_US 20
+#define RX_GAP_US     60
+
+// Request-to-send: the host released clock but keeps data low. XT hosts
+// never send anything.
+static inline bool hostRequest(XtatPort &p) {
+  return p.mode != MODE_XT && GpioBus::readClk(p.wire) && !GpioBus::readData(p.wire);
+}
+
+// Host -> device, after its request-to-send: clocks in 8 data bits, parity
+// and stop, sampling while clock is high, then acknowledges by holding data
+// low for one more clock. Same framing as ps2_mouse.cpp receiveByte.
+static bool receive_host_byte(XtatPort &p, uint8_t &out) {
+  TxGuard g;
+  XtatWire &w = p.wire;
+  uint16_t bits = 0;
+  for (int i = 0; i < 10; i++) {
+    GpioBus::wait(RX_QUARTER_US);
+    GpioBus::clk(w, false);
+    GpioBus::wait(RX_HALF_US);
+    GpioBus::clk(w, true);
+    GpioBus::wait(RX_QUARTER_US);
+    if (!GpioBus::readClk(w)) { metricsInc(M_HOST_RX_ERRORS); return false; }   // host gave up
+    if (GpioBus::readData(w)) bits |= 1u << i;
+  }
+  GpioBus::data(w, false);
+  GpioBus::wait(RX_QUARTER_US);
+  GpioBus::clk(w, false);
+  GpioBus::wait(RX_HALF_US);
+  GpioBus::clk(w, true);
+  GpioBus::data(w, true);
+  GpioBus::wait(RX_GAP_US);
+  out = bits & 0xFF;
+  if (((bits >> 8) & 1) != xtatOddParity(out) || !(bits & (1u << 9))) {
+    metricsInc(M_HOST_RX_ERRORS);
+    return false;
+  }
+  metricsInc(M_HOST_BYTES);
+  if (xtat_hostecho_enabled) hostEchoPush(p, out);
   return true;
 }
 
-void xt_send_make(uint8_t scancode) {
-  debug_json_serial("make", scancode);
-  ws_send_json("make", scancode);
-  send_byte_raw(scancode);
+void xt_send_make(uint8_t scancode) { send_make(ctl(), scancode); }
+void xt_send_break_code(uint8_t scancode) { send_break(ctl(), scancode); }
+
+static inline uint8_t translate_hid(uint8_t hidcode) {
+  return config.keymap[hidcode] ? config.keymap[hidcode] : default_usb_to_xt[hidcode];
 }
 
-void xt_send_break_code(uint8_t scancode) {
-  if (config.kb_mode == MODE_AT) {
-    debug_json_serial("break", 0xF0);
-    ws_send_json("break", 0xF0);
-    send_byte_raw(0xF0);
-    delayMicroseconds(BIT_DELAY_US);
-    debug_json_serial("break", scancode);
-    ws_send_json("break", scancode);
-    send_byte_raw(scancode);
-  } else {
-    debug_json_serial("break", scancode);
-    ws_send_json("break", scancode);
-    send_byte_raw(scancode);
+// Held HID modifiers select the keymapEx column on press; the code that was
+// made is remembered so the break matches even if modifiers changed since.
+static uint8_t hidMods = 0;
+static uint8_t madeCode[256];
+// Keys held across a port switch: their breaks already went to the old
+// port, so the release is swallowed instead of reaching the new one.
+static uint8_t dropBreak[32];
+
+static void transmit(XtatPort &p, uint8_t code, bool isBreak, uint32_t t_in) {
+  uint32_t t0 = (uint32_t)micros();
+  if (!isBreak) send_make(p, code);
+  else send_break(p, code);
+  uint32_t t1 = (uint32_t)micros();
+  metricsInc(M_TRANSMITTED);
+  metricsObserveUs(H_TX_DURATION, t1 - t0);
+  metricsObserveUs(H_INGRESS_TO_WIRE, t1 - t_in);
+}
+
+// Queues a code on every target port; a full queue sends it right away on
+// that port only, unless detection is listening there (the code is lost).
+static void enqueue(uint8_t code, bool isBreak, uint32_t t_in, uint8_t hidcode) {
+  for (uint8_t i = 0; i < portCount; i++) {
+    if (!isTarget(i)) continue;
+    if (q_push(ports[i], code, isBreak, t_in)) {
+      metricsInc(M_QUEUED);
+    } else {
+      metricsInc(M_QUEUE_OVERFLOW);
+      flightrecLog(FR_QUEUE_OVERFLOW, code, hidcode);
+      if (i != listenPort) transmit(ports[i], code, isBreak, t_in);
+    }
+  }
+}
+
+static void applyHostTypematic() {
+  uint8_t arg = ctl().typematicArg;
+  if (arg == TYPEMATIC_ARG_NONE) typematicRestoreDefaults();
+  else typematicSetHostRate(arg);
+}
+
+static void switchPort(uint8_t port) {
+  // Release everything held on the old target(s) before moving on.
+  uint32_t now = (uint32_t)micros();
+  for (int h = 0; h < 256; h++) {
+    if (!madeCode[h]) continue;
+    enqueue(madeCode[h], true, now, (uint8_t)h);
+    madeCode[h] = 0;
+    dropBreak[h >> 3] |= 1 << (h & 7);
   }
+  typematicReleaseAll();
+  activePort = port;
+  applyHostTypematic();
+  prefs.begin("xtports", false);
+  prefs.putUChar("active", activePort);
+  prefs.end();
+  if (port == XTAT_PORT_ALL) Serial.println("[XT_AT] Output: all ports");
+  else Serial.printf("[XT_AT] Output: port %u\n", port);
+  stateChanged(STATE_MODE | STATE_PROFILE);
+}
+
+// Right Ctrl + F1..F4 picks a port, Right Ctrl + F12 broadcasts.
+static bool hotkey(uint8_t hidcode) {
+  if (!(hidMods & XTAT_HOTKEY_MOD)) return false;
+  if (hidcode == 0x45) { switchPort(XTAT_PORT_ALL); return true; }
+  if (hidcode < 0x3A || hidcode >= 0x3A + portCount) return false;
+  switchPort(hidcode - 0x3A);
+  return true;
 }
 
 void xtatSendFromUSB(uint8_t hidcode, bool pressed) {
-  uint8_t xtcode = config.keymap[hidcode] ? config.keymap[hidcode] : default_usb_to_xt[hidcode];
+  uint32_t t_in = (uint32_t)micros();
+  metricsInc(M_INGESTED);
+  uint8_t dropMask = 1 << (hidcode & 7);
+  if (!pressed && (dropBreak[hidcode >> 3] & dropMask)) {
+    dropBreak[hidcode >> 3] &= ~dropMask;
+    if (hidcode >= 0xE0) hidMods &= ~(1 << (hidcode - 0xE0));
+    return;
+  }
+  if (pressed && portCount > 1 && hotkey(hidcode)) {
+    dropBreak[hidcode >> 3] |= dropMask;
+    return;
+  }
+  uint8_t xtcode;
+  if (pressed) {
+    xtcode = keymapExTranslate(hidcode, hidMods);
+    madeCode[hidcode] = xtcode;
+  } else {
+    xtcode = madeCode[hidcode] ? madeCode[hidcode] : translate_hid(hidcode);
+    madeCode[hidcode] = 0;
+  }
+  if (hidcode >= 0xE0) {
+    uint8_t bit = 1 << (hidcode - 0xE0);
+    hidMods = pressed ? (hidMods | bit) : (hidMods & ~bit);
+  }
   if (!xtcode) return;
-  if (!q_push(xtcode, !pressed)) {
-    if (pressed) xt_send_make(xtcode);
-    else xt_send_break_code(xtcode);
+  metricsInc(M_TRANSLATED);
+  if (pressed) typematicPress(hidcode);
+  else typematicRelease(hidcode);
+  flightrecLog(pressed ? FR_MAKE : FR_BREAK, xtcode, hidcode);
+  enqueue(xtcode, !pressed, t_in, hidcode);
+}
+
+// Typematic repeat: another make of the same code, queued like a fresh press.
+static void typematic_fire(uint8_t hidcode) {
+  uint8_t xtcode = madeCode[hidcode];
+  if (!xtcode) return;
+  uint32_t now = (uint32_t)micros();
+  for (uint8_t i = 0; i < portCount; i++) {
+    if (isTarget(i) && q_push(ports[i], xtcode, false, now)) metricsInc(M_QUEUED);
+  }
+}
+
+// Host -> device commands that carry an argument byte. AT/PS2 hosts expect an
+// ACK (0xFA) for the command and for its argument; XT hosts never send any.
+// Typematic rate is per host, but there is one keyboard: the control port's
+// setting is the one in effect.
+static void handle_host_byte(XtatPort &p, uint8_t b) {
+  if (p.mode == MODE_XT) return;
+  if (logEnabled(LOG_MOD_HOST, LOG_DEBUG)) logEvent(LOG_MOD_HOST, LOG_DEBUG, "[HOST] 0x%02X (pending 0x%02X)", b, p.hostPendingCmd);
+  if (p.hostPendingCmd == 0 && b == 0xFE) {   // resend: repeat, never ACK
+    metricsInc(M_HOST_RESENDS);
+    flightrecLog(FR_RESEND, p.lastSentByte);
+    send_byte_raw(p, p.lastSentByte);
+    return;
+  }
+  if (p.hostPendingCmd == 0 && b == 0xEE) {   // echo: answered with 0xEE, no ACK
+    send_byte_raw(p, 0xEE);
+    return;
+  }
+  flightrecLog(FR_HOST_CMD, b, p.hostPendingCmd);
+  bool reset = false;
+  if (p.hostPendingCmd == 0xF3) {
+    p.typematicArg = b;
+    if (&p == &ctl()) typematicSetHostRate(b);
+    p.hostPendingCmd = 0;
+  } else if (p.hostPendingCmd == 0xED) {
+    p.hostPendingCmd = 0;           // LED state, nothing to drive
+  } else if (b == 0xF3 || b == 0xED) {
+    p.hostPendingCmd = b;
+  } else if (b == 0xF6 || b == 0xFF) {
+    p.typematicArg = TYPEMATIC_ARG_NONE;
+    if (&p == &ctl()) typematicRestoreDefaults();
+    reset = (b == 0xFF);
+  }
+  send_byte_raw(p, 0xFA);
+  if (reset) {
+    flightrecLog(FR_HOST_RESET);
+    delayMicroseconds(p.wire.interByteUs);
+    send_byte_raw(p, 0xAA);         // BAT passed
+  }
+}
+
+// Takes a byte the host asked to send, if any, and answers it; a garbled
+// one is answered with 0xFE so the host sends it again. Never waits for
+// the host: without a request-to-send on the lines this is two reads.
+static bool serviceHost(XtatPort &p) {
+  if (!hostRequest(p)) return false;
+  uint8_t b;
+  if (!receive_host_byte(p, b)) {
+    send_byte_raw(p, 0xFE);
+    return true;
+  }
+  handle_host_byte(p, b);
+  realtimePublishHost(b);
+  return true;
+}
+
+void xtatSetTiming(unsigned int halfPeriodUs, unsigned int interByteUs) {
+  XtatWire &wire = ctl().wire;
+  wire.bitDelayUs = halfPeriodUs ? halfPeriodUs : BIT_DELAY_DEFAULT_US;
+  wire.interByteUs = interByteUs;
+}
+
+unsigned int xtatBitDelayUs() { return ctl().wire.bitDelayUs; }
+unsigned int xtatInterByteUs() { return ctl().wire.interByteUs; }
+unsigned int xtatDefaultBitDelayUs() { return BIT_DELAY_DEFAULT_US; }
+
+// The port's saved profile for its protocol, or the default speed.
+static void loadTiming(uint8_t i) {
+  XtatPort &p = ports[i];
+  TimingProfile tp;
+  if (timingProfileLoad(i, p.mode, tp)) {
+    p.wire.bitDelayUs = tp.half_period_us ? tp.half_period_us : BIT_DELAY_DEFAULT_US;
+    p.wire.interByteUs = tp.inter_byte_us;
+  } else {
+    p.wire.bitDelayUs = p.wire.interByteUs = BIT_DELAY_DEFAULT_US;
+  }
+}
+
+void xtatReloadTiming() {
+  for (uint8_t i = 0; i < portCount; i++) loadTiming(i);
+}
+
+// The clock is open drain and released between bytes, so a host holding
+// it low reads straight back.
+static inline bool inhibiting(XtatWire &wire) {
+  return !GpioBus::readClk(wire);
+}
+
+bool xtatHostInhibiting() {
+  return inhibiting(ctl().wire);
+}
+
+// Open drain lines at the idle level are released already; listening only
+// keeps the queue from being sent.
+void xtatListen(bool on) {
+  if (on && listenPort < 0) {
+    listenPort = (int8_t)xtatControlPort();
+    lines_idle_high(ports[listenPort].wire);
+  } else if (!on && listenPort >= 0) {
+    lines_idle_high(ports[listenPort].wire);
+    listenPort = -1;
+  }
+}
+
+void xtatControlPins(uint8_t &clkPin, uint8_t &dataPin) {
+  clkPin = ctl().wire.clkPin;
+  dataPin = ctl().wire.dataPin;
+}
+
+// False only if the host was inhibiting before the byte. Holding the clock
+// low afterwards is the normal AT inhibit while the host handles the byte.
+bool xtatSendProbe(uint8_t b) {
+  if (xtatHostInhibiting()) return false;
+  send_byte_raw(ctl(), b);
+  return true;
+}
+
+// ---- Ports ----
+
+uint8_t xtatPortCount() { return portCount; }
+uint8_t xtatActivePort() { return activePort; }
+uint8_t xtatControlPort() { return activePort == XTAT_PORT_ALL ? 0 : activePort; }
+uint8_t xtatMode() { return ctl().mode; }
+
+uint8_t xtatPortMode(uint8_t port) {
+  return port < portCount ? ports[port].mode : 0;
+}
+
+bool xtatSelectPort(uint8_t port) {
+  if (port != XTAT_PORT_ALL && port >= portCount) return false;
+  portENTER_CRITICAL(&pendMux);
+  pendingPort = port;
+  portEXIT_CRITICAL(&pendMux);
+  return true;
+}
+
+// Aimed at the control port as of the latest port request, so the mode
+// goes where the caller saw it going even before the switch is applied.
+void xtatSetMode(uint8_t mode) {
+  portENTER_CRITICAL(&pendMux);
+  int16_t port = pendingPort >= 0 ? pendingPort : activePort;
+  pendingModePort = port == XTAT_PORT_ALL ? 0 : port;
+  pendingMode = mode;
+  portEXIT_CRITICAL(&pendMux);
+}
+
+void xtatSetPortMode(uint8_t port, uint8_t mode) {
+  if (port >= portCount) return;
+  portENTER_CRITICAL(&pendMux);
+  pendingModePort = port;
+  pendingMode = mode;
+  portEXIT_CRITICAL(&pendMux);
+}
+
+// Port 0 keeps using config.kb_mode; the others have their own NVS keys.
+static void applyMode(uint8_t i, uint8_t mode) {
+  if (i == 0) {
+    config.kb_mode = mode;
+    configSave();
+  } else {
+    char key[8];
+    snprintf(key, sizeof(key), "mode%u", i);
+    prefs.begin("xtports", false);
+    prefs.putUChar(key, mode);
+    prefs.end();
+  }
+  ports[i].mode = mode;
+  loadTiming(i);
+  stateChanged(STATE_MODE | STATE_PROFILE);
+}
+
+static void applyPending() {
+  portENTER_CRITICAL(&pendMux);
+  int16_t port = pendingPort;
+  int8_t modePort = pendingModePort;
+  uint8_t mode = pendingMode;
+  pendingPort = pendingModePort = -1;
+  portEXIT_CRITICAL(&pendMux);
+  if (modePort >= 0) applyMode(modePort, mode);
+  if (port >= 0 && port != activePort) switchPort(port);
+}
+
+bool xtatTypeKey(uint8_t hid, uint8_t mods) {
+  portENTER_CRITICAL(&pendMux);
+  uint8_t next = (typedTail + 1) % TYPED_LEN;
+  bool ok = next != typedHead;
+  if (ok) {
+    typed[typedTail] = { hid, mods };
+    typedTail = next;
   }
+  portEXIT_CRITICAL(&pendMux);
+  return ok;
+}
+
+// Modifier bit n is HID usage 0xE0 + n.
+static void typePending() {
+  for (;;) {
+    portENTER_CRITICAL(&pendMux);
+    bool any = typedHead != typedTail;
+    TypedKey k = typed[typedHead];
+    if (any) typedHead = (typedHead + 1) % TYPED_LEN;
+    portEXIT_CRITICAL(&pendMux);
+    if (!any) return;
+    for (uint8_t b = 0; b < 8; b++) if (k.mods & (1 << b)) xtatSendFromUSB(0xE0 + b, true);
+    xtatSendFromUSB(k.hid, true);
+    xtatSendFromUSB(k.hid, false);
+    for (int8_t b = 7; b >= 0; b--) if (k.mods & (1 << b)) xtatSendFromUSB(0xE0 + b, false);
+  }
+}
+
+static void portReset(uint8_t i, uint8_t clkPin, uint8_t dataPin, uint8_t mode) {
+  XtatPort &p = ports[i];
+  xtatWireSetPins(p.wire, clkPin, dataPin);
+  p.wire.bitDelayUs = p.wire.interByteUs = BIT_DELAY_DEFAULT_US;
+  lines_idle_high(p.wire);
+  p.mode = mode;
+  p.engine = XtatEngineTable<GpioBus>::table[protoIndex(mode)][XTAT_TRACE_EVENTS];
+  p.engineKey = 0xFF;
+  p.q_head = p.q_tail = 0;
+  p.hostEchoHead = p.hostEchoTail = 0;
+  p.lastSentByte = 0xAA;
+  p.hostPendingCmd = 0;
+  p.typematicArg = TYPEMATIC_ARG_NONE;
+  loadTiming(i);
+}
+
+int xtatAddPort(uint8_t clkPin, uint8_t dataPin) {
+  if (portCount == 0 || portCount >= XTAT_MAX_PORTS) return -1;
+  uint8_t i = portCount;
+  char key[8];
+  snprintf(key, sizeof(key), "mode%u", i);
+  prefs.begin("xtports", true);
+  uint8_t mode = prefs.getUChar(key, MODE_AT);
+  uint8_t active = prefs.getUChar("active", 0);
+  prefs.end();
+  if (mode < MODE_XT || mode > MODE_PS2) mode = MODE_AT;
+  portReset(i, clkPin, dataPin, mode);
+  portCount++;
+  // The saved selection may name a port that only exists from here on.
+  if (active == i || (active == XTAT_PORT_ALL && activePort == 0)) activePort = active;
+  xtatSelectEngine();
+  Serial.printf("[XT_AT] port %u CLK=%d DATA=%d delay=%uus gap=%uus\n", i, clkPin, dataPin,
+                ports[i].wire.bitDelayUs, ports[i].wire.interByteUs);
+  return i;
+}
+
+String xtatPortsJSON() {
+  static const char *modes[] = { "XT", "AT", "PS2" };
+  String out = "{\"active\":";
+  out += activePort == XTAT_PORT_ALL ? String("\"all\"") : String(activePort);
+  out += ",\"ports\":[";
+  for (uint8_t i = 0; i < portCount; i++) {
+    XtatPort &p = ports[i];
+    char buf[192];
+    snprintf(buf, sizeof(buf),
+             "%s{\"port\":%u,\"clk\":%u,\"data\":%u,\"mode\":\"%s\",\"half_period_us\":%u,\"inter_byte_us\":%u,\"queued\":%d,\"target\":%s}",
+             i ? "," : "", i, p.wire.clkPin, p.wire.dataPin, modes[protoIndex(p.mode)],
+             p.wire.bitDelayUs, p.wire.interByteUs, (p.q_tail - p.q_head + XT_QUEUE_LEN) % XT_QUEUE_LEN,
+             isTarget(i) ? "true" : "false");
+    out += buf;
+  }
+  out += "]}";
+  return out;
+}
+
+// ---- Benchmark ----
+
+// The transmit path as it was before xtat_engine.h, kept for the benchmark
+// only: pinMode + digitalWrite for every data change, trace flags checked
+// at run time, and a JSON String built per clock phase (the old code sent
+// each one to every WebSocket client; here it is dropped). Every write is
+// the idle level, so the lines do not move; clock edges are recorded where
+// SimBus records them.
+static void legacyPhase(XtatWire &w, const char *phase, int clk) {
+  int dataState = digitalRead(w.dataPin);
+  unsigned long ts = (unsigned long)micros();
+  char buf[128];
+  snprintf(buf, sizeof(buf), "{\"type\":\"bit\",\"phase\":\"%s\",\"ts\":%lu,\"clk\":%d,\"data\":%d}",
+           phase, ts, clk, dataState);
+  String msg(buf);
+}
+
+static void legacyData(XtatWire &w, bool hi) {
+  pinMode(w.dataPin, OUTPUT_OPEN_DRAIN | PULLUP);
+  digitalWrite(w.dataPin, HIGH);
+  SimBus::data(w, hi);
+}
+
+static void legacyPulse(XtatWire &w) {
+  legacyPhase(w, "pre", 1);
+  digitalWrite(w.clkPin, HIGH);
+  SimBus::clk(w, false);
+  delayMicroseconds(w.bitDelayUs);
+  legacyPhase(w, "low", 0);
+  digitalWrite(w.clkPin, HIGH);
+  SimBus::clk(w, true);
+  delayMicroseconds(w.bitDelayUs);
+  legacyPhase(w, "high", 1);
+}
+
+static void legacySendByte(XtatWire &w, uint8_t b) {
+  if (xtat_bitdump_enabled) xtatTraceByte(b);
+  legacyData(w, false);
+  delayMicroseconds(w.bitDelayUs);
+  for (int i = 0; i < 8; i++) {
+    legacyData(w, b & 0x01);
+    legacyPulse(w);
+    b >>= 1;
+  }
+  legacyData(w, true);
+  legacyPulse(w);
+}
+
+// Half-period jitter of one send path on the simulated bus, and the time
+// a whole byte takes, trace calls included. A byte is `edges` clock edges
+// (18 XT, 22 AT/PS2); only intervals inside a byte count towards the jitter.
+struct BenchStats { uint32_t n; float mean_ns, sd_ns, min_ns, max_ns, byte_us, byte_max_us; };
+
+static BenchStats bench_run(void (*send)(XtatWire &, uint8_t), uint16_t bytes, uint8_t edges) {
+  SimBus::edgeCount = 0;
+  XtatWire &wire = ctl().wire;
+  float nsPerCycle = 1000.0f / getCpuFrequencyMhz();
+  BenchStats st = {0, 0, 0, 1e9f, 0, 0, 0};
+  uint32_t byteSum = 0, byteMax = 0;
+  for (uint16_t i = 0; i < bytes; i++) {
+    uint32_t t0 = ESP.getCycleCount();
+    send(wire, (uint8_t)(0x55 ^ i));
+    uint32_t took = ESP.getCycleCount() - t0;
+    byteSum += took;
+    if (took > byteMax) byteMax = took;
+  }
+  double sum = 0, sum2 = 0;
+  for (uint16_t i = 1; i < SimBus::edgeCount; i++) {
+    if (i % edges == 0) continue;
+    float ns = (uint32_t)(SimBus::edges[i] - SimBus::edges[i - 1]) * nsPerCycle;
+    sum += ns; sum2 += (double)ns * ns;
+    if (ns < st.min_ns) st.min_ns = ns;
+    if (ns > st.max_ns) st.max_ns = ns;
+    st.n++;
+  }
+  if (st.n) {
+    st.mean_ns = sum / st.n;
+    double var = sum2 / st.n - (double)st.mean_ns * st.mean_ns;
+    st.sd_ns = var > 0 ? sqrt(var) : 0;
+  }
+  if (bytes) {
+    st.byte_us = byteSum * nsPerCycle / 1000.0f / bytes;
+    st.byte_max_us = byteMax * nsPerCycle / 1000.0f;
+  }
+  return st;
+}
+
+#define BENCH_JSON_MAX 1024
+
+// /api/xtat_bench asks, xtatTask runs (the legacy path touches the pins,
+// which must not happen under a transmission), /api/xtat_bench_result
+// reads. benchGen moves before and after each run, so a reader can tell a
+// result that changed while it was being copied.
+static volatile uint16_t benchWanted = 0;
+static volatile uint32_t benchGen = 0;          // odd while a run is writing
+static char benchJson[BENCH_JSON_MAX];
+
+static void appendStats(size_t &n, const char *path, const char *trace, const BenchStats &st) {
+  n += snprintf(benchJson + n, BENCH_JSON_MAX - n,
+                "%s{\"path\":\"%s\",\"trace\":\"%s\",\"n\":%u,\"mean_ns\":%.0f,\"stddev_ns\":%.1f,"
+                "\"min_ns\":%.0f,\"max_ns\":%.0f,\"byte_us\":%.1f,\"byte_max_us\":%.1f}",
+                path[0] == 'l' ? "" : ",", path, trace, (unsigned)st.n, st.mean_ns, st.sd_ns,
+                st.min_ns, st.max_ns, st.byte_us, st.byte_max_us);
+  if (n >= BENCH_JSON_MAX) n = BENCH_JSON_MAX - 1;
+}
+
+static void benchRun(uint16_t bytes) {
+  uint16_t maxBytes = XTAT_SIM_EDGES / xtatEdgesPerByte(ctl().mode);
+  if (bytes == 0 || bytes > maxBytes) bytes = maxBytes;
+  benchGen++;
+  size_t n = 0;
+  if (listenPort >= 0) {
+    n = snprintf(benchJson, BENCH_JSON_MAX, "{\"status\":\"error\",\"error\":\"detection running\"}");
+  } else {
+    uint8_t p = protoIndex(ctl().mode);
+    static const char *names[XTAT_TRACE_LEVELS] = { "off", "events", "bits" };
+    n = snprintf(benchJson, BENCH_JSON_MAX, "{\"status\":\"done\",\"bytes\":%u,\"half_period_us\":%u,\"results\":[",
+                 bytes, ctl().wire.bitDelayUs);
+    appendStats(n, "legacy", xtat_bitdump_enabled ? "bits" : "flags", bench_run(legacySendByte, bytes, xtatEdgesPerByte(MODE_XT)));
+    for (uint8_t t = 0; t < XTAT_TRACE_LEVELS; t++)
+      appendStats(n, "engine", names[t], bench_run(XtatEngineTable<SimBus>::table[p][t].sendByte, bytes,
+                                               xtatEdgesPerByte(ctl().mode)));
+    snprintf(benchJson + n, BENCH_JSON_MAX - n, "]}");
+  }
+  benchGen++;
+}
+
+void xtatBenchmarkStart(uint16_t bytes) {
+  benchWanted = bytes ? bytes : 0xFFFF;
+}
+
+String xtatBenchmarkResult() {
+  uint32_t gen = benchGen;
+  if (benchWanted || gen & 1) return "{\"status\":\"running\"}";
+  if (gen == 0) return "{\"status\":\"none\"}";
+  String out = benchJson;
+  if (gen != benchGen) return "{\"status\":\"running\"}";
+  return out;
 }
 
 void xtatBegin(uint8_t clkPin, uint8_t dataPin, unsigned int bitDelayUs) {
-  XT_CLK_PIN = clkPin; XT_DATA_PIN = dataPin; BIT_DELAY_US = bitDelayUs;
-  pinMode(XT_CLK_PIN, OUTPUT); digitalWrite(XT_CLK_PIN, HIGH);
-  pinMode(XT_DATA_PIN, OUTPUT); digitalWrite(XT_DATA_PIN, HIGH);
-  q_head = q_tail = 0;
-  hostEchoHead = hostEchoTail = 0;
-  Serial.printf("[XT_AT] init CLK=%d DATA=%d delay=%uus\n", XT_CLK_PIN, XT_DATA_PIN, BIT_DELAY_US);
+  BIT_DELAY_DEFAULT_US = bitDelayUs;
+  portCount = 1;
+  activePort = 0;
+  portReset(0, clkPin, dataPin, config.kb_mode);
+  hidMods = 0;
+  memset(madeCode, 0, sizeof(madeCode));
+  memset(dropBreak, 0, sizeof(dropBreak));
+  typematicBegin(typematic_fire);
+  xtatSelectEngine();
+  XtatWire &wire = ports[0].wire;
+  Serial.printf("[XT_AT] init CLK=%d DATA=%d delay=%uus gap=%uus\n", wire.clkPin, wire.dataPin, wire.bitDelayUs, wire.interByteUs);
 }
 
+// Ports take turns one code at a time, so a slow host holds the others up by
+// at most one code per round. A host asking to send (request-to-send) is
+// served before the port's next code and that takes its turn; one that is
+// inhibiting (clock held low) is skipped and keeps its queue. Both checks
+// only read the lines. The port detection listens on still answers its
+// host, so a BIOS reset during detection gets its ACK, but sends no codes.
 void xtatTask() {
-  XT_Queued t;
-  int processed = 0;
-  while (processed < 6 && q_pop(t)) {
-    if (!t.isBreak) xt_send_make(t.code);
-    else xt_send_break_code(t.code);
-    processed++;
-  }
-  if (xtat_hostecho_enabled) {
-    uint8_t hv;
-    int tries = 2;
-    while (tries-- > 0) {
-      if (try_read_host_byte(hv)) {
-        char buf[64];
-        snprintf(buf, sizeof(buf), "{"type":"host->dev","code":"%02X"}", hv);
-        realtimeBroadcastScancode(String(buf));
-      } else break;
+  if (benchWanted) {
+    uint16_t bytes = benchWanted;
+    benchWanted = 0;
+    benchRun(bytes == 0xFFFF ? 0 : bytes);
+  }
+  applyPending();
+  typePending();
+  xtatSelectEngine();
+  typematicTask();
+  int processed[XTAT_MAX_PORTS] = {0};
+  bool busy = true;
+  while (busy) {
+    busy = false;
+    for (uint8_t i = 0; i < portCount; i++) {
+      XtatPort &p = ports[i];
+      if (processed[i] >= 6) continue;
+      if (serviceHost(p)) {
+        processed[i]++;
+        busy = true;
+        continue;
+      }
+      if (p.q_head == p.q_tail || i == listenPort) continue;
+      if (inhibiting(p.wire)) { processed[i] = 6; continue; }
+      XT_Queued t;
+      q_pop(p, t);
+      transmit(p, t.code, t.isBreak, t.t_in);
+      processed[i]++;
+      busy = true;
     }
   }
 }
@@ -4,12 +4,74 @@
 void xtatBegin(uint8_t clkPin, uint8_t dataPin, unsigned int bitDelayUs);
 void xtatTask();
 void xtatSendFromUSB(uint8_t hidcode, bool pressed);
+// Press and release hidcode with the HID modifier bits in mods held, from
+// the next xtatTask pass. Safe from any task; false while 16 keys wait.
+bool xtatTypeKey(uint8_t hidcode, uint8_t mods);
 void xt_send_make(uint8_t scancode);
 void xt_send_break_code(uint8_t scancode);
 
+// Wire timing (clock half-period and gap between bytes of one sequence)
+void xtatSetTiming(unsigned int halfPeriodUs, unsigned int interByteUs);
+unsigned int xtatBitDelayUs();
+unsigned int xtatInterByteUs();
+unsigned int xtatDefaultBitDelayUs();
+bool xtatHostInhibiting();
+bool xtatSendProbe(uint8_t b);              // false if the host was inhibiting
+// Protocol detection: while listening, the control port's lines stay
+// released and no keystrokes are sent on it (they wait in its queue);
+// host commands are still received and answered. Loop task only.
+void xtatListen(bool on);
+void xtatControlPins(uint8_t &clkPin, uint8_t &dataPin);
+// Flash erases and writes pause the other core, which would stretch a bit
+// in the middle of a byte. Take the hold before one (refused while a byte
+// is going out or waiting in a queue) and release it after; no byte starts
+// while it is held.
+bool xtatFlashHold();
+void xtatFlashRelease();
+
+// The transmit instantiation follows the mode and trace flags by itself:
+// xtatTask picks it again on every pass, so a change to config.kb_mode or
+// a flag takes effect on the next one.
+
+// Runs the pre-template send path and every trace level of the current
+// protocol on a simulated bus, and reports clock half-period jitter and
+// time per byte as JSON. The run happens in xtatTask and blocks it for
+// about bytes * 2.5 ms; 0 = as many bytes as the edge buffer holds. The
+// result reads {"status":"running"} until it is there.
+void xtatBenchmarkStart(uint16_t bytes);
+String xtatBenchmarkResult();
+
 extern bool xtat_debug_enabled;
 extern bool xtat_timestamp_enabled;
 extern bool xtat_bitdump_enabled;
+// AT/PS2 host commands are always received, ACKed and answered;
+// xtat_hostecho_enabled only copies the bytes to the ring xtatPopHostEcho reads.
 extern bool xtat_hostecho_enabled;
 
 size_t xtatPopHostEcho(uint8_t *buf, size_t max);
+
+// Output ports. xtatBegin() sets up port 0; xtatAddPort() attaches more
+// hosts, each with its own pins, mode, timing, queue and host-command state.
+// Keystrokes go to the active port, or to all of them (XTAT_PORT_ALL).
+// Right Ctrl + F1..F4 selects a port and Right Ctrl + F12 broadcasts; held
+// keys are released on the old port first.
+// The single-port calls above (timing, probes, host echo, benchmark) act on
+// the control port: the active one, or port 0 while broadcasting.
+#define XTAT_MAX_PORTS  4
+#define XTAT_PORT_ALL   0xFF
+#define XTAT_HOTKEY_MOD 0x10          // HID modifier bit of Right Ctrl
+
+int xtatAddPort(uint8_t clkPin, uint8_t dataPin);   // index, or -1
+uint8_t xtatPortCount();
+uint8_t xtatActivePort();
+uint8_t xtatControlPort();
+// xtatSelectPort, xtatSetMode and xtatSetPortMode may be called from any
+// task: they only record the request, and the next xtatTask pass applies
+// and persists it.
+bool xtatSelectPort(uint8_t port);                  // false for a port that does not exist
+uint8_t xtatPortMode(uint8_t port);
+uint8_t xtatMode();                                 // control port
+void xtatSetMode(uint8_t mode);                     // control port
+void xtatSetPortMode(uint8_t port, uint8_t mode);
+void xtatReloadTiming();                            // every port, from its saved profile
+String xtatPortsJSON();
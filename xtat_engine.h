@@ -0,0 +1,90 @@
+#ifndef XTAT_ENGINE_H
+#define XTAT_ENGINE_H
+
+// Transmit engine: XtatTx (xtat_tx.h) specialised at compile time on
+//   Bus   - GpioBus (real pins) or SimBus (records edges, for benchmarks)
+//   Proto - MODE_XT / MODE_AT / MODE_PS2
+//   Trace - XTAT_TRACE_OFF / XTAT_TRACE_EVENTS / XTAT_TRACE_BITS
+// One instantiation is selected when the mode or trace level changes; the
+// XTAT_TRACE_OFF instantiations contain no tracing code at all.
+// Only included by xt_at_output.cpp.
+
+#include <Arduino.h>
+#include <soc/gpio_reg.h>
+#include "config.h"
+#include "xtat_tx.h"
+
+static_assert(XTAT_PROTO_XT == MODE_XT && XTAT_PROTO_AT == MODE_AT && XTAT_PROTO_PS2 == MODE_PS2,
+              "xtat_tx.h protocol numbers follow config.h");
+
+static inline void xtatWireSetPins(XtatWire &w, uint8_t clkPin, uint8_t dataPin) {
+  w.clkPin = clkPin;
+  w.dataPin = dataPin;
+  w.clkMask = 1UL << (clkPin & 31);
+  w.dataMask = 1UL << (dataPin & 31);
+  w.clkSetReg  = clkPin  < 32 ? GPIO_OUT_W1TS_REG : GPIO_OUT1_W1TS_REG;
+  w.clkClrReg  = clkPin  < 32 ? GPIO_OUT_W1TC_REG : GPIO_OUT1_W1TC_REG;
+  w.dataSetReg = dataPin < 32 ? GPIO_OUT_W1TS_REG : GPIO_OUT1_W1TS_REG;
+  w.dataClrReg = dataPin < 32 ? GPIO_OUT_W1TC_REG : GPIO_OUT1_W1TC_REG;
+  w.clkInReg   = clkPin  < 32 ? GPIO_IN_REG : GPIO_IN1_REG;
+  w.dataInReg  = dataPin < 32 ? GPIO_IN_REG : GPIO_IN1_REG;
+}
+
+// Direct register access: no pinMode()/digitalWrite() per bit. The pins are
+// open drain with pull-up (set up by the port), so the host can pull either
+// line low and both levels read back from GPIO_IN without a mode change.
+static inline void xtatWirePinMode(XtatWire &w) {
+  pinMode(w.clkPin, OUTPUT_OPEN_DRAIN | PULLUP);
+  pinMode(w.dataPin, OUTPUT_OPEN_DRAIN | PULLUP);
+}
+
+struct GpioBus {
+  static inline void clk(XtatWire &w, bool hi) { REG_WRITE(hi ? w.clkSetReg : w.clkClrReg, w.clkMask); }
+  static inline void data(XtatWire &w, bool hi) { REG_WRITE(hi ? w.dataSetReg : w.dataClrReg, w.dataMask); }
+  static inline uint8_t readClk(XtatWire &w) { return (REG_READ(w.clkInReg) & w.clkMask) ? 1 : 0; }
+  static inline uint8_t readData(XtatWire &w) { return (REG_READ(w.dataInReg) & w.dataMask) ? 1 : 0; }
+  static inline void wait(unsigned int us) { delayMicroseconds(us); }
+};
+
+// Simulated bus: same timing, no pins; clock edges are timestamped in cycles.
+#define XTAT_SIM_EDGES 1024
+struct SimBus {
+  static uint32_t edges[XTAT_SIM_EDGES];
+  static uint16_t edgeCount;
+  static uint8_t dataLevel;
+  static inline void clk(XtatWire &, bool) {
+    if (edgeCount < XTAT_SIM_EDGES) edges[edgeCount++] = ESP.getCycleCount();
+  }
+  static inline void data(XtatWire &, bool hi) { dataLevel = hi; }
+  static inline uint8_t readClk(XtatWire &) { return 1; }
+  static inline uint8_t readData(XtatWire &) { return dataLevel; }
+  static inline void wait(unsigned int us) { delayMicroseconds(us); }
+};
+
+struct XtatEngine {
+  void (*sendByte)(XtatWire &, uint8_t);
+  void (*make)(XtatWire &, uint8_t);
+  void (*brk)(XtatWire &, uint8_t);
+};
+
+template <class Bus, uint8_t Proto, uint8_t Trace>
+constexpr XtatEngine xtatEngineFor() {
+  return { &XtatTx<Bus, Proto, Trace>::sendByte,
+           &XtatTx<Bus, Proto, Trace>::make,
+           &XtatTx<Bus, Proto, Trace>::brk };
+}
+
+// Indexed [Proto - 1][Trace].
+template <class Bus>
+struct XtatEngineTable {
+  static constexpr XtatEngine table[3][XTAT_TRACE_LEVELS] = {
+    { xtatEngineFor<Bus, MODE_XT,  XTAT_TRACE_OFF>(), xtatEngineFor<Bus, MODE_XT,  XTAT_TRACE_EVENTS>(), xtatEngineFor<Bus, MODE_XT,  XTAT_TRACE_BITS>() },
+    { xtatEngineFor<Bus, MODE_AT,  XTAT_TRACE_OFF>(), xtatEngineFor<Bus, MODE_AT,  XTAT_TRACE_EVENTS>(), xtatEngineFor<Bus, MODE_AT,  XTAT_TRACE_BITS>() },
+    { xtatEngineFor<Bus, MODE_PS2, XTAT_TRACE_OFF>(), xtatEngineFor<Bus, MODE_PS2, XTAT_TRACE_EVENTS>(), xtatEngineFor<Bus, MODE_PS2, XTAT_TRACE_BITS>() },
+  };
+};
+
+template <class Bus>
+constexpr XtatEngine XtatEngineTable<Bus>::table[3][XTAT_TRACE_LEVELS];
+
+#endif
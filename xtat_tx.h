@@ -0,0 +1,119 @@
+#ifndef XTAT_TX_H
+#define XTAT_TX_H
+
+// Byte framing of each protocol, written against a Bus that only sets the
+// lines and waits:
+//   Bus   - any type with clk(), data(), readData() and wait()
+//   Proto - XTAT_PROTO_XT / XTAT_PROTO_AT / XTAT_PROTO_PS2
+//   Trace - XTAT_TRACE_OFF / XTAT_TRACE_EVENTS / XTAT_TRACE_BITS
+// No Arduino dependency, so the logic analyzer simulation (la_sim.cpp) and
+// the host tests clock bytes through the same code as the pins.
+// xtat_engine.h adds the buses and the instantiation tables.
+
+#include <stdint.h>
+
+// Protocol numbers, the same values as MODE_XT / MODE_AT / MODE_PS2 (config.h).
+#define XTAT_PROTO_XT  1
+#define XTAT_PROTO_AT  2
+#define XTAT_PROTO_PS2 3
+
+#define XTAT_TRACE_OFF    0
+#define XTAT_TRACE_EVENTS 1   // every byte sent to Serial JSON, make/break to WebSocket
+#define XTAT_TRACE_BITS   2   // + per-bit WebSocket samples and bit dumps
+#define XTAT_TRACE_LEVELS 3
+
+// Pins and GPIO registers are for GpioBus (xtatWireSetPins in
+// xtat_engine.h); every bus uses the timing.
+struct XtatWire {
+  uint8_t clkPin, dataPin;
+  uint32_t clkMask, dataMask;
+  uint32_t clkSetReg, clkClrReg, dataSetReg, dataClrReg, clkInReg, dataInReg;
+  unsigned int bitDelayUs;
+  unsigned int interByteUs;
+};
+
+// Odd parity bit of b, as the AT/PS2 frame carries it.
+static inline uint8_t xtatOddParity(uint8_t b) {
+  b ^= b >> 4; b ^= b >> 2; b ^= b >> 1;
+  return (~b) & 1;
+}
+
+template <uint8_t Proto> struct ProtoInfo;
+// parity: AT/PS2 frame (start, 8 data, odd parity, stop, all 11 clocked)
+// instead of the XT one (unclocked start, 8 data, stop).
+template <> struct ProtoInfo<XTAT_PROTO_XT>  { static constexpr const char *name = "XT";  static constexpr bool breakPrefix = false; static constexpr bool parity = false; };
+template <> struct ProtoInfo<XTAT_PROTO_AT>  { static constexpr const char *name = "AT";  static constexpr bool breakPrefix = true;  static constexpr bool parity = true;  };
+template <> struct ProtoInfo<XTAT_PROTO_PS2> { static constexpr const char *name = "PS2"; static constexpr bool breakPrefix = false; static constexpr bool parity = true;  };
+
+// Clock edges one byte produces on the wire.
+static inline uint8_t xtatEdgesPerByte(uint8_t proto) {
+  return proto == XTAT_PROTO_XT ? 18 : 22;
+}
+
+// What a traced byte is: a key code, or anything else (ack, echo, BAT).
+#define XTAT_EV_MAKE  0
+#define XTAT_EV_BREAK 1
+#define XTAT_EV_BYTE  2
+
+// Clock phases of a traced bit; the same values as RT_BIT_* (realtime_ws.h).
+#define XTAT_BIT_PRE  0
+#define XTAT_BIT_LOW  1
+#define XTAT_BIT_HIGH 2
+
+// Tracing hooks, implemented in xt_at_output.cpp.
+void xtatTraceEvent(uint8_t kind, uint8_t sc, uint8_t proto, const char *protoName);
+void xtatTraceByte(uint8_t b);
+void xtatTraceBit(uint8_t phase, uint8_t clk, uint8_t data);
+
+template <class Bus, uint8_t Proto, uint8_t Trace>
+struct XtatTx {
+  static inline void bit(XtatWire &w) {
+    if (Trace >= XTAT_TRACE_BITS) xtatTraceBit(XTAT_BIT_PRE, 1, Bus::readData(w));
+    Bus::clk(w, false);
+    Bus::wait(w.bitDelayUs);
+    if (Trace >= XTAT_TRACE_BITS) xtatTraceBit(XTAT_BIT_LOW, 0, Bus::readData(w));
+    Bus::clk(w, true);
+    Bus::wait(w.bitDelayUs);
+    if (Trace >= XTAT_TRACE_BITS) xtatTraceBit(XTAT_BIT_HIGH, 1, Bus::readData(w));
+  }
+
+  // XT: start bit (low), 8 data bits LSB first, stop bit (high). AT/PS2:
+  // start, 8 data bits LSB first, odd parity, stop, each on its own clock,
+  // as ps2_mouse.cpp frames it. Every byte goes through here, so this is
+  // where it is traced.
+  static void send(XtatWire &w, uint8_t b, uint8_t kind) {
+    if (Trace >= XTAT_TRACE_EVENTS) xtatTraceEvent(kind, b, Proto, ProtoInfo<Proto>::name);
+    if (Trace >= XTAT_TRACE_BITS) xtatTraceByte(b);
+    if (ProtoInfo<Proto>::parity) {
+      uint16_t frame = ((uint16_t)b << 1) | ((uint16_t)xtatOddParity(b) << 9) | (1u << 10);
+      for (int i = 0; i < 11; i++) {
+        Bus::data(w, (frame >> i) & 1);
+        bit(w);
+      }
+      return;
+    }
+    Bus::data(w, false);
+    Bus::wait(w.bitDelayUs);
+    for (int i = 0; i < 8; i++) {
+      Bus::data(w, b & 0x01);
+      bit(w);
+      b >>= 1;
+    }
+    Bus::data(w, true);
+    bit(w);
+  }
+
+  static void sendByte(XtatWire &w, uint8_t b) { send(w, b, XTAT_EV_BYTE); }
+
+  static void make(XtatWire &w, uint8_t sc) { send(w, sc, XTAT_EV_MAKE); }
+
+  static void brk(XtatWire &w, uint8_t sc) {
+    if (ProtoInfo<Proto>::breakPrefix) {
+      send(w, 0xF0, XTAT_EV_BREAK);
+      Bus::wait(w.interByteUs);
+    }
+    send(w, sc, XTAT_EV_BREAK);
+  }
+};
+
+#endif